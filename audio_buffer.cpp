@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+#include "audio_buffer.h"
+
+namespace fxdsp {
+
+static int align_stride(int frames) {
+    return (frames + AudioBuffer::STRIDE_ALIGN - 1) / AudioBuffer::STRIDE_ALIGN * AudioBuffer::STRIDE_ALIGN;
+}
+
+void AudioBuffer::AlignedDeleter::operator()(float* ptr) const {
+    ::operator delete[](ptr, std::align_val_t(ALIGNMENT));
+}
+
+AudioBuffer::AudioBuffer() :
+        data(nullptr),
+        owning(true),
+        num_channels(0),
+        num_frames(0),
+        max_frames(0),
+        channel_stride(0) {
+}
+
+AudioBuffer::AudioBuffer(int channels, int max_frames) : AudioBuffer() {
+    allocate(channels, max_frames);
+}
+
+AudioBuffer::AudioBuffer(AudioBuffer&& other) noexcept :
+        storage(std::move(other.storage)),
+        data(other.data),
+        owning(other.owning),
+        num_channels(other.num_channels),
+        num_frames(other.num_frames),
+        max_frames(other.max_frames),
+        channel_stride(other.channel_stride) {
+    other.data = nullptr;
+    other.num_channels = other.num_frames = other.max_frames = other.channel_stride = 0;
+}
+
+AudioBuffer& AudioBuffer::operator=(AudioBuffer&& other) noexcept {
+    storage = std::move(other.storage);
+    data = other.data;
+    owning = other.owning;
+    num_channels = other.num_channels;
+    num_frames = other.num_frames;
+    max_frames = other.max_frames;
+    channel_stride = other.channel_stride;
+
+    other.data = nullptr;
+    other.num_channels = other.num_frames = other.max_frames = other.channel_stride = 0;
+    return *this;
+}
+
+void AudioBuffer::allocate(int channels, int frames) {
+    if (channels < 0 || frames < 0) {
+        throw std::invalid_argument("AudioBuffer: invalid size: " + std::to_string(channels) + "x" +
+                                    std::to_string(frames));
+    }
+
+    num_channels = channels;
+    num_frames = frames;
+    max_frames = frames;
+    channel_stride = align_stride(frames);
+
+    auto total = static_cast<size_t>(channels) * channel_stride;
+    if (total == 0) {
+        storage.reset();
+        data = nullptr;
+        return;
+    }
+
+    auto raw = static_cast<float*>(::operator new[](total * sizeof(float), std::align_val_t(ALIGNMENT)));
+    std::fill(raw, raw + total, 0.0f);
+    storage.reset(raw);
+    data = raw;
+}
+
+void AudioBuffer::reserve(int frames) {
+    if (frames > max_frames) {
+        auto old_frames = num_frames;
+        set_frames(frames);
+        num_frames = old_frames;
+    }
+}
+
+void AudioBuffer::set_frames(int frames) {
+    if (frames > max_frames) {
+        if (is_view()) {
+            throw std::out_of_range("AudioBuffer: can't grow view from " + std::to_string(max_frames) +
+                                    " to " + std::to_string(frames) + " frames");
+        }
+
+        allocate(num_channels, frames);
+    }
+
+    num_frames = frames;
+}
+
+void AudioBuffer::clear() {
+    for (int ch = 0; ch < num_channels; ch++) {
+        std::fill_n(channel(ch), num_frames, 0.0f);
+    }
+}
+
+void AudioBuffer::copy_from(const AudioBuffer& other) {
+    if (num_channels != other.num_channels && !is_view()) {
+        allocate(other.num_channels, other.num_frames);
+    }
+
+    set_frames(other.num_frames);
+    for (int ch = 0; ch < std::min(num_channels, other.num_channels); ch++) {
+        std::copy_n(other.channel(ch), num_frames, channel(ch));
+    }
+}
+
+AudioBuffer AudioBuffer::view(int offset, int frames) {
+    if (offset < 0 || frames < 0 || offset + frames > max_frames) {
+        throw std::out_of_range("AudioBuffer: view [" + std::to_string(offset) + ", " +
+                                std::to_string(offset + frames) + ") out of range for capacity " +
+                                std::to_string(max_frames));
+    }
+
+    AudioBuffer view;
+    view.data = data + offset;
+    view.owning = false;
+    view.num_channels = num_channels;
+    view.num_frames = frames;
+    view.max_frames = frames;
+    view.channel_stride = channel_stride;
+    return view;
+}
+
+}
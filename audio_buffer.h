@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <span>
+
+namespace fxdsp {
+
+// Planar F32 audio buffer: [channel samples] in a single aligned allocation
+// Frame count is separate from capacity, so blocks of any size up to the capacity can be passed
+// down the chain without reallocating.
+class AudioBuffer {
+public:
+    // Bytes; covers AVX-512 and typical cache lines
+    static constexpr size_t ALIGNMENT = 64;
+    // Channel stride is padded to a multiple of this many samples
+    static constexpr int STRIDE_ALIGN = ALIGNMENT / sizeof(float);
+
+private:
+    struct AlignedDeleter {
+        void operator()(float* ptr) const;
+    };
+
+    // Null for views and empty buffers
+    std::unique_ptr<float[], AlignedDeleter> storage;
+    float* data;
+    bool owning;
+
+    int num_channels;
+    int num_frames;
+    int max_frames;
+    // Distance between the starts of two channels, in samples
+    int channel_stride;
+
+public:
+    AudioBuffer();
+    AudioBuffer(int channels, int max_frames);
+
+    // Owning buffers can't be copied implicitly, use copy_from()
+    AudioBuffer(const AudioBuffer&) = delete;
+    AudioBuffer& operator=(const AudioBuffer&) = delete;
+    AudioBuffer(AudioBuffer&& other) noexcept;
+    AudioBuffer& operator=(AudioBuffer&& other) noexcept;
+
+    // Discards contents. Zero-initialized, frame count = max_frames
+    void allocate(int channels, int max_frames);
+    // Grow capacity without changing the frame count. Contents are discarded if this allocates
+    void reserve(int max_frames);
+    // This allocates if frames > capacity(), in which case contents are discarded
+    void set_frames(int frames);
+    // Zero all samples in the current frame range
+    void clear();
+    // Copy frame count and samples. Grows if necessary
+    void copy_from(const AudioBuffer& other);
+
+    // Non-owning view of [offset, offset + frames) in every channel
+    AudioBuffer view(int offset, int frames);
+
+    int channels() const { return num_channels; }
+    int frames() const { return num_frames; }
+    int capacity() const { return max_frames; }
+    int stride() const { return channel_stride; }
+    bool is_view() const { return !owning; }
+
+    float* channel(int ch) { return data + static_cast<ptrdiff_t>(ch) * channel_stride; }
+    const float* channel(int ch) const { return data + static_cast<ptrdiff_t>(ch) * channel_stride; }
+
+    // Frame range of one channel
+    std::span<float> operator[](int ch) { return { channel(ch), static_cast<size_t>(num_frames) }; }
+    std::span<const float> operator[](int ch) const { return { channel(ch), static_cast<size_t>(num_frames) }; }
+};
+
+}
@@ -0,0 +1,95 @@
+#include <algorithm>
+
+#include "bypass_fade.h"
+
+namespace fxdsp {
+
+BypassFade::Tap::Tap(BypassFade& fade, int channels) :
+        AudioSink(FORMAT_F32, channels),
+        fade(fade) {
+}
+
+void BypassFade::Tap::write_audio(AudioBuffer& buf) {
+    // Never allocate here: skip mixing if the block is bigger than expected
+    fade.dry_valid = buf.frames() <= fade.dry_buf.capacity();
+    if (fade.dry_valid) {
+        fade.dry_buf.copy_from(buf);
+    }
+
+    fade.effect->write_audio(buf);
+}
+
+BypassFade::Mix::Mix(BypassFade& fade, int channels) :
+        AudioSink(FORMAT_F32, channels),
+        fade(fade) {
+}
+
+void BypassFade::Mix::write_audio(AudioBuffer& buf) {
+    auto& dry_buf = fade.dry_buf;
+
+    // Output that isn't aligned with the input can't be mixed
+    auto aligned = fade.dry_valid && buf.frames() == dry_buf.frames();
+    fade.dry_valid = false;
+
+    if (aligned && !fade.is_done()) {
+        auto frames = buf.frames();
+        auto step = 1.0f / static_cast<float>(fade.fade_frames);
+
+        for (int ch = 0; ch < buf.channels(); ch++) {
+            auto wet = buf.channel(ch);
+            auto dry = dry_buf.channel(ch);
+
+            for (int i = 0; i < frames; i++) {
+                // Linear wet gain, clamped at the end of the fade
+                auto pos = std::min(fade.fade_pos + i, fade.fade_frames);
+                auto wet_gain = static_cast<float>(pos) * step;
+                if (!fade.fade_in) {
+                    wet_gain = 1.0f - wet_gain;
+                }
+
+                wet[i] = dry[i] + (wet[i] - dry[i]) * wet_gain;
+            }
+        }
+
+        fade.fade_pos = std::min(fade.fade_pos + frames, fade.fade_frames);
+    } else if (aligned && !fade.fade_in) {
+        // Finished fading out, but the chain hasn't switched yet
+        buf.copy_from(dry_buf);
+    } else if (!aligned) {
+        // Can't fade: switch at this block
+        fade.fade_pos = fade.fade_frames;
+    }
+
+    fade.next_sink->write_audio(buf);
+}
+
+BypassFade::BypassFade(int channels) :
+        dry_valid(false),
+        effect(nullptr),
+        next_sink(nullptr),
+        fade_in(true),
+        fade_frames(0),
+        fade_pos(0),
+        tap(*this, channels),
+        mix(*this, channels) {
+    dry_buf.allocate(channels, 0);
+}
+
+void BypassFade::prepare(int max_frames) {
+    dry_buf.reserve(max_frames);
+}
+
+void BypassFade::start(AudioSink* new_effect, AudioSink* new_next_sink, bool new_fade_in, int frames) {
+    effect = new_effect;
+    next_sink = new_next_sink;
+    fade_in = new_fade_in;
+    fade_frames = std::max(frames, 1);
+    fade_pos = 0;
+    dry_valid = false;
+}
+
+bool BypassFade::is_done() const {
+    return fade_pos >= fade_frames;
+}
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "audio_buffer.h"
+#include "sink.h"
+
+namespace fxdsp {
+
+// Crossfades between the input and output of an effect that was just enabled or disabled
+// Wiring while fading: previous -> tap -> effect -> mix -> next
+// Only effects that output each block synchronously (same frame count, no latency) are mixed.
+// Others pass through unchanged and switch at the next block boundary.
+class BypassFade {
+private:
+    class Tap : public AudioSink {
+    private:
+        BypassFade& fade;
+
+    public:
+        Tap(BypassFade& fade, int channels);
+        void write_audio(AudioBuffer& buf) override;
+    };
+
+    class Mix : public AudioSink {
+    private:
+        BypassFade& fade;
+
+    public:
+        Mix(BypassFade& fade, int channels);
+        void write_audio(AudioBuffer& buf) override;
+    };
+
+    // Copy of the effect's input for the current block
+    AudioBuffer dry_buf;
+    bool dry_valid;
+
+    AudioSink* effect;
+    AudioSink* next_sink;
+    bool fade_in;
+    int fade_frames;
+    int fade_pos;
+
+public:
+    BypassFade(int channels);
+
+    Tap tap;
+    Mix mix;
+
+    // Not real-time safe
+    void prepare(int max_frames);
+
+    // Audio thread only
+    void start(AudioSink* effect, AudioSink* next_sink, bool fade_in, int frames);
+    bool is_done() const;
+};
+
+}
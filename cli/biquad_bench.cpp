@@ -0,0 +1,277 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../audio_buffer.h"
+#include "../filters/biquad.h"
+#include "../filters/biquad_bank.h"
+#include "../filters/iir_plan.h"
+
+using namespace fxdsp;
+
+static constexpr auto SAMPLE_RATE = 48000;
+static constexpr auto BLOCK_SIZE = 256;
+static constexpr auto CHANNEL_COUNTS = {1, 2, 4, 6, 8};
+static constexpr auto SECTION_COUNTS = {1, 4, 10, 32};
+static constexpr auto SECONDS = 5;
+// The bank uses separate multiplies and adds in the scalar order, so this only allows for
+// compilers contracting the scalar path into FMAs
+static constexpr auto MAX_BANK_ERROR = 1e-4f;
+// Other forms round differently, but must be about as accurate as the scalar filters
+static constexpr auto MAX_FORM_ERROR_RATIO = 4.0;
+static constexpr auto REBUILD_CHANNELS = 2;
+static constexpr auto REBUILDS = 200;
+
+// Previous ParametricEqEffect layout: one heap object per filter per channel, sample-major
+class LegacyBiquadChain {
+private:
+    std::vector<std::vector<std::unique_ptr<BiquadFilter>>> channel_filters;
+
+public:
+    LegacyBiquadChain(int channels) {
+        channel_filters.resize(channels);
+    }
+
+    void add_filter(BiquadFilterType type, float center_freq, float q, float gain_db) {
+        for (auto& filters : channel_filters) {
+            filters.push_back(std::make_unique<BiquadFilter>(type, SAMPLE_RATE, center_freq, q, gain_db));
+        }
+    }
+
+    void process(AudioBuffer& buf) {
+        for (auto ch = 0; ch < buf.channels(); ch++) {
+            for (auto& sample : buf[ch]) {
+                for (const auto& filter : channel_filters[ch]) {
+                    sample = filter->process_sample(sample);
+                }
+            }
+        }
+    }
+};
+
+class PlanChain {
+private:
+    IirPlan plan;
+    std::vector<float> state;
+
+public:
+    PlanChain(int channels, const std::vector<BiquadCoeffs>& sections, IirForm form) :
+            plan(channels, sections, form),
+            state(plan.state_size()) {
+    }
+
+    IirForm get_form() const { return plan.get_form(); }
+
+    void process(AudioBuffer& buf) {
+        plan.process(state.data(), buf);
+    }
+};
+
+static void fill_input(AudioBuffer& buf, std::mt19937& rng) {
+    std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+    for (auto ch = 0; ch < buf.channels(); ch++) {
+        for (auto& sample : buf[ch]) {
+            sample = dist(rng);
+        }
+    }
+}
+
+// Process one second of noise in blocks, returning channel-major output
+template <typename Chain>
+static std::vector<float> run_once(Chain& chain, int channels) {
+    AudioBuffer buf;
+    buf.allocate(channels, BLOCK_SIZE);
+    std::mt19937 rng(1);
+
+    std::vector<float> out;
+    out.reserve(SAMPLE_RATE * channels);
+    for (auto i = 0; i < SAMPLE_RATE / BLOCK_SIZE; i++) {
+        fill_input(buf, rng);
+        chain.process(buf);
+        for (auto ch = 0; ch < channels; ch++) {
+            out.insert(out.end(), buf[ch].begin(), buf[ch].end());
+        }
+    }
+
+    return out;
+}
+
+// Same input in double precision, as the accuracy reference
+static std::vector<double> run_reference(const std::vector<BiquadCoeffs>& sections, int channels) {
+    AudioBuffer buf;
+    buf.allocate(channels, BLOCK_SIZE);
+    std::mt19937 rng(1);
+    std::vector<double> state(sections.size() * channels * 4);
+
+    std::vector<double> out;
+    for (auto i = 0; i < SAMPLE_RATE / BLOCK_SIZE; i++) {
+        fill_input(buf, rng);
+        for (auto ch = 0; ch < channels; ch++) {
+            for (auto sample : buf[ch]) {
+                double x = sample;
+                for (size_t s = 0; s < sections.size(); s++) {
+                    auto& c = sections[s];
+                    auto st = state.data() + (s * channels + ch) * 4;
+                    double y = c.b0 * x + c.b1 * st[0] + c.b2 * st[1] - c.a1 * st[2] - c.a2 * st[3];
+                    st[1] = st[0];
+                    st[0] = x;
+                    st[3] = st[2];
+                    st[2] = y;
+                    x = y;
+                }
+                out.push_back(x);
+            }
+        }
+    }
+
+    return out;
+}
+
+// Returns ns per frame per channel
+template <typename Chain>
+static double run_bench(Chain& chain, int channels) {
+    AudioBuffer buf;
+    buf.allocate(channels, BLOCK_SIZE);
+    std::mt19937 rng(1);
+    fill_input(buf, rng);
+
+    auto num_blocks = SAMPLE_RATE * SECONDS / BLOCK_SIZE;
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < num_blocks; i++) {
+        chain.process(buf);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    auto ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return ns / (static_cast<double>(num_blocks) * BLOCK_SIZE * channels);
+}
+
+static double error_power(const std::vector<float>& out, const std::vector<double>& reference) {
+    double err = 0.0;
+    for (size_t i = 0; i < out.size(); i++) {
+        err += std::pow(out[i] - reference[i], 2);
+    }
+    return err;
+}
+
+// AutoEq preset from filter.h, repeated for longer cascades
+static const struct { float freq, q, gain; } FILTERS[] = {
+    {48.0f, 1.09f, -2.5f}, {134.0f, 1.1f, -4.9f}, {997.0f, 1.15f, 2.1f}, {3765.0f, 5.12f, 6.1f},
+    {19743.0f, 0.22f, -7.4f}, {2348.0f, 2.83f, -2.1f}, {3166.0f, 0.65f, 1.0f},
+    {5591.0f, 2.83f, -2.0f}, {7842.0f, 1.95f, -2.0f}, {10073.0f, 1.03f, 1.3f},
+};
+static constexpr int NUM_FILTERS = sizeof(FILTERS) / sizeof(FILTERS[0]);
+
+// us per IirPlan rebuild of the AutoEq preset as a gain moves, as the chain compiler rebuilds on
+// parameter changes: from scratch, and from the plan it replaces. A band's poles move with its gain,
+// a fused gain only scales the first section. Returns false if the form ever changes.
+static bool bench_rebuild(bool move_poles) {
+    auto rebuilt = [&](int i) {
+        std::vector<BiquadCoeffs> sections;
+        for (auto& f : FILTERS) {
+            sections.push_back(BiquadFilter(BIQUAD_PEAKING_EQ, SAMPLE_RATE, f.freq, f.q, f.gain).get_coeffs());
+        }
+
+        auto step = static_cast<float>(i % 40) * 0.05f;
+        if (move_poles) {
+            auto& f = FILTERS[0];
+            sections[0] = BiquadFilter(BIQUAD_PEAKING_EQ, SAMPLE_RATE, f.freq, f.q, f.gain + step).get_coeffs();
+        } else {
+            auto gain = std::pow(10.0f, step / 20.0f);
+            sections[0].b0 *= gain;
+            sections[0].b1 *= gain;
+            sections[0].b2 *= gain;
+        }
+        return sections;
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < REBUILDS; i++) {
+        IirPlan plan(REBUILD_CHANNELS, rebuilt(i));
+    }
+    auto scratch_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    auto stable = true;
+    auto plan = std::make_unique<IirPlan>(REBUILD_CHANNELS, rebuilt(0));
+    start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < REBUILDS; i++) {
+        auto next = std::make_unique<IirPlan>(REBUILD_CHANNELS, rebuilt(i), IIR_FORM_AUTO, plan.get());
+        stable &= next->get_form() == plan->get_form();
+        plan = std::move(next);
+    }
+    auto previous_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+    printf("Rebuild, %zu sections, %s moving: %.1f us from scratch, %.1f us from the previous plan (%s)%s\n",
+           std::size(FILTERS), move_poles ? "band gain" : "fused gain", scratch_us / REBUILDS,
+           previous_us / REBUILDS, iir_form_name(plan->get_form()), stable ? "" : " UNSTABLE");
+    return stable;
+}
+
+int main() {
+    static constexpr IirForm FORMS[] = {IIR_FORM_CASCADE, IIR_FORM_LOOKAHEAD, IIR_FORM_PARALLEL};
+
+    std::cout << "Block size " << BLOCK_SIZE << ", ns per sample (error vs. double precision in dB)\n";
+    auto ok = true;
+    for (auto channels : CHANNEL_COUNTS) {
+        for (auto num_sections : SECTION_COUNTS) {
+            LegacyBiquadChain legacy(channels);
+            BiquadBank bank(channels);
+            std::vector<BiquadCoeffs> sections;
+            for (auto i = 0; i < num_sections; i++) {
+                // Detune repeats so that poles stay distinct
+                auto& f = FILTERS[i % NUM_FILTERS];
+                auto freq = f.freq * (1.0f + 0.05f * static_cast<float>(i / NUM_FILTERS));
+                legacy.add_filter(BIQUAD_PEAKING_EQ, freq, f.q, f.gain);
+                sections.push_back(BiquadFilter(BIQUAD_PEAKING_EQ, SAMPLE_RATE, freq, f.q, f.gain).get_coeffs());
+                bank.add_section(sections.back());
+            }
+
+            auto reference = run_reference(sections, channels);
+            auto legacy_out = run_once(legacy, channels);
+            auto bank_out = run_once(bank, channels);
+            auto ref_power = error_power(std::vector<float>(reference.size()), reference);
+            auto legacy_err = error_power(legacy_out, reference);
+
+            float bank_diff = 0.0f;
+            for (size_t i = 0; i < legacy_out.size(); i++) {
+                bank_diff = std::max(bank_diff, std::abs(legacy_out[i] - bank_out[i]));
+            }
+            ok &= bank_diff <= MAX_BANK_ERROR;
+
+            printf("%d ch, %2d sections: legacy %6.2f (%.0f), bank %6.2f", channels, num_sections,
+                   run_bench(legacy, channels), 10 * std::log10(legacy_err / ref_power),
+                   run_bench(bank, channels));
+
+            for (auto form : FORMS) {
+                PlanChain chain(channels, sections, form);
+                if (chain.get_form() != form) {
+                    printf(", %s n/a", iir_form_name(form));
+                    continue;
+                }
+
+                auto err = error_power(run_once(chain, channels), reference);
+                ok &= err <= legacy_err * MAX_FORM_ERROR_RATIO * MAX_FORM_ERROR_RATIO;
+                PlanChain bench_chain(channels, sections, form);
+                printf(", %s %6.2f (%.0f)", iir_form_name(form), run_bench(bench_chain, channels),
+                       10 * std::log10(err / ref_power));
+            }
+
+            printf(" -> auto: %s\n", iir_form_name(IirPlan(channels, sections).get_form()));
+        }
+    }
+
+    ok &= bench_rebuild(false);
+    ok &= bench_rebuild(true);
+
+    if (!ok) {
+        std::cerr << "Optimized biquad paths don't match the scalar filters\n";
+        return 1;
+    }
+
+    return 0;
+}
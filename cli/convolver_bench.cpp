@@ -0,0 +1,416 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../dsp.h"
+#include "../effects/convolver.h"
+#include "../sinks/collecting_float.h"
+#include "../util/fft_tuner.h"
+
+using namespace fxdsp;
+
+static constexpr auto SAMPLE_RATE = 48000;
+static constexpr auto CHANNELS = 2;
+// Host callback size
+static constexpr auto HOST_BLOCK_SIZE = 192;
+static constexpr auto SECONDS = 3;
+// Partitioned output must match direct convolution to this, relative to the output's peak
+static constexpr auto MAX_ERROR = 1e-4;
+static constexpr auto CHECK_FRAMES = 12000;
+static constexpr auto CHECK_IR_FRAMES = 2400;
+// Tuned and fixed sizes are timed alternately this many times, and compared by the median
+static constexpr auto TUNED_ROUNDS = 15;
+// Tuned sizes can be this much slower than the fixed default before it counts as a failure
+static constexpr auto TUNED_MAX_SLOWDOWN = 1.1;
+
+// Counts output, for timing without collecting
+class NullSink : public AudioSink {
+public:
+    long frames = 0;
+
+    NullSink() : AudioSink(FORMAT_F32, CHANNELS) {}
+
+    void write_audio(AudioBuffer& buf) override {
+        frames += buf.frames();
+    }
+};
+
+static std::vector<float> make_ir(int frames, int seed = 2) {
+    // Exponentially decaying noise, like a room
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> ir(frames);
+    for (auto i = 0; i < frames; i++) {
+        ir[i] = dist(rng) * std::exp(-5.0f * static_cast<float>(i) / static_cast<float>(frames));
+    }
+    return ir;
+}
+
+static std::vector<float> make_input(int frames) {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+    std::vector<float> in(frames * CHANNELS);
+    for (auto& sample : in) {
+        sample = dist(rng);
+    }
+    return in;
+}
+
+static const char* mode_name(ConvolverMode mode) {
+    switch (mode) {
+        case CONVOLVER_SINGLE_BLOCK:
+            return "single";
+        case CONVOLVER_UNIFORM_PARTITIONED:
+            return "uniform";
+        default:
+            return "non-uniform";
+    }
+}
+
+// Interleaved in and out, including the tail from finalize() and excluding latency
+// Host blocks vary in size, and some are bigger than prepared for. Returns empty if any output
+// block doesn't match its input block's size.
+static std::vector<float> run_convolver(ConvolverMode mode, int block_size, int fft_size,
+                                        const std::vector<std::vector<float>>& irs, const std::vector<float>& in) {
+    static constexpr int host_block_sizes[] = { HOST_BLOCK_SIZE, 37, 1024, 512 };
+
+    DSP dsp(FORMAT_F32, SAMPLE_RATE, CHANNELS, nullptr);
+    CollectingFloatBufferSink sink(CHANNELS, static_cast<int>(in.size() / CHANNELS + block_size + irs[0].size()));
+    ConvolverEffect convolver(dsp, block_size, mode, fft_size);
+    convolver.set_filters(irs);
+    convolver.set_next_sink(sink);
+    convolver.prepare(512);
+
+    AudioBuffer buf;
+    buf.allocate(CHANNELS, 1024);
+    auto frames = static_cast<int>(in.size() / CHANNELS);
+    auto steady = true;
+    for (auto pos = 0, n = 0; pos < frames; n++) {
+        auto count = std::min(host_block_sizes[n % std::size(host_block_sizes)], frames - pos);
+        buf.set_frames(count);
+        for (auto ch = 0; ch < CHANNELS; ch++) {
+            for (auto i = 0; i < count; i++) {
+                buf.channel(ch)[i] = in[(pos + i) * CHANNELS + ch];
+            }
+        }
+
+        auto out_size = sink.get_buffer().size();
+        convolver.write_audio(buf);
+        steady &= sink.get_buffer().size() == out_size + count * CHANNELS;
+        pos += count;
+    }
+    convolver.finalize();
+
+    if (!steady) {
+        return {};
+    }
+
+    auto& out = sink.get_buffer();
+    auto latency = std::min(out.size(), static_cast<size_t>(convolver.get_latency() * CHANNELS));
+    return { out.begin() + static_cast<ptrdiff_t>(latency), out.end() };
+}
+
+// Returns ns per frame (all channels)
+static double bench_convolver(ConvolverMode mode, int block_size, const std::vector<float>& ir, int fft_size = 0) {
+    DSP dsp(FORMAT_F32, SAMPLE_RATE, CHANNELS, nullptr);
+    NullSink sink;
+    ConvolverEffect convolver(dsp, block_size, mode, fft_size);
+    convolver.set_filter(ir);
+    convolver.set_next_sink(sink);
+    convolver.prepare(HOST_BLOCK_SIZE);
+
+    AudioBuffer buf;
+    buf.allocate(CHANNELS, HOST_BLOCK_SIZE);
+    auto num_blocks = SAMPLE_RATE * SECONDS / HOST_BLOCK_SIZE;
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < num_blocks; i++) {
+        convolver.write_audio(buf);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    auto ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return ns / (static_cast<double>(num_blocks) * HOST_BLOCK_SIZE);
+}
+
+// Direct convolution in double precision, with the convolver's routing for this filter count
+static std::vector<double> convolve_direct(const std::vector<std::vector<float>>& irs, const std::vector<float>& in) {
+    auto out_frames = CHECK_FRAMES + CHECK_IR_FRAMES;
+    std::vector<double> reference(out_frames * CHANNELS);
+    for (auto in_ch = 0; in_ch < CHANNELS; in_ch++) {
+        for (auto out_ch = 0; out_ch < CHANNELS; out_ch++) {
+            const std::vector<float>* ir;
+            if (irs.size() == 4) {
+                ir = &irs[in_ch * 2 + out_ch];
+            } else if (in_ch == out_ch) {
+                ir = &irs[irs.size() == 1 ? 0 : in_ch];
+            } else {
+                continue;
+            }
+
+            for (auto n = 0; n < CHECK_FRAMES; n++) {
+                for (auto k = 0; k < CHECK_IR_FRAMES; k++) {
+                    reference[(n + k) * CHANNELS + out_ch] += static_cast<double>(in[n * CHANNELS + in_ch]) * (*ir)[k];
+                }
+            }
+        }
+    }
+
+    return reference;
+}
+
+static bool check_accuracy() {
+    auto in = make_input(CHECK_FRAMES);
+
+    auto ok = true;
+    for (auto num_irs : {1, CHANNELS, 4}) {
+        std::vector<std::vector<float>> irs;
+        for (auto i = 0; i < num_irs; i++) {
+            irs.push_back(make_ir(CHECK_IR_FRAMES, 2 + i));
+        }
+
+        auto reference = convolve_direct(irs, in);
+        auto peak = 0.0;
+        for (auto sample : reference) {
+            peak = std::max(peak, std::abs(sample));
+        }
+
+        // FFT sizes larger than needed, as tune_sizes() may choose
+        struct { ConvolverMode mode; int block_size; int fft_size; } configs[] = {
+            {CONVOLVER_SINGLE_BLOCK, 512, 0},
+            {CONVOLVER_SINGLE_BLOCK, 4999, 0},
+            {CONVOLVER_SINGLE_BLOCK, 512, 4096},
+            {CONVOLVER_UNIFORM_PARTITIONED, 128, 0},
+            {CONVOLVER_UNIFORM_PARTITIONED, 300, 0},
+            {CONVOLVER_UNIFORM_PARTITIONED, 4096, 0},
+            {CONVOLVER_UNIFORM_PARTITIONED, 300, 1024},
+            // Head only, then 2 and 3 tail segments
+            {CONVOLVER_NON_UNIFORM_PARTITIONED, 512, 0},
+            {CONVOLVER_NON_UNIFORM_PARTITIONED, 128, 0},
+            {CONVOLVER_NON_UNIFORM_PARTITIONED, 64, 0},
+            {CONVOLVER_NON_UNIFORM_PARTITIONED, 96, 250},
+        };
+        for (auto& config : configs) {
+            auto out = run_convolver(config.mode, config.block_size, config.fft_size, irs, in);
+
+            // All input plus the tail, flushed by finalize(), in blocks the size of the input
+            auto frames_ok = out.size() == reference.size();
+            auto max_err = 0.0;
+            for (size_t i = 0; i < std::min(out.size(), reference.size()); i++) {
+                max_err = std::max(max_err, std::abs(out[i] - reference[i]));
+            }
+
+            auto pass = frames_ok && max_err / peak <= MAX_ERROR;
+            ok &= pass;
+            printf("%d IR%s, %-11s block %4d, fft %4d: %zu frames, max error %.1f dB %s\n",
+                   num_irs, num_irs == 1 ? " " : "s", mode_name(config.mode), config.block_size,
+                   config.fft_size, out.size() / CHANNELS, 20 * std::log10(max_err / peak + 1e-30),
+                   pass ? "" : "FAIL");
+        }
+    }
+
+    return ok;
+}
+
+// Filter changed halfway through, while running: the crossfade must stay between the two
+// filters' outputs, and end up matching the new filter
+static bool check_hot_swap() {
+    auto in = make_input(CHECK_FRAMES);
+    std::vector<std::vector<float>> old_irs{ make_ir(CHECK_IR_FRAMES, 2) };
+    std::vector<std::vector<float>> new_irs{ make_ir(CHECK_IR_FRAMES, 3) };
+    auto old_ref = convolve_direct(old_irs, in);
+    auto new_ref = convolve_direct(new_irs, in);
+    auto peak = 0.0;
+    for (auto sample : old_ref) {
+        peak = std::max(peak, std::abs(sample));
+    }
+
+    auto ok = true;
+    for (auto mode : { CONVOLVER_SINGLE_BLOCK, CONVOLVER_UNIFORM_PARTITIONED, CONVOLVER_NON_UNIFORM_PARTITIONED }) {
+        auto block_size = mode == CONVOLVER_SINGLE_BLOCK ? 512 : 128;
+        DSP dsp(FORMAT_F32, SAMPLE_RATE, CHANNELS, nullptr);
+        CollectingFloatBufferSink sink(CHANNELS, CHECK_FRAMES + block_size + CHECK_IR_FRAMES);
+        ConvolverEffect convolver(dsp, block_size, mode);
+        convolver.set_filters(old_irs);
+        convolver.set_next_sink(sink);
+
+        AudioBuffer buf;
+        buf.allocate(CHANNELS, HOST_BLOCK_SIZE);
+        for (auto pos = 0; pos < CHECK_FRAMES; pos += HOST_BLOCK_SIZE) {
+            if (pos / HOST_BLOCK_SIZE == CHECK_FRAMES / HOST_BLOCK_SIZE / 2) {
+                // Prepared in the background and picked up at a later block
+                convolver.set_filters(new_irs);
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            }
+
+            auto count = std::min(HOST_BLOCK_SIZE, CHECK_FRAMES - pos);
+            buf.set_frames(count);
+            for (auto ch = 0; ch < CHANNELS; ch++) {
+                for (auto i = 0; i < count; i++) {
+                    buf.channel(ch)[i] = in[(pos + i) * CHANNELS + ch];
+                }
+            }
+            convolver.write_audio(buf);
+        }
+
+        auto& out = sink.get_buffer();
+        auto latency = convolver.get_latency() * CHANNELS;
+        auto outside_err = 0.0;
+        auto end_err = 0.0;
+        for (auto i = 0; i < CHECK_FRAMES * CHANNELS - latency; i++) {
+            auto sample = out[i + latency];
+            auto low = std::min(old_ref[i], new_ref[i]);
+            auto high = std::max(old_ref[i], new_ref[i]);
+            outside_err = std::max({ outside_err, low - sample, sample - high });
+            // Halfway + warmup (up to the IR length) + fade, with margin for the background preparation
+            if (i >= CHECK_FRAMES * CHANNELS * 7 / 8) {
+                end_err = std::max(end_err, std::abs(sample - new_ref[i]));
+            }
+        }
+
+        auto pass = outside_err / peak <= MAX_ERROR && end_err / peak <= MAX_ERROR;
+        ok &= pass;
+        printf("Swap, %-11s block %4d: max overshoot %.1f dB, max error after %.1f dB %s\n",
+               mode_name(mode), block_size, 20 * std::log10(std::max(outside_err, 0.0) / peak + 1e-30),
+               20 * std::log10(end_err / peak + 1e-30), pass ? "" : "FAIL");
+    }
+
+    return ok;
+}
+
+// 2x2 matrix vs. running two convolvers on the same input, which transforms each input twice
+static void bench_true_stereo() {
+    auto ir = make_ir(SAMPLE_RATE);
+    std::vector<std::vector<float>> irs(4, ir);
+
+    DSP dsp(FORMAT_F32, SAMPLE_RATE, CHANNELS, nullptr);
+    NullSink sink;
+    ConvolverEffect matrix(dsp, 256, CONVOLVER_UNIFORM_PARTITIONED);
+    matrix.set_filters(irs);
+    matrix.set_next_sink(sink);
+    ConvolverEffect direct(dsp, 256, CONVOLVER_UNIFORM_PARTITIONED);
+    direct.set_filters({ ir, ir });
+    direct.set_next_sink(sink);
+    ConvolverEffect cross(dsp, 256, CONVOLVER_UNIFORM_PARTITIONED);
+    cross.set_filters({ ir, ir });
+    cross.set_next_sink(sink);
+
+    AudioBuffer buf;
+    buf.allocate(CHANNELS, HOST_BLOCK_SIZE);
+    auto num_blocks = SAMPLE_RATE * SECONDS / HOST_BLOCK_SIZE;
+    auto time_blocks = [&](auto&& process) {
+        auto start = std::chrono::steady_clock::now();
+        for (auto i = 0; i < num_blocks; i++) {
+            process();
+        }
+        auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - start).count() /
+               (static_cast<double>(num_blocks) * HOST_BLOCK_SIZE);
+    };
+
+    auto matrix_ns = time_blocks([&] { matrix.write_audio(buf); });
+    auto pair_ns = time_blocks([&] { direct.write_audio(buf); cross.write_audio(buf); });
+    printf("True stereo, 1000 ms IRs, uniform block 256: shared FFTs %.1f ns/frame, separate %.1f ns/frame\n",
+           matrix_ns, pair_ns);
+}
+
+// Sizes from tune_sizes() against the largest fixed block under the same latency bound
+static double median(std::vector<double> values) {
+    auto mid = values.begin() + values.size() / 2;
+    std::nth_element(values.begin(), mid, values.end());
+    return *mid;
+}
+
+static bool bench_tuned(const char* wisdom_path) {
+    auto loaded = wisdom_path != nullptr && fft_tuner::load_wisdom(wisdom_path);
+    std::cout << "\nTuned sizes" << (loaded ? " (from wisdom)" : "") << ", " << CHANNELS << " channels\n";
+
+    struct { ConvolverMode mode; int ir_ms; int max_latency; } configs[] = {
+        {CONVOLVER_SINGLE_BLOCK, 100, 4999},
+        {CONVOLVER_SINGLE_BLOCK, 100, 2048},
+        {CONVOLVER_UNIFORM_PARTITIONED, 1000, 256},
+        {CONVOLVER_UNIFORM_PARTITIONED, 1000, 1024},
+        {CONVOLVER_NON_UNIFORM_PARTITIONED, 5000, 256},
+    };
+    auto ok = true;
+    for (auto& config : configs) {
+        auto ir = make_ir(SAMPLE_RATE * config.ir_ms / 1000);
+        auto start = std::chrono::steady_clock::now();
+        auto sizes = ConvolverEffect::tune_sizes(config.mode, CHANNELS, static_cast<int>(ir.size()),
+                                                 config.max_latency);
+        auto end = std::chrono::steady_clock::now();
+
+        // Alternated, so drift in the device's speed affects both alike
+        std::vector<double> tuned_runs, fixed_runs;
+        for (auto round = 0; round < TUNED_ROUNDS; round++) {
+            tuned_runs.push_back(bench_convolver(config.mode, sizes.block_size, ir, sizes.fft_size));
+            fixed_runs.push_back(bench_convolver(config.mode, config.max_latency, ir));
+        }
+        auto tuned_ns = median(tuned_runs);
+        auto fixed_ns = median(fixed_runs);
+        // The default sizes run the same engine as the fixed block, so timings only differ by noise
+        auto fixed = ConvolverEffect::default_sizes(config.mode, static_cast<int>(ir.size()), config.max_latency);
+        auto is_default = sizes.block_size == fixed.block_size && sizes.fft_size == fixed.fft_size;
+        auto slower = !is_default && tuned_ns > fixed_ns * TUNED_MAX_SLOWDOWN;
+        ok &= !slower;
+        printf("IR %4d ms, %-11s latency <= %4d: block %4d, fft %5d, %7.1f ns/frame (tuner %7.1f), "
+               "fixed block %7.1f ns/frame, tuned in %.0f ms%s\n",
+               config.ir_ms, mode_name(config.mode), config.max_latency, sizes.block_size, sizes.fft_size,
+               tuned_ns, sizes.ns_per_frame, fixed_ns,
+               std::chrono::duration<double, std::milli>(end - start).count(),
+               slower ? " SLOWER" : is_default ? " (default)" : "");
+    }
+
+    if (wisdom_path != nullptr && !fft_tuner::save_wisdom(wisdom_path)) {
+        std::cerr << "Failed to save FFT wisdom to " << wisdom_path << "\n";
+    }
+    return ok;
+}
+
+// Optional argument: FFT wisdom file, loaded before tuning and saved after
+int main(int argc, char** argv) {
+    std::cout << "Accuracy vs. direct convolution, " << CHECK_IR_FRAMES << "-tap IRs\n";
+    auto ok = check_accuracy();
+    ok &= check_hot_swap();
+
+    // Non-uniform tail segments run on worker threads and are not included
+    std::cout << "\nCPU per frame on the calling thread for " << CHANNELS << " channels, host blocks of "
+              << HOST_BLOCK_SIZE << "\n";
+    for (auto ir_ms : {100, 1000, 2000, 5000, 10000}) {
+        auto ir = make_ir(SAMPLE_RATE * ir_ms / 1000);
+
+        struct { ConvolverMode mode; int block_size; } configs[] = {
+            {CONVOLVER_SINGLE_BLOCK, 4999},
+            {CONVOLVER_SINGLE_BLOCK, static_cast<int>(ir.size())},
+            {CONVOLVER_UNIFORM_PARTITIONED, 128},
+            {CONVOLVER_UNIFORM_PARTITIONED, 256},
+            {CONVOLVER_NON_UNIFORM_PARTITIONED, 128},
+            {CONVOLVER_NON_UNIFORM_PARTITIONED, 256},
+        };
+        for (auto& config : configs) {
+            auto ns = bench_convolver(config.mode, config.block_size, ir);
+            printf("IR %4d ms, %-11s block %5d: latency %6.1f ms, %8.1f ns/frame (%.1f%% of real time)\n",
+                   ir_ms, mode_name(config.mode),
+                   config.block_size, 1000.0 * config.block_size / SAMPLE_RATE, ns,
+                   ns * SAMPLE_RATE / 1e7);
+        }
+    }
+
+    std::cout << "\n";
+    bench_true_stereo();
+    auto tuned_ok = bench_tuned(argc > 1 ? argv[1] : nullptr);
+
+    if (!ok) {
+        std::cerr << "Convolver output doesn't match direct convolution\n";
+        return 1;
+    }
+    if (!tuned_ok) {
+        std::cerr << "Tuned sizes are slower than the fixed default\n";
+        return 1;
+    }
+
+    return 0;
+}
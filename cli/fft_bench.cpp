@@ -0,0 +1,210 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "../util/fft.h"
+#include "../util/fft_plan_cache.h"
+
+using namespace fxdsp;
+
+static constexpr auto FFT_SIZES = {64, 256, 960, 1024, 4096, 6144, 16384, 65536};
+static constexpr auto CHANNEL_COUNTS = {1, 2, 3, 4, 8};
+static constexpr FftBackend BACKENDS[] = {FFT_BACKEND_KISS, FFT_BACKEND_KISS_SIMD};
+// Samples transformed per timed run, so each size gets similar run time
+static constexpr auto BENCH_SAMPLES = 1 << 24;
+// Filter rebuild sizes for the plan cache timings
+static constexpr auto CACHE_FFT_SIZES = {4096, 65536, 1 << 20};
+// Both backends run kissfft's arithmetic in the same order, so batches should match exactly. This
+// only allows for compilers contracting one of them into FMAs.
+static constexpr auto MAX_BATCH_ERROR = 1e-5f;
+// Round trip against the input, relative to the signal
+static constexpr auto MAX_ROUND_TRIP_ERROR = 1e-5f;
+
+struct Signals {
+    int fft_size;
+    std::vector<std::vector<float>> time;
+    std::vector<std::vector<FftComplex>> freq;
+    std::vector<float*> time_ptrs;
+    std::vector<FftComplex*> freq_ptrs;
+
+    Signals(int channels, int fft_size) : fft_size(fft_size) {
+        time.resize(channels);
+        freq.resize(channels);
+        for (auto ch = 0; ch < channels; ch++) {
+            // Room for the spectrum, for in-place transforms
+            time[ch].resize(fft_size + 2);
+            freq[ch].resize(fft_size / 2 + 1);
+            time_ptrs.push_back(time[ch].data());
+            freq_ptrs.push_back(freq[ch].data());
+        }
+    }
+
+    void fill(std::mt19937& rng) {
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        for (auto& ch : time) {
+            std::generate_n(ch.begin(), fft_size, [&] { return dist(rng); });
+        }
+    }
+
+    int channels() const { return static_cast<int>(time.size()); }
+};
+
+static float max_diff(const std::vector<FftComplex>& a, const std::vector<FftComplex>& b) {
+    float diff = 0.0f;
+    for (size_t i = 0; i < a.size(); i++) {
+        diff = std::max({diff, std::abs(a[i].r - b[i].r), std::abs(a[i].i - b[i].i)});
+    }
+    return diff;
+}
+
+// Batched transforms against one scalar transform per channel, out of place and in place
+static bool check_batch(RealFft& fft, int channels) {
+    auto reference = RealFft::create(fft.size(), FFT_BACKEND_KISS);
+    Signals signals(channels, fft.size());
+    std::mt19937 rng(1);
+    signals.fill(rng);
+    auto input = signals.time;
+
+    fft.forward_batch(channels, signals.time_ptrs.data(), signals.freq_ptrs.data());
+    auto ok = true;
+    std::vector<FftComplex> expected(fft.bins());
+    for (auto ch = 0; ch < channels; ch++) {
+        reference->forward(input[ch].data(), expected.data());
+        ok &= max_diff(signals.freq[ch], expected) <= MAX_BATCH_ERROR * static_cast<float>(fft.size());
+    }
+
+    // Inverse in place, over the spectra
+    std::vector<float*> in_place(channels);
+    for (auto ch = 0; ch < channels; ch++) {
+        in_place[ch] = reinterpret_cast<float*>(signals.freq[ch].data());
+    }
+    fft.inverse_batch(channels, signals.freq_ptrs.data(), in_place.data());
+    for (auto ch = 0; ch < channels; ch++) {
+        for (auto i = 0; i < fft.size(); i++) {
+            auto out = in_place[ch][i] / static_cast<float>(fft.size());
+            ok &= std::abs(out - input[ch][i]) <= MAX_ROUND_TRIP_ERROR;
+        }
+    }
+
+    return ok;
+}
+
+// Returns ns per forward + inverse pair per channel
+static double run_bench(RealFft& fft, int channels) {
+    Signals signals(channels, fft.size());
+    std::mt19937 rng(1);
+    signals.fill(rng);
+
+    auto num_runs = std::max(BENCH_SAMPLES / (fft.size() * channels), 4);
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < num_runs; i++) {
+        fft.forward_batch(channels, signals.time_ptrs.data(), signals.freq_ptrs.data());
+        fft.inverse_batch(channels, signals.freq_ptrs.data(), signals.time_ptrs.data());
+        // Keep values bounded across runs
+        for (auto& ch : signals.time) {
+            ch[0] *= 1.0f / static_cast<float>(fft.size());
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    auto ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return ns / (static_cast<double>(num_runs) * channels);
+}
+
+static double time_create_us(int fft_size) {
+    auto start = std::chrono::steady_clock::now();
+    auto fft = RealFft::create(fft_size);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count();
+}
+
+// Creation time with and without cached tables, and sharing between live instances
+static bool check_plan_cache() {
+    auto ok = true;
+    std::cout << "\nPlan creation, default backend\n";
+    for (auto fft_size : CACHE_FFT_SIZES) {
+        fft_plan_cache::trim();
+        auto before = fft_plan_cache::get_stats();
+        auto cold = time_create_us(fft_size);
+        auto warm = time_create_us(fft_size);
+        auto after = fft_plan_cache::get_stats();
+
+        // Only the first creation builds plans
+        auto built = after.misses - before.misses;
+        auto reused = after.hits - before.hits;
+        ok &= built > 0 && reused == built;
+        printf("%7d: cold %8.1f us, cached %6.1f us, %d KiB of tables\n", fft_size, cold, warm,
+               static_cast<int>(after.bytes / 1024));
+    }
+
+    // Instances in use share tables and are never evicted
+    fft_plan_cache::trim();
+    auto a = RealFft::create(8192);
+    auto shared = fft_plan_cache::get_stats();
+    auto b = RealFft::create(8192);
+    fft_plan_cache::set_budget(0);
+    auto stats = fft_plan_cache::get_stats();
+    ok &= stats.plans == shared.plans && stats.bytes == shared.bytes && stats.plans_in_use == stats.plans;
+
+    // Released plans are cached until the budget is exceeded
+    a.reset();
+    b.reset();
+    fft_plan_cache::set_budget(fft_plan_cache::DEFAULT_BUDGET);
+    RealFft::create(4096);
+    ok &= fft_plan_cache::get_stats().plans_in_use == 0;
+    fft_plan_cache::set_budget(0);
+    stats = fft_plan_cache::get_stats();
+    ok &= stats.plans == 0 && stats.bytes == 0;
+    fft_plan_cache::set_budget(fft_plan_cache::DEFAULT_BUDGET);
+
+    printf("Cache: %llu hits, %llu misses, %llu evictions\n", static_cast<unsigned long long>(stats.hits),
+           static_cast<unsigned long long>(stats.misses), static_cast<unsigned long long>(stats.evictions));
+    return ok;
+}
+
+int main() {
+    std::cout << "Default backend: " << fft_backend_name(get_default_fft_backend()) << "\n";
+    std::cout << "ns per forward + inverse real FFT per channel\n";
+
+    auto ok = true;
+    for (auto fft_size : FFT_SIZES) {
+        for (auto channels : CHANNEL_COUNTS) {
+            printf("%5d x %d ch:", fft_size, channels);
+            double baseline = 0.0;
+            for (auto backend : BACKENDS) {
+                if (!fft_backend_available(backend)) {
+                    printf("  %s n/a", fft_backend_name(backend));
+                    continue;
+                }
+
+                auto fft = RealFft::create(fft_size, backend);
+                auto matches = check_batch(*fft, channels);
+                ok &= matches;
+
+                auto ns = run_bench(*fft, channels);
+                if (backend == FFT_BACKEND_KISS) {
+                    baseline = ns;
+                }
+                printf("  %s %9.0f (%.2fx)%s", fft_backend_name(backend), ns, baseline / ns,
+                       matches ? "" : " MISMATCH");
+            }
+            printf("\n");
+        }
+    }
+
+    if (!ok) {
+        std::cerr << "FFT backends don't match\n";
+        return 1;
+    }
+
+    if (!check_plan_cache()) {
+        std::cerr << "FFT plan cache didn't share or evict plans as expected\n";
+        return 1;
+    }
+
+    return 0;
+}
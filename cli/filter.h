@@ -3,8 +3,7 @@
 #include <vector>
 #include <iterator>
 #include <cstring>
-#include <variant>
-#include <memory>
+#include <span>
 
 #include "../dsp.h"
 #include "../wave.h"
@@ -12,8 +11,7 @@
 #include "../effects/gain.h"
 #include "../effects/graphic_eq_fir.h"
 #include "../effects/parametric_eq.h"
-#include "../sinks/collecting_float.h"
-#include "../sinks/collecting_s16.h"
+#include "../sinks/wave_file.h"
 
 using namespace fxdsp;
 
@@ -31,10 +29,9 @@ static std::vector<float> GEQ_BANDS{5.0f, -7.0f, 1.0f, 8.0f, 9.0f, -9.0f, -6.5f,
 
 static bool is_first_init = true;
 
-void process_buffer_short(DSP& dsp, CollectingS16BufferSink& sink, std::vector<short>& buf,
-                          const std::vector<std::vector<float>>& fir_filter);
-void process_buffer_float(DSP& dsp, CollectingFloatBufferSink& sink, std::vector<float>& buf,
-                          const std::vector<std::vector<float>>& fir_filter);
+// Processes the input's PCM samples, in its format, into out
+void process_pcm(DSP& dsp, WaveFileSink& out, std::span<const std::byte> pcm,
+                 const std::vector<std::vector<float>>& fir_filter);
 
 void init_effects(DSP& dsp, const std::vector<std::vector<float>>& fir_filter) {
     // https://github.com/jaakkopasanen/AutoEq/tree/master/results/rtings/rtings_harman_over-ear_2018/HyperX%20Cloud%20II
@@ -68,20 +65,21 @@ void init_effects(DSP& dsp, const std::vector<std::vector<float>>& fir_filter) {
         dsp.add_effect(geq);
 
         if (GEQ_FIR_EXPORT_FILTER && is_first_init) {
-            WaveHeader wave(FORMAT_F32, 1, dsp.sample_rate, geq->get_filter().size());
+            std::vector<float> filter = geq->get_filter();
+            WaveHeader wave(FORMAT_F32, 1, dsp.sample_rate, filter.size());
 
             std::string out_path(GEQ_FIR_EXPORT_FILTER_PATH);
             std::ofstream out_file(out_path, std::ios::binary);
             out_file.write(reinterpret_cast<char*>(&wave), sizeof(wave));
-            out_file.write(reinterpret_cast<const char*>(geq->get_filter().data()), wave.data.size);
+            out_file.write(reinterpret_cast<const char*>(filter.data()), wave.data.size);
             out_file.close();
         }
     }
 
     if (TEST_CONV && !fir_filter.empty()) {
         auto convolver = new ConvolverEffect(dsp, CONVOLVER_BLOCK_SIZE);
-        // Only use first channel for now
-        convolver->set_filter(fir_filter[0]);
+        // Routing follows the IR's channel count
+        convolver->set_filters(fir_filter);
         dsp.add_effect(convolver);
     }
 
@@ -94,7 +92,6 @@ int main(int argc, char **argv) {
         return 1;
     }
 
-    // TODO: migrate to common I/O helpers once helpers can do output while preserving format
     std::string in_path(argv[1]);
     std::ifstream in_file(in_path, std::ios::binary);
     std::vector<char> in_buf((std::istreambuf_iterator<char>(in_file)),
@@ -116,43 +113,17 @@ int main(int argc, char **argv) {
     WaveHeader wave(in_payload);
 
     auto num_channels = wave.fmt.num_channels;
-    auto num_samples = wave.data.size / (wave.fmt.bits_per_sample / 8);
-    auto samples_per_channel = wave.data.size / wave.fmt.block_align;
     auto format = wave.getAudioFormat();
-
-    DSP dsp(format, wave.fmt.sample_rate, num_channels, nullptr);
-
-    // Ugly, but this avoids having to make a copy with malloc
-    std::variant<std::shared_ptr<std::vector<short>>, std::shared_ptr<std::vector<float>>> pcm_buf;
-    char* pcm_out_data;
-    if (format == FORMAT_S16) {
-        auto pcm_data = reinterpret_cast<short*>(in_payload.data());
-        pcm_buf = std::make_shared<std::vector<short>>(pcm_data, pcm_data + num_samples);
-
-        auto short_buf = std::get<std::shared_ptr<std::vector<short>>>(pcm_buf);
-        auto sink = std::make_shared<CollectingS16BufferSink>(num_channels, samples_per_channel);
-        dsp.set_sink(sink.get());
-        process_buffer_short(dsp, *sink, *short_buf, fir_filter);
-        pcm_out_data = reinterpret_cast<char*>(short_buf->data());
-    } else if (format == FORMAT_F32) {
-        auto pcm_data = reinterpret_cast<float*>(in_payload.data());
-        pcm_buf = std::make_shared<std::vector<float>>(pcm_data, pcm_data + num_samples);
-
-        auto float_buf = std::get<std::shared_ptr<std::vector<float>>>(pcm_buf);
-        auto sink = std::make_shared<CollectingFloatBufferSink>(num_channels, samples_per_channel);
-        dsp.set_sink(sink.get());
-        process_buffer_float(dsp, *sink, *float_buf, fir_filter);
-        pcm_out_data = reinterpret_cast<char*>(float_buf->data());
-    } else {
+    if (format == FORMAT_UNKNOWN) {
         std::cerr << "Unknown audio format\n";
         return 3;
     }
 
-    std::string out_path(argv[2]);
-    std::ofstream out_file(out_path, std::ios::binary);
-    out_file.write(reinterpret_cast<char*>(&wave), sizeof(wave));
-    out_file.write(pcm_out_data, wave.data.size);
-    out_file.close();
+    // Output is streamed in the input's format
+    WaveFileSink out(argv[2], format, num_channels, wave.fmt.sample_rate);
+    DSP dsp(format, wave.fmt.sample_rate, num_channels, nullptr);
+    process_pcm(dsp, out, in_payload.first(wave.data.size), fir_filter);
+    out.close();
 
     return 0;
 }
@@ -1,30 +1,36 @@
 #include "filter.h"
 #include "fr_sweep.h"
+#include "../sinks/collecting_float.h"
 
-void process_buffer_short(DSP& dsp, CollectingS16BufferSink& sink, std::vector<short>& buf,
-                          const std::vector<std::vector<float>>& fir_filter) {
-    // Unsupported
-    exit(3);
-}
+void process_pcm(DSP& dsp, WaveFileSink& out, std::span<const std::byte> pcm,
+                 const std::vector<std::vector<float>>& fir_filter) {
+    if (dsp.audio_format != FORMAT_F32) {
+        // Unsupported
+        exit(3);
+    }
 
-void process_buffer_float(DSP& dsp, CollectingFloatBufferSink& sink, std::vector<float>& buf,
-                          const std::vector<std::vector<float>>& fir_filter) {
+    // One period at a time, passed on to the file before the next
+    CollectingFloatBufferSink sink(dsp.channels, PERIOD);
     init_effects(dsp, fir_filter);
+    dsp.set_sink(&sink);
+    dsp.prepare(dsp.sample_rate, PERIOD);
 
+    auto samples = reinterpret_cast<const float*>(pcm.data());
     int si = 0; // total
     for (int freq = MIN_FREQ; freq < MAX_FREQ; freq += FREQ_STEP) {
         int period_samples = get_freq_sample_count(freq);
-        std::vector<float> freq_buf(buf.begin() + si, buf.begin() + si + period_samples);
+        std::vector<float> freq_buf(samples + si, samples + si + period_samples);
 
+        sink.get_buffer().clear();
         sink.set_limit(period_samples);
         dsp.write_audio_1d(freq_buf);
+        out.write_audio_1d(sink.get_buffer());
 
         si += period_samples;
         for (auto effect : dsp.get_effects()) {
             effect->finalize();
-            effect->reset();
         }
+        // Also resets fused filter state
+        dsp.reset();
     }
-
-    buf = sink.get_buffer();
 }
@@ -1,15 +1,16 @@
 #include "filter.h"
 
-void process_buffer_short(DSP& dsp, CollectingS16BufferSink& sink, std::vector<short>& buf,
-                          const std::vector<std::vector<float>>& fir_filter) {
-    init_effects(dsp, fir_filter);
-    dsp.write_audio_1d(buf);
-    std::copy(sink.get_buffer().begin(), sink.get_buffer().end(), buf.begin());
-}
+// Frames per write, as an audio callback would deliver them
+static constexpr auto PROCESS_FRAMES = 4096;
 
-void process_buffer_float(DSP& dsp, CollectingFloatBufferSink& sink, std::vector<float>& buf,
-                          const std::vector<std::vector<float>>& fir_filter) {
+void process_pcm(DSP& dsp, WaveFileSink& out, std::span<const std::byte> pcm,
+                 const std::vector<std::vector<float>>& fir_filter) {
     init_effects(dsp, fir_filter);
-    dsp.write_audio_1d(buf);
-    std::copy(sink.get_buffer().begin(), sink.get_buffer().end(), buf.begin());
+    dsp.set_sink(&out);
+    dsp.prepare(dsp.sample_rate, PROCESS_FRAMES);
+
+    auto chunk_size = static_cast<size_t>(PROCESS_FRAMES) * dsp.channels * pcm_sample_size(dsp.audio_format);
+    for (size_t pos = 0; pos < pcm.size(); pos += chunk_size) {
+        dsp.write_audio_1d(pcm.subspan(pos, std::min(chunk_size, pcm.size() - pos)));
+    }
 }
@@ -0,0 +1,232 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../effects/graphic_eq_fir.h"
+#include "../filters/fir_design.h"
+#include "../filters/kernel_cache.h"
+#include "../util/fft.h"
+
+using namespace fxdsp;
+
+static constexpr auto SAMPLE_RATE = 48000;
+static constexpr auto FILTER_SIZES = {1023, 4999};
+static constexpr auto MAX_ERRORS_DB = {0.1f, 0.01f, 0.001f};
+static constexpr auto MIN_FREQ = 20.0f;
+static constexpr auto MAX_FREQ = 20000.0f;
+// Fine enough to resolve the response of the longest filter
+static constexpr auto RESPONSE_FFT_SIZE = 1 << 16;
+// Bins this far below the peak are dominated by rounding, not by the design
+static constexpr auto RESPONSE_FLOOR_DB = -80.0f;
+static constexpr auto REFERENCE_RUNS = 3;
+static constexpr auto FAST_RUNS = 10;
+// Fast designs that can't reach their target stop once doubling gains less than this, and start from
+// a prototype with a different IFFT
+static constexpr auto ROUNDING_ERROR_DB = 0.0001f;
+static constexpr auto SWITCH_BANDS = 10;
+
+struct Preset {
+    std::string name;
+    std::vector<float> freqs;
+    std::vector<float> gains;
+};
+
+// Log-spaced band centers, as in GraphicEqBase
+static std::vector<float> band_freqs(int num_bands) {
+    std::vector<float> freqs;
+    auto ratio = std::pow(MAX_FREQ / MIN_FREQ, 1.0f / static_cast<float>(num_bands - 1));
+    for (auto i = 0; i < num_bands; i++) {
+        freqs.push_back(MIN_FREQ * std::pow(ratio, static_cast<float>(i)));
+    }
+    return freqs;
+}
+
+static std::vector<Preset> make_presets() {
+    std::vector<Preset> presets;
+    presets.push_back({"flat, 10 bands", band_freqs(10), std::vector<float>(10, 0.0f)});
+    presets.push_back({"bass boost, 10 bands", band_freqs(10), {9, 7, 4, 1, 0, 0, 0, 0, 0, 0}});
+
+    std::vector<float> alternating(10);
+    for (auto i = 0; i < 10; i++) {
+        alternating[i] = i % 2 ? -6.0f : 6.0f;
+    }
+    presets.push_back({"alternating +-6 dB, 10 bands", band_freqs(10), alternating});
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(-12.0f, 12.0f);
+    std::vector<float> random(31);
+    std::generate(random.begin(), random.end(), [&] { return dist(rng); });
+    presets.push_back({"random, 31 bands", band_freqs(31), random});
+    return presets;
+}
+
+// Returns ms per design
+static double design(const Preset& preset, std::vector<float>& filter, float max_error_db, int runs) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < runs; i++) {
+        // make_filter consumes the bands
+        auto freqs = preset.freqs;
+        auto gains = preset.gains;
+        if (!fir::make_filter(freqs, gains, filter, SAMPLE_RATE, true, max_error_db)) {
+            std::cerr << "Failed to design " << preset.name << "\n";
+            exit(1);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / runs;
+}
+
+// Magnitude in dB over the audio band, optionally square rooted
+static std::vector<float> response_db(const std::vector<float>& filter, bool sqrt_magnitude = false) {
+    auto fft = RealFft::create(RESPONSE_FFT_SIZE);
+    std::vector<float> time(RESPONSE_FFT_SIZE);
+    std::copy(filter.begin(), filter.end(), time.begin());
+    std::vector<FftComplex> freq(fft->bins());
+    fft->forward(time.data(), freq.data());
+
+    std::vector<float> db;
+    for (auto i = 0; i < fft->bins(); i++) {
+        auto hz = static_cast<float>(i) * SAMPLE_RATE / RESPONSE_FFT_SIZE;
+        if (hz >= MIN_FREQ && hz <= MAX_FREQ) {
+            auto mag = std::hypot(freq[i].r, freq[i].i);
+            if (sqrt_magnitude) {
+                mag = std::sqrt(mag);
+            }
+            db.push_back(20.0f * std::log10(std::max(mag, 1e-20f)));
+        }
+    }
+    return db;
+}
+
+static float max_error(const std::vector<float>& target_db, const std::vector<float>& db) {
+    auto floor = *std::max_element(target_db.begin(), target_db.end()) + RESPONSE_FLOOR_DB;
+    auto error = 0.0f;
+    for (size_t i = 0; i < db.size(); i++) {
+        if (target_db[i] > floor) {
+            error = std::max(error, std::abs(db[i] - target_db[i]));
+        }
+    }
+    return error;
+}
+
+// What minimum phase designs approximate: the square root of the linear phase design they're made
+// from, which has twice the length and twice the gains in dB
+static std::vector<float> target_response_db(const Preset& preset, int filter_size) {
+    auto freqs = preset.freqs;
+    auto gains = preset.gains;
+    for (auto& gain : gains) {
+        gain *= 2.0f;
+    }
+
+    std::vector<float> linear(filter_size * 2 - 1);
+    if (!fir::make_filter(freqs, gains, linear, SAMPLE_RATE, false)) {
+        std::cerr << "Failed to design " << preset.name << "\n";
+        exit(1);
+    }
+    return response_db(linear, true);
+}
+
+// ms per switch through all presets with SWITCH_BANDS bands, with each preset's taps
+static double switch_presets(FirGraphicEqEffect& geq, const std::vector<Preset>& presets,
+                             std::vector<std::vector<float>>& filters) {
+    filters.clear();
+    auto start = std::chrono::steady_clock::now();
+    for (auto& preset : presets) {
+        geq.set_all_bands(preset.gains);
+        filters.push_back(geq.get_filter());
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count() / presets.size();
+}
+
+// Preset switches in the GEQ: designed once, then taken from the kernel cache in memory and on disk
+static bool bench_preset_switch() {
+    std::vector<Preset> presets;
+    for (auto& preset : make_presets()) {
+        if (preset.freqs.size() == SWITCH_BANDS) {
+            presets.push_back(preset);
+        }
+    }
+
+    auto cache_dir = std::filesystem::temp_directory_path() / "fxdsp-fir-design-bench";
+    std::filesystem::remove_all(cache_dir);
+    kernel_cache::set_directory(cache_dir.string());
+    kernel_cache::clear();
+
+    DSP dsp(FORMAT_F32, SAMPLE_RATE, 2, nullptr);
+    FirGraphicEqEffect geq(dsp, SWITCH_BANDS);
+    std::vector<std::vector<float>> designed, from_memory, from_disk;
+    auto design_ms = switch_presets(geq, presets, designed);
+    auto memory_ms = switch_presets(geq, presets, from_memory);
+    kernel_cache::clear();
+    auto disk_ms = switch_presets(geq, presets, from_disk);
+
+    auto stats = kernel_cache::get_stats();
+
+    // Halving the disk budget has to trim the directory to fit, oldest files first
+    auto disk_budget = stats.disk_bytes / 2;
+    kernel_cache::set_disk_budget(disk_budget);
+    size_t disk_bytes = 0;
+    for (auto& entry : std::filesystem::directory_iterator(cache_dir)) {
+        disk_bytes += entry.file_size();
+    }
+    kernel_cache::set_disk_budget(kernel_cache::DEFAULT_DISK_BUDGET);
+    kernel_cache::set_directory("");
+    std::filesystem::remove_all(cache_dir);
+
+    printf("GEQ preset switch, ms per switch: designed %.2f, memory cache %.3f, disk cache %.3f\n",
+           design_ms, memory_ms, disk_ms);
+    auto ok = designed == from_memory && designed == from_disk && stats.disk_hits == presets.size();
+    if (!ok) {
+        std::cerr << "Cached GEQ filters don't match their designs\n";
+    }
+    if (disk_bytes == 0 || disk_bytes > disk_budget) {
+        std::cerr << "Kernel cache directory has " << disk_bytes << " bytes, over its budget of " << disk_budget << "\n";
+        ok = false;
+    }
+    return ok;
+}
+
+int main() {
+    std::cout << "Minimum phase GEQ design, ms per design and max response error against the target\n";
+
+    auto ok = true;
+    for (auto filter_size : FILTER_SIZES) {
+        for (auto& preset : make_presets()) {
+            std::vector<float> reference(filter_size);
+            auto reference_ms = design(preset, reference, 0.0f, REFERENCE_RUNS);
+            auto target_db = target_response_db(preset, filter_size);
+            auto reference_error = max_error(target_db, response_db(reference));
+            printf("%4d taps, %-30s reference %7.1f ms, error %.5f dB\n", filter_size, preset.name.c_str(),
+                   reference_ms, reference_error);
+
+            for (auto max_error_db : MAX_ERRORS_DB) {
+                std::vector<float> filter(filter_size);
+                auto ms = design(preset, filter, max_error_db, FAST_RUNS);
+                auto error = max_error(target_db, response_db(filter));
+                // Targets tighter than the reference can reach get about its error, and never cost more
+                auto within = error <= std::max(max_error_db, reference_error) + ROUNDING_ERROR_DB;
+                auto faster = ms <= reference_ms;
+                ok &= within && faster;
+                printf("    max error %5.3f dB: %6.2f ms (%5.0fx), error %.5f dB%s%s\n", max_error_db, ms,
+                       reference_ms / ms, error, within ? "" : " OVER", faster ? "" : " SLOWER");
+            }
+        }
+    }
+
+    if (!ok) {
+        std::cerr << "Fast designs exceed their max error or are slower than the reference\n";
+        return 1;
+    }
+
+    if (!bench_preset_switch()) {
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,76 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "../effects/convolver.h"
+#include "../filters/kernel_file.h"
+#include "../wave.h"
+
+using namespace fxdsp;
+
+static constexpr auto DEFAULT_BLOCK_SIZE = 256;
+// Round trip through the file and inverse FFTs, relative to the peak tap
+static constexpr auto MAX_TAP_ERROR = 1e-5f;
+
+static double ms_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0] << " [in.wav] [out.kernels] {block_size} {single|uniform} {fft_size}\n";
+        return 1;
+    }
+
+    std::string in_path(argv[1]);
+    std::string out_path(argv[2]);
+    auto block_size = argc > 3 ? std::stoi(argv[3]) : DEFAULT_BLOCK_SIZE;
+    auto mode = CONVOLVER_SINGLE_BLOCK;
+    if (argc > 4) {
+        std::string mode_name(argv[4]);
+        if (mode_name == "uniform") {
+            mode = CONVOLVER_UNIFORM_PARTITIONED;
+        } else if (mode_name != "single") {
+            std::cerr << "Unknown mode: " << mode_name << "\n";
+            return 1;
+        }
+    }
+    auto fft_size = argc > 5 ? std::stoi(argv[5]) : 0;
+
+    // What loading the WAV costs at runtime, for comparison
+    auto start = std::chrono::steady_clock::now();
+    auto irs = load_wave_file_float(in_path);
+    auto prepared = ConvolverEffect::prepare_filters(mode, block_size, fft_size, irs);
+    auto wav_ms = ms_since(start);
+    kernel_file::save(out_path, prepared);
+
+    start = std::chrono::steady_clock::now();
+    auto loaded = kernel_file::load(out_path);
+    auto load_ms = ms_since(start);
+
+    // Check that the file gives the IR back
+    auto taps = loaded.to_taps();
+    auto error = 0.0f;
+    auto peak = 0.0f;
+    for (size_t f = 0; f < irs.size(); f++) {
+        for (size_t i = 0; i < irs[f].size(); i++) {
+            error = std::max(error, std::abs(taps[f][i] - irs[f][i]));
+            peak = std::max(peak, std::abs(irs[f][i]));
+        }
+    }
+
+    printf("%d filters, %d frames, %d partitions of %d at FFT size %d\n", loaded.num_filters(), loaded.max_frames(),
+           loaded.num_partitions, loaded.partition_size, loaded.fft_size);
+    printf("WAV load and transform %.3f ms, kernel file load %.3f ms, max tap error %g\n", wav_ms, load_ms,
+           error / std::max(peak, 1e-20f));
+
+    if (taps.size() != irs.size() || error > MAX_TAP_ERROR * std::max(peak, 1e-20f)) {
+        std::cerr << "Kernel file doesn't match the IR\n";
+        return 2;
+    }
+
+    return 0;
+}
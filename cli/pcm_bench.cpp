@@ -0,0 +1,220 @@
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "../audio_buffer.h"
+#include "../dither.h"
+#include "../util/fft.h"
+#include "../util/window.h"
+#include "../pcm.h"
+
+using namespace fxdsp;
+
+static constexpr auto BLOCK_SIZE = 256;
+static constexpr auto CHANNEL_COUNTS = {1, 2, 3, 6, 8};
+static constexpr auto ITERATIONS = 20000;
+static constexpr auto FORMAT_CHANNELS = 2;
+static constexpr struct { AudioFormat format; const char* name; } FORMATS[] = {
+    {FORMAT_U8, "U8"}, {FORMAT_S16, "S16"}, {FORMAT_S24, "S24"}, {FORMAT_S24_32, "S24_32"}, {FORMAT_S32, "S32"},
+    {FORMAT_F32, "F32"},
+};
+static constexpr struct { DitherMode mode; const char* name; } DITHER_MODES[] = {
+    {DITHER_OFF, "off"}, {DITHER_TPDF, "TPDF"}, {DITHER_SHAPED, "shaped"},
+};
+// Quiet 1 kHz tone, where requantization error matters most
+static constexpr auto DITHER_TONE_LSB = 3.0f;
+static constexpr auto DITHER_SAMPLE_RATE = 48000;
+// TPDF adds 1/6 LSB^2 to rounding's 1/12
+static constexpr auto MIN_TPDF_POWER = 0.2;
+static constexpr auto MAX_TPDF_POWER = 0.3;
+static constexpr auto DITHER_LOW_BAND = 2000.0f;
+// Shaped error below DITHER_LOW_BAND vs. TPDF
+static constexpr auto MAX_SHAPED_LOW_RATIO_DB = -20.0;
+
+// Previous per-channel loops, strided by the channel count
+static void legacy_deinterleave_s16(const short* raw_buf, AudioBuffer& buf) {
+    for (auto ch = 0; ch < buf.channels(); ch++) {
+        auto out = buf.channel(ch);
+        for (auto i = 0; i < buf.frames(); i++) {
+            out[i] = pcm_s16_to_float32(raw_buf[i * buf.channels() + ch]);
+        }
+    }
+}
+
+static void legacy_interleave_s16(const AudioBuffer& buf, short* raw_buf) {
+    for (auto ch = 0; ch < buf.channels(); ch++) {
+        auto in = buf.channel(ch);
+        for (auto i = 0; i < buf.frames(); i++) {
+            raw_buf[i * buf.channels() + ch] = pcm_float32_to_s16(in[i]);
+        }
+    }
+}
+
+static void legacy_interleave(const AudioBuffer& buf, float* raw_buf) {
+    for (auto ch = 0; ch < buf.channels(); ch++) {
+        auto in = buf.channel(ch);
+        for (auto i = 0; i < buf.frames(); i++) {
+            raw_buf[i * buf.channels() + ch] = in[i];
+        }
+    }
+}
+
+struct ErrorStats {
+    // LSB^2
+    double power;
+    // Below DITHER_LOW_BAND, relative to power
+    double low_ratio;
+};
+
+// Error of dithered S16 output vs. the exact tone, in LSBs
+static ErrorStats measure_dither(DitherMode mode) {
+    auto frames = 32768;
+    AudioBuffer buf(FORMAT_CHANNELS, frames);
+    std::vector<float> tone(frames);
+    for (auto i = 0; i < frames; i++) {
+        tone[i] = DITHER_TONE_LSB / 32768.0f * std::sin(2.0f * static_cast<float>(M_PI) * 1000.0f * i / DITHER_SAMPLE_RATE);
+    }
+    for (auto ch = 0; ch < FORMAT_CHANNELS; ch++) {
+        std::copy(tone.begin(), tone.end(), buf.channel(ch));
+    }
+
+    Dither dither(FORMAT_CHANNELS, FORMAT_S16, mode);
+    std::vector<short> out(frames * FORMAT_CHANNELS);
+    dither.process(buf, frames);
+    interleave_pcm_s16(buf, frames, out.data());
+
+    // Windowed, so the loud high-frequency noise of shaped dither doesn't leak into low bins
+    auto fft = RealFft::create(frames);
+    std::vector<float> error(frames);
+    std::vector<FftComplex> spectrum(frames / 2 + 1);
+    auto low_bins = static_cast<int>(DITHER_LOW_BAND * frames / DITHER_SAMPLE_RATE);
+    double power = 0.0, spectrum_power = 0.0, low_power = 0.0;
+    for (auto ch = 0; ch < FORMAT_CHANNELS; ch++) {
+        for (auto i = 0; i < frames; i++) {
+            auto sample_error = out[i * FORMAT_CHANNELS + ch] - tone[i] * 32768.0f;
+            power += sample_error * sample_error;
+            error[i] = sample_error * window::hann_periodic(frames, i);
+        }
+
+        fft->forward(error.data(), spectrum.data());
+        for (auto bin = 1; bin < static_cast<int>(spectrum.size()); bin++) {
+            auto bin_power = spectrum[bin].r * spectrum[bin].r + spectrum[bin].i * spectrum[bin].i;
+            spectrum_power += bin_power;
+            low_power += bin < low_bins ? bin_power : 0.0;
+        }
+    }
+
+    return { power / (frames * FORMAT_CHANNELS), low_power / spectrum_power };
+}
+
+// Returns ns per sample
+template <typename Fn>
+static double run_bench(int channels, Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto i = 0; i < ITERATIONS; i++) {
+        fn();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    auto ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return ns / (static_cast<double>(ITERATIONS) * BLOCK_SIZE * channels);
+}
+
+int main() {
+    std::cout << "Block size " << BLOCK_SIZE << ", ns per sample (legacy -> kernel)\n";
+    auto ok = true;
+    for (auto channels : CHANNEL_COUNTS) {
+        std::mt19937 rng(1);
+        std::vector<short> s16(BLOCK_SIZE * channels);
+        for (auto& sample : s16) {
+            sample = static_cast<short>(rng());
+        }
+
+        AudioBuffer legacy_buf(channels, BLOCK_SIZE);
+        AudioBuffer buf(channels, BLOCK_SIZE);
+        legacy_deinterleave_s16(s16.data(), legacy_buf);
+        deinterleave_pcm_s16(s16.data(), static_cast<int>(s16.size()), buf);
+
+        std::vector<short> legacy_s16(s16.size()), out_s16(s16.size());
+        std::vector<float> legacy_f32(s16.size()), out_f32(s16.size());
+        legacy_interleave_s16(legacy_buf, legacy_s16.data());
+        interleave_pcm_s16(buf, BLOCK_SIZE, out_s16.data());
+        legacy_interleave(legacy_buf, legacy_f32.data());
+        interleave_pcm(buf, BLOCK_SIZE, out_f32.data());
+
+        for (auto ch = 0; ch < channels; ch++) {
+            ok &= memcmp(legacy_buf.channel(ch), buf.channel(ch), BLOCK_SIZE * sizeof(float)) == 0;
+        }
+        ok &= legacy_s16 == out_s16 && legacy_s16 == s16;
+        ok &= legacy_f32 == out_f32;
+
+        printf("%d ch: deinterleave S16 %5.2f -> %5.2f, interleave S16 %5.2f -> %5.2f, F32 %5.2f -> %5.2f\n",
+               channels,
+               run_bench(channels, [&] { legacy_deinterleave_s16(s16.data(), legacy_buf); }),
+               run_bench(channels, [&] { deinterleave_pcm_s16(s16.data(), static_cast<int>(s16.size()), buf); }),
+               run_bench(channels, [&] { legacy_interleave_s16(legacy_buf, legacy_s16.data()); }),
+               run_bench(channels, [&] { interleave_pcm_s16(buf, BLOCK_SIZE, out_s16.data()); }),
+               run_bench(channels, [&] { legacy_interleave(legacy_buf, legacy_f32.data()); }),
+               run_bench(channels, [&] { interleave_pcm(buf, BLOCK_SIZE, out_f32.data()); }));
+    }
+
+    // Integer samples survive a round trip through float, except for S32 beyond 24 bits
+    printf("\n%d ch, ns per sample (deinterleave, interleave)\n", FORMAT_CHANNELS);
+    for (auto [format, name] : FORMATS) {
+        std::mt19937 rng(1);
+        auto bytes = static_cast<size_t>(BLOCK_SIZE) * FORMAT_CHANNELS * pcm_sample_size(format);
+        std::vector<std::byte> raw(bytes), out(bytes);
+        for (auto& byte : raw) {
+            byte = static_cast<std::byte>(rng());
+        }
+        if (format == FORMAT_S24_32 || format == FORMAT_S32 || format == FORMAT_F32) {
+            // Keep 24-in-32 in range, and S32 and F32 to values that are exact in float
+            auto words = reinterpret_cast<int32_t*>(raw.data());
+            for (size_t i = 0; i < bytes / sizeof(int32_t); i++) {
+                words[i] = (words[i] >> 8) * (format == FORMAT_S32 ? 256 : 1);
+            }
+            if (format == FORMAT_F32) {
+                for (size_t i = 0; i < bytes / sizeof(float); i++) {
+                    reinterpret_cast<float*>(raw.data())[i] = static_cast<float>(words[i]) / 8388608.0f;
+                }
+            }
+        }
+
+        AudioBuffer buf(FORMAT_CHANNELS, BLOCK_SIZE);
+        deinterleave_pcm(raw.data(), format, BLOCK_SIZE * FORMAT_CHANNELS, buf);
+        interleave_pcm(buf, BLOCK_SIZE, format, out.data());
+        ok &= raw == out;
+
+        printf("%-6s %5.2f, %5.2f\n", name,
+               run_bench(FORMAT_CHANNELS, [&] { deinterleave_pcm(raw.data(), format, BLOCK_SIZE * FORMAT_CHANNELS, buf); }),
+               run_bench(FORMAT_CHANNELS, [&] { interleave_pcm(buf, BLOCK_SIZE, format, out.data()); }));
+    }
+
+    printf("\nS16 dither, %d ch, ns per sample (error power, below 2 kHz)\n", FORMAT_CHANNELS);
+    auto tpdf = measure_dither(DITHER_TPDF);
+    auto shaped = measure_dither(DITHER_SHAPED);
+    ok &= tpdf.power >= MIN_TPDF_POWER && tpdf.power <= MAX_TPDF_POWER;
+    ok &= 10 * std::log10(shaped.power * shaped.low_ratio / (tpdf.power * tpdf.low_ratio)) <= MAX_SHAPED_LOW_RATIO_DB;
+    for (auto [mode, name] : DITHER_MODES) {
+        AudioBuffer buf(FORMAT_CHANNELS, BLOCK_SIZE);
+        buf.clear();
+        std::vector<short> out(BLOCK_SIZE * FORMAT_CHANNELS);
+        Dither dither(FORMAT_CHANNELS, FORMAT_S16, mode);
+
+        auto stats = measure_dither(mode);
+        printf("%-6s %5.2f (%.1f dB, %.1f dB)\n", name, run_bench(FORMAT_CHANNELS, [&] {
+            dither.process(buf, BLOCK_SIZE);
+            interleave_pcm_s16(buf, BLOCK_SIZE, out.data());
+        }), 10 * std::log10(stats.power), 10 * std::log10(stats.power * stats.low_ratio));
+    }
+
+    if (!ok) {
+        std::cerr << "PCM kernels or dither don't match the expected results\n";
+        return 1;
+    }
+
+    return 0;
+}
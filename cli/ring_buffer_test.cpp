@@ -0,0 +1,153 @@
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../audio_buffer.h"
+#include "../sinks/ring_buffer.h"
+
+using namespace fxdsp;
+
+static constexpr auto CHANNELS = 2;
+static constexpr auto CAPACITY_FRAMES = 1000;
+static constexpr auto MAX_BLOCK_FRAMES = 700;
+static constexpr auto STREAM_FRAMES = 1 << 22;
+static constexpr auto REAL_TIME_BLOCK_FRAMES = 256;
+static constexpr auto TIMEOUT_MS = 1000;
+
+// Frames carry their index, +/-, exact through S32 below 2^24
+static void fill_frames(AudioBuffer& buf, int first, int frames) {
+    buf.set_frames(frames);
+    for (auto i = 0; i < frames; i++) {
+        auto value = static_cast<float>(first + i) / 2147483648.0f;
+        buf.channel(0)[i] = value;
+        buf.channel(1)[i] = -value;
+    }
+}
+
+// Index of a frame read back, or -1 if its channels don't agree
+static int64_t frame_index(const int32_t* frame) {
+    return frame[0] == -frame[1] ? frame[0] : -1;
+}
+
+static double ns_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Overruns, underruns, wrapping and silence, on one thread
+static bool check_single_thread() {
+    auto ok = true;
+    RingBufferSink sink(FORMAT_S32, CHANNELS, CAPACITY_FRAMES);
+    auto& source = sink.get_source();
+    AudioBuffer buf(CHANNELS, 0);
+    std::vector<int32_t> out(CAPACITY_FRAMES * 2 * CHANNELS);
+
+    auto capacity = sink.get_capacity_frames();
+    ok &= capacity == 1024;
+
+    // Past capacity: the newest frames are dropped
+    fill_frames(buf, 0, capacity + 100);
+    sink.write_audio(buf);
+    ok &= sink.get_overruns() == 1 && sink.get_fill_frames() == capacity;
+
+    ok &= source.read(out.data(), 600) == 600;
+    for (auto i = 0; i < 600; i++) {
+        ok &= frame_index(&out[i * CHANNELS]) == i;
+    }
+
+    // Wraps around the end
+    fill_frames(buf, capacity + 100, 300);
+    sink.write_audio(buf);
+    ok &= sink.get_overruns() == 1 && sink.get_fill_frames() == capacity - 300;
+
+    // Short read: the rest is silence
+    auto frames = source.read(out.data(), capacity);
+    ok &= frames == capacity - 300 && source.get_underruns() == 1;
+    for (auto i = 0; i < capacity; i++) {
+        auto expected = i < capacity - 600 ? 600 + i : i < frames ? capacity + 100 + (i - (capacity - 600)) : 0;
+        ok &= frame_index(&out[i * CHANNELS]) == expected;
+    }
+
+    // Unsigned silence
+    RingBufferSink u8_sink(FORMAT_U8, 1, CAPACITY_FRAMES);
+    std::vector<uint8_t> u8_out(16);
+    ok &= u8_sink.get_source().read(u8_out.data(), 16) == 0 && u8_sink.get_source().get_underruns() == 1;
+    ok &= std::all_of(u8_out.begin(), u8_out.end(), [](auto sample) { return sample == 0x80; });
+
+    return ok;
+}
+
+// Producer and consumer threads in blocks of random sizes. With timeouts, every frame arrives in
+// order. Without, frames are dropped and reads come up short, but what arrives is in order and whole.
+static bool check_threads(int timeout_ms, int max_block_frames, double& ns_per_frame, uint64_t& xruns) {
+    RingBufferSink sink(FORMAT_S32, CHANNELS, CAPACITY_FRAMES, timeout_ms);
+    auto& source = sink.get_source();
+    std::atomic<bool> produced(false);
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&] {
+        std::mt19937 rng(1);
+        AudioBuffer buf(CHANNELS, max_block_frames);
+        for (auto pos = 0; pos < STREAM_FRAMES;) {
+            auto frames = std::min(static_cast<int>(rng() % max_block_frames) + 1, STREAM_FRAMES - pos);
+            fill_frames(buf, pos, frames);
+            sink.write_audio(buf);
+            pos += frames;
+        }
+        produced = true;
+    });
+
+    auto ok = true;
+    std::mt19937 rng(2);
+    std::vector<int32_t> out(max_block_frames * CHANNELS);
+    int64_t last = -1;
+    for (auto total = 0; total < STREAM_FRAMES;) {
+        // Read before draining, so frames written before it was set aren't missed
+        auto finished = produced.load();
+        auto frames = std::min(static_cast<int>(rng() % max_block_frames) + 1, STREAM_FRAMES - total);
+        auto count = source.read(out.data(), frames, timeout_ms);
+        for (auto i = 0; i < count; i++) {
+            auto index = frame_index(&out[i * CHANNELS]);
+            ok &= timeout_ms > 0 ? index == last + 1 : index > last;
+            last = index;
+        }
+
+        if (timeout_ms > 0) {
+            total += frames;
+        } else if (finished && count == 0) {
+            break;
+        }
+    }
+    producer.join();
+
+    ns_per_frame = ns_since(start) / STREAM_FRAMES;
+    xruns = sink.get_overruns() + source.get_underruns();
+    ok &= last >= 0 && (timeout_ms == 0 || (xruns == 0 && last == STREAM_FRAMES - 1));
+    return ok;
+}
+
+int main() {
+    auto ok = check_single_thread();
+    printf("Single thread: %s\n", ok ? "ok" : "FAILED");
+
+    double ns_per_frame;
+    uint64_t xruns;
+    auto blocking_ok = check_threads(TIMEOUT_MS, MAX_BLOCK_FRAMES, ns_per_frame, xruns);
+    printf("Blocking, random blocks: %.2f ns per frame, %llu xruns: %s\n", ns_per_frame,
+           static_cast<unsigned long long>(xruns), blocking_ok ? "ok" : "FAILED");
+
+    auto real_time_ok = check_threads(0, REAL_TIME_BLOCK_FRAMES, ns_per_frame, xruns);
+    printf("Wait-free, blocks of up to %d: %.2f ns per frame, %llu xruns: %s\n", REAL_TIME_BLOCK_FRAMES,
+           ns_per_frame, static_cast<unsigned long long>(xruns), real_time_ok ? "ok" : "FAILED");
+
+    if (!ok || !blocking_ok || !real_time_ok) {
+        std::cerr << "Ring buffer doesn't deliver the expected frames\n";
+        return 2;
+    }
+
+    return 0;
+}
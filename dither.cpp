@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "dither.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace fxdsp {
+
+// Adding and subtracting 1.5 * 2^23 rounds values below 2^22 to integers, without the latency of
+// converting to int and back
+static constexpr float ROUNDING_MAGIC = 12582912.0f;
+
+static float dither_scale(AudioFormat format) {
+    switch (format) {
+        case FORMAT_U8: return 128.0f;
+        case FORMAT_S16: return 32768.0f;
+        default: throw std::invalid_argument("Dither: unsupported format " + std::to_string(format));
+    }
+}
+
+// xorshift32 steps and TPDF noise in LSBs, as the difference of the two 16-bit halves of each value
+// Compilers leave the scalar loop as serial shift/XOR chains per lane, so vectors are explicit, as in
+// the PCM kernels.
+struct ScalarNoise {
+    static constexpr int WIDTH = 1;
+    using I = uint32_t;
+    using V = float;
+
+    static I load_state(const uint32_t* p) { return *p; }
+    static void store_state(uint32_t* p, I x) { *p = x; }
+
+    static I next(I x) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        return x ^ (x << 5);
+    }
+
+    static V noise(I x) {
+        auto lo = static_cast<int32_t>(x & 0xffff);
+        auto hi = static_cast<int32_t>(x >> 16);
+        return static_cast<float>(lo - hi) * (1.0f / 65536.0f);
+    }
+
+    static V load(const float* p) { return *p; }
+    static void store(float* p, V v) { *p = v; }
+    static V add_scaled(V a, V b, float scale) { return a + b * scale; }
+};
+
+#if defined(__SSE2__)
+struct SseNoise {
+    static constexpr int WIDTH = 4;
+    using I = __m128i;
+    using V = __m128;
+
+    static I load_state(const uint32_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    static void store_state(uint32_t* p, I x) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), x); }
+
+    static I next(I x) {
+        x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+        x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+        return _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    }
+
+    static V noise(I x) {
+        auto lo = _mm_and_si128(x, _mm_set1_epi32(0xffff));
+        auto hi = _mm_srli_epi32(x, 16);
+        return _mm_mul_ps(_mm_cvtepi32_ps(_mm_sub_epi32(lo, hi)), _mm_set1_ps(1.0f / 65536.0f));
+    }
+
+    static V load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, V v) { _mm_storeu_ps(p, v); }
+    static V add_scaled(V a, V b, float scale) { return _mm_add_ps(a, _mm_mul_ps(b, _mm_set1_ps(scale))); }
+};
+using NoiseLanes = SseNoise;
+#elif defined(__ARM_NEON)
+struct NeonNoise {
+    static constexpr int WIDTH = 4;
+    using I = uint32x4_t;
+    using V = float32x4_t;
+
+    static I load_state(const uint32_t* p) { return vld1q_u32(p); }
+    static void store_state(uint32_t* p, I x) { vst1q_u32(p, x); }
+
+    static I next(I x) {
+        x = veorq_u32(x, vshlq_n_u32(x, 13));
+        x = veorq_u32(x, vshrq_n_u32(x, 17));
+        return veorq_u32(x, vshlq_n_u32(x, 5));
+    }
+
+    static V noise(I x) {
+        auto lo = vreinterpretq_s32_u32(vandq_u32(x, vdupq_n_u32(0xffff)));
+        auto hi = vreinterpretq_s32_u32(vshrq_n_u32(x, 16));
+        return vmulq_n_f32(vcvtq_f32_s32(vsubq_s32(lo, hi)), 1.0f / 65536.0f);
+    }
+
+    static V load(const float* p) { return vld1q_f32(p); }
+    static void store(float* p, V v) { vst1q_f32(p, v); }
+    // Separate multiply and add, so results match the other paths
+    static V add_scaled(V a, V b, float scale) { return vaddq_f32(a, vmulq_n_f32(b, scale)); }
+};
+using NoiseLanes = NeonNoise;
+#else
+using NoiseLanes = ScalarNoise;
+#endif
+
+// Generator state for all LANES, kept in registers across a block of samples
+template <typename L>
+struct NoiseState {
+    static constexpr int VECTORS = Dither::LANES / L::WIDTH;
+    typename L::I x[VECTORS];
+
+    explicit NoiseState(const uint32_t* rng) {
+        for (auto j = 0; j < VECTORS; j++) {
+            x[j] = L::load_state(rng + j * L::WIDTH);
+        }
+    }
+
+    void save(uint32_t* rng) const {
+        for (auto j = 0; j < VECTORS; j++) {
+            L::store_state(rng + j * L::WIDTH, x[j]);
+        }
+    }
+
+    void next(float* noise) {
+        for (auto j = 0; j < VECTORS; j++) {
+            x[j] = L::next(x[j]);
+            L::store(noise + j * L::WIDTH, L::noise(x[j]));
+        }
+    }
+
+    // Adds the next LANES values of noise, times scale, to samples
+    void add_next(float* samples, float scale) {
+        for (auto j = 0; j < VECTORS; j++) {
+            x[j] = L::next(x[j]);
+            auto p = samples + j * L::WIDTH;
+            L::store(p, L::add_scaled(L::load(p), L::noise(x[j]), scale));
+        }
+    }
+};
+
+Dither::Dither(int channels, AudioFormat format, DitherMode mode) :
+        state(channels),
+        mode(mode),
+        scale(dither_scale(format)) {
+    reset();
+}
+
+void Dither::set_mode(DitherMode mode) {
+    this->mode = mode;
+}
+
+void Dither::reset() {
+    // Distinct and never zero, which xorshift can't leave
+    uint32_t seed = 0;
+    for (auto& channel : state) {
+        for (auto& rng : channel.rng) {
+            rng = ++seed * 0x9e3779b9u;
+        }
+        channel.error[0] = 0.0f;
+        channel.error[1] = 0.0f;
+    }
+}
+
+void Dither::process_tpdf(float* samples, ChannelState& channel, int frames) {
+    alignas(32) float noise[LANES];
+    auto lsb = 1.0f / scale;
+    NoiseState<NoiseLanes> rng(channel.rng);
+
+    auto i = 0;
+    for (; i + LANES <= frames; i += LANES) {
+        rng.add_next(samples + i, lsb);
+    }
+
+    rng.next(noise);
+    for (auto k = 0; i < frames; i++, k++) {
+        samples[i] += noise[k] * lsb;
+    }
+    rng.save(channel.rng);
+}
+
+void Dither::process_shaped(float* samples, ChannelState& channel, int frames) {
+    alignas(32) float noise[LANES];
+    // Locals, so they aren't reloaded after every store to samples
+    auto scale = this->scale;
+    auto lsb = 1.0f / scale;
+    auto e1 = channel.error[0];
+    auto e2 = channel.error[1];
+    NoiseState<NoiseLanes> rng(channel.rng);
+
+    // Errors depend on the previous ones, so only the noise is generated in blocks
+    for (auto i = 0; i < frames; i += LANES) {
+        rng.next(noise);
+        auto n = std::min(LANES, frames - i);
+        for (auto k = 0; k < n; k++) {
+            // Keeps the target in range for rounding. Anything beyond full scale clips anyway.
+            auto input = std::clamp(samples[i + k] * scale, -2.0f * scale, 2.0f * scale);
+            // Output is x + e[n] - 2 e[n - 1] + e[n - 2]
+            auto target = input + e2 - 2.0f * e1;
+            auto rounded = (target + noise[k] + ROUNDING_MAGIC) - ROUNDING_MAGIC;
+            e2 = e1;
+            e1 = rounded - target;
+
+            // Clipping isn't fed back, so overloads can't make the error run away. Exact, so the
+            // conversion that follows gives the same value.
+            samples[i + k] = std::clamp(rounded, -scale, scale - 1.0f) * lsb;
+        }
+    }
+
+    channel.error[0] = e1;
+    channel.error[1] = e2;
+    rng.save(channel.rng);
+}
+
+void Dither::process(AudioBuffer& buf, int frames) {
+    if (mode == DITHER_OFF) {
+        return;
+    }
+
+    auto channels = std::min(buf.channels(), static_cast<int>(state.size()));
+    for (auto ch = 0; ch < channels; ch++) {
+        if (mode == DITHER_SHAPED) {
+            process_shaped(buf.channel(ch), state[ch], frames);
+        } else {
+            process_tpdf(buf.channel(ch), state[ch], frames);
+        }
+    }
+}
+
+}
@@ -1,5 +1,11 @@
 #include "dsp.h"
+#include "util/alloc_guard.h"
 
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <thread>
 #include <utility>
 
 namespace fxdsp {
@@ -9,6 +15,36 @@ Effect::Effect(const DSP &dsp) :
         sink(nullptr) {
 }
 
+void Effect::set_enabled(bool new_enabled) {
+    if (enabled == new_enabled) {
+        return;
+    }
+
+    enabled = new_enabled;
+    enabled_changed();
+
+    if (attached_dsp != nullptr) {
+        attached_dsp->effect_changed(this, true);
+    }
+}
+
+void Effect::parameters_changed() {
+    if (attached_dsp != nullptr) {
+        attached_dsp->effect_changed(this, false);
+    }
+}
+
+bool Effect::get_iir_stages(float& gain, std::vector<BiquadCoeffs>& sections) const {
+    return false;
+}
+
+bool Effect::is_enabled() const {
+    return enabled;
+}
+
+void Effect::enabled_changed() {
+}
+
 void Effect::set_next_sink(AudioSink &next_sink) {
     sink = &next_sink;
 }
@@ -22,28 +58,113 @@ void Effect::finalize() {
 DSP::DSP(AudioFormat audio_format, int sample_rate, int channels, AudioSink* sink) :
         AudioSink(audio_format, channels),
         sink(sink),
+        max_frames(0),
+        bypass_fade_frames(0),
+        iir_form(IIR_FORM_AUTO),
+        next_generation(1),
+        current_chain(nullptr),
+        audio_epoch(0),
+        applied_generation(0),
+        bypass_fade(channels),
         sample_rate(sample_rate),
         channels(channels) {
-    audio_buf.resize(channels);
+    update_sinks();
 }
 
-void DSP::write_audio(std::vector<std::vector<float>>& buf) {
-    if (!effect_chain.empty()) {
-        effect_chain[0]->write_audio(buf);
-    } else {
-        sink->write_audio(buf);
+void DSP::prepare(int new_sample_rate, int new_max_frames) {
+    std::lock_guard lock(control_lock);
+
+    // Effects bake the sample rate into their filters at creation time
+    if (new_sample_rate != sample_rate && !effect_chain.empty()) {
+        throw std::invalid_argument("DSP: can't change sample rate from " + std::to_string(sample_rate) +
+                                    " to " + std::to_string(new_sample_rate) + " with effects attached");
+    }
+
+    sample_rate = new_sample_rate;
+    prepare_chain(new_max_frames);
+}
+
+void DSP::prepare(int new_max_frames) {
+    std::lock_guard lock(control_lock);
+    prepare_chain(new_max_frames);
+}
+
+void DSP::prepare_chain(int new_max_frames) {
+    AudioSink::prepare(new_max_frames);
+    bypass_fade.prepare(new_max_frames);
+    max_frames = new_max_frames;
+
+    for (auto effect : effect_chain) {
+        effect->prepare(max_frames);
+    }
+    if (sink != nullptr) {
+        sink->prepare(max_frames);
+    }
+}
+
+void DSP::write_audio(AudioBuffer& buf) {
+    // No-op unless built with FXDSP_ALLOC_GUARD
+    alloc_guard::Scope guard;
+
+    // Enter: any chain retired after this point stays alive until we exit
+    audio_epoch.fetch_add(1);
+    auto chain = current_chain.load();
+
+    // Routing is only ever changed here, so effects never see a half-updated chain
+    if (chain->generation != applied_generation) {
+        apply_chain(*chain);
+    }
+
+    if (chain->head != nullptr) {
+        chain->head->write_audio(buf);
+    }
+
+    // Drop the toggled effect (or the fade) from the chain once it's done, unless the control
+    // thread has already published something newer
+    if (chain->after_fade && bypass_fade.is_done()) {
+        current_chain.compare_exchange_strong(chain, chain->after_fade.get());
+    }
+
+    // Exit: quiescent point
+    audio_epoch.fetch_add(1);
+}
+
+void DSP::apply_chain(const ChainSnapshot& chain) {
+    for (auto effect : chain.reset_effects) {
+        effect->reset();
+    }
+
+    for (size_t i = 0; i < chain.effects.size(); i++) {
+        if (chain.next_sinks[i] != nullptr) {
+            chain.effects[i]->set_next_sink(*chain.next_sinks[i]);
+        }
     }
+
+    if (chain.fade_effect != nullptr) {
+        bypass_fade.start(chain.fade_effect, chain.fade_next_sink, chain.fade_in, chain.fade_frames);
+    }
+
+    applied_generation = chain.generation;
 }
 
 void DSP::add_effect(Effect* effect) {
+    std::lock_guard lock(control_lock);
+    if (max_frames > 0) {
+        effect->prepare(max_frames);
+    }
+
+    effect->attached_dsp = this;
     effect_chain.push_back(effect);
     update_sinks();
 }
 
 void DSP::remove_effect(Effect* effect) {
+    std::lock_guard lock(control_lock);
+    effect->attached_dsp = nullptr;
     effect_chain.erase(std::remove(effect_chain.begin(), effect_chain.end(), effect),
                        effect_chain.end());
     update_sinks();
+    synchronize();
 }
 
 const std::vector<Effect*>& DSP::get_effects() {
@@ -51,23 +172,269 @@ const std::vector<Effect*>& DSP::get_effects() {
 }
 
 void DSP::clear_effects() {
+    std::lock_guard lock(control_lock);
+    for (auto effect : effect_chain) {
+        effect->attached_dsp = nullptr;
+    }
     effect_chain.clear();
+    update_sinks();
+    synchronize();
 }
 
 void DSP::set_sink(AudioSink* new_sink) {
+    std::lock_guard lock(control_lock);
     sink = new_sink;
+    if (sink != nullptr && max_frames > 0) {
+        sink->prepare(max_frames);
+    }
+
+    update_sinks();
+    synchronize();
+}
+
+void DSP::set_bypass_fade(int frames) {
+    std::lock_guard lock(control_lock);
+    bypass_fade_frames = frames;
+}
+
+void DSP::set_iir_form(IirForm form) {
+    std::lock_guard lock(control_lock);
+    iir_form = form;
     update_sinks();
 }
 
-void DSP::update_sinks() {
-    for (auto i = 0; i < effect_chain.size(); i++) {
-        auto& effect = effect_chain[i];
+std::vector<IirForm> DSP::get_iir_forms() {
+    std::lock_guard lock(control_lock);
 
-        if (effect->enabled) {
-            auto& next_sink = (i == effect_chain.size() - 1) ? *sink : *effect_chain[i+1];
-            effect->set_next_sink(next_sink);
+    std::vector<IirForm> forms;
+    for (auto& stage : published_chain->fused_stages) {
+        forms.push_back(stage->get_form());
+    }
+
+    return forms;
+}
+
+void DSP::effect_changed(Effect* effect, bool toggled) {
+    std::lock_guard lock(control_lock);
+    update_sinks(toggled ? effect : nullptr);
+}
+
+void DSP::reset() {
+    // Same as write_audio: the control thread may be editing effect_chain, so only touch the
+    // published chain, which stays alive until we exit
+    audio_epoch.fetch_add(1);
+    auto chain = current_chain.load();
+
+    for (auto effect : chain->effects) {
+        effect->reset();
+    }
+    for (auto& stage : chain->fused_stages) {
+        stage->reset();
+    }
+
+    audio_epoch.fetch_add(1);
+}
+
+// Compile enabled effects into a snapshot. fade_effect is included even if disabled, and wired
+// through bypass_fade. Fused stages share state with matching stages in prev_chain.
+std::unique_ptr<DSP::ChainSnapshot> DSP::compile_chain(Effect* fade_effect, const ChainSnapshot* prev_chain) {
+    auto chain = std::make_unique<ChainSnapshot>();
+    chain->generation = next_generation++;
+    chain->fade_effect = nullptr;
+    chain->fade_next_sink = nullptr;
+    chain->fade_in = false;
+    chain->fade_frames = 0;
+
+    // Dispatch order: either a directly-called effect or a fused stage
+    std::vector<AudioSink*> nodes;
+    std::vector<Effect*> node_effects;
+    std::vector<FusedIirStage*> node_stages;
+
+    // Pending run of fusable effects
+    Effect* run_start = nullptr;
+    float run_gain = 1.0f;
+    std::vector<BiquadCoeffs> run_sections;
+    std::vector<IirSectionSource> run_sources;
+
+    // The fading effect's stage is kept even if it passes everything through, so it can be mixed
+    auto end_run = [&](bool keep_identity = false) {
+        if (run_start == nullptr) {
+            return;
+        }
+
+        // Drop pass-through sections, and the whole stage if nothing is left
+        size_t kept = 0;
+        for (size_t i = 0; i < run_sections.size(); i++) {
+            if (!run_sections[i].is_identity()) {
+                run_sections[kept] = run_sections[i];
+                run_sources[kept] = run_sources[i];
+                kept++;
+            }
+        }
+        run_sections.resize(kept);
+        run_sources.resize(kept);
+        if (keep_identity || !run_sections.empty() || std::abs(run_gain - 1.0f) > 1e-6f) {
+            // The stage this replaces: the one with the most sections in common, so effects keep
+            // their state when a fade splits them from their run or merges them back. Failing that,
+            // the one starting at the same effect, for its form.
+            const FusedIirStage* prev_stage = nullptr;
+            if (prev_chain != nullptr) {
+                size_t most_shared = 0;
+                for (auto& candidate : prev_chain->fused_stages) {
+                    auto shared = static_cast<size_t>(std::count_if(run_sources.begin(), run_sources.end(), [&](auto& source) {
+                        return std::find(candidate->sources.begin(), candidate->sources.end(), source) != candidate->sources.end();
+                    }));
+                    if (shared > most_shared || (most_shared == 0 && candidate->first_effect == run_start)) {
+                        prev_stage = candidate.get();
+                        most_shared = shared;
+                    }
+                }
+            }
+
+            auto stage = std::make_unique<FusedIirStage>(channels, run_gain, std::move(run_sections), iir_form,
+                                                         prev_stage);
+            stage->first_effect = run_start;
+            stage->sources = std::move(run_sources);
+            if (prev_stage != nullptr) {
+                stage->inherit_state(*prev_stage);
+            }
+
+            nodes.push_back(stage.get());
+            node_effects.push_back(nullptr);
+            node_stages.push_back(stage.get());
+            chain->fused_stages.push_back(std::move(stage));
+        }
+
+        run_start = nullptr;
+        run_gain = 1.0f;
+        run_sections.clear();
+        run_sources.clear();
+    };
+
+    // The fading effect runs on its own so its input and output can be mixed. Fusable ones still run
+    // as a stage, from a copy of their filters: the control thread can edit an effect's own filters
+    // at any time, so the audio thread never runs them.
+    AudioSink* fade_node = nullptr;
+    for (auto effect : effect_chain) {
+        if (!effect->enabled && effect != fade_effect) {
+            continue;
+        }
+
+        float gain = 1.0f;
+        std::vector<BiquadCoeffs> sections;
+        if (effect->get_iir_stages(gain, sections)) {
+            if (effect == fade_effect) {
+                end_run();
+            }
+            if (run_start == nullptr) {
+                run_start = effect;
+            }
+            run_gain *= gain;
+            run_sections.insert(run_sections.end(), sections.begin(), sections.end());
+            for (size_t i = 0; i < sections.size(); i++) {
+                run_sources.push_back({ effect, static_cast<int>(i) });
+            }
+            if (effect == fade_effect) {
+                end_run(true);
+                fade_node = nodes.back();
+            }
+            continue;
+        }
+
+        end_run();
+        nodes.push_back(effect);
+        node_effects.push_back(effect);
+        node_stages.push_back(nullptr);
+        if (effect == fade_effect) {
+            fade_node = effect;
         }
     }
+    end_run();
+
+    chain->head = nodes.empty() ? sink : nodes[0];
+    std::vector<AudioSink*> next_sinks(nodes.size());
+    for (size_t i = 0; i < nodes.size(); i++) {
+        next_sinks[i] = (i == nodes.size() - 1) ? sink : nodes[i+1];
+    }
+
+    if (fade_node != nullptr) {
+        auto idx = std::find(nodes.begin(), nodes.end(), fade_node) - nodes.begin();
+        chain->fade_effect = fade_node;
+        chain->fade_next_sink = next_sinks[idx];
+        chain->fade_in = fade_effect->enabled;
+        chain->fade_frames = bypass_fade_frames;
+
+        // previous -> tap -> effect -> mix -> next
+        next_sinks[idx] = &bypass_fade.mix;
+        if (idx == 0) {
+            chain->head = &bypass_fade.tap;
+        } else {
+            next_sinks[idx - 1] = &bypass_fade.tap;
+        }
+    }
+
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (node_effects[i] != nullptr) {
+            chain->effects.push_back(node_effects[i]);
+            chain->next_sinks.push_back(next_sinks[i]);
+        } else if (next_sinks[i] != nullptr) {
+            node_stages[i]->set_next_sink(*next_sinks[i]);
+        }
+    }
+
+    return chain;
+}
+
+// Build and publish a new snapshot. The audio thread rewires effects when it picks it up.
+void DSP::update_sinks(Effect* toggled_effect) {
+    // Whatever the audio thread is running, for carrying over fused filter state
+    auto prev_chain = current_chain.load();
+    std::unique_ptr<ChainSnapshot> chain;
+
+    // Crossfade if enabled and possible, then switch to the normal chain
+    if (toggled_effect != nullptr && bypass_fade_frames > 0 && sink != nullptr) {
+        chain = compile_chain(toggled_effect, prev_chain);
+        chain->after_fade = compile_chain(nullptr, chain.get());
+    } else {
+        chain = compile_chain(nullptr, prev_chain);
+    }
+
+    // Fused effects start from their stage's state instead, and resetting their own here would
+    // race with the control thread's edits
+    if (toggled_effect != nullptr && toggled_effect->enabled &&
+            std::find(chain->effects.begin(), chain->effects.end(), toggled_effect) != chain->effects.end()) {
+        chain->reset_effects.push_back(toggled_effect);
+    }
+
+    current_chain.store(chain.get());
+
+    // The audio thread may still be using the old snapshot
+    if (published_chain) {
+        retired_chains.push_back({ std::move(published_chain), audio_epoch.load() });
+    }
+    published_chain = std::move(chain);
+    collect_retired();
+}
+
+// Wait until the audio thread is no longer using any retired snapshot
+void DSP::synchronize() {
+    auto epoch = audio_epoch.load();
+    if (epoch % 2 != 0) {
+        while (audio_epoch.load() == epoch) {
+            std::this_thread::yield();
+        }
+    }
+
+    collect_retired();
+}
+
+void DSP::collect_retired() {
+    auto epoch = audio_epoch.load();
+
+    // Safe if the audio thread was idle at retirement, or has exited write_audio since then
+    std::erase_if(retired_chains, [epoch](const RetiredChain& retired) {
+        return retired.epoch % 2 == 0 || retired.epoch != epoch;
+    });
 }
 
 }
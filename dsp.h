@@ -1,8 +1,13 @@
 #pragma once
 
-#include <vector>
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <mutex>
+#include <vector>
 
+#include "bypass_fade.h"
+#include "fused_iir.h"
 #include "pcm.h"
 #include "types.h"
 #include "sink.h"
@@ -13,30 +18,107 @@ class DSP;
 
 // Lifecycle managed by Java
 class Effect : public AudioSink {
+private:
+    bool enabled = true;
+    // DSP whose chain this is in, if any
+    DSP* attached_dsp = nullptr;
+
+    friend class DSP;
+
 protected:
     // Initialized at attach time
     AudioSink* sink;
 
+    // Called on the control thread after the enabled state changes, before the chain is updated
+    virtual void enabled_changed();
+    // Call after changing anything reported by get_iir_stages, so the chain is recompiled
+    void parameters_changed();
+
 public:
     Effect(const DSP& dsp);
     virtual ~Effect() {}
 
-    bool enabled = true;
+    // Disabled effects are skipped by the chain entirely. When re-enabled, they're reset on the
+    // audio thread before processing.
+    void set_enabled(bool enabled);
+    bool is_enabled() const;
 
     // Virtual so effects can delegate to encapsulated effects
     virtual void set_next_sink(AudioSink& next_sink);
 
     virtual void reset();
     virtual void finalize();
+
+    // For chain fusion: describe this effect as a gain followed by a biquad cascade, if possible
+    // Adjacent effects that support this are compiled into one FusedIirStage, and their own
+    // write_audio is never called.
+    virtual bool get_iir_stages(float& gain, std::vector<BiquadCoeffs>& sections) const;
 };
 
 class DSP : public AudioSink {
 private:
+    // Immutable routing published to the audio thread, with disabled effects compiled out
+    struct ChainSnapshot {
+        // Never reused, unlike addresses
+        uint64_t generation;
+        // Receives input: first enabled effect or the sink
+        AudioSink* head;
+        // Enabled effects that aren't fused, and the sink each one writes to
+        std::vector<Effect*> effects;
+        std::vector<AudioSink*> next_sinks;
+        // Runs of gain/biquad effects, wired at compile time
+        std::vector<std::unique_ptr<FusedIirStage>> fused_stages;
+        // Reset when this is applied, for effects that were just enabled
+        std::vector<Effect*> reset_effects;
+
+        // Crossfade for a toggled effect, wired through bypass_fade: the effect, or the fused stage
+        // that runs a copy of its filters
+        AudioSink* fade_effect;
+        AudioSink* fade_next_sink;
+        bool fade_in;
+        int fade_frames;
+        // Switched to by the audio thread once the fade is done
+        std::unique_ptr<ChainSnapshot> after_fade;
+    };
+
+    struct RetiredChain {
+        std::unique_ptr<ChainSnapshot> chain;
+        // Audio epoch when it was replaced
+        uint64_t epoch;
+    };
+
+    // Control thread state, protected by control_lock
+    std::mutex control_lock;
     std::vector<Effect*> effect_chain;
-    std::vector<std::vector<float>> audio_buf;
     AudioSink* sink;
-
-    void update_sinks();
+    // 0 until prepared
+    int max_frames;
+    int bypass_fade_frames;
+    IirForm iir_form;
+    uint64_t next_generation;
+    std::unique_ptr<ChainSnapshot> published_chain;
+    std::vector<RetiredChain> retired_chains;
+
+    // Shared with the audio thread
+    std::atomic<const ChainSnapshot*> current_chain;
+    // Incremented on entry to and exit from write_audio: odd = processing
+    std::atomic<uint64_t> audio_epoch;
+
+    // Audio thread state
+    uint64_t applied_generation;
+    BypassFade bypass_fade;
+
+    void apply_chain(const ChainSnapshot& chain);
+
+    // Control thread helpers, called with control_lock held
+    void prepare_chain(int max_frames);
+    std::unique_ptr<ChainSnapshot> compile_chain(Effect* fade_effect, const ChainSnapshot* prev_chain);
+    void update_sinks(Effect* toggled_effect = nullptr);
+    void synchronize();
+    void collect_retired();
+
+    void effect_changed(Effect* effect, bool toggled);
+    friend class Effect;
 
 public:
     DSP(AudioFormat audio_format, int sample_rate, int channels, AudioSink* sink);
@@ -44,15 +126,38 @@ public:
     int sample_rate;
     int channels;
 
-    // F32 [channel samples]
-    void write_audio(std::vector<std::vector<float>>& buf) override;
+    // Pre-size buffers in the whole chain, including the sink
+    // Effects and sinks added later are prepared automatically.
+    void prepare(int sample_rate, int max_frames);
+    void prepare(int max_frames) override;
 
+    // F32 [channel samples]
+    // Lock-free and doesn't allocate if all blocks fit in the size passed to prepare()
+    // Only one thread may process audio at a time.
+    void write_audio(AudioBuffer& buf) override;
+    using AudioSink::write_audio;
+
+    // Chain changes are published to the audio thread atomically and never block it.
+    // Removal functions wait until the audio thread is done with the old chain, so removed effects
+    // and sinks can be freed as soon as they return.
     void add_effect(Effect* effect);
     void remove_effect(Effect* effect);
     const std::vector<Effect*>& get_effects();
     void clear_effects();
 
     void set_sink(AudioSink* new_sink);
+
+    // Reset enabled effects and fused stages. Must be called from the audio thread. Disabled effects
+    // are reset when they're enabled again.
+    void reset();
+
+    // Crossfade length when an effect is enabled or disabled. 0 = switch at the next block (default)
+    void set_bypass_fade(int frames);
+
+    // Evaluation form for fused gain/biquad stages. Default: IIR_FORM_AUTO
+    void set_iir_form(IirForm form);
+    // Form in use by each fused stage in the current chain, in chain order
+    std::vector<IirForm> get_iir_forms();
 };
 
 }
@@ -1,174 +1,702 @@
+#include <algorithm>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+
 #include "convolver.h"
+#include "../filters/kernel_cache.h"
+#include "../filters/kernel_file.h"
+#include "../filters/non_uniform_convolver.h"
+#include "../filters/single_block_convolver.h"
+#include "../filters/uniform_convolver.h"
 #include "../util/fft.h"
-#include "../util/math_ext.h"
-
-#include "../external/kissfft/kiss_fftr.h"
-#include "../external/kissfft/_kiss_fft_guts.h"
+#include "../util/fft_tuner.h"
+#include "../wave.h"
 
 namespace fxdsp {
 
-ConvolverEffect::ConvolverEffect(const DSP& dsp, int block_size) :
+ConvolverKernel::ConvolverKernel(int channels, int block_size, int fft_size, ConvolverMode mode,
+                                 const std::vector<std::vector<float>>& filters, bool crossfade) :
+        max_filter_frames(0),
+        crossfade(crossfade),
+        next_retired(nullptr) {
+    auto paths = make_paths(channels, choose_routing(channels, static_cast<int>(filters.size())));
+    std::vector<std::span<const float>> filter_spans(filters.begin(), filters.end());
+    for (auto& filter : filters) {
+        max_filter_frames = std::max(max_filter_frames, static_cast<int>(filter.size()));
+    }
+
+    if (mode == CONVOLVER_SINGLE_BLOCK) {
+        engine = std::make_unique<SingleBlockConvolver>(channels, block_size, filter_spans, paths, fft_size);
+    } else if (mode == CONVOLVER_UNIFORM_PARTITIONED) {
+        engine = std::make_unique<UniformConvolver>(channels, block_size, filter_spans, paths, fft_size);
+    } else {
+        engine = std::make_unique<NonUniformConvolver>(channels, block_size, filter_spans, paths, fft_size);
+    }
+}
+
+ConvolverKernel::ConvolverKernel(int channels, int block_size, ConvolverMode mode, PreparedFilters filters,
+                                 bool crossfade) :
+        max_filter_frames(filters.max_frames()),
+        crossfade(crossfade),
+        next_retired(nullptr) {
+    auto paths = make_paths(channels, choose_routing(channels, filters.num_filters()));
+    if (mode == CONVOLVER_SINGLE_BLOCK) {
+        engine = std::make_unique<SingleBlockConvolver>(channels, block_size, std::move(filters), paths);
+    } else {
+        engine = std::make_unique<UniformConvolver>(channels, block_size, std::move(filters), paths);
+    }
+}
+
+ConvolverRouting ConvolverKernel::choose_routing(int channels, int num_filters) {
+    if (num_filters == 1) {
+        return CONVOLVER_ROUTING_SHARED;
+    } else if (num_filters == channels) {
+        return CONVOLVER_ROUTING_PER_CHANNEL;
+    } else if (num_filters == 4 && channels == 2) {
+        return CONVOLVER_ROUTING_TRUE_STEREO;
+    } else {
+        throw std::invalid_argument("Filter count doesn't match channel count");
+    }
+}
+
+std::vector<ConvolutionPath> ConvolverKernel::make_paths(int channels, ConvolverRouting routing) {
+    std::vector<ConvolutionPath> paths;
+    if (routing == CONVOLVER_ROUTING_TRUE_STEREO) {
+        // LL, LR, RL, RR: input-major
+        for (int in = 0; in < 2; in++) {
+            for (int out = 0; out < 2; out++) {
+                paths.push_back({ in, out, in * 2 + out });
+            }
+        }
+    } else {
+        for (int ch = 0; ch < channels; ch++) {
+            paths.push_back({ ch, ch, routing == CONVOLVER_ROUTING_SHARED ? 0 : ch });
+        }
+    }
+
+    return paths;
+}
+
+ConvolverEffect::ConvolverEffect(const DSP& dsp, int block_size, ConvolverMode mode, int fft_size) :
         Effect(dsp),
+        mode(mode),
         block_size(block_size),
-        conv_size(0),
-        fft_size(0),
-        fft_bins(0),
+        fft_size(fft_size),
         channels(dsp.channels),
-        channel_spans(channels),
         block_pos(0),
-        fft_cfg(nullptr) {
-    channel_bufs.resize(dsp.channels);
+        ring_read(0),
+        ring_write(0),
+        ring_frames(0),
+        warmup_max_frames(dsp.sample_rate * WARMUP_MAX_MS / 1000),
+        warmup_blocks(0),
+        fade_frames(std::max(dsp.sample_rate * CROSSFADE_MS / 1000, 1)),
+        fade_pos(0),
+        pending_kernel(nullptr),
+        retired_kernels(nullptr),
+        started(false),
+        prepare_requested(false),
+        stopping(false),
+        routing(CONVOLVER_ROUTING_SHARED),
+        filters_time_stale(false) {
+    channel_bufs.allocate(dsp.channels, block_size);
+    fade_buf.allocate(dsp.channels, block_size);
+    final_bufs.allocate(dsp.channels, 0);
+    // Enough for input in chunks of up to one block, until prepared
+    out_ring.allocate(dsp.channels, block_size * 2);
+    reset_ring();
+}
+
+ConvolverEffect::~ConvolverEffect() {
+    {
+        std::lock_guard<std::mutex> lock(prepare_lock);
+        stopping = true;
+    }
+    prepare_cond.notify_one();
+    if (preparer.joinable()) {
+        preparer.join();
+    }
 
-    for (auto& channel : channel_bufs) {
-        channel.resize(block_size);
+    delete pending_kernel.exchange(nullptr);
+    free_retired_kernels();
+}
+
+void ConvolverEffect::prepare(int max_frames) {
+    Effect::prepare(max_frames);
+
+    // Latency plus the largest input, in whole blocks so processed blocks never wrap
+    auto ring_blocks = 1 + std::max((max_frames + block_size - 1) / block_size, 1);
+    if (ring_blocks * block_size > out_ring.capacity()) {
+        out_ring.allocate(channels, ring_blocks * block_size);
+        reset_ring();
     }
 }
 
-void ConvolverEffect::write_audio(std::vector<std::vector<float>>& buf) {
-    // Convert to spans
-    for (int i = 0; i < buf.size(); i++) {
-        channel_spans[i] = buf[i];
+void ConvolverEffect::write_audio(AudioBuffer& buf) {
+    if (!started.load(std::memory_order_relaxed)) {
+        started.store(true, std::memory_order_release);
     }
 
-    while (!channel_spans[0].empty()) {
-        // Fill block up to block size
-        auto block_remaining = block_size - block_pos;
-        auto in_remaining = static_cast<int>(channel_spans[0].size());
-        auto remaining = std::min(in_remaining, block_remaining);
+    // Output for each chunk only depends on input before it, so it can replace the input in place.
+    // Input bigger than prepared for is split to fit the ring.
+    auto max_chunk = out_ring.capacity() - block_size;
+    for (auto pos = 0; pos < buf.frames(); pos += max_chunk) {
+        auto count = std::min(max_chunk, buf.frames() - pos);
+        consume_input(buf, pos, count);
+        read_output(buf, pos, count);
+    }
 
-        // Process each channel
-        for (int ch = 0; ch < channel_bufs.size(); ch++) {
-            auto& block_buf = channel_bufs[ch];
-            auto& in_span = channel_spans[ch];
+    sink->write_audio(buf);
+}
 
-            // Copy to block
-            std::copy(in_span.begin(), in_span.begin() + remaining, block_buf.begin() + block_pos);
+void ConvolverEffect::consume_input(AudioBuffer& buf, int offset, int count) {
+    while (count > 0) {
+        if (block_pos == 0 && count >= block_size) {
+            // Whole block: straight from the caller's buffer
+            auto in = buf.view(offset, block_size);
+            process_block(in);
+            offset += block_size;
+            count -= block_size;
+            continue;
         }
 
-        // Update state
-        for (int ch = 0; ch < buf.size(); ch++) {
-            channel_spans[ch] = channel_spans[ch].subspan(remaining);
+        // Stage a partial block
+        auto staged = std::min(count, block_size - block_pos);
+        for (int ch = 0; ch < channels; ch++) {
+            std::copy_n(buf.channel(ch) + offset, staged, channel_bufs.channel(ch) + block_pos);
         }
-        block_pos += remaining;
+        offset += staged;
+        count -= staged;
+        block_pos += staged;
 
-        // Process full FFT buffer
         if (block_pos == block_size) {
-            for (auto& ch : channel_bufs) {
-                process_fft_chunk(ch);
-            }
-
-            sink->write_audio(channel_bufs);
+            process_block(channel_bufs);
             block_pos = 0;
         }
     }
 }
 
+void ConvolverEffect::read_output(AudioBuffer& buf, int offset, int count) {
+    // Up to the end of the ring, then from the start
+    auto first = std::min(count, out_ring.capacity() - ring_read);
+    for (int ch = 0; ch < channels; ch++) {
+        auto ring = out_ring.channel(ch);
+        auto out = buf.channel(ch) + offset;
+        std::copy_n(ring + ring_read, first, out);
+        std::copy_n(ring, count - first, out + first);
+    }
+
+    ring_read = (ring_read + count) % out_ring.capacity();
+    ring_frames -= count;
+}
+
+void ConvolverEffect::reset_ring() {
+    // Latency: one block of silence
+    out_ring.clear();
+    ring_read = 0;
+    ring_write = block_size;
+    ring_frames = block_size;
+}
+
 void ConvolverEffect::reset() {
     Effect::reset();
 
     // Keep filter, just reset input state
     block_pos = 0;
-    channel_spans.clear();
-    channel_spans.resize(channels);
-    for (auto& buf : channel_bufs) {
-        std::fill(buf.begin(), buf.end(), 0.0f);
+    channel_bufs.clear();
+    reset_ring();
+    if (next_kernel) {
+        finish_fade();
+    }
+    if (kernel) {
+        kernel->reset();
     }
-    std::fill(last_overlap.begin(), last_overlap.end(), 0.0f);
 }
 
 void ConvolverEffect::finalize() {
     Effect::finalize();
 
-    // Finish last zero-padded block
-    std::vector<std::vector<float>> final_bufs(channels);
+    // Flush the latency, the staged input, and the tail: max tail length = M; the rest is undefined
+    take_pending_kernel();
+    auto tail_size = 0;
+    for (auto k : { kernel.get(), next_kernel.get() }) {
+        tail_size = std::max(tail_size, k ? k->max_filter_size() : 0);
+    }
+    auto final_size = block_size + tail_size;
+    final_bufs.set_frames(final_size);
     for (int ch = 0; ch < channels; ch++) {
-        auto& buf = channel_bufs[ch];
+        auto buf = channel_bufs[ch];
         std::fill(buf.begin() + block_pos, buf.end(), 0.0f);
-        process_fft_chunk(buf);
+    }
+
+    auto pos = 0;
+    while (true) {
+        auto count = std::min(ring_frames, final_size - pos);
+        read_output(final_bufs, pos, count);
+        pos += count;
+        if (pos == final_size) {
+            break;
+        }
 
-        // Max tail length = M; the rest is undefined
-        // TODO: span
-        final_bufs[ch] = std::vector<float>(buf.begin(), buf.begin() + block_pos + static_cast<int>(fir_filter_time.size()));
+        // Run zero-padded blocks until the tail is out
+        process_block(channel_bufs);
+        channel_bufs.clear();
     }
+
+    block_pos = 0;
     sink->write_audio(final_bufs);
 }
 
-void ConvolverEffect::process_fft_chunk(std::vector<float>& block_buf) {
-    // Copy and zero-pad to avoid circular convolution and improve performance
-    // (fft_time_buf has static size of fft_size)
-    std::copy(block_buf.begin(), block_buf.end(), fft_time_buf.begin());
-    std::fill(fft_time_buf.begin() + block_buf.size(), fft_time_buf.end(), 0.0f);
+void ConvolverEffect::process_block(const AudioBuffer& in) {
+    // Kernels only change between blocks, and not while fading
+    if (!next_kernel) {
+        take_pending_kernel();
+    }
+
+    // Output goes to the ring in whole blocks, which never wrap
+    auto out = out_ring.view(ring_write, block_size);
+    ring_write = (ring_write + block_size) % out_ring.capacity();
+    ring_frames += block_size;
+
+    if (!kernel) {
+        out.clear();
+        return;
+    }
+
+    kernel->process(in, out);
+    if (!next_kernel) {
+        return;
+    }
+
+    // The new kernel starts with no history, so it only joins the output once that's filled
+    next_kernel->process(in, fade_buf);
+    if (warmup_blocks > 0) {
+        warmup_blocks--;
+        return;
+    }
+
+    auto step = 1.0f / static_cast<float>(fade_frames);
+    for (int ch = 0; ch < channels; ch++) {
+        auto old_out = out.channel(ch);
+        auto new_out = fade_buf.channel(ch);
+
+        for (int i = 0; i < block_size; i++) {
+            // Linear gain, clamped at the end of the fade
+            auto new_gain = static_cast<float>(std::min(fade_pos + i, fade_frames)) * step;
+            old_out[i] += (new_out[i] - old_out[i]) * new_gain;
+        }
+    }
+
+    fade_pos += block_size;
+    if (fade_pos >= fade_frames) {
+        finish_fade();
+    }
+}
+
+void ConvolverEffect::take_pending_kernel() {
+    auto new_kernel = pending_kernel.exchange(nullptr, std::memory_order_acq_rel);
+    if (new_kernel == nullptr) {
+        return;
+    }
 
-    // Forward FFT
-    kiss_fftr(fft_cfg.get(), fft_time_buf.data(), fft_freq_buf.data());
+    if (kernel && new_kernel->crossfade) {
+        next_kernel.reset(new_kernel);
+        auto warmup_frames = std::min(new_kernel->max_filter_size(), warmup_max_frames);
+        warmup_blocks = (warmup_frames + block_size - 1) / block_size;
+        fade_pos = 0;
+    } else {
+        retire_kernel(kernel.release());
+        kernel.reset(new_kernel);
+    }
+}
+
+void ConvolverEffect::finish_fade() {
+    retire_kernel(kernel.release());
+    kernel = std::move(next_kernel);
+}
 
-    // Convolve by multiplying complex numbers
-    for (auto i = 0; i < fft_bins; i++) {
-        kiss_fft_cpx cpx;
-        // Multiply with filter FR
-        C_MUL(cpx, fft_freq_buf[i], fir_filter_freq[i]);
-        fft_freq_buf[i] = cpx;
+void ConvolverEffect::retire_kernel(ConvolverKernel* old_kernel) {
+    if (old_kernel == nullptr) {
+        return;
     }
 
-    // Inverse FFT
-    kiss_fftri(ifft_cfg.get(), fft_freq_buf.data(), fft_time_buf.data());
+    // Lock-free push: freeing it here could block (e.g. joining worker threads)
+    old_kernel->next_retired = retired_kernels.load(std::memory_order_relaxed);
+    while (!retired_kernels.compare_exchange_weak(old_kernel->next_retired, old_kernel,
+                                                  std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
 
-    // Add last overlapping region
-    for (auto i = 0; i < last_overlap.size(); i++) {
-        fft_time_buf[i] += last_overlap[i];
+void ConvolverEffect::publish_kernel(ConvolverKernel* new_kernel) {
+    // Replaces a kernel that the audio thread hasn't taken yet
+    delete pending_kernel.exchange(new_kernel, std::memory_order_acq_rel);
+}
+
+void ConvolverEffect::free_retired_kernels() {
+    auto old_kernel = retired_kernels.exchange(nullptr, std::memory_order_acquire);
+    while (old_kernel != nullptr) {
+        auto next = old_kernel->next_retired;
+        delete old_kernel;
+        old_kernel = next;
     }
+}
 
-    // Save new overlap region
-    auto tail_start = fft_time_buf.begin() + block_size;
-    std::copy(tail_start, tail_start + static_cast<int>(last_overlap.size()), last_overlap.begin());
+void ConvolverEffect::prepare_loop() {
+    while (true) {
+        std::vector<std::vector<float>> filters;
+        std::optional<PreparedFilters> prepared;
+        {
+            std::unique_lock<std::mutex> lock(prepare_lock);
+            prepare_cond.wait(lock, [this] { return prepare_requested || stopping; });
+            if (stopping) {
+                return;
+            }
+
+            filters = std::move(requested_filters);
+            prepared = std::move(requested_prepared);
+            prepare_requested = false;
+        }
 
-    // Write non-ringing portion back to block buffer (not yet written to sink)
-    std::copy(fft_time_buf.begin(), fft_time_buf.begin() + block_size, block_buf.begin());
+        if (prepared) {
+            publish_kernel(new ConvolverKernel(channels, block_size, mode, std::move(*prepared), true));
+        } else {
+            publish_kernel(new ConvolverKernel(channels, block_size, fft_size, mode, filters, true));
+        }
+        free_retired_kernels();
+    }
 }
 
 void ConvolverEffect::set_filter(const std::vector<float>& filter) {
-    // Min size = N+M to accommodate ringing tail from linear convolution and avoid circular
-    // convolution (tail wrapping around)
-    // N+M-1 still results in circular convolution sometimes! e.g. Kronecker delta (filter = [1.0])
-    auto tail_size = static_cast<int>(filter.size());
-    auto overlap_size = block_size;
-    conv_size = block_size + tail_size;
+    set_filters({ filter });
+}
+
+void ConvolverEffect::set_filters(const std::vector<std::vector<float>>& filters) {
+    // Validate here, so errors reach the caller
+    routing = ConvolverKernel::choose_routing(channels, static_cast<int>(filters.size()));
+
+    // Copy and save *original, unpadded* time domain filters
+    fir_filters_time = filters;
+    prepared_filters.reset();
+    filters_time_stale = false;
+
+    // Max output from finalize()
+    size_t max_filter_size = 0;
+    for (auto& filter : filters) {
+        max_filter_size = std::max(max_filter_size, filter.size());
+    }
+    final_bufs.reserve(block_size + static_cast<int>(max_filter_size));
+
+    free_retired_kernels();
+    if (!started.load(std::memory_order_acquire)) {
+        publish_kernel(new ConvolverKernel(channels, block_size, fft_size, mode, filters, false));
+        return;
+    }
+
+    request_kernel(filters, {});
+}
+
+void ConvolverEffect::set_filter_file(const std::string& path) {
+    // Only single-block kernels can be adopted as spectra
+    if (mode != CONVOLVER_SINGLE_BLOCK) {
+        set_filters(load_wave_file_float(path));
+        return;
+    }
+
+    // Size and modification time stand in for the contents, so hits don't need to read the file
+    KernelKey key("ir-wav", IR_CACHE_VERSION);
+    key.add(std::filesystem::absolute(path).string());
+    key.add(static_cast<int64_t>(std::filesystem::file_size(path)));
+    key.add(static_cast<int64_t>(std::filesystem::last_write_time(path).time_since_epoch().count()));
+    key.add(block_size).add(fft_size);
+
+    auto kernels = kernel_cache::find(key);
+    if (kernels == nullptr) {
+        auto irs = load_wave_file_float(path);
+        auto max_filter_size = 0;
+        for (auto& ir : irs) {
+            max_filter_size = std::max(max_filter_size, static_cast<int>(ir.size()));
+        }
+
+        KernelSet filters;
+        auto filter_fft_size = get_filter_fft_size(max_filter_size);
+        for (auto& ir : irs) {
+            filters.push_back(SingleBlockConvolver::transform_filter(ir, filter_fft_size));
+        }
+        kernels = kernel_cache::insert(key, std::move(filters));
+    }
+
+    set_filter_spectra(*kernels);
+}
 
-    // Min size to run FFT quickly
-    fft_size = next_fft_size(conv_size);
-    fft_bins = fft_size / 2 + 1;
-    fft_time_buf.resize(fft_size);
-    fft_freq_buf.resize(fft_size);
+void ConvolverEffect::set_filter_spectrum(FilterSpectrum filter) {
+    std::vector<FilterSpectrum> filters;
+    filters.push_back(std::move(filter));
+    set_filter_spectra(std::move(filters));
+}
 
-    // Buffer for last overlapping region, zero-initialized
-    last_overlap.clear();
-    last_overlap.resize(overlap_size);
+void ConvolverEffect::set_filter_spectra(std::vector<FilterSpectrum> filters) {
+    if (mode != CONVOLVER_SINGLE_BLOCK) {
+        throw std::invalid_argument("Filter spectra need the single-block convolver");
+    }
 
-    // Copy and save *original, unpadded* time domain filter (kept for block convolution)
-    fir_filter_time = filter;
+    set_prepared_filters(SingleBlockConvolver::from_spectra(std::move(filters)));
+}
 
-    // Init real-only FFT
-    fft_cfg = std::unique_ptr<struct kiss_fftr_state>(kiss_fftr_alloc(fft_size, false, nullptr, nullptr));
-    ifft_cfg = std::unique_ptr<struct kiss_fftr_state>(kiss_fftr_alloc(fft_size, true, nullptr, nullptr));
+void ConvolverEffect::set_prepared_filters(PreparedFilters filters) {
+    // Validate here, so errors reach the caller
+    auto new_routing = ConvolverKernel::choose_routing(channels, filters.num_filters());
+    if (mode == CONVOLVER_SINGLE_BLOCK) {
+        SingleBlockConvolver::check_prepared(block_size, filters);
+    } else if (mode == CONVOLVER_UNIFORM_PARTITIONED) {
+        UniformConvolver::check_prepared(block_size, filters);
+    } else {
+        throw std::invalid_argument("Prepared filters need the single-block or uniform partitioned convolver");
+    }
+    routing = new_routing;
 
-    // Copy and zero-pad
-    std::copy(fir_filter_time.begin(), fir_filter_time.end(), fft_time_buf.begin());
-    std::fill(fft_time_buf.begin() + tail_size, fft_time_buf.end(), 0.0f);
+    // Taps are only needed if someone asks for them. Copies share the bins.
+    prepared_filters = filters;
+    fir_filters_time.clear();
+    filters_time_stale = true;
 
-    // Compute complex FFT and save as frequency domain filter
-    fir_filter_freq.clear();
-    fir_filter_freq.resize(fft_size);
-    kiss_fftr(fft_cfg.get(), fft_time_buf.data(), fir_filter_freq.data());
+    // Max output from finalize()
+    final_bufs.reserve(block_size + filters.max_frames());
 
-    // Pre-multiply IFFT amplitude scale factor into the filter
-    for (auto& cpx : fir_filter_freq) {
-        cpx.r /= static_cast<float>(fft_size);
-        cpx.i /= static_cast<float>(fft_size);
+    free_retired_kernels();
+    if (!started.load(std::memory_order_acquire)) {
+        publish_kernel(new ConvolverKernel(channels, block_size, mode, std::move(filters), false));
+        return;
     }
+
+    request_kernel({}, std::move(filters));
+}
+
+void ConvolverEffect::set_kernel_file(const std::string& path) {
+    set_prepared_filters(kernel_file::load(path));
+}
+
+void ConvolverEffect::request_kernel(std::vector<std::vector<float>> filters,
+                                     std::optional<PreparedFilters> prepared) {
+    {
+        std::lock_guard<std::mutex> lock(prepare_lock);
+        requested_filters = std::move(filters);
+        requested_prepared = std::move(prepared);
+        prepare_requested = true;
+        if (!preparer.joinable()) {
+            preparer = std::thread(&ConvolverEffect::prepare_loop, this);
+        }
+    }
+    prepare_cond.notify_one();
+}
+
+int ConvolverEffect::get_filter_fft_size(int filter_frames) const {
+    return SingleBlockConvolver::fft_size_for(block_size, filter_frames, fft_size);
 }
 
 const std::vector<float>& ConvolverEffect::get_filter() {
-    return fir_filter_time;
+    return get_filters()[0];
+}
+
+const std::vector<std::vector<float>>& ConvolverEffect::get_filters() {
+    if (filters_time_stale) {
+        fir_filters_time = prepared_filters->to_taps();
+        filters_time_stale = false;
+    }
+
+    return fir_filters_time;
+}
+
+PreparedFilters ConvolverEffect::prepare_filters(ConvolverMode mode, int block_size, int fft_size,
+                                                 const std::vector<std::vector<float>>& filters) {
+    std::vector<std::span<const float>> filter_spans(filters.begin(), filters.end());
+    if (mode == CONVOLVER_SINGLE_BLOCK) {
+        return SingleBlockConvolver::prepare_filters(block_size, filter_spans, fft_size);
+    } else if (mode == CONVOLVER_UNIFORM_PARTITIONED) {
+        return UniformConvolver::prepare_filters(block_size, filter_spans, fft_size);
+    } else {
+        throw std::invalid_argument("Only single-block and uniform partitioned filters can be prepared");
+    }
+}
+
+// Near ties go to the largest block, which has the least per-block overhead that costs leave out
+static ConvolverSizes pick_sizes(const std::vector<ConvolverSizes>& candidates, double tie_ratio) {
+    auto cheapest = std::numeric_limits<double>::infinity();
+    for (auto& candidate : candidates) {
+        cheapest = std::min(cheapest, candidate.ns_per_frame);
+    }
+    ConvolverSizes best { 0, 0, std::numeric_limits<double>::infinity() };
+    for (auto& candidate : candidates) {
+        if (candidate.ns_per_frame <= cheapest * tie_ratio &&
+                (candidate.block_size > best.block_size ||
+                 (candidate.block_size == best.block_size && candidate.ns_per_frame < best.ns_per_frame))) {
+            best = candidate;
+        }
+    }
+
+    return best;
+}
+
+// Largest tail partition NonUniformConvolver uses for block_size, or the block if it has no tail
+static int non_uniform_period(int block_size, int filter_frames) {
+    auto period = block_size;
+    auto partition = block_size * NonUniformConvolver::SEGMENT_GROWTH;
+    auto offset = 2 * partition;
+    while (offset < filter_frames) {
+        period = partition;
+        if (partition * NonUniformConvolver::SEGMENT_GROWTH > NonUniformConvolver::MAX_PARTITION_SIZE) {
+            break;
+        }
+        offset = std::min(filter_frames, 2 * partition * NonUniformConvolver::SEGMENT_GROWTH);
+        partition *= NonUniformConvolver::SEGMENT_GROWTH;
+    }
+
+    return period;
+}
+
+// Replaces each candidate's estimate with the CPU per frame its engine takes, on a filter of
+// filter_frames. Non-uniform rounds cover whole periods of the largest tail segment from a reset
+// engine, and wait for its jobs before stopping the clock, so each candidate pays for its own tail
+// and no other's. On devices with spare cores, tails only count when workers fall behind, as in use.
+static void measure_engines(ConvolverMode mode, int channels, int filter_frames, int bench_frames,
+                            std::vector<ConvolverSizes>& candidates) {
+    // Content doesn't change the cost, as long as it stays clear of denormals
+    std::vector<std::vector<float>> filters { std::vector<float>(filter_frames, 1.0f / static_cast<float>(filter_frames)) };
+    std::vector<std::unique_ptr<ConvolverKernel>> kernels;
+    std::vector<AudioBuffer> ins, outs;
+    std::vector<int> iterations;
+    for (auto& candidate : candidates) {
+        kernels.push_back(std::make_unique<ConvolverKernel>(channels, candidate.block_size, candidate.fft_size,
+                                                            mode, filters, false));
+        auto& in = ins.emplace_back(channels, candidate.block_size);
+        for (auto ch = 0; ch < channels; ch++) {
+            std::fill_n(in.channel(ch), candidate.block_size, 0.5f);
+        }
+        outs.emplace_back(channels, candidate.block_size);
+
+        auto round_frames = bench_frames;
+        if (mode == CONVOLVER_NON_UNIFORM_PARTITIONED) {
+            auto period = non_uniform_period(candidate.block_size, filter_frames);
+            round_frames = (bench_frames + period - 1) / period * period;
+        }
+        iterations.push_back(std::max(round_frames / candidate.block_size, 1));
+    }
+
+    auto block_ns = fft_tuner::median_times_ns(iterations, [&](size_t i) {
+        kernels[i]->process(ins[i], outs[i]);
+    }, [&](size_t i) {
+        if (mode == CONVOLVER_NON_UNIFORM_PARTITIONED) {
+            kernels[i]->reset();
+        }
+    });
+    for (size_t i = 0; i < candidates.size(); i++) {
+        candidates[i].ns_per_frame = block_ns[i] / candidates[i].block_size;
+    }
+}
+
+ConvolverSizes ConvolverEffect::default_sizes(ConvolverMode mode, int filter_frames, int max_latency) {
+    // A block of max_latency at the engine's smallest FFT
+    ConvolverSizes sizes { max_latency, 0, 0.0 };
+    if (mode == CONVOLVER_SINGLE_BLOCK) {
+        sizes.fft_size = SingleBlockConvolver::fft_size_for(max_latency, filter_frames, 0);
+    } else {
+        sizes.fft_size = UniformConvolver::fft_size_for(max_latency, 0);
+    }
+
+    return sizes;
+}
+
+ConvolverSizes ConvolverEffect::tune_sizes(ConvolverMode mode, int channels, int filter_frames,
+                                           int max_latency) {
+    filter_frames = std::max(filter_frames, 1);
+    max_latency = std::max(max_latency, 1);
+    auto mac = fft_tuner::mac_cost();
+    auto add = fft_tuner::add_cost();
+
+    // Per block, each channel costs one forward and one inverse FFT, one multiply-accumulate per
+    // partition, and a few time-domain passes (copies and overlap-add) of the given length
+    auto block_ns = [&](int fft, int partitions, int time_samples) {
+        auto bins = fft / 2 + 1;
+        return channels * (fft_tuner::fft_cost(fft) + partitions * bins * mac + time_samples * add);
+    };
+
+    std::vector<ConvolverSizes> candidates;
+    auto consider = [&](int block, int fft, double ns) {
+        candidates.push_back({ block, fft, ns });
+    };
+
+    if (mode == CONVOLVER_SINGLE_BLOCK) {
+        // One partition: the FFT must fit the block and the whole filter, so the largest block that
+        // fits each size is the cheapest. Each block pads the input to the FFT size, clears the
+        // spectrum (about as many floats), shifts and adds the filter's tail for overlap-add, and
+        // copies the block in and out of the effect's buffers.
+        auto max_fft = next_fft_size(filter_frames + max_latency);
+        auto ffts = fft_tuner::fft_sizes_between(filter_frames + 1, max_fft);
+        fft_tuner::fft_costs(ffts);
+        for (auto fft : ffts) {
+            auto block = std::min(fft - filter_frames, max_latency);
+            consider(block, fft, block_ns(fft, 1, 2 * fft + 3 * filter_frames + 3 * block) / block);
+        }
+    } else if (mode == CONVOLVER_UNIFORM_PARTITIONED) {
+        // Partitions of block_size, and the FFT must be at least twice the block. Overlap-save
+        // copies the window in and the history out. Tiny blocks are never worth measuring.
+        auto max_fft = next_fft_size(max_latency * 2);
+        auto ffts = fft_tuner::fft_sizes_between(std::min(MIN_TUNED_FFT_SIZE, max_fft), max_fft);
+        fft_tuner::fft_costs(ffts);
+        for (auto fft : ffts) {
+            auto block = std::min(fft / 2, max_latency);
+            auto partitions = (filter_frames + block - 1) / block;
+            consider(block, fft, block_ns(fft, partitions, 2 * fft) / block);
+        }
+    } else {
+        // The head plus every tail segment, laid out as in NonUniformConvolver. Segments run on
+        // workers, but still take CPU from the same device. Only power-of-2 blocks are considered,
+        // so segment FFTs are powers of 2 too, rather than measuring every large size.
+        for (auto fft = MIN_TUNED_FFT_SIZE; fft / 2 <= max_latency; fft *= 2) {
+            auto block = fft / 2;
+            auto head_partitions = std::min((filter_frames + block - 1) / block,
+                                            NonUniformConvolver::HEAD_PARTITIONS);
+            auto ns = block_ns(fft, head_partitions, 2 * fft) / block;
+
+            auto partition = block * NonUniformConvolver::SEGMENT_GROWTH;
+            auto offset = 2 * partition;
+            while (offset < filter_frames) {
+                auto last = partition * NonUniformConvolver::SEGMENT_GROWTH > NonUniformConvolver::MAX_PARTITION_SIZE;
+                auto end = last ? filter_frames
+                                : std::min(filter_frames, 2 * partition * NonUniformConvolver::SEGMENT_GROWTH);
+                auto partitions = (end - offset + partition - 1) / partition;
+                // Segment output is mixed into the tail ring and back out
+                ns += block_ns(next_fft_size(2 * partition), partitions, 4 * partition) / partition;
+
+                offset = end;
+                partition *= NonUniformConvolver::SEGMENT_GROWTH;
+            }
+
+            consider(block, fft, ns);
+        }
+
+        // Latency shorter than the smallest block considered
+        if (candidates.empty()) {
+            auto fft = next_fft_size(max_latency * 2);
+            consider(max_latency, fft, block_ns(fft, NonUniformConvolver::HEAD_PARTITIONS, 2 * fft) / max_latency);
+        }
+    }
+
+    // Estimates leave out cache misses and the engines' own overhead, so the best few are timed on
+    // the engines, along with the untuned default. Tuning then never picks anything measurably
+    // slower than not tuning.
+    auto fixed = default_sizes(mode, filter_frames, max_latency);
+
+    std::sort(candidates.begin(), candidates.end(), [](auto& a, auto& b) { return a.ns_per_frame < b.ns_per_frame; });
+    candidates.resize(std::min(candidates.size(), static_cast<size_t>(TUNE_MEASURED_CANDIDATES)));
+    auto has_fixed = std::any_of(candidates.begin(), candidates.end(), [&](auto& candidate) {
+        return candidate.block_size == fixed.block_size && candidate.fft_size == fixed.fft_size;
+    });
+    if (!has_fixed) {
+        candidates.push_back(fixed);
+    }
+
+    measure_engines(mode, channels, filter_frames, TUNE_BENCH_FRAMES, candidates);
+    return pick_sizes(candidates, TUNE_MEASURED_TIE_RATIO);
 }
 
 }
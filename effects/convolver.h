@@ -1,66 +1,226 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
 #include <vector>
-#include <span>
 
 #include "../dsp.h"
+#include "../filters/block_convolver.h"
 #include "../util/amplitude.h"
 
-#include "../external/kissfft/kiss_fftr.h"
-
 namespace fxdsp {
 
+enum ConvolverMode {
+    // One FFT of the whole filter per block: latency and FFT size grow with the filter
+    CONVOLVER_SINGLE_BLOCK,
+    // Uniformly partitioned overlap-save with a frequency-domain delay line: partitions of
+    // block_size, so latency is independent of the filter length
+    CONVOLVER_UNIFORM_PARTITIONED,
+    // Small partitions for the head of the filter, larger ones for the tail on worker threads:
+    // same latency as uniform, with much less CPU on the audio thread for long filters (reverb)
+    CONVOLVER_NON_UNIFORM_PARTITIONED,
+};
+
+// Which filter feeds each output, chosen by filter count
+enum ConvolverRouting {
+    // One filter for every channel
+    CONVOLVER_ROUTING_SHARED,
+    // One filter per channel
+    CONVOLVER_ROUTING_PER_CHANNEL,
+    // Stereo with 4 filters (LL, LR, RL, RR): each input feeds both outputs
+    CONVOLVER_ROUTING_TRUE_STEREO,
+};
+
+// A set of filters prepared for one mode, with the engine that applies them
+// Built off the audio thread. Only the engine's state changes after that.
+class ConvolverKernel {
+private:
+    std::unique_ptr<BlockConvolver> engine;
+    int max_filter_frames;
+
+public:
+    ConvolverKernel(int channels, int block_size, int fft_size, ConvolverMode mode,
+                    const std::vector<std::vector<float>>& filters, bool crossfade);
+    // Single-block or uniform partitioned mode, from filters already prepared for the engine
+    ConvolverKernel(int channels, int block_size, ConvolverMode mode, PreparedFilters filters, bool crossfade);
+
+    // Fade from the kernel in use to this one, rather than switching at once
+    bool crossfade;
+    // Intrusive list of kernels waiting to be freed off the audio thread
+    ConvolverKernel* next_retired;
+
+    // Throws std::invalid_argument if no routing has this many filters
+    static ConvolverRouting choose_routing(int channels, int num_filters);
+    static std::vector<ConvolutionPath> make_paths(int channels, ConvolverRouting routing);
+
+    int max_filter_size() const { return max_filter_frames; }
+
+    void process(const AudioBuffer& in, AudioBuffer& out) { engine->process(in, out); }
+    void reset() { engine->reset(); }
+};
+
+// Block and FFT sizes for a convolver, from measured costs
+struct ConvolverSizes {
+    int block_size;
+    int fft_size;
+    // CPU per frame for all channels, measured on the engine on the calling thread
+    double ns_per_frame;
+};
+
 class ConvolverEffect : public Effect {
 private:
-    // Sizes: fft > conv > block
+    // New kernels are run silently for up to this long to fill their history, then faded in
+    static constexpr int WARMUP_MAX_MS = 100;
+    static constexpr int CROSSFADE_MS = 20;
+    // Smallest FFT tune_sizes() considers for partitioned modes
+    static constexpr int MIN_TUNED_FFT_SIZE = 64;
+    // Estimates within this ratio of the cheapest count as ties in tune_sizes()
+    static constexpr double TUNE_TIE_RATIO = 1.15;
+    // Candidates with the best estimates that tune_sizes() times on the engines, and the ratio for
+    // ties between their timings. Timings of nearby sizes vary by several percent between runs, so
+    // a smaller block only replaces the fixed default when it's clearly faster.
+    static constexpr int TUNE_MEASURED_CANDIDATES = 3;
+    static constexpr double TUNE_MEASURED_TIE_RATIO = 1.1;
+    // Frames processed per timing round
+    static constexpr int TUNE_BENCH_FRAMES = 1 << 15;
+    // Bump when IR loading changes, so cached kernels from older versions stop matching
+    static constexpr int IR_CACHE_VERSION = 1;
+
+    ConvolverMode mode;
     // Input buffer block size, excl. conv and FFT padding
     int block_size;
-    // Size of resulting linear convolution: L+M
-    int conv_size;
-    // FFT size, incl. conv and FFT padding
+    // Preferred FFT size for the engines, 0 for the smallest that fits
     int fft_size;
-    // FFT bin count (fft_size/2+1 for real FFT)
-    int fft_bins;
 
-    // Allocated to block size, excl. all padding
-    std::vector<std::vector<float>> channel_bufs;
+    // Input staged until a block is complete, allocated to block size, excl. all padding
+    // Whole blocks in the caller's buffer are processed from there.
+    AudioBuffer channel_bufs;
     int channels;
-    // Allocated to channel count
-    std::vector<std::span<float>> channel_spans;
     // Current position in per-channel block buffers
     int block_pos;
 
-    // Only one channel is processed at a time, so only one of each
-    // Allocated to FFT size, incl. all padding
-    std::vector<float> fft_time_buf;
-    std::vector<kiss_fft_cpx> fft_freq_buf;
+    // Processed output, delivered with a fixed latency of one block
+    // Capacity is a whole number of blocks.
+    AudioBuffer out_ring;
+    int ring_read;
+    int ring_write;
+    int ring_frames;
+
+    // Audio thread: kernel in use, and the one being faded to
+    std::unique_ptr<ConvolverKernel> kernel;
+    std::unique_ptr<ConvolverKernel> next_kernel;
+    // Output of next_kernel, mixed with the current output while fading
+    AudioBuffer fade_buf;
+    int warmup_max_frames;
+    int warmup_blocks;
+    int fade_frames;
+    int fade_pos;
+
+    // Latest kernel published for the audio thread, taken at the next block boundary
+    std::atomic<ConvolverKernel*> pending_kernel;
+    // Replaced kernels from the audio thread, freed by the control or preparer thread
+    std::atomic<ConvolverKernel*> retired_kernels;
+    // Set once audio has been processed. Before that, filters are prepared synchronously and
+    // switched to without a fade, so offline output is deterministic.
+    std::atomic<bool> started;
 
-    // Overlapping region (L) from last block
-    std::vector<float> last_overlap;
+    // Background preparation: only the latest request is built
+    std::mutex prepare_lock;
+    std::condition_variable prepare_cond;
+    // Either taps or prepared filters
+    std::vector<std::vector<float>> requested_filters;
+    std::optional<PreparedFilters> requested_prepared;
+    bool prepare_requested;
+    bool stopping;
+    std::thread preparer;
 
-    // FIR filter in time and frequency domains
-    std::vector<float> fir_filter_time; // excl. zero pad
-    std::vector<kiss_fft_cpx> fir_filter_freq; // incl. zero pad
+    // Control thread: latest filters set
+    ConvolverRouting routing;
+    std::vector<std::vector<float>> fir_filters_time; // excl. zero pad
+    // Set prepared, transformed back into fir_filters_time only when asked for
+    std::optional<PreparedFilters> prepared_filters;
+    bool filters_time_stale;
 
-    // kissfft configs for forward and inverse FFT
-    std::unique_ptr<struct kiss_fftr_state> fft_cfg;
-    std::unique_ptr<struct kiss_fftr_state> ifft_cfg;
+    // Latency, last zero-padded block + tail, allocated with the filter for finalize()
+    AudioBuffer final_bufs;
 
-    // Process the current accumulated input buffer
-    void process_fft_chunk(std::vector<float>& block_buf);
+    // Process a full block for all channels into the output ring
+    void process_block(const AudioBuffer& in);
+    void consume_input(AudioBuffer& buf, int offset, int count);
+    void read_output(AudioBuffer& buf, int offset, int count);
+    void reset_ring();
 
-    friend class FirGraphicEqEffect;
+    // Audio thread
+    void take_pending_kernel();
+    void finish_fade();
+    void retire_kernel(ConvolverKernel* old_kernel);
+    // Not real-time safe
+    void publish_kernel(ConvolverKernel* new_kernel);
+    void free_retired_kernels();
+    void prepare_loop();
+    void request_kernel(std::vector<std::vector<float>> filters, std::optional<PreparedFilters> prepared);
 
 public:
-    ConvolverEffect(const DSP& dsp, int block_size);
-    void write_audio(std::vector<std::vector<float>>& buf) override;
+    // Latency is block_size frames in all modes. Output has the same frame count as the input,
+    // starting with block_size frames of silence.
+    // fft_size is a preference, e.g. from tune_sizes(). Engines use a larger size if it doesn't fit.
+    ConvolverEffect(const DSP& dsp, int block_size, ConvolverMode mode = CONVOLVER_SINGLE_BLOCK,
+                    int fft_size = 0);
+    ~ConvolverEffect() override;
+
+    void prepare(int max_frames) override;
+    void write_audio(AudioBuffer& buf) override;
     void reset() override;
-    // This allocates! Not normally used
+    // Not normally used
     void finalize() override;
 
-    // FIR time domain filter
+    // FIR time domain filter, for all channels
+    // Once audio is running, filters are prepared on a background thread and crossfaded in at a
+    // block boundary. The output is silent until the first filter is set.
     void set_filter(const std::vector<float>& filter);
+    // One filter per channel, or 4 for true stereo (e.g. channels from a WAV IR).
+    // Throws std::invalid_argument for other counts.
+    void set_filters(const std::vector<std::vector<float>>& filters);
+    // All channels of a WAV file, as set_filters(). In single-block mode the transformed filters are
+    // cached by the file's path, size and modification time (see kernel_cache), so reloading an
+    // unchanged IR skips reading and transforming it.
+    void set_filter_file(const std::string& path);
+    // Single-block mode only: filters already transformed at get_filter_fft_size(), e.g. by
+    // fir::make_filter_spectrum(), so the engine doesn't need the taps or another FFT.
+    // Throws std::invalid_argument in other modes or for mismatched spectra.
+    void set_filter_spectrum(FilterSpectrum filter);
+    void set_filter_spectra(std::vector<FilterSpectrum> filters);
+    // FFT size for spectra of filters up to filter_frames long
+    int get_filter_fft_size(int filter_frames) const;
+    // Filters already partitioned and transformed for this effect's mode and block size, e.g. from
+    // prepare_filters() or a kernel file. They're used without copying. Single-block and uniform
+    // partitioned modes only: throws std::invalid_argument otherwise or if they don't fit.
+    void set_prepared_filters(PreparedFilters filters);
+    // Maps a kernel file, see kernel_file::load()
+    void set_kernel_file(const std::string& path);
+    // Filters set as spectra or prepared are transformed back to taps here, on first call
     const std::vector<float>& get_filter();
+    const std::vector<std::vector<float>>& get_filters();
+    ConvolverRouting get_routing() const { return routing; }
+    int get_latency() const { return block_size; }
+
+    // For set_prepared_filters() on effects with the same mode and sizes, e.g. to save as a kernel file.
+    // Throws std::invalid_argument for the non-uniform mode.
+    static PreparedFilters prepare_filters(ConvolverMode mode, int block_size, int fft_size,
+                                           const std::vector<std::vector<float>>& filters);
+
+    // Block and FFT sizes with the least CPU per frame on this device, for filters up to filter_frames
+    // long and latency up to max_latency frames. Measures FFT costs on first use (see fft_tuner), and
+    // times the most promising engines, so this can take a while.
+    static ConvolverSizes tune_sizes(ConvolverMode mode, int channels, int filter_frames, int max_latency);
+    // Sizes the engine uses untuned, with a block of max_latency: tune_sizes() never picks anything
+    // measurably slower. ns_per_frame is left at 0.
+    static ConvolverSizes default_sizes(ConvolverMode mode, int filter_frames, int max_latency);
 };
 
 }
@@ -7,9 +7,9 @@ GainEffect::GainEffect(const DSP &dsp, float gain_db) :
         sample_factor(amplitude::db_to_linear(gain_db)) {
 }
 
-void GainEffect::write_audio(std::vector<std::vector<float>>& buf) {
-    for (auto& channel : buf) {
-        for (auto& sample : channel) {
+void GainEffect::write_audio(AudioBuffer& buf) {
+    for (auto ch = 0; ch < buf.channels(); ch++) {
+        for (auto& sample : buf[ch]) {
             sample *= sample_factor;
         }
     }
@@ -17,4 +17,9 @@ void GainEffect::write_audio(std::vector<std::vector<float>>& buf) {
     sink->write_audio(buf);
 }
 
+bool GainEffect::get_iir_stages(float& gain, std::vector<BiquadCoeffs>& sections) const {
+    gain = sample_factor;
+    return true;
+}
+
 }
@@ -11,7 +11,8 @@ private:
 
 public:
     GainEffect(const DSP& dsp, float gain_db);
-    void write_audio(std::vector<std::vector<float>>& buf) override;
+    void write_audio(AudioBuffer& buf) override;
+    bool get_iir_stages(float& gain, std::vector<BiquadCoeffs>& sections) const override;
 };
 
 }
@@ -1,7 +1,9 @@
 #include <cmath>
+#include <utility>
 
 #include "graphic_eq_fir.h"
 #include "../filters/fir_design.h"
+#include "../filters/kernel_cache.h"
 #include "../log.h"
 
 namespace fxdsp {
@@ -11,18 +13,48 @@ namespace fxdsp {
 #pragma ide diagnostic ignored "VirtualCallInCtorOrDtor"
 FirGraphicEqEffect::FirGraphicEqEffect(const DSP& dsp,
                                        int num_bands,
-                                       int block_size,
+                                       int filter_size,
                                        float start_freq,
-                                       float end_freq) :
+                                       float end_freq,
+                                       int max_latency) :
                                        GraphicEqBase(dsp, num_bands, start_freq, end_freq),
-                                       convolver(dsp, block_size),
-                                       sample_rate(dsp.sample_rate) {
+                                       filter_size(filter_size),
+                                       sizes(choose_sizes(dsp, filter_size, max_latency)),
+                                       convolver(dsp, sizes.block_size, CONVOLVER_SINGLE_BLOCK, sizes.fft_size),
+                                       sample_rate(dsp.sample_rate),
+                                       filters_dirty(false),
+                                       started(false),
+                                       prepare_requested(false),
+                                       stopping(false) {
     // Safe in this context as it delegates to this derived class' implementation
     build_filters();
 }
 #pragma clang diagnostic pop
 
-void FirGraphicEqEffect::write_audio(std::vector<std::vector<float>>& buf) {
+FirGraphicEqEffect::~FirGraphicEqEffect() {
+    {
+        std::lock_guard<std::mutex> lock(prepare_lock);
+        stopping = true;
+    }
+    prepare_cond.notify_one();
+    if (preparer.joinable()) {
+        preparer.join();
+    }
+}
+
+ConvolverSizes FirGraphicEqEffect::choose_sizes(const DSP& dsp, int filter_size, int max_latency) {
+    if (max_latency <= 0) {
+        return { filter_size, 0, 0.0 };
+    }
+
+    return ConvolverEffect::tune_sizes(CONVOLVER_SINGLE_BLOCK, dsp.channels, filter_size, max_latency);
+}
+
+void FirGraphicEqEffect::write_audio(AudioBuffer& buf) {
+    if (!started.load(std::memory_order_relaxed)) {
+        started.store(true, std::memory_order_release);
+    }
+
     convolver.write_audio(buf);
 }
 
@@ -31,6 +63,11 @@ void FirGraphicEqEffect::set_next_sink(AudioSink &next_sink) {
     convolver.set_next_sink(next_sink);
 }
 
+void FirGraphicEqEffect::prepare(int max_frames) {
+    Effect::prepare(max_frames);
+    convolver.prepare(max_frames);
+}
+
 void FirGraphicEqEffect::reset() {
     Effect::reset();
     convolver.reset();
@@ -41,7 +78,25 @@ void FirGraphicEqEffect::finalize() {
     convolver.finalize();
 }
 
+void FirGraphicEqEffect::enabled_changed() {
+    if (is_enabled() && filters_dirty) {
+        request_design();
+    }
+}
+
 void FirGraphicEqEffect::build_filters() {
+    // Skip expensive filter design while bypassed
+    if (!is_enabled()) {
+        filters_dirty = true;
+        return;
+    }
+
+    request_design();
+}
+
+void FirGraphicEqEffect::request_design() {
+    filters_dirty = false;
+
     std::vector<float> freqs;
     freqs.reserve(bands.size());
     std::vector<float> gains;
@@ -53,17 +108,93 @@ void FirGraphicEqEffect::build_filters() {
         gains.push_back(band.gain_db);
     }
 
-    std::vector<float> filter(convolver.block_size);
-    auto success = fir::make_filter(freqs, gains, filter, static_cast<float>(sample_rate));
-    if (!success) {
-        ALOGE("GEQ build: Failed to build FIR filter: %d", success);
+    if (!started.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(design_lock);
+        design_filter(std::move(freqs), std::move(gains));
         return;
     }
 
-    convolver.set_filter(filter);
+    // A design can take tens of ms, so it runs on the preparer. Requests made meanwhile replace
+    // each other, and only the newest is designed.
+    {
+        std::lock_guard<std::mutex> lock(prepare_lock);
+        requested_freqs = std::move(freqs);
+        requested_gains = std::move(gains);
+        prepare_requested = true;
+        if (!preparer.joinable()) {
+            preparer = std::thread(&FirGraphicEqEffect::prepare_loop, this);
+        }
+    }
+    prepare_cond.notify_one();
+}
+
+// Called with design_lock held
+void FirGraphicEqEffect::design_filter(std::vector<float> freqs, std::vector<float> gains) {
+    // Presets are often revisited, so designs are cached by everything that goes into them
+    auto fft_size = convolver.get_filter_fft_size(filter_size);
+    KernelKey key("geq-fir", DESIGN_CACHE_VERSION);
+    key.add(freqs).add(gains).add(sample_rate).add(filter_size).add(static_cast<int>(DESIGN_MINIMUM_PHASE));
+    key.add(DESIGN_MAX_ERROR_DB).add(fft_size);
+    auto kernels = kernel_cache::find(key);
+    if (kernels == nullptr) {
+        // Designed straight into the convolver's spectrum, skipping its own transform of the taps
+        FilterSpectrum filter { filter_size, fft_size, {} };
+        auto success = fir::make_filter_spectrum(freqs, gains, filter, static_cast<float>(sample_rate),
+                                                 DESIGN_MINIMUM_PHASE, DESIGN_MAX_ERROR_DB);
+        if (!success) {
+            ALOGE("GEQ build: Failed to build FIR filter: %d", success);
+            return;
+        }
+
+        KernelSet filters;
+        filters.push_back(std::move(filter));
+        kernels = kernel_cache::insert(key, std::move(filters));
+    }
+
+    convolver.set_filter_spectra(*kernels);
 }
 
-const std::vector<float>& FirGraphicEqEffect::get_filter() {
+// Designs the latest request, if any. Called with design_lock held, and the request is taken under
+// it, so an older design can never be handed to the convolver after a newer one.
+void FirGraphicEqEffect::finish_pending_design() {
+    std::vector<float> freqs, gains;
+    {
+        std::lock_guard<std::mutex> lock(prepare_lock);
+        if (!prepare_requested) {
+            return;
+        }
+
+        freqs = std::move(requested_freqs);
+        gains = std::move(requested_gains);
+        prepare_requested = false;
+    }
+
+    design_filter(std::move(freqs), std::move(gains));
+}
+
+void FirGraphicEqEffect::prepare_loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(prepare_lock);
+            prepare_cond.wait(lock, [this] { return prepare_requested || stopping; });
+            if (stopping) {
+                return;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(design_lock);
+        finish_pending_design();
+    }
+}
+
+std::vector<float> FirGraphicEqEffect::get_filter() {
+    if (filters_dirty) {
+        request_design();
+    }
+
+    // Copied under the lock: the preparer replaces the convolver's taps when it publishes.
+    std::lock_guard<std::mutex> lock(design_lock);
+    finish_pending_design();
     return convolver.get_filter();
 }
 
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include "../dsp.h"
@@ -11,28 +15,68 @@ namespace fxdsp {
 
 class FirGraphicEqEffect : public GraphicEqBase {
 private:
+    static constexpr bool DESIGN_MINIMUM_PHASE = true;
+    // Minimum phase design accuracy, loose enough for band changes to take a few ms
+    static constexpr float DESIGN_MAX_ERROR_DB = 0.01f;
+    // Bump when the design changes, so cached kernels from older versions stop matching
+    static constexpr int DESIGN_CACHE_VERSION = 1;
+
+    // FIR length in taps
+    int filter_size;
+    ConvolverSizes sizes;
     // Underlying FIR convolver
     ConvolverEffect convolver;
 
     // For building FIR filter
     int sample_rate;
+    // Band changes while disabled are applied when re-enabled
+    bool filters_dirty;
+    // Set once audio has been processed. Before that, filters are designed synchronously, so offline
+    // output is deterministic.
+    std::atomic<bool> started;
+
+    // Background design: only the latest bands are designed
+    std::mutex prepare_lock;
+    std::condition_variable prepare_cond;
+    std::vector<float> requested_freqs;
+    std::vector<float> requested_gains;
+    bool prepare_requested;
+    bool stopping;
+    std::thread preparer;
+    // Held while designing and handing the filter to the convolver, from either thread
+    std::mutex design_lock;
 
     void build_filters() override;
+    void request_design();
+    void design_filter(std::vector<float> freqs, std::vector<float> gains);
+    void finish_pending_design();
+    void prepare_loop();
+    void enabled_changed() override;
+
+    static ConvolverSizes choose_sizes(const DSP& dsp, int filter_size, int max_latency);
 
 public:
+    // max_latency = 0: the block size is filter_size, so latency grows with the filter.
+    // Otherwise, block and FFT sizes are tuned for the least CPU with latency up to max_latency frames.
     FirGraphicEqEffect(const DSP& dsp,
                        int num_bands,
-                       int block_size = 4999,
+                       int filter_size = 4999,
                        float start_freq = 20.0f,
-                       float end_freq = 20000.0f);
+                       float end_freq = 20000.0f,
+                       int max_latency = 0);
+    ~FirGraphicEqEffect() override;
 
-    void write_audio(std::vector<std::vector<float>>& buf) override;
+    void write_audio(AudioBuffer& buf) override;
     // Delegate
     void set_next_sink(AudioSink& next_sink) override;
+    void prepare(int max_frames) override;
     void reset() override;
     void finalize() override;
 
-    const std::vector<float>& get_filter();
+    // Band changes are designed in the background once audio is running. This waits for the latest
+    // and returns a copy of its taps.
+    std::vector<float> get_filter();
+    int get_latency() const { return convolver.get_latency(); }
 };
 
 }
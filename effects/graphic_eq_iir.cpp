@@ -10,7 +10,7 @@ IirGraphicEqEffect::IirGraphicEqEffect(const DSP& dsp, int num_bands, float star
         peq(dsp) {
 }
 
-void IirGraphicEqEffect::write_audio(std::vector<std::vector<float>>& buf) {
+void IirGraphicEqEffect::write_audio(AudioBuffer& buf) {
     peq.write_audio(buf);
 }
 
@@ -19,6 +19,11 @@ void IirGraphicEqEffect::set_next_sink(AudioSink &next_sink) {
     peq.set_next_sink(next_sink);
 }
 
+void IirGraphicEqEffect::prepare(int max_frames) {
+    Effect::prepare(max_frames);
+    peq.prepare(max_frames);
+}
+
 void IirGraphicEqEffect::build_filters() {
     peq.remove_all_filters();
     peq.reserve_filters(bands.size());
@@ -27,6 +32,8 @@ void IirGraphicEqEffect::build_filters() {
         ALOGV("GEQ build: center=%f q=%f  gain=%f\n", band.center_freq, band.q, band.gain_db);
         peq.add_filter(BIQUAD_PEAKING_EQ, band.center_freq, band.q, band.gain_db);
     }
+
+    parameters_changed();
 }
 
 void IirGraphicEqEffect::reset() {
@@ -34,4 +41,8 @@ void IirGraphicEqEffect::reset() {
     peq.reset();
 }
 
+bool IirGraphicEqEffect::get_iir_stages(float& gain, std::vector<BiquadCoeffs>& sections) const {
+    return peq.get_iir_stages(gain, sections);
+}
+
 }
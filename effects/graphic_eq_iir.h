@@ -18,9 +18,11 @@ private:
 
 public:
     IirGraphicEqEffect(const DSP& dsp, int num_bands, float start_freq = 20.0f, float end_freq = 20000.0f);
-    void write_audio(std::vector<std::vector<float>>& buf) override;
+    void write_audio(AudioBuffer& buf) override;
     void set_next_sink(AudioSink& next_sink) override;
+    void prepare(int max_frames) override;
     void reset() override;
+    bool get_iir_stages(float& gain, std::vector<BiquadCoeffs>& sections) const override;
 };
 
 }
@@ -8,9 +8,9 @@ NoiseEffect::NoiseEffect(const DSP &dsp) :
         rand_dist(-1.0f, 1.0f) {
 }
 
-void NoiseEffect::write_audio(std::vector<std::vector<float>>& buf) {
-    for (auto& channel : buf) {
-        for (auto& sample : channel) {
+void NoiseEffect::write_audio(AudioBuffer& buf) {
+    for (auto ch = 0; ch < buf.channels(); ch++) {
+        for (auto& sample : buf[ch]) {
             sample = rand_dist(rand_engine);
         }
     }
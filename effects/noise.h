@@ -14,7 +14,7 @@ private:
 
 public:
     NoiseEffect(const DSP& dsp);
-    void write_audio(std::vector<std::vector<float>>& buf) override;
+    void write_audio(AudioBuffer& buf) override;
 };
 
 }
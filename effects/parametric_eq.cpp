@@ -4,65 +4,59 @@ namespace fxdsp {
 
 ParametricEqEffect::ParametricEqEffect(const DSP& dsp) :
         Effect(dsp),
+        filters(dsp.channels),
         sample_rate(dsp.sample_rate) {
-    channel_filters.resize(dsp.channels);
 }
 
-void ParametricEqEffect::write_audio(std::vector<std::vector<float>>& buf) {
-    for (auto ch = 0; ch < buf.size(); ch++) {
-        for (auto& sample : buf[ch]) {
-            for (const auto& filter : channel_filters[ch]) {
-                sample = filter->process_sample(sample);
-            }
-        }
-    }
-
+void ParametricEqEffect::write_audio(AudioBuffer& buf) {
+    filters.process(buf);
     sink->write_audio(buf);
 }
 
 unsigned int ParametricEqEffect::add_filter(BiquadFilterType type, float center_freq, float q, float gain_db) {
-    unsigned int idx = -1;
-    for (auto& filters : channel_filters) {
-        filters.push_back(std::make_unique<BiquadFilter>(type, sample_rate, center_freq, q, gain_db));
-        idx = filters.size() - 1;
-    }
+    BiquadFilter filter(type, sample_rate, center_freq, q, gain_db);
+    unsigned int idx = filters.add_section(filter.get_coeffs());
 
+    parameters_changed();
     return idx;
 }
 
 void ParametricEqEffect::update_filter(int idx, BiquadFilterType type, float center_freq, float q,
                                        float gain_db) {
-    for (auto& filters : channel_filters) {
-        filters[idx] = std::make_unique<BiquadFilter>(type, sample_rate, center_freq, q, gain_db);
-    }
+    // Replace in place to avoid reallocating
+    BiquadFilter filter(type, sample_rate, center_freq, q, gain_db);
+    filters.set_section(idx, filter.get_coeffs());
+
+    parameters_changed();
 }
 
 void ParametricEqEffect::remove_filter(int idx) {
-    for (auto& filters : channel_filters) {
-        filters.erase(filters.begin() + idx);
-    }
+    filters.remove_section(idx);
+
+    parameters_changed();
 }
 
 void ParametricEqEffect::remove_all_filters() {
-    for (auto& filters : channel_filters) {
-        filters.clear();
-    }
+    filters.clear();
+
+    parameters_changed();
 }
 
 void fxdsp::ParametricEqEffect::reserve_filters(int count) {
-    for (auto& filters : channel_filters) {
-        filters.reserve(count);
-    }
+    filters.reserve(count);
 }
 
 void ParametricEqEffect::reset() {
     Effect::reset();
+    filters.reset();
+}
+
+bool ParametricEqEffect::get_iir_stages(float& gain, std::vector<BiquadCoeffs>& sections) const {
+    gain = 1.0f;
+    auto& coeffs = filters.get_sections();
+    sections.insert(sections.end(), coeffs.begin(), coeffs.end());
 
-    for (auto& filters : channel_filters) {
-        for (auto& filter : filters) {
-            filter.reset();
-        }
-    }
+    return true;
 }
 
 }
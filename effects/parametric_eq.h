@@ -1,17 +1,17 @@
 #pragma once
 
 #include <vector>
-#include <memory>
 
 #include "../dsp.h"
 #include "../filters/biquad.h"
+#include "../filters/biquad_bank.h"
 
 namespace fxdsp {
 
 class ParametricEqEffect : public Effect {
 private:
-    // [channel: [filters]] to keep state separate per channel
-    std::vector<std::vector<std::unique_ptr<BiquadFilter>>> channel_filters;
+    // One section per filter, with state kept separately per channel
+    BiquadBank filters;
     int sample_rate;
 
     // Private API for GEQ
@@ -20,7 +20,7 @@ private:
 
 public:
     ParametricEqEffect(const DSP& dsp);
-    void write_audio(std::vector<std::vector<float>>& buf) override;
+    void write_audio(AudioBuffer& buf) override;
 
     unsigned int add_filter(BiquadFilterType type, float center_freq, float q,
                             float gain_db = std::numeric_limits<double>::quiet_NaN());
@@ -30,6 +30,7 @@ public:
     void remove_all_filters();
 
     void reset() override;
+    bool get_iir_stages(float& gain, std::vector<BiquadCoeffs>& sections) const override;
 };
 
 }
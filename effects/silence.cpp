@@ -6,10 +6,8 @@ SilenceEffect::SilenceEffect(const DSP &dsp) :
         Effect(dsp) {
 }
 
-void SilenceEffect::write_audio(std::vector<std::vector<float>>& buf) {
-    for (auto& channel : buf) {
-        std::fill(channel.begin(), channel.end(), 0);
-    }
+void SilenceEffect::write_audio(AudioBuffer& buf) {
+    buf.clear();
 
     sink->write_audio(buf);
 }
@@ -7,7 +7,7 @@ namespace fxdsp {
 class SilenceEffect : public Effect {
 public:
     SilenceEffect(const DSP& dsp);
-    void write_audio(std::vector<std::vector<float>>& buf) override;
+    void write_audio(AudioBuffer& buf) override;
 };
 
 }
@@ -11,6 +11,14 @@ using namespace std::complex_literals;
 namespace fxdsp {
 
 static constexpr auto GRAPH_MIN_FREQ = 0.000001f;
+// Tolerance for detecting pass-through sections
+static constexpr auto IDENTITY_EPSILON = 1e-6f;
+
+bool BiquadCoeffs::is_identity() const {
+    return std::abs(b0 - 1.0f) < IDENTITY_EPSILON &&
+           std::abs(b1 - a1) < IDENTITY_EPSILON &&
+           std::abs(b2 - a2) < IDENTITY_EPSILON;
+}
 
 // https://www.w3.org/TR/audio-eq-cookbook/
 BiquadFilter::BiquadFilter(BiquadFilterType type, float sample_rate, float center_freq, float q,
@@ -131,6 +139,10 @@ void BiquadFilter::reset() {
     x1 = y1 = x2 = y2 = 0.0f;
 }
 
+BiquadCoeffs BiquadFilter::get_coeffs() const {
+    return { b0_a0, b1_a0, b2_a0, a1_a0, a2_a0 };
+}
+
 void BiquadFilter::gen_graph(std::vector<float> &out_x, std::vector<float> &out_y, float max_freq) const {
     auto count = out_y.size();
     auto log_min = log2(20.f);
@@ -142,7 +154,7 @@ void BiquadFilter::gen_graph(std::vector<float> &out_x, std::vector<float> &out_
         auto w = pow(2.0f, log_min + log_step * static_cast<float>(i)) / max_freq * static_cast<float>(M_PI);
 
         // Exponent
-        auto ze = exp(w * -1.0if);
+        auto ze = exp(static_cast<float>(w) * -1.0if);
         // Transfer function
         auto H = (b0_a0 * ze*ze + b1_a0 * ze + b2_a0) /
                 (/*1*/ ze*ze + a1_a0 * ze + a2_a0);
@@ -19,6 +19,15 @@ enum BiquadFilterType {
     BIQUAD_HIGH_SHELF,
 };
 
+// Normalized coefficients (a0 = 1)
+struct BiquadCoeffs {
+    float b0, b1, b2;
+    float a1, a2;
+
+    // H(z) = 1, e.g. peaking EQ at 0 dB
+    bool is_identity() const;
+};
+
 class BiquadFilter {
 private:
     // Final coefficients for evaluation
@@ -39,6 +48,8 @@ public:
     float process_sample(float sample);
     void reset();
 
+    BiquadCoeffs get_coeffs() const;
+
     // UI
     void gen_graph(std::vector<float> &out_x, std::vector<float> &out_y, float max_freq) const;
 };
@@ -0,0 +1,21 @@
+// Compiled with -mavx2 on x86-64. Only called after checking CPU support.
+
+#include "biquad_kernel.h"
+
+#if defined(__AVX2__)
+
+namespace fxdsp {
+
+void process_biquad_cascade_avx2(const BiquadCoeffs* coeffs, int num_sections, float* state,
+                                 int lane_stride, AudioBuffer& buf) {
+    process_cascade_lanes<AvxLanes>(coeffs, num_sections, state, lane_stride, buf);
+}
+
+void process_biquad_parallel_avx2(const float* coeffs, int num_groups, float direct, float* state,
+                                  AudioBuffer& buf) {
+    process_parallel_lanes<AvxLanes>(coeffs, num_groups, direct, state, buf);
+}
+
+}
+
+#endif
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "biquad_bank.h"
+#include "biquad_kernel.h"
+#include "../util/cpu_features.h"
+
+namespace fxdsp {
+
+#if defined(__x86_64__)
+// biquad_avx2.cpp
+void process_biquad_cascade_avx2(const BiquadCoeffs* coeffs, int num_sections, float* state,
+                                 int lane_stride, AudioBuffer& buf);
+#endif
+
+BiquadBank::BiquadBank(int channels) : num_channels(channels) {
+}
+
+void BiquadBank::reserve(int sections) {
+    coeffs.reserve(sections);
+    state.reserve(sections * section_state_size(num_channels));
+}
+
+int BiquadBank::add_section(const BiquadCoeffs& section) {
+    coeffs.push_back(section);
+    state.resize(state.size() + section_state_size(num_channels), 0.0f);
+    return size() - 1;
+}
+
+void BiquadBank::set_section(int idx, const BiquadCoeffs& section) {
+    if (idx < 0 || idx >= size()) {
+        throw std::out_of_range("Section index out of range");
+    }
+
+    coeffs[idx] = section;
+}
+
+void BiquadBank::remove_section(int idx) {
+    if (idx < 0 || idx >= size()) {
+        throw std::out_of_range("Section index out of range");
+    }
+
+    coeffs.erase(coeffs.begin() + idx);
+    auto section_state = state.begin() + idx * section_state_size(num_channels);
+    state.erase(section_state, section_state + section_state_size(num_channels));
+}
+
+void BiquadBank::clear() {
+    coeffs.clear();
+    state.clear();
+}
+
+void BiquadBank::reset() {
+    std::fill(state.begin(), state.end(), 0.0f);
+}
+
+void BiquadBank::process(AudioBuffer& buf) {
+    process_cascade(coeffs.data(), size(), state.data(), buf);
+}
+
+int BiquadBank::lane_stride(int channels) {
+    return (channels + MAX_LANES - 1) / MAX_LANES * MAX_LANES;
+}
+
+int BiquadBank::section_state_size(int channels) {
+    return STATE_SIZE * lane_stride(channels);
+}
+
+void BiquadBank::process_cascade(const BiquadCoeffs* coeffs, int num_sections, float* state,
+                                 AudioBuffer& buf) {
+    static_assert(STATE_SIZE == KERNEL_STATE_SIZE);
+    auto stride = lane_stride(buf.channels());
+
+    if (buf.channels() == 1) {
+        process_cascade_lanes<ScalarLanes>(coeffs, num_sections, state, stride, buf);
+        return;
+    }
+
+#if defined(__x86_64__)
+    // 8 lanes only pay off with more than 4 channels
+    if (buf.channels() > 4 && cpu_features::has_avx2()) {
+        process_biquad_cascade_avx2(coeffs, num_sections, state, stride, buf);
+    } else {
+        process_cascade_lanes<SseLanes>(coeffs, num_sections, state, stride, buf);
+    }
+#elif defined(__ARM_NEON)
+    process_cascade_lanes<NeonLanes>(coeffs, num_sections, state, stride, buf);
+#else
+    process_cascade_lanes<ScalarLanes>(coeffs, num_sections, state, stride, buf);
+#endif
+}
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+
+#include "biquad.h"
+#include "../audio_buffer.h"
+
+namespace fxdsp {
+
+// Cascade of biquad sections for all channels, with coefficients and state in flat arrays
+// Processed one section at a time over chunks of the block, so the section's coefficients and
+// state stay in registers. All channels share coefficients and run in SIMD lanes.
+class BiquadBank {
+private:
+    int num_channels;
+    // [section]
+    std::vector<BiquadCoeffs> coeffs;
+    // [section: [x1, x2, y1, y2: [lane_stride channels]]]
+    std::vector<float> state;
+
+public:
+    // State values per section per channel
+    static constexpr int STATE_SIZE = 4;
+    // Widest SIMD kernel, in channels
+    static constexpr int MAX_LANES = 8;
+
+    BiquadBank(int channels);
+
+    int channels() const { return num_channels; }
+    int size() const { return static_cast<int>(coeffs.size()); }
+    const std::vector<BiquadCoeffs>& get_sections() const { return coeffs; }
+
+    // Adding sections only allocates past the reserved count
+    void reserve(int sections);
+    int add_section(const BiquadCoeffs& section);
+    // In place, keeping state: never allocates
+    void set_section(int idx, const BiquadCoeffs& section);
+    void remove_section(int idx);
+    void clear();
+
+    void reset();
+    void process(AudioBuffer& buf);
+
+    // Channels padded to a whole number of SIMD lanes
+    static int lane_stride(int channels);
+    // Floats of state per section, for all channels
+    static int section_state_size(int channels);
+
+    // Run a Direct Form 1 cascade over all channels of buf in place, using the best kernel for
+    // this CPU. state must hold section_state_size(buf.channels()) floats per section.
+    static void process_cascade(const BiquadCoeffs* coeffs, int num_sections, float* state,
+                                AudioBuffer& buf);
+};
+
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+// Biquad cascade kernel shared by the per-ISA translation units
+// Everything here has internal linkage: each TU compiles it with different target flags, so
+// instantiations must never be merged by the linker.
+
+#include <algorithm>
+
+#include "biquad.h"
+#include "../audio_buffer.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace fxdsp {
+namespace {
+
+// Frames gathered per pass, small enough to stay in L1
+constexpr int KERNEL_CHUNK_FRAMES = 64;
+constexpr int KERNEL_STATE_SIZE = 4;
+
+struct ScalarLanes {
+    static constexpr int WIDTH = 1;
+    using V = float;
+    static V load(const float* p) { return *p; }
+    static void store(float* p, V v) { *p = v; }
+    static V set1(float x) { return x; }
+    static V add(V a, V b) { return a + b; }
+    static V sub(V a, V b) { return a - b; }
+    static V mul(V a, V b) { return a * b; }
+};
+
+#if defined(__SSE2__)
+struct SseLanes {
+    static constexpr int WIDTH = 4;
+    using V = __m128;
+    static V load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, V v) { _mm_storeu_ps(p, v); }
+    static V set1(float x) { return _mm_set1_ps(x); }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+};
+#endif
+
+#if defined(__AVX2__)
+struct AvxLanes {
+    static constexpr int WIDTH = 8;
+    using V = __m256;
+    static V load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+    static V set1(float x) { return _mm256_set1_ps(x); }
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+};
+#endif
+
+#if defined(__ARM_NEON)
+struct NeonLanes {
+    static constexpr int WIDTH = 4;
+    using V = float32x4_t;
+    static V load(const float* p) { return vld1q_f32(p); }
+    static void store(float* p, V v) { vst1q_f32(p, v); }
+    static V set1(float x) { return vdupq_n_f32(x); }
+    static V add(V a, V b) { return vaddq_f32(a, b); }
+    static V sub(V a, V b) { return vsubq_f32(a, b); }
+    static V mul(V a, V b) { return vmulq_f32(a, b); }
+};
+#endif
+
+// Direct Form 1 cascade with one channel per lane
+// State is [section: [x1, x2, y1, y2: [lane_stride channels]]]. lane_stride must cover the last
+// group of L::WIDTH channels. Separate multiplies and adds, in the same order as
+// BiquadFilter::process_sample, keep results identical to the scalar path.
+template <typename L>
+void process_cascade_lanes(const BiquadCoeffs* coeffs, int num_sections, float* state, int lane_stride,
+                           AudioBuffer& buf) {
+    constexpr auto W = L::WIDTH;
+    alignas(32) float lanes[KERNEL_CHUNK_FRAMES * W];
+
+    auto channels = buf.channels();
+    auto frames = buf.frames();
+    for (auto ch0 = 0; ch0 < channels; ch0 += W) {
+        auto group = std::min(W, channels - ch0);
+
+        for (auto start = 0; start < frames; start += KERNEL_CHUNK_FRAMES) {
+            auto n = std::min(KERNEL_CHUNK_FRAMES, frames - start);
+
+            // Gather into [frame: [lane]], with unused lanes silent
+            for (auto c = 0; c < W; c++) {
+                if (c < group) {
+                    auto src = buf.channel(ch0 + c) + start;
+                    for (auto i = 0; i < n; i++) {
+                        lanes[i * W + c] = src[i];
+                    }
+                } else {
+                    for (auto i = 0; i < n; i++) {
+                        lanes[i * W + c] = 0.0f;
+                    }
+                }
+            }
+
+            for (auto s = 0; s < num_sections; s++) {
+                const auto& c = coeffs[s];
+                auto b0 = L::set1(c.b0);
+                auto b1 = L::set1(c.b1);
+                auto b2 = L::set1(c.b2);
+                auto a1 = L::set1(c.a1);
+                auto a2 = L::set1(c.a2);
+
+                auto st = state + s * KERNEL_STATE_SIZE * lane_stride + ch0;
+                auto x1 = L::load(st);
+                auto x2 = L::load(st + lane_stride);
+                auto y1 = L::load(st + 2 * lane_stride);
+                auto y2 = L::load(st + 3 * lane_stride);
+
+                for (auto i = 0; i < n; i++) {
+                    auto x = L::load(lanes + i * W);
+                    auto y = L::add(L::mul(b0, x), L::mul(b1, x1));
+                    y = L::add(y, L::mul(b2, x2));
+                    y = L::sub(y, L::mul(a1, y1));
+                    y = L::sub(y, L::mul(a2, y2));
+                    x2 = x1;
+                    y2 = y1;
+                    x1 = x;
+                    y1 = y;
+                    L::store(lanes + i * W, y);
+                }
+
+                L::store(st, x1);
+                L::store(st + lane_stride, x2);
+                L::store(st + 2 * lane_stride, y1);
+                L::store(st + 3 * lane_stride, y2);
+            }
+
+            // Scatter
+            for (auto c = 0; c < group; c++) {
+                auto dst = buf.channel(ch0 + c) + start;
+                for (auto i = 0; i < n; i++) {
+                    dst[i] = lanes[i * W + c];
+                }
+            }
+        }
+    }
+}
+
+// Look-ahead (state-space) form: W outputs per iteration, one channel at a time
+// The feedforward part runs first over the chunk. Each block of W outputs is then
+// y = H * v + P1 * y[-1] + P2 * y[-2], so only the P terms depend on the previous block.
+// matrices holds, per section, W columns of H followed by P1 and P2 (W floats each).
+template <typename L>
+constexpr int lookahead_matrix_size() {
+    return (L::WIDTH + 2) * L::WIDTH;
+}
+
+template <typename L>
+void process_lookahead_lanes(const BiquadCoeffs* coeffs, const float* matrices, int num_sections,
+                             float* state, int lane_stride, AudioBuffer& buf) {
+    constexpr auto W = L::WIDTH;
+    alignas(32) float v[KERNEL_CHUNK_FRAMES];
+
+    for (auto ch = 0; ch < buf.channels(); ch++) {
+        auto samples = buf.channel(ch);
+
+        for (auto start = 0; start < buf.frames(); start += KERNEL_CHUNK_FRAMES) {
+            auto n = std::min(KERNEL_CHUNK_FRAMES, buf.frames() - start);
+            auto x = samples + start;
+
+            for (auto s = 0; s < num_sections; s++) {
+                const auto& c = coeffs[s];
+                auto m = matrices + s * lookahead_matrix_size<L>();
+                auto st = state + s * KERNEL_STATE_SIZE * lane_stride + ch;
+                auto x1 = st[0];
+                auto x2 = st[lane_stride];
+                auto y1 = st[2 * lane_stride];
+                auto y2 = st[3 * lane_stride];
+
+                // Feedforward, independent across samples
+                for (auto i = 0; i < n; i++) {
+                    auto xi = x[i];
+                    v[i] = c.b0 * xi + c.b1 * x1 + c.b2 * x2;
+                    x2 = x1;
+                    x1 = xi;
+                }
+
+                // Feedback, W samples at a time
+                auto i = 0;
+                for (; i + W <= n; i += W) {
+                    auto y = L::mul(L::set1(v[i]), L::load(m));
+                    for (auto j = 1; j < W; j++) {
+                        y = L::add(y, L::mul(L::set1(v[i + j]), L::load(m + j * W)));
+                    }
+                    y = L::add(y, L::mul(L::set1(y1), L::load(m + W * W)));
+                    y = L::add(y, L::mul(L::set1(y2), L::load(m + W * W + W)));
+                    L::store(x + i, y);
+
+                    y1 = x[i + W - 1];
+                    y2 = x[i + W - 2];
+                }
+                for (; i < n; i++) {
+                    float y = v[i] - c.a1 * y1 - c.a2 * y2;
+                    y2 = y1;
+                    y1 = y;
+                    x[i] = y;
+                }
+
+                st[0] = x1;
+                st[lane_stride] = x2;
+                st[2 * lane_stride] = y1;
+                st[3 * lane_stride] = y2;
+            }
+        }
+    }
+}
+
+// Parallel (partial fraction) form: one channel at a time, with independent second-order sections
+// in lanes. coeffs is [group: [c0, c1, a1, a2: [W sections]]], padded with silent sections.
+// Per-channel state is [group: [y1, y2: [W]]] followed by x1.
+template <typename L>
+constexpr int parallel_state_size(int num_groups) {
+    return num_groups * 2 * L::WIDTH + 1;
+}
+
+template <typename L>
+void process_parallel_lanes(const float* coeffs, int num_groups, float direct, float* state,
+                            AudioBuffer& buf) {
+    constexpr auto W = L::WIDTH;
+    alignas(32) float sum[KERNEL_CHUNK_FRAMES * W];
+
+    for (auto ch = 0; ch < buf.channels(); ch++) {
+        auto samples = buf.channel(ch);
+        auto ch_state = state + ch * parallel_state_size<L>(num_groups);
+        auto& x_prev = ch_state[num_groups * 2 * W];
+
+        for (auto start = 0; start < buf.frames(); start += KERNEL_CHUNK_FRAMES) {
+            auto n = std::min(KERNEL_CHUNK_FRAMES, buf.frames() - start);
+            auto x = samples + start;
+
+            for (auto g = 0; g < num_groups; g++) {
+                auto gc = coeffs + g * 4 * W;
+                auto c0 = L::load(gc);
+                auto c1 = L::load(gc + W);
+                auto a1 = L::load(gc + 2 * W);
+                auto a2 = L::load(gc + 3 * W);
+
+                auto st = ch_state + g * 2 * W;
+                auto y1 = L::load(st);
+                auto y2 = L::load(st + W);
+                auto x1 = L::set1(x_prev);
+
+                for (auto i = 0; i < n; i++) {
+                    auto xi = L::set1(x[i]);
+                    auto y = L::add(L::mul(c0, xi), L::mul(c1, x1));
+                    y = L::sub(y, L::mul(a1, y1));
+                    y = L::sub(y, L::mul(a2, y2));
+                    y2 = y1;
+                    y1 = y;
+                    x1 = xi;
+
+                    if (g == 0) {
+                        L::store(sum + i * W, y);
+                    } else {
+                        L::store(sum + i * W, L::add(L::load(sum + i * W), y));
+                    }
+                }
+
+                L::store(st, y1);
+                L::store(st + W, y2);
+            }
+
+            x_prev = x[n - 1];
+            for (auto i = 0; i < n; i++) {
+                auto y = direct * x[i];
+                for (auto l = 0; l < W; l++) {
+                    y += sum[i * W + l];
+                }
+                x[i] = y;
+            }
+        }
+    }
+}
+
+}
+}
@@ -0,0 +1,55 @@
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "block_convolver.h"
+
+namespace fxdsp {
+
+int PreparedFilters::max_frames() const {
+    auto max_frames = 0;
+    for (auto filter_frames : frames) {
+        max_frames = std::max(max_frames, filter_frames);
+    }
+
+    return max_frames;
+}
+
+void PreparedFilters::validate() const {
+    if (frames.empty()) {
+        throw std::invalid_argument("No prepared filters");
+    }
+    if (partition_size <= 0 || num_partitions <= 0 || fft_size < partition_size) {
+        throw std::invalid_argument("Invalid prepared filter sizes");
+    }
+    if (max_frames() > static_cast<int64_t>(partition_size) * num_partitions) {
+        throw std::invalid_argument("Prepared filters are longer than their partitions");
+    }
+
+    // Divided rather than multiplied out, as corrupt sizes could wrap the product
+    auto filter_bins = static_cast<uint64_t>(num_partitions) * fft_bins();
+    if (bins.size() % num_filters() != 0 || bins.size() / num_filters() != filter_bins) {
+        throw std::invalid_argument("Prepared filters have " + std::to_string(bins.size()) + " bins, expected " +
+                                    std::to_string(filter_bins) + " per filter");
+    }
+}
+
+std::vector<std::vector<float>> PreparedFilters::to_taps() const {
+    // Prescaled for the unscaled inverse, so this gives the taps back
+    auto fft = RealFft::create(fft_size, FFT_BACKEND_KISS);
+    std::vector<float> time(fft_size);
+    std::vector<std::vector<float>> taps(frames.size());
+    for (size_t f = 0; f < frames.size(); f++) {
+        taps[f].reserve(partition_size * num_partitions);
+        for (auto k = 0; k < num_partitions; k++) {
+            fft->inverse(bins.data() + (f * num_partitions + k) * fft_bins(), time.data());
+            taps[f].insert(taps[f].end(), time.begin(), time.begin() + partition_size);
+        }
+        taps[f].resize(frames[f]);
+    }
+
+    return taps;
+}
+
+}
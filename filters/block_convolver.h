@@ -0,0 +1,62 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "../audio_buffer.h"
+#include "../util/fft.h"
+
+namespace fxdsp {
+
+// One input channel convolved with one filter, summed into one output channel
+struct ConvolutionPath {
+    int input;
+    int output;
+    int filter;
+};
+
+// One filter already transformed for SingleBlockConvolver: the spectrum of its taps zero-padded to
+// fft_size, scaled by 1 / fft_size for the engine's unscaled inverse FFT
+struct FilterSpectrum {
+    // Taps before padding
+    int frames;
+    int fft_size;
+    // fft_size / 2 + 1
+    std::vector<FftComplex> bins;
+};
+
+// Filters already partitioned and transformed in an engine's layout, [filter: [partition: [bins]]],
+// each partition's taps zero-padded to fft_size and scaled by 1 / fft_size
+// Engines only read the bins, which stay alive as long as owner: e.g. a mapped kernel file that any
+// number of engines can share.
+struct PreparedFilters {
+    // Taps per partition: the block size for UniformConvolver, the longest filter for SingleBlockConvolver
+    int partition_size;
+    int num_partitions;
+    int fft_size;
+    // Taps per filter, before padding
+    std::vector<int> frames;
+    std::span<const FftComplex> bins;
+    std::shared_ptr<const void> owner;
+
+    int fft_bins() const { return fft_size / 2 + 1; }
+    int num_filters() const { return static_cast<int>(frames.size()); }
+    int max_frames() const;
+    // Throws std::invalid_argument unless the sizes are consistent
+    void validate() const;
+    // Taps of each filter, by inverse transforms
+    std::vector<std::vector<float>> to_taps() const;
+};
+
+// Convolution engine that processes fixed-size blocks with no delay in stream positions
+class BlockConvolver {
+public:
+    virtual ~BlockConvolver() {}
+
+    // Both must have the engine's block size in frames, and can be the same buffer
+    virtual void process(const AudioBuffer& in, AudioBuffer& out) = 0;
+    virtual void reset() = 0;
+};
+
+}
@@ -1,13 +1,15 @@
+#include <bit>
 #include <span>
 
 #include "fir_design.h"
+#include "single_block_convolver.h"
 #include "../log.h"
 #include "../util/amplitude.h"
+#include "../util/fft.h"
 #include "../util/math_ext.h"
 #include "../util/window.h"
 
 #include <boost/math/interpolators/makima.hpp>
-#include "../external/kissfft/kiss_fftr.h"
 
 namespace fxdsp::fir {
 
@@ -15,29 +17,48 @@ using namespace std::complex_literals;
 
 // Value for freq=0
 static constexpr float FREQ_EPSILON = 1e-7;
+// Fast minimum phase designs check their response on a grid this much finer than the filter
+static constexpr int RESPONSE_OVERSAMPLING = 4;
+// Bins this far below the peak are dominated by rounding, not by the design
+static constexpr float RESPONSE_FLOOR_DB = -80.0f;
+// Fast designs stop doubling their FFT once the error improves by less than this
+static constexpr double MIN_PHASE_MIN_IMPROVEMENT_DB = 0.0001;
 
 // Homomorphic out size = (N + 1) / 2, prefers odd N
 static constexpr int get_min_phase_size(int size) {
     return size * 2 - 1;
 }
 
+// scipy's default, with ~1% cepstral aliasing
+static int get_reference_min_phase_fft_size(size_t linear_size) {
+    return static_cast<int>(pow(2.0f, ceil(log2(2 * (linear_size - 1) / 0.01))));
+}
+
+static size_t check_min_phase_out(size_t linear_size, const std::vector<float>& out) {
+    auto out_size = (linear_size / 2) + (linear_size % 2);
+    if (out.size() < out_size) {
+        throw std::out_of_range("Output buffer (" + std::to_string(out.size()) +
+                                ") too small for minimum phase filter (" + std::to_string(out_size) +
+                                ")");
+    }
+
+    return out_size;
+}
+
 static bool filter_to_minimum_phase(std::span<float> linear, std::vector<float>& out) {
     // Mostly a translation of https://github.com/scipy/scipy/blob/v1.7.1/scipy/signal/fir_filter_design.py#L1091-L1263
-    auto n_fft = static_cast<int>(pow(2.0f, ceil(log2(2 * (linear.size() - 1) / 0.01))));
+    auto n_fft = get_reference_min_phase_fft_size(linear.size());
 
-    auto cfg = kiss_fft_alloc(n_fft, false, nullptr, nullptr);
-    if (cfg == nullptr) {
-        return false;
-    }
+    ComplexFft fft(n_fft);
 
     // Convert to real-only complex and zero-pad
-    std::vector<kiss_fft_cpx> time_buf(n_fft);
+    std::vector<FftComplex> time_buf(n_fft);
     for (int i = 0; i < linear.size(); i++) {
         time_buf[i].r = linear[i];
     }
 
-    std::vector<kiss_fft_cpx> freq_buf(n_fft);
-    kiss_fft(cfg, time_buf.data(), freq_buf.data());
+    std::vector<FftComplex> freq_buf(n_fft);
+    fft.forward(time_buf.data(), freq_buf.data());
 
     // Convert to real-only magnitude
     float min_pos = std::numeric_limits<float>::infinity();
@@ -45,8 +66,8 @@ static bool filter_to_minimum_phase(std::span<float> linear, std::vector<float>&
         auto mag = sqrt(bin.r * bin.r + bin.i * bin.i);
         bin = { .r = mag };
 
-        // Find min positive for log adjustment
-        if (mag < min_pos) {
+        // Find min positive for log adjustment. Bins can underflow to exactly 0.
+        if (mag > 0.0f && mag < min_pos) {
             min_pos = mag;
         }
     }
@@ -57,12 +78,7 @@ static bool filter_to_minimum_phase(std::span<float> linear, std::vector<float>&
     }
 
     // Back to time domain, real-only
-    auto icfg = kiss_fft_alloc(n_fft, true, nullptr, nullptr);
-    if (icfg == nullptr) {
-        free(cfg);
-        return false;
-    }
-    kiss_fft(icfg, freq_buf.data(), time_buf.data());
+    fft.inverse(freq_buf.data(), time_buf.data());
 
     // Homomorphic filter
     std::vector<float> window(n_fft);
@@ -77,22 +93,15 @@ static bool filter_to_minimum_phase(std::span<float> linear, std::vector<float>&
     }
 
     // exp in freq domain
-    kiss_fft(cfg, time_buf.data(), freq_buf.data());
+    fft.forward(time_buf.data(), freq_buf.data());
     for (auto& bin : freq_buf) {
         std::complex<float> cpx(bin.r, bin.i);
         cpx = exp(cpx) / static_cast<float>(n_fft);
         bin = { .r = cpx.real(), .i = cpx.imag() };
     }
-    kiss_fft(icfg, freq_buf.data(), time_buf.data());
-    free(cfg);
-    free(icfg);
+    fft.inverse(freq_buf.data(), time_buf.data());
 
-    auto out_size = (linear.size() / 2) + (linear.size() % 2);
-    if (out.size() < out_size) {
-        throw std::out_of_range("Output buffer (" + std::to_string(out.size()) +
-                                ") too small for minimum phase filter (" + std::to_string(out_size) +
-                                ")");
-    }
+    auto out_size = check_min_phase_out(linear.size(), out);
 
     // Truncate, real-only
     for (int i = 0; i < out_size; i++) {
@@ -102,11 +111,180 @@ static bool filter_to_minimum_phase(std::span<float> linear, std::vector<float>&
     return true;
 }
 
+// Same conversion with real FFTs, out.size() taps from an n_fft cepstrum
+// Single transforms only, so the scalar backend avoids the SIMD one's batch scratch.
+static void min_phase_real(std::span<const float> linear, int n_fft, std::vector<float>& out) {
+    auto fft = RealFft::create(n_fft, FFT_BACKEND_KISS);
+    // Room for the spectrum, so every step can run in place
+    std::vector<float> time_buf(n_fft + 2);
+    auto freq_buf = reinterpret_cast<FftComplex*>(time_buf.data());
+    auto bins = fft->bins();
+
+    std::copy(linear.begin(), linear.end(), time_buf.begin());
+    fft->forward(time_buf.data(), freq_buf);
+
+    // Log magnitude, which is real and even, so the cepstrum is too
+    float min_pos = std::numeric_limits<float>::infinity();
+    for (auto i = 0; i < bins; i++) {
+        auto& bin = freq_buf[i];
+        bin = { .r = static_cast<float>(sqrt(bin.r * bin.r + bin.i * bin.i)) };
+        if (bin.r > 0.0f) {
+            min_pos = std::min(min_pos, bin.r);
+        }
+    }
+    for (auto i = 0; i < bins; i++) {
+        freq_buf[i].r = 0.5f * log(freq_buf[i].r + (FREQ_EPSILON * min_pos)) / static_cast<float>(n_fft);
+    }
+    fft->inverse(freq_buf, time_buf.data());
+
+    // Homomorphic filter: fold the anti-causal half onto the causal half
+    auto stop = static_cast<int>((linear.size() + 1) / 2);
+    for (auto i = 1; i < stop; i++) {
+        time_buf[i] *= 2.0f;
+    }
+    if (linear.size() % 2 == 0) {
+        time_buf[stop] = 0.0f;
+    }
+    std::fill(time_buf.begin() + stop + 1, time_buf.begin() + n_fft, 0.0f);
+
+    // exp in freq domain
+    fft->forward(time_buf.data(), freq_buf);
+    for (auto i = 0; i < bins; i++) {
+        auto& bin = freq_buf[i];
+        auto cpx = std::exp(std::complex<float>(bin.r, bin.i)) / static_cast<float>(n_fft);
+        bin = { .r = cpx.real(), .i = cpx.imag() };
+    }
+    fft->inverse(freq_buf, time_buf.data());
+
+    std::copy_n(time_buf.begin(), out.size(), out.begin());
+}
+
+// Same as RealFft::inverse of out.size() (any size), through power-of-two FFTs with Bluestein's
+// algorithm. kissfft is O(N * p) for a large prime factor p, e.g. 2 * 4999 taps = 2 * 13 * 769.
+static void inverse_real_chirp_z(const std::vector<FftComplex>& bins, std::vector<float>& out) {
+    auto n = static_cast<int64_t>(out.size());
+    auto m = static_cast<int>(std::bit_ceil(static_cast<size_t>(2 * n - 1)));
+    ComplexFft fft(m);
+
+    // exp(i*pi*k^2/n), with k^2 reduced mod 2n so the angle stays exact
+    std::vector<std::complex<double>> chirp(n);
+    for (int64_t k = 0; k < n; k++) {
+        chirp[k] = std::polar(1.0, M_PI * static_cast<double>((k * k) % (2 * n)) / static_cast<double>(n));
+    }
+
+    // 2kt = k^2 + t^2 - (t - k)^2, so the IDFT is a convolution of the chirped spectrum with the
+    // conjugate chirp, over lags -(n - 1)..n - 1
+    std::vector<FftComplex> spectrum(m), kernel(m);
+    for (int64_t k = 0; k < n; k++) {
+        // Hermitian
+        auto& bin = bins[k <= n / 2 ? k : n - k];
+        auto coeff = std::complex<double>(bin.r, k <= n / 2 ? bin.i : -bin.i) * chirp[k];
+        spectrum[k] = { .r = static_cast<float>(coeff.real()), .i = static_cast<float>(coeff.imag()) };
+
+        auto lag = std::conj(chirp[k]);
+        kernel[k] = { .r = static_cast<float>(lag.real()), .i = static_cast<float>(lag.imag()) };
+        if (k > 0) {
+            kernel[m - k] = kernel[k];
+        }
+    }
+
+    std::vector<FftComplex> spectrum_freq(m), kernel_freq(m);
+    fft.forward(spectrum.data(), spectrum_freq.data());
+    fft.forward(kernel.data(), kernel_freq.data());
+    for (auto i = 0; i < m; i++) {
+        auto product = std::complex<float>(spectrum_freq[i].r, spectrum_freq[i].i) *
+                       std::complex<float>(kernel_freq[i].r, kernel_freq[i].i) / static_cast<float>(m);
+        spectrum_freq[i] = { .r = product.real(), .i = product.imag() };
+    }
+    fft.inverse(spectrum_freq.data(), spectrum.data());
+
+    for (int64_t t = 0; t < n; t++) {
+        out[t] = static_cast<float>((std::complex<double>(spectrum[t].r, spectrum[t].i) * chirp[t]).real());
+    }
+}
+
+// Magnitude of taps on an n_fft grid, up to Nyquist
+static std::vector<float> magnitude_response(std::span<const float> taps, RealFft& fft) {
+    std::vector<float> time(fft.size());
+    std::copy(taps.begin(), taps.end(), time.begin());
+    std::vector<FftComplex> freq(fft.bins());
+    fft.forward(time.data(), freq.data());
+
+    std::vector<float> mag(fft.bins());
+    for (auto i = 0; i < fft.bins(); i++) {
+        mag[i] = std::hypot(freq[i].r, freq[i].i);
+    }
+    return mag;
+}
+
+// Starts from the smallest FFT that holds the cepstrum and doubles it until the taps' magnitude
+// response is within max_error_db of the target, sqrt(|linear|), at every bin in [band_low, band_high]
+// (normalized to Nyquist) above RESPONSE_FLOOR_DB. Targets it can't reach get the most accurate
+// taps seen, once doubling stops helping or at the reference size. The cepstrum at that size is the
+// reference conversion's, so running that too would only repeat the work.
+static bool filter_to_minimum_phase_fast(std::span<float> linear, std::vector<float>& out,
+                                         float max_error_db, float band_low, float band_high) {
+    auto out_size = check_min_phase_out(linear.size(), out);
+    auto max_fft = get_reference_min_phase_fft_size(linear.size());
+    auto n_fft = std::min(static_cast<int>(std::bit_ceil(linear.size())), max_fft);
+
+    // Fine enough to see the response between the bins of any n_fft
+    auto response_fft = RealFft::create(static_cast<int>(std::bit_ceil(linear.size())) * RESPONSE_OVERSAMPLING,
+                                        FFT_BACKEND_KISS);
+    auto target = magnitude_response(linear, *response_fft);
+    auto peak = 0.0f;
+    for (auto& mag : target) {
+        mag = std::sqrt(mag);
+        peak = std::max(peak, mag);
+    }
+    auto floor = peak * amplitude::db_to_linear(RESPONSE_FLOOR_DB);
+    // Outside the band, the response only has to reach the 0 dB ends, which it can't do exactly
+    auto last_bin = static_cast<double>(target.size() - 1);
+    auto first_checked = static_cast<size_t>(std::ceil(band_low * last_bin));
+    auto last_checked = static_cast<size_t>(std::floor(band_high * last_bin));
+
+    std::vector<float> result(out_size);
+    auto best_error_db = std::numeric_limits<double>::infinity();
+    auto last_error_db = best_error_db;
+    while (true) {
+        min_phase_real(linear, n_fft, result);
+
+        auto response = magnitude_response(result, *response_fft);
+        auto error_db = 0.0;
+        for (auto i = first_checked; i <= last_checked; i++) {
+            if (target[i] > floor) {
+                auto db = 20.0 * log10(std::max(response[i], 1e-30f) / target[i]);
+                error_db = std::max(error_db, std::abs(db));
+            }
+        }
+
+        if (error_db < best_error_db) {
+            std::copy(result.begin(), result.end(), out.begin());
+            best_error_db = error_db;
+        }
+        if (error_db <= max_error_db || n_fft >= max_fft) {
+            return true;
+        }
+
+        // Aliasing halves with each doubling, so the error converges on what truncation leaves, and
+        // about as much as the last step gained is left. Early on, the error can also grow as
+        // aliasing stops cancelling out.
+        auto improvement = last_error_db - error_db;
+        if (improvement >= 0.0 && improvement < MIN_PHASE_MIN_IMPROVEMENT_DB) {
+            return true;
+        }
+        last_error_db = error_db;
+        n_fft *= 2;
+    }
+}
+
 bool make_filter(std::vector<float>& freqs,
                  std::vector<float>& gains,
                  std::vector<float>& out,
                  float sample_rate,
-                 bool minimum_phase) {
+                 bool minimum_phase,
+                 float max_error_db) {
+    auto fast = max_error_db > 0.0f;
     auto n_taps = out.size();
     if (minimum_phase) {
         n_taps = get_min_phase_size(n_taps);
@@ -121,6 +299,9 @@ bool make_filter(std::vector<float>& freqs,
     }
     // Always use normalized freqs internally
     nyquist = 1.0f;
+    // Where the response is specified, for checking fast designs
+    auto band_low = freqs.empty() ? 0.0f : std::clamp(freqs.front(), 0.0f, nyquist);
+    auto band_high = freqs.empty() ? nyquist : std::clamp(freqs.back(), 0.0f, nyquist);
 
     // Add freqs ~0 (to avoid breaking log) and Nyquist, both 0 dB gain
     freqs.insert(freqs.begin(), FREQ_EPSILON);
@@ -161,31 +342,31 @@ bool make_filter(std::vector<float>& freqs,
 
     // Interpolate in linear frequency domain and create FFT coefficients
     spline = boost::math::interpolators::makima(std::move(linear_freqs), std::move(linear_gains));
-    std::vector<kiss_fft_cpx> freq_taps(n_taps);
+    // Real IFFT size = (complex coefficients)*2, so there is one more bin for Nyquist, left at 0.
+    auto fft_size = static_cast<int>(n_taps * 2);
+    auto fft = RealFft::create(fft_size, FFT_BACKEND_KISS);
+    std::vector<FftComplex> freq_taps(fft->bins());
     // Linear phase term to avoid non-casual filter
     auto freq_coeff = -static_cast<float>(n_taps - 1) / 2.0f * 1.0if * PI / nyquist;
-    for (auto i = 0; i < n_taps; i++) {
+    for (auto i = 0; i < static_cast<int>(n_taps); i++) {
         auto freq = step * i;
         auto gain = spline(freq);
 
         auto coeff = exp(freq_coeff * freq) * gain;
 
         // Scale for IFFT
-        coeff /= static_cast<float>(n_taps) * 2;
-        // std::complex -> kiss_fft_cpx
-        // TODO: remove after switching to pocketfft
+        coeff /= static_cast<float>(fft_size);
+        // std::complex -> FftComplex
         freq_taps[i] = { .r = coeff.real(), .i = coeff.imag() };
     }
 
     // Inverse real-only FFT
-    auto cfg = kiss_fftr_alloc(static_cast<int>(n_taps * 2), true, nullptr, nullptr);
-    if (cfg == nullptr) {
-        return false;
+    std::vector<float> ifft_buf(fft->size());
+    if (fast && next_fft_size(fft_size) != fft_size) {
+        inverse_real_chirp_z(freq_taps, ifft_buf);
+    } else {
+        fft->inverse(freq_taps.data(), ifft_buf.data());
     }
-    // Allocate temporary buffer to accommodate results: real IFFT size = (complex coefficients)*2
-    std::vector<float> ifft_buf(n_taps * 2);
-    kiss_fftri(cfg, freq_taps.data(), ifft_buf.data());
-    free(cfg);
 
     // Window first N coefficients for truncation
     for (auto i = 0; i < n_taps; i++) {
@@ -195,6 +376,9 @@ bool make_filter(std::vector<float>& freqs,
 
     if (minimum_phase) {
         std::span<float> linear(ifft_buf.data(), n_taps);
+        if (fast) {
+            return filter_to_minimum_phase_fast(linear, out, max_error_db, band_low, band_high);
+        }
         return filter_to_minimum_phase(linear, out);
     }
 
@@ -204,4 +388,25 @@ bool make_filter(std::vector<float>& freqs,
     return true;
 }
 
+bool make_filter_spectrum(std::vector<float>& freqs,
+                          std::vector<float>& gains,
+                          FilterSpectrum& out,
+                          float sample_rate,
+                          bool minimum_phase,
+                          float max_error_db) {
+    // Before designing, which takes far longer than the transform that would throw
+    if (out.fft_size < out.frames) {
+        throw std::invalid_argument("FFT size (" + std::to_string(out.fft_size) + ") too small for filter (" +
+                                    std::to_string(out.frames) + ")");
+    }
+
+    std::vector<float> taps(out.frames);
+    if (!make_filter(freqs, gains, taps, sample_rate, minimum_phase, max_error_db)) {
+        return false;
+    }
+
+    out = SingleBlockConvolver::transform_filter(taps, out.fft_size);
+    return true;
+}
+
 }
@@ -3,6 +3,8 @@
 #include <vector>
 #include <complex>
 
+#include "block_convolver.h"
+
 namespace fxdsp::fir {
 
 // Number of taps = out.size()
@@ -11,10 +13,26 @@ namespace fxdsp::fir {
 // freqs will be mutated
 // gains should be in dB
 // This will allocate memory for temporary storage
+// max_error_db = 0 designs as scipy does, with a ~100x oversampled complex FFT for the minimum phase
+// conversion (~1 s for 5000 taps). Otherwise, the minimum phase conversion uses real FFTs only as
+// large as needed for the magnitude response to be within max_error_db of the target at every
+// frequency between the first and last of freqs. Targets tighter than scipy's conversion reaches
+// get the closest taps, at no more than its cost.
 bool make_filter(std::vector<float> &freqs,
                  std::vector<float> &gains,
                  std::vector<float> &out,
                  float sample_rate = 2.0f,
-                 bool minimum_phase = true);
+                 bool minimum_phase = true,
+                 float max_error_db = 0.0f);
+
+// Same design, transformed for SingleBlockConvolver: out.frames taps at out.fft_size, written to
+// out.bins. Saves the engine from transforming the taps again.
+// Throws std::invalid_argument if out.fft_size < out.frames.
+bool make_filter_spectrum(std::vector<float> &freqs,
+                          std::vector<float> &gains,
+                          FilterSpectrum &out,
+                          float sample_rate = 2.0f,
+                          bool minimum_phase = true,
+                          float max_error_db = 0.0f);
 
 }
@@ -0,0 +1,399 @@
+#include <chrono>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <random>
+#include <utility>
+
+#include "iir_plan.h"
+#include "biquad_bank.h"
+#include "biquad_kernel.h"
+#include "../util/cpu_features.h"
+#include "../log.h"
+
+namespace fxdsp {
+
+#if defined(__x86_64__)
+// biquad_avx2.cpp
+void process_biquad_parallel_avx2(const float* coeffs, int num_groups, float direct, float* state,
+                                  AudioBuffer& buf);
+
+using DefaultLanes = SseLanes;
+#elif defined(__ARM_NEON)
+using DefaultLanes = NeonLanes;
+#else
+using DefaultLanes = ScalarLanes;
+#endif
+
+// Poles closer than this can't be expanded into partial fractions reliably
+static constexpr auto MIN_POLE_DISTANCE = 1e-6;
+// Parallel form must be about as accurate as the cascade it replaces
+static constexpr auto PARALLEL_ERROR_RATIO = 4.0;
+static constexpr auto PARALLEL_CHECK_FRAMES = 4096;
+
+// Micro-benchmark for IIR_FORM_AUTO
+static constexpr auto BENCH_FRAMES = 256;
+static constexpr auto BENCH_ITERATIONS = 8;
+static constexpr auto BENCH_ROUNDS = 3;
+// Pole radius of the cascades timed for IIR_FORM_AUTO
+static constexpr auto BENCH_POLE_RADIUS = 0.9;
+// IIR_FORM_AUTO only switches from the previous form to one at least this much faster
+static constexpr auto FORM_SWITCH_SPEEDUP = 1.25;
+
+const char* iir_form_name(IirForm form) {
+    switch (form) {
+        case IIR_FORM_AUTO: return "auto";
+        case IIR_FORM_CASCADE: return "cascade";
+        case IIR_FORM_LOOKAHEAD: return "lookahead";
+        case IIR_FORM_PARALLEL: return "parallel";
+    }
+
+    return "unknown";
+}
+
+// Sections per group in biquad_avx2.cpp
+static constexpr auto AVX2_LANES = 8;
+
+IirPlan::IirPlan(int channels, std::vector<BiquadCoeffs> sections, IirForm form, const IirPlan* previous) :
+        form(IIR_FORM_CASCADE),
+        num_channels(channels),
+        sections(std::move(sections)),
+        parallel_lanes(0),
+        parallel_groups(0),
+        parallel_direct(0.0f),
+        parallel_rejected(false) {
+    auto num_sections = static_cast<int>(this->sections.size());
+    auto parallel_built = false;
+    if (form == IIR_FORM_AUTO) {
+        auto previous_form = previous != nullptr && previous->num_channels == channels ? previous->form
+                                                                                       : IIR_FORM_AUTO;
+        form = choose_form(channels, num_sections, previous_form, true);
+        if (form == IIR_FORM_PARALLEL) {
+            parallel_built = try_parallel(previous);
+            if (!parallel_built) {
+                form = choose_form(channels, num_sections, previous_form, false);
+            }
+        }
+    } else if (form == IIR_FORM_PARALLEL) {
+        parallel_built = try_parallel(previous);
+    }
+
+    if (form == IIR_FORM_LOOKAHEAD) {
+        constexpr auto W = DefaultLanes::WIDTH;
+        lookahead_matrices.resize(this->sections.size() * lookahead_matrix_size<DefaultLanes>());
+
+        for (size_t s = 0; s < this->sections.size(); s++) {
+            double a1 = this->sections[s].a1;
+            double a2 = this->sections[s].a2;
+            auto m = lookahead_matrices.data() + s * lookahead_matrix_size<DefaultLanes>();
+
+            // Impulse response of the feedback part, and responses to initial y[-1] and y[-2]
+            double h[W], p1[W], p2[W];
+            for (auto i = 0; i < W; i++) {
+                auto prev = [](const double* r, int k, double init1, double init2) {
+                    return (k >= 0) ? r[k] : (k == -1 ? init1 : init2);
+                };
+                h[i] = (i == 0 ? 1.0 : 0.0) - a1 * prev(h, i - 1, 0.0, 0.0) - a2 * prev(h, i - 2, 0.0, 0.0);
+                p1[i] = -a1 * prev(p1, i - 1, 1.0, 0.0) - a2 * prev(p1, i - 2, 1.0, 0.0);
+                p2[i] = -a1 * prev(p2, i - 1, 0.0, 1.0) - a2 * prev(p2, i - 2, 0.0, 1.0);
+            }
+
+            for (auto j = 0; j < W; j++) {
+                for (auto i = 0; i < W; i++) {
+                    m[j * W + i] = static_cast<float>(i >= j ? h[i - j] : 0.0);
+                }
+            }
+            for (auto i = 0; i < W; i++) {
+                m[W * W + i] = static_cast<float>(p1[i]);
+                m[W * W + W + i] = static_cast<float>(p2[i]);
+            }
+        }
+
+        this->form = IIR_FORM_LOOKAHEAD;
+    } else if (parallel_built) {
+        this->form = IIR_FORM_PARALLEL;
+    }
+}
+
+bool IirPlan::same_poles(const IirPlan& other) const {
+    return num_channels == other.num_channels &&
+           std::equal(sections.begin(), sections.end(), other.sections.begin(), other.sections.end(),
+                      [](const BiquadCoeffs& a, const BiquadCoeffs& b) { return a.a1 == b.a1 && a.a2 == b.a2; });
+}
+
+// Parallel form loses precision where poles are close together or near the unit circle, so the
+// check is skipped while the poles stay the same as previous's, e.g. for gain changes
+bool IirPlan::try_parallel(const IirPlan* previous) {
+    auto same = previous != nullptr && same_poles(*previous);
+    if (same && previous->parallel_rejected) {
+        parallel_rejected = true;
+        return false;
+    }
+
+    parallel_rejected = !build_parallel(!(same && previous->form == IIR_FORM_PARALLEL));
+    return !parallel_rejected;
+}
+
+bool IirPlan::build_parallel(bool check_precision) {
+    using complex = std::complex<double>;
+
+    auto num_sections = static_cast<int>(sections.size());
+    if (num_sections == 0) {
+        return false;
+    }
+
+    // A(w) = 1 + a1 w + a2 w^2 = (1 - p w)(1 - q w) for each section
+    std::vector<complex> poles(num_sections * 2);
+    for (auto j = 0; j < num_sections; j++) {
+        double a1 = sections[j].a1;
+        double a2 = sections[j].a2;
+        if (std::abs(a2) < std::numeric_limits<float>::epsilon()) {
+            // Fewer than two poles: would need an FIR part
+            return false;
+        }
+
+        auto root = std::sqrt(complex(a1 * a1 - 4.0 * a2));
+        poles[j * 2] = (-a1 + root) / 2.0;
+        poles[j * 2 + 1] = (-a1 - root) / 2.0;
+    }
+
+    for (size_t i = 0; i < poles.size(); i++) {
+        for (size_t k = i + 1; k < poles.size(); k++) {
+            if (std::abs(poles[i] - poles[k]) < MIN_POLE_DISTANCE) {
+                return false;
+            }
+        }
+    }
+
+    auto numerator = [&](int j, complex w) {
+        auto& c = sections[j];
+        return complex(c.b0) + complex(c.b1) * w + complex(c.b2) * w * w;
+    };
+    auto response = [&](int j, complex w) {
+        auto& c = sections[j];
+        return numerator(j, w) / (1.0 + complex(c.a1) * w + complex(c.a2) * w * w);
+    };
+
+    // H(w) = d + sum r_k / (1 - p_k w)
+    std::vector<complex> residues(poles.size());
+    for (size_t k = 0; k < poles.size(); k++) {
+        auto j = static_cast<int>(k / 2);
+        auto w = 1.0 / poles[k];
+        auto r = numerator(j, w) / (1.0 - poles[k ^ 1] * w);
+        for (auto i = 0; i < num_sections; i++) {
+            if (i != j) {
+                r *= response(i, w);
+            }
+        }
+        residues[k] = r;
+    }
+
+    double direct = 1.0;
+    for (auto& c : sections) {
+        direct *= static_cast<double>(c.b2) / static_cast<double>(c.a2);
+    }
+
+    // Recombine each section's poles into real second-order sections
+    auto W = cpu_features::has_avx2() ? AVX2_LANES : DefaultLanes::WIDTH;
+    parallel_lanes = W;
+    parallel_groups = (num_sections + W - 1) / W;
+    parallel_coeffs.assign(parallel_groups * 4 * W, 0.0f);
+    for (auto j = 0; j < num_sections; j++) {
+        auto p = poles[j * 2];
+        auto q = poles[j * 2 + 1];
+        auto rp = residues[j * 2];
+        auto rq = residues[j * 2 + 1];
+
+        auto gc = parallel_coeffs.data() + (j / W) * 4 * W + (j % W);
+        gc[0] = static_cast<float>((rp + rq).real());
+        gc[W] = static_cast<float>((-(rp * q + rq * p)).real());
+        gc[2 * W] = sections[j].a1;
+        gc[3 * W] = sections[j].a2;
+    }
+    parallel_direct = static_cast<float>(direct);
+    if (!check_precision) {
+        return true;
+    }
+
+    // Check precision against a double-precision cascade, compared to the float cascade
+    std::vector<double> reference(PARALLEL_CHECK_FRAMES);
+    AudioBuffer cascade_buf, parallel_buf;
+    cascade_buf.allocate(1, PARALLEL_CHECK_FRAMES);
+    parallel_buf.allocate(1, PARALLEL_CHECK_FRAMES);
+
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+    for (auto i = 0; i < PARALLEL_CHECK_FRAMES; i++) {
+        reference[i] = cascade_buf.channel(0)[i] = parallel_buf.channel(0)[i] = dist(rng);
+    }
+
+    for (auto& c : sections) {
+        double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+        for (auto& sample : reference) {
+            double y = c.b0 * sample + c.b1 * x1 + c.b2 * x2 - c.a1 * y1 - c.a2 * y2;
+            x2 = x1;
+            y2 = y1;
+            x1 = sample;
+            y1 = y;
+            sample = y;
+        }
+    }
+
+    auto old_form = form;
+    std::vector<float> state;
+
+    form = IIR_FORM_CASCADE;
+    state.assign(state_size(), 0.0f);
+    process(state.data(), cascade_buf);
+
+    form = IIR_FORM_PARALLEL;
+    state.assign(state_size(), 0.0f);
+    process(state.data(), parallel_buf);
+    form = old_form;
+
+    double ref_power = 0, cascade_err = 0, parallel_err = 0;
+    for (auto i = 0; i < PARALLEL_CHECK_FRAMES; i++) {
+        ref_power += reference[i] * reference[i];
+        cascade_err += std::pow(cascade_buf.channel(0)[i] - reference[i], 2);
+        parallel_err += std::pow(parallel_buf.channel(0)[i] - reference[i], 2);
+    }
+
+    auto max_err = std::max(cascade_err, ref_power * 1e-14) * PARALLEL_ERROR_RATIO * PARALLEL_ERROR_RATIO;
+    if (!std::isfinite(parallel_err) || parallel_err > max_err) {
+        ALOGV("Parallel IIR form too imprecise: %g dB vs %g dB for cascade\n",
+              10 * std::log10(parallel_err / ref_power), 10 * std::log10(cascade_err / ref_power));
+        parallel_coeffs.clear();
+        parallel_lanes = 0;
+        parallel_groups = 0;
+        return false;
+    }
+
+    return true;
+}
+
+int IirPlan::state_size() const {
+    if (form == IIR_FORM_PARALLEL) {
+        // Matches parallel_state_size()
+        return num_channels * (parallel_groups * 2 * parallel_lanes + 1);
+    }
+
+    return static_cast<int>(sections.size()) * BiquadBank::section_state_size(num_channels);
+}
+
+int IirPlan::section_state_size() const {
+    return form == IIR_FORM_PARALLEL ? 0 : BiquadBank::section_state_size(num_channels);
+}
+
+bool IirPlan::state_compatible(const IirPlan& other) const {
+    // Cascade and look-ahead use the same state
+    return (form == IIR_FORM_PARALLEL) == (other.form == IIR_FORM_PARALLEL) &&
+           num_channels == other.num_channels &&
+           state_size() == other.state_size();
+}
+
+void IirPlan::process(float* state, AudioBuffer& buf) const {
+    auto num_sections = static_cast<int>(sections.size());
+
+    switch (form) {
+        case IIR_FORM_LOOKAHEAD:
+            process_lookahead_lanes<DefaultLanes>(sections.data(), lookahead_matrices.data(), num_sections,
+                                                  state, BiquadBank::lane_stride(num_channels), buf);
+            break;
+        case IIR_FORM_PARALLEL:
+#if defined(__x86_64__)
+            if (parallel_lanes == AVX2_LANES) {
+                process_biquad_parallel_avx2(parallel_coeffs.data(), parallel_groups, parallel_direct,
+                                             state, buf);
+                break;
+            }
+#endif
+            process_parallel_lanes<DefaultLanes>(parallel_coeffs.data(), parallel_groups, parallel_direct,
+                                                 state, buf);
+            break;
+        default:
+            BiquadBank::process_cascade(sections.data(), num_sections, state, buf);
+            break;
+    }
+}
+
+// Fastest form for this cascade length, allowed to replace previous_form. Speed only depends on
+// the length, so each form is timed once per length and channel count, on a cascade with distinct
+// poles that every form supports.
+IirForm IirPlan::choose_form(int channels, int num_sections, IirForm previous_form, bool allow_parallel) {
+    static std::mutex cache_lock;
+    static std::map<std::pair<int, int>, std::map<IirForm, double>> timing_cache;
+
+    std::map<IirForm, double> timings;
+    {
+        std::lock_guard lock(cache_lock);
+        auto& cached = timing_cache[{ channels, num_sections }];
+        if (cached.empty()) {
+            std::vector<BiquadCoeffs> bench_sections;
+            auto bench_count = std::max(num_sections, 1);
+            for (auto j = 0; j < bench_count; j++) {
+                auto angle = M_PI * (j + 0.5) / bench_count;
+                bench_sections.push_back({ 1.0f, 0.0f, 0.0f,
+                                           static_cast<float>(-2.0 * BENCH_POLE_RADIUS * std::cos(angle)),
+                                           static_cast<float>(BENCH_POLE_RADIUS * BENCH_POLE_RADIUS) });
+            }
+
+            std::vector<IirPlan> plans;
+            plans.emplace_back(channels, bench_sections, IIR_FORM_CASCADE);
+            plans.emplace_back(channels, bench_sections, IIR_FORM_LOOKAHEAD);
+            IirPlan parallel(channels, bench_sections, IIR_FORM_CASCADE);
+            if (parallel.build_parallel(false)) {
+                parallel.form = IIR_FORM_PARALLEL;
+                plans.push_back(std::move(parallel));
+            }
+
+            AudioBuffer buf;
+            buf.allocate(channels, BENCH_FRAMES);
+            std::mt19937 rng(1);
+            std::uniform_real_distribution<float> dist(-0.5f, 0.5f);
+            for (auto ch = 0; ch < channels; ch++) {
+                for (auto& sample : buf[ch]) {
+                    sample = dist(rng);
+                }
+            }
+
+            for (auto& plan : plans) {
+                std::vector<float> state(plan.state_size());
+                auto best = std::numeric_limits<double>::infinity();
+                for (auto round = 0; round < BENCH_ROUNDS; round++) {
+                    auto start = std::chrono::steady_clock::now();
+                    for (auto i = 0; i < BENCH_ITERATIONS; i++) {
+                        plan.process(state.data(), buf);
+                    }
+                    auto end = std::chrono::steady_clock::now();
+                    best = std::min(best, std::chrono::duration<double>(end - start).count());
+                }
+
+                cached[plan.get_form()] = best;
+            }
+        }
+        timings = cached;
+    }
+
+    if (!allow_parallel) {
+        timings.erase(IIR_FORM_PARALLEL);
+    }
+
+    auto chosen = IIR_FORM_CASCADE;
+    for (auto [form, time] : timings) {
+        if (time < timings[chosen]) {
+            chosen = form;
+        }
+    }
+
+    // Timings this close can swap between runs, and switching to or from parallel resets state
+    if (timings.contains(previous_form) && timings[chosen] * FORM_SWITCH_SPEEDUP > timings[previous_form]) {
+        chosen = previous_form;
+    }
+
+    ALOGV("IIR form for %d sections, %d channels: %s\n", num_sections, channels, iir_form_name(chosen));
+    return chosen;
+}
+
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+
+#include "biquad.h"
+#include "../audio_buffer.h"
+
+namespace fxdsp {
+
+// How a biquad cascade is evaluated. All forms have the same response.
+enum IirForm {
+    // Pick the fastest form for the cascade length with a micro-benchmark
+    IIR_FORM_AUTO,
+    // Sections in series, channels in SIMD lanes
+    IIR_FORM_CASCADE,
+    // Sections in series, 4 outputs per iteration (state-space look-ahead)
+    IIR_FORM_LOOKAHEAD,
+    // Partial fraction expansion into independent sections, sections in SIMD lanes
+    IIR_FORM_PARALLEL,
+};
+
+const char* iir_form_name(IirForm form);
+
+// Precomputed, immutable plan for evaluating a biquad cascade
+// Built on the control thread. Processing state is owned by the caller, so that it can be
+// carried over to a new plan with the same state layout.
+class IirPlan {
+private:
+    IirForm form;
+    int num_channels;
+    std::vector<BiquadCoeffs> sections;
+
+    // Look-ahead: H and P matrices per section
+    std::vector<float> lookahead_matrices;
+
+    // Parallel: section coefficients in groups of SIMD lanes, and the constant term
+    std::vector<float> parallel_coeffs;
+    int parallel_lanes;
+    int parallel_groups;
+    float parallel_direct;
+    // Parallel form was tried and failed for these poles
+    bool parallel_rejected;
+
+    bool build_parallel(bool check_precision);
+    bool try_parallel(const IirPlan* previous);
+    bool same_poles(const IirPlan& other) const;
+    static IirForm choose_form(int channels, int num_sections, IirForm previous_form, bool allow_parallel);
+
+public:
+    // Unsupported forms fall back to IIR_FORM_CASCADE, e.g. parallel form for filters with
+    // repeated poles or poor precision.
+    // previous is the plan this one replaces, if any. Parallel precision is only checked again if a
+    // pole moved, and IIR_FORM_AUTO keeps previous's form unless another is clearly faster.
+    IirPlan(int channels, std::vector<BiquadCoeffs> sections, IirForm form = IIR_FORM_AUTO,
+            const IirPlan* previous = nullptr);
+
+    IirForm get_form() const { return form; }
+    int channels() const { return num_channels; }
+    int state_size() const;
+    // Floats of state per section, in section order, or 0 if state isn't per section (parallel form)
+    int section_state_size() const;
+    // Whether state from the other plan can be used for this one
+    bool state_compatible(const IirPlan& other) const;
+
+    // In place. state must hold state_size() floats.
+    void process(float* state, AudioBuffer& buf) const;
+};
+
+}
@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <unistd.h>
+
+#include "kernel_cache.h"
+
+namespace fxdsp {
+
+KernelKey::KernelKey(std::string_view kind, int version) {
+    add(kind);
+    add(version);
+}
+
+void KernelKey::append(const void* value, size_t size) {
+    data.append(static_cast<const char*>(value), size);
+}
+
+KernelKey& KernelKey::add(int value) {
+    append(&value, sizeof(value));
+    return *this;
+}
+
+KernelKey& KernelKey::add(int64_t value) {
+    append(&value, sizeof(value));
+    return *this;
+}
+
+KernelKey& KernelKey::add(float value) {
+    append(&value, sizeof(value));
+    return *this;
+}
+
+// Variable-length values are prefixed with their length, so adjacent values can't run together
+KernelKey& KernelKey::add(std::string_view value) {
+    add(static_cast<int64_t>(value.size()));
+    append(value.data(), value.size());
+    return *this;
+}
+
+KernelKey& KernelKey::add(std::span<const float> values) {
+    add(static_cast<int64_t>(values.size()));
+    append(values.data(), values.size_bytes());
+    return *this;
+}
+
+uint64_t KernelKey::hash() const {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (auto byte : data) {
+        hash ^= static_cast<uint8_t>(byte);
+        hash *= 0x100000001b3;
+    }
+
+    return hash;
+}
+
+}
+
+namespace fxdsp::kernel_cache {
+
+static constexpr char FILE_MAGIC[8] = { 'F', 'X', 'K', 'E', 'R', 'N', 'E', 'L' };
+static constexpr uint32_t FILE_VERSION = 1;
+static constexpr auto FILE_EXTENSION = ".kernels";
+// Rejects corrupt sizes before allocating for them
+static constexpr uint32_t MAX_FILE_KERNELS = 64;
+static constexpr int MAX_FILE_FFT_SIZE = 1 << 24;
+
+struct Entry {
+    std::shared_ptr<const KernelSet> kernels;
+    size_t bytes;
+    // Position in lru_order
+    std::list<KernelKey>::iterator lru_pos;
+};
+
+struct Cache {
+    std::mutex lock;
+    std::map<KernelKey, Entry> entries;
+    // Most recently used first
+    std::list<KernelKey> lru_order;
+    std::string directory;
+    size_t bytes = 0;
+    size_t budget = DEFAULT_BUDGET;
+    size_t disk_bytes = 0;
+    size_t disk_budget = DEFAULT_DISK_BUDGET;
+    uint64_t hits = 0;
+    uint64_t disk_hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+static Cache& get_cache() {
+    static Cache cache;
+    return cache;
+}
+
+static size_t kernel_bytes(const KernelSet& kernels) {
+    size_t bytes = 0;
+    for (auto& kernel : kernels) {
+        bytes += kernel.bins.size() * sizeof(FftComplex);
+    }
+
+    return bytes;
+}
+
+// Unlike FFT plans, kernels in use can be evicted: their users keep them alive
+static void evict(Cache& cache, size_t budget) {
+    while (cache.bytes > budget && !cache.lru_order.empty()) {
+        auto entry = cache.entries.find(cache.lru_order.back());
+        cache.bytes -= entry->second.bytes;
+        cache.evictions++;
+        cache.entries.erase(entry);
+        cache.lru_order.pop_back();
+    }
+}
+
+// Caller holds the lock. Keeps an existing entry, so all users share one copy.
+static std::shared_ptr<const KernelSet> add_entry(Cache& cache, const KernelKey& key,
+                                                  std::shared_ptr<const KernelSet> kernels) {
+    auto it = cache.entries.find(key);
+    if (it != cache.entries.end()) {
+        cache.lru_order.splice(cache.lru_order.begin(), cache.lru_order, it->second.lru_pos);
+        return it->second.kernels;
+    }
+
+    auto bytes = kernel_bytes(*kernels);
+    cache.lru_order.push_front(key);
+    cache.entries[key] = { kernels, bytes, cache.lru_order.begin() };
+    cache.bytes += bytes;
+    evict(cache, cache.budget);
+    return kernels;
+}
+
+static std::filesystem::path file_path(const std::string& directory, const KernelKey& key) {
+    char name[17];
+    snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key.hash()));
+    return std::filesystem::path(directory) / (std::string(name) + FILE_EXTENSION);
+}
+
+template <typename T>
+static void write_value(std::ofstream& file, const T& value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool read_value(std::ifstream& file, T& value) {
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+// Magic, version, then the full key to rule out hash collisions, then each kernel
+static bool save_file(const std::filesystem::path& path, const KernelKey& key, const KernelSet& kernels) {
+    // Write to a temporary file first, so readers never see a partial file. Named per process and
+    // write, so concurrent saves of the same key don't write into each other's file.
+    static std::atomic<uint64_t> tmp_counter = 0;
+    char tmp_suffix[48];
+    snprintf(tmp_suffix, sizeof(tmp_suffix), ".%d-%llu.tmp", static_cast<int>(getpid()),
+             static_cast<unsigned long long>(tmp_counter.fetch_add(1)));
+    auto tmp_path = path;
+    tmp_path += tmp_suffix;
+    {
+        std::ofstream file(tmp_path, std::ios::binary);
+        file.write(FILE_MAGIC, sizeof(FILE_MAGIC));
+        write_value(file, FILE_VERSION);
+        write_value(file, static_cast<uint32_t>(key.bytes().size()));
+        file.write(key.bytes().data(), static_cast<std::streamsize>(key.bytes().size()));
+
+        write_value(file, static_cast<uint32_t>(kernels.size()));
+        for (auto& kernel : kernels) {
+            write_value(file, static_cast<int32_t>(kernel.frames));
+            write_value(file, static_cast<int32_t>(kernel.fft_size));
+            file.write(reinterpret_cast<const char*>(kernel.bins.data()),
+                       static_cast<std::streamsize>(kernel.bins.size() * sizeof(FftComplex)));
+        }
+
+        file.close();
+        if (file.fail()) {
+            std::error_code error;
+            std::filesystem::remove(tmp_path, error);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmp_path, path, error);
+    return !error;
+}
+
+// nullptr if missing, corrupt or for another key
+static std::shared_ptr<const KernelSet> load_file(const std::filesystem::path& path, const KernelKey& key) {
+    std::ifstream file(path, std::ios::binary);
+    char magic[sizeof(FILE_MAGIC)];
+    uint32_t version;
+    uint32_t key_size;
+    if (!file.read(magic, sizeof(magic)) || memcmp(magic, FILE_MAGIC, sizeof(magic)) != 0 ||
+            !read_value(file, version) || version != FILE_VERSION ||
+            !read_value(file, key_size) || key_size != key.bytes().size()) {
+        return nullptr;
+    }
+
+    std::string file_key(key_size, '\0');
+    uint32_t count;
+    if (!file.read(file_key.data(), key_size) || file_key != key.bytes() ||
+            !read_value(file, count) || count > MAX_FILE_KERNELS) {
+        return nullptr;
+    }
+
+    auto kernels = std::make_shared<KernelSet>(count);
+    for (auto& kernel : *kernels) {
+        int32_t frames;
+        int32_t fft_size;
+        if (!read_value(file, frames) || !read_value(file, fft_size) ||
+                fft_size <= 0 || fft_size > MAX_FILE_FFT_SIZE || frames < 0 || frames > fft_size) {
+            return nullptr;
+        }
+
+        kernel.frames = frames;
+        kernel.fft_size = fft_size;
+        kernel.bins.resize(fft_size / 2 + 1);
+        if (!file.read(reinterpret_cast<char*>(kernel.bins.data()),
+                       static_cast<std::streamsize>(kernel.bins.size() * sizeof(FftComplex)))) {
+            return nullptr;
+        }
+    }
+
+    return kernels;
+}
+
+struct DiskFile {
+    std::filesystem::path path;
+    uintmax_t bytes;
+    std::filesystem::file_time_type last_used;
+};
+
+// Removes the least recently used kernel files until the directory fits in the budget, and returns
+// the bytes left. Disk hits touch their files, so modification times order them by use.
+static size_t trim_directory(const std::string& directory, size_t budget) {
+    std::vector<DiskFile> files;
+    size_t bytes = 0;
+    std::error_code error;
+    for (std::filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+        if (it->path().extension() != FILE_EXTENSION) {
+            continue;
+        }
+
+        std::error_code file_error;
+        DiskFile file { it->path(), it->file_size(file_error), it->last_write_time(file_error) };
+        if (!file_error) {
+            bytes += file.bytes;
+            files.push_back(std::move(file));
+        }
+    }
+
+    if (bytes <= budget) {
+        return bytes;
+    }
+
+    std::sort(files.begin(), files.end(), [](auto& a, auto& b) { return a.last_used < b.last_used; });
+    for (auto& file : files) {
+        if (bytes <= budget) {
+            break;
+        }
+
+        if (std::filesystem::remove(file.path, error)) {
+            bytes -= file.bytes;
+        }
+    }
+
+    return bytes;
+}
+
+// Counts a saved file, and trims the directory once the estimate exceeds the budget
+static void account_saved_file(Cache& cache, const std::string& directory, const std::filesystem::path& path) {
+    std::error_code error;
+    auto file_bytes = std::filesystem::file_size(path, error);
+    size_t budget;
+    {
+        std::lock_guard lock(cache.lock);
+        if (cache.directory != directory) {
+            return;
+        }
+
+        // Overcounts replaced files until the next scan, which only trims early
+        cache.disk_bytes += error ? 0 : file_bytes;
+        if (cache.disk_bytes <= cache.disk_budget) {
+            return;
+        }
+        budget = cache.disk_budget;
+    }
+
+    // Scan outside the lock, like file reads
+    auto bytes = trim_directory(directory, budget);
+
+    std::lock_guard lock(cache.lock);
+    if (cache.directory == directory) {
+        cache.disk_bytes = bytes;
+    }
+}
+
+std::shared_ptr<const KernelSet> find(const KernelKey& key) {
+    auto& cache = get_cache();
+    std::string directory;
+    {
+        std::lock_guard lock(cache.lock);
+        auto it = cache.entries.find(key);
+        if (it != cache.entries.end()) {
+            cache.hits++;
+            cache.lru_order.splice(cache.lru_order.begin(), cache.lru_order, it->second.lru_pos);
+            return it->second.kernels;
+        }
+
+        directory = cache.directory;
+        if (directory.empty()) {
+            cache.misses++;
+            return nullptr;
+        }
+    }
+
+    // Read outside the lock: large kernels take a while
+    auto path = file_path(directory, key);
+    auto kernels = load_file(path, key);
+    if (kernels != nullptr) {
+        // Marks it as recently used for trimming
+        std::error_code error;
+        std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+    }
+
+    std::lock_guard lock(cache.lock);
+    if (kernels == nullptr) {
+        cache.misses++;
+        return nullptr;
+    }
+
+    cache.disk_hits++;
+    return add_entry(cache, key, std::move(kernels));
+}
+
+std::shared_ptr<const KernelSet> insert(const KernelKey& key, KernelSet kernels) {
+    auto& cache = get_cache();
+    auto shared = std::make_shared<const KernelSet>(std::move(kernels));
+    std::string directory;
+    {
+        std::lock_guard lock(cache.lock);
+        shared = add_entry(cache, key, std::move(shared));
+        directory = cache.directory;
+    }
+
+    if (!directory.empty()) {
+        auto path = file_path(directory, key);
+        if (save_file(path, key, *shared)) {
+            account_saved_file(cache, directory, path);
+        }
+    }
+
+    return shared;
+}
+
+void set_directory(const std::string& path) {
+    auto& cache = get_cache();
+    size_t disk_budget;
+    {
+        std::lock_guard lock(cache.lock);
+        disk_budget = cache.disk_budget;
+    }
+
+    // Files left by earlier runs count against the budget
+    size_t disk_bytes = 0;
+    if (!path.empty()) {
+        std::error_code error;
+        std::filesystem::create_directories(path, error);
+        disk_bytes = trim_directory(path, disk_budget);
+    }
+
+    std::lock_guard lock(cache.lock);
+    cache.directory = path;
+    cache.disk_bytes = disk_bytes;
+}
+
+void set_budget(size_t bytes) {
+    auto& cache = get_cache();
+    std::lock_guard lock(cache.lock);
+    cache.budget = bytes;
+    evict(cache, cache.budget);
+}
+
+void set_disk_budget(size_t bytes) {
+    auto& cache = get_cache();
+    std::string directory;
+    {
+        std::lock_guard lock(cache.lock);
+        cache.disk_budget = bytes;
+        directory = cache.directory;
+    }
+
+    if (!directory.empty()) {
+        auto disk_bytes = trim_directory(directory, bytes);
+
+        std::lock_guard lock(cache.lock);
+        if (cache.directory == directory) {
+            cache.disk_bytes = disk_bytes;
+        }
+    }
+}
+
+Stats get_stats() {
+    auto& cache = get_cache();
+    std::lock_guard lock(cache.lock);
+
+    return {
+        .hits = cache.hits,
+        .disk_hits = cache.disk_hits,
+        .misses = cache.misses,
+        .evictions = cache.evictions,
+        .kernel_sets = static_cast<int>(cache.entries.size()),
+        .bytes = cache.bytes,
+        .budget = cache.budget,
+        .disk_bytes = cache.disk_bytes,
+        .disk_budget = cache.disk_budget,
+    };
+}
+
+void clear() {
+    auto& cache = get_cache();
+    std::lock_guard lock(cache.lock);
+    evict(cache, 0);
+}
+
+}
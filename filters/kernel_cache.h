@@ -0,0 +1,84 @@
+#pragma once
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "block_convolver.h"
+
+namespace fxdsp {
+
+// Everything that determines a set of convolver kernels, serialized
+// Two keys are equal only if all their inputs are, so a hit can be used as is. Values are stored in
+// native byte order, so disk entries only match on similar devices.
+class KernelKey {
+private:
+    // Binary, in a string for cheap comparisons
+    std::string data;
+
+    void append(const void* value, size_t size);
+
+public:
+    // kind names the producer and version its algorithm, so kernels from older designs stop matching
+    KernelKey(std::string_view kind, int version);
+
+    KernelKey& add(int value);
+    KernelKey& add(int64_t value);
+    KernelKey& add(float value);
+    KernelKey& add(std::string_view value);
+    KernelKey& add(std::span<const float> values);
+
+    const std::string& bytes() const { return data; }
+    // FNV-1a, for disk file names
+    uint64_t hash() const;
+
+    auto operator<=>(const KernelKey&) const = default;
+};
+
+using KernelSet = std::vector<FilterSpectrum>;
+
+}
+
+// Process-wide cache of transformed convolver kernels, such as GEQ designs and IRs
+// Kernels are kept in memory until the cache exceeds its budget, then evicted in LRU order. With a
+// directory set, kernels are also saved there and loaded back on memory misses, so they survive
+// restarts. The directory has its own budget, enforced by removing the least recently used files.
+// All functions are thread-safe. They lock and may do file I/O, so none of them are real-time safe.
+namespace fxdsp::kernel_cache {
+
+static constexpr size_t DEFAULT_BUDGET = 32 << 20;
+static constexpr size_t DEFAULT_DISK_BUDGET = 64 << 20;
+
+struct Stats {
+    uint64_t hits;
+    // Memory misses loaded from the directory
+    uint64_t disk_hits;
+    uint64_t misses;
+    uint64_t evictions;
+    int kernel_sets;
+    size_t bytes;
+    size_t budget;
+    // Estimated between directory scans
+    size_t disk_bytes;
+    size_t disk_budget;
+};
+
+// nullptr on a miss
+std::shared_ptr<const KernelSet> find(const KernelKey& key);
+// Also saves to the directory, if set. Failing to save only loses persistence.
+std::shared_ptr<const KernelSet> insert(const KernelKey& key, KernelSet kernels);
+
+// Created if missing. Empty disables saving and loading.
+void set_directory(const std::string& path);
+void set_budget(size_t bytes);
+void set_disk_budget(size_t bytes);
+Stats get_stats();
+// Drops everything in memory, not on disk
+void clear();
+
+}
@@ -0,0 +1,140 @@
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kernel_file.h"
+
+namespace fxdsp::kernel_file {
+
+static constexpr char MAGIC[8] = { 'F', 'X', 'D', 'S', 'P', 'K', 'R', 'N' };
+// Reads back differently on devices with the other byte order
+static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+// Rejects corrupt counts before allocating for them
+static constexpr int MAX_FILTERS = 64;
+
+// Owns one read-only mapping
+class Mapping {
+public:
+    const std::byte* data;
+    size_t size;
+
+    Mapping(const void* data, size_t size) : data(static_cast<const std::byte*>(data)), size(size) {}
+    ~Mapping() { munmap(const_cast<std::byte*>(data), size); }
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+};
+
+static size_t data_offset_for(int num_filters) {
+    auto end = sizeof(Header) + num_filters * sizeof(int32_t);
+    return (end + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+}
+
+static std::shared_ptr<const Mapping> map_file(const std::string& path) {
+    auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw std::runtime_error("Kernel file: can't open " + path + ": " + strerror(errno));
+    }
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+        close(fd);
+        throw std::runtime_error("Kernel file: " + path + " is too small");
+    }
+
+    // The mapping stays valid after closing
+    auto size = static_cast<size_t>(st.st_size);
+    auto data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Kernel file: can't map " + path + ": " + strerror(errno));
+    }
+
+    return std::make_shared<const Mapping>(data, size);
+}
+
+PreparedFilters load(const std::string& path) {
+    auto mapping = map_file(path);
+
+    Header header;
+    memcpy(&header, mapping->data, sizeof(header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+        throw std::runtime_error("Kernel file: " + path + " isn't a kernel file");
+    }
+    if (header.version != VERSION) {
+        throw std::runtime_error("Kernel file: unsupported version " + std::to_string(header.version));
+    }
+    if (header.byte_order != BYTE_ORDER_MARK) {
+        throw std::runtime_error("Kernel file: made for a device with another byte order");
+    }
+    if (header.num_filters <= 0 || header.num_filters > MAX_FILTERS ||
+            header.data_offset != data_offset_for(header.num_filters) ||
+            header.data_offset > mapping->size ||
+            header.data_size != mapping->size - header.data_offset ||
+            header.data_size % sizeof(FftComplex) != 0) {
+        throw std::runtime_error("Kernel file: invalid layout in " + path);
+    }
+
+    PreparedFilters filters;
+    filters.partition_size = header.partition_size;
+    filters.num_partitions = header.num_partitions;
+    filters.fft_size = header.fft_size;
+    filters.frames.resize(header.num_filters);
+    memcpy(filters.frames.data(), mapping->data + sizeof(Header), header.num_filters * sizeof(int32_t));
+    filters.bins = { reinterpret_cast<const FftComplex*>(mapping->data + header.data_offset),
+                     header.data_size / sizeof(FftComplex) };
+    filters.owner = std::move(mapping);
+
+    try {
+        filters.validate();
+    } catch (const std::invalid_argument& e) {
+        throw std::runtime_error("Kernel file: " + std::string(e.what()));
+    }
+
+    return filters;
+}
+
+void save(const std::string& path, const PreparedFilters& filters) {
+    filters.validate();
+
+    Header header {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.partition_size = filters.partition_size;
+    header.num_partitions = filters.num_partitions;
+    header.fft_size = filters.fft_size;
+    header.num_filters = filters.num_filters();
+    header.data_offset = data_offset_for(filters.num_filters());
+    header.data_size = filters.bins.size_bytes();
+
+    // Truncating a file in place would break its existing mappings, so write a new one and rename it
+    auto tmp_path = path + ".tmp";
+    {
+        std::ofstream file(tmp_path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::vector<int32_t> frames(filters.frames.begin(), filters.frames.end());
+        file.write(reinterpret_cast<const char*>(frames.data()), frames.size() * sizeof(int32_t));
+
+        std::vector<char> padding(header.data_offset - sizeof(header) - frames.size() * sizeof(int32_t));
+        file.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        file.write(reinterpret_cast<const char*>(filters.bins.data()), static_cast<std::streamsize>(header.data_size));
+
+        file.close();
+        if (file.fail()) {
+            std::filesystem::remove(tmp_path);
+            throw std::runtime_error("Kernel file: can't write " + tmp_path);
+        }
+    }
+
+    std::filesystem::rename(tmp_path, path);
+}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "block_convolver.h"
+
+// Versioned file of prepared convolver filters, mapped into memory to load
+// Bins are stored in the engines' own layout, starting DATA_ALIGNMENT-aligned, so loading is one
+// mmap() with no parsing or copies, and all engines and processes using a file share its pages.
+// Values are in native byte order, so files are made for the devices using them, e.g. by
+// fxdsp-kernel-convert.
+namespace fxdsp::kernel_file {
+
+static constexpr uint32_t VERSION = 1;
+static constexpr int DATA_ALIGNMENT = 64;
+
+// Fixed part of the file, followed by int32_t frames[num_filters], then bins at data_offset
+struct Header {
+    char magic[8];
+    uint32_t version;
+    // BYTE_ORDER_MARK as written by the device that made the file
+    uint32_t byte_order;
+    int32_t partition_size;
+    int32_t num_partitions;
+    int32_t fft_size;
+    int32_t num_filters;
+    uint64_t data_offset;
+    uint64_t data_size;
+};
+
+// Throws std::runtime_error if the file can't be mapped or isn't a valid kernel file for this device.
+// The mapping lasts as long as the returned filters or any copies of them.
+PreparedFilters load(const std::string& path);
+// Replaces the file atomically, so existing mappings keep the old contents.
+// Throws std::runtime_error on write errors.
+void save(const std::string& path, const PreparedFilters& filters);
+
+}
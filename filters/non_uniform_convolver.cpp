@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <bit>
+
+#include "non_uniform_convolver.h"
+
+namespace fxdsp {
+
+NonUniformConvolver::Segment::Segment(int channels, int partition_size, int filter_offset,
+                                      std::span<const std::span<const float>> filters,
+                                      std::span<const ConvolutionPath> paths) :
+        filter_offset(filter_offset),
+        engine(channels, partition_size, filters, paths),
+        fill_index(0),
+        fill_pos(0),
+        job_state(JOB_IDLE),
+        job_block(0),
+        job_pos(0),
+        job_deadline(0) {
+    blocks[0].allocate(channels, partition_size);
+    blocks[1].allocate(channels, partition_size);
+}
+
+NonUniformConvolver::NonUniformConvolver(int channels, int block_size,
+                                         std::span<const std::span<const float>> filters,
+                                         std::span<const ConvolutionPath> paths, int head_fft_size,
+                                         int num_workers) :
+        num_channels(channels),
+        block_size(block_size),
+        head(channels, block_size, slice_filters(filters, 0, block_size * HEAD_PARTITIONS), paths, head_fft_size),
+        stream_pos(0),
+        jobs_posted(0),
+        stopping(false) {
+    // Each segment starts 2 of its partitions in: the block is complete one partition before its
+    // output starts to be needed, minus one head block for mixing ahead of time
+    size_t max_filter_size = 0;
+    for (auto& filter : filters) {
+        max_filter_size = std::max(max_filter_size, filter.size());
+    }
+
+    auto filter_size = static_cast<int>(max_filter_size);
+    auto partition = block_size * SEGMENT_GROWTH;
+    auto offset = 2 * partition;
+    auto max_offset = 0;
+    while (offset < filter_size) {
+        auto last = partition * SEGMENT_GROWTH > MAX_PARTITION_SIZE;
+        auto end = last ? filter_size : std::min(filter_size, 2 * partition * SEGMENT_GROWTH);
+        segments.push_back(std::make_unique<Segment>(channels, partition, offset,
+                                                     slice_filters(filters, offset, end), paths));
+
+        max_offset = offset;
+        offset = end;
+        partition *= SEGMENT_GROWTH;
+    }
+
+    // Segment output is mixed up to block_size + offset ahead of the current block
+    auto ring_size = std::bit_ceil(static_cast<unsigned>(block_size + max_offset));
+    tail_ring.allocate(channels, static_cast<int>(ring_size));
+    ring_mask = static_cast<int>(ring_size) - 1;
+
+    if (num_workers <= 0) {
+        auto spare_cores = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+        num_workers = std::min(get_segment_count(), std::max(spare_cores, 1));
+    }
+    if (segments.empty()) {
+        num_workers = 0;
+    }
+    for (auto i = 0; i < num_workers; i++) {
+        workers.emplace_back(&NonUniformConvolver::worker_loop, this);
+    }
+}
+
+NonUniformConvolver::~NonUniformConvolver() {
+    stopping.store(true, std::memory_order_release);
+    jobs_posted.release(static_cast<std::ptrdiff_t>(workers.size()));
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+std::vector<std::span<const float>> NonUniformConvolver::slice_filters(
+        std::span<const std::span<const float>> filters, size_t start, size_t end) {
+    std::vector<std::span<const float>> slices;
+    for (auto& filter : filters) {
+        auto slice_start = std::min(start, filter.size());
+        auto slice_end = std::min(end, filter.size());
+        slices.push_back(filter.subspan(slice_start, slice_end - slice_start));
+    }
+    return slices;
+}
+
+void NonUniformConvolver::worker_loop() {
+    while (true) {
+        jobs_posted.acquire();
+        if (stopping.load(std::memory_order_acquire)) {
+            return;
+        }
+
+        // Earliest deadline first. Retry if the caller took over the chosen job in the meantime.
+        while (true) {
+            Segment* next = nullptr;
+            for (auto& segment : segments) {
+                if (segment->job_state.load(std::memory_order_acquire) == JOB_PENDING &&
+                        (next == nullptr || segment->job_deadline.load(std::memory_order_relaxed) <
+                                            next->job_deadline.load(std::memory_order_relaxed))) {
+                    next = segment.get();
+                }
+            }
+            if (next == nullptr) {
+                break;
+            }
+
+            auto expected = static_cast<int>(JOB_PENDING);
+            if (next->job_state.compare_exchange_strong(expected, JOB_RUNNING, std::memory_order_acq_rel)) {
+                run_job(*next);
+                break;
+            }
+        }
+    }
+}
+
+void NonUniformConvolver::run_job(Segment& segment) {
+    auto& block = segment.blocks[segment.job_block];
+    segment.engine.process(block, block);
+    segment.job_state.store(JOB_DONE, std::memory_order_release);
+}
+
+void NonUniformConvolver::finish_job(Segment& segment, bool keep_output) {
+    auto expected = static_cast<int>(JOB_PENDING);
+    if (segment.job_state.compare_exchange_strong(expected, JOB_RUNNING, std::memory_order_acq_rel)) {
+        // Missed the deadline without starting
+        run_job(segment);
+    } else if (expected == JOB_IDLE) {
+        return;
+    }
+
+    while (segment.job_state.load(std::memory_order_acquire) != JOB_DONE) {
+        std::this_thread::yield();
+    }
+
+    if (keep_output) {
+        auto& out = segment.blocks[segment.job_block];
+        auto out_pos = segment.job_pos + segment.filter_offset;
+        for (auto ch = 0; ch < num_channels; ch++) {
+            auto src = out.channel(ch);
+            auto dst = tail_ring.channel(ch);
+            for (auto i = 0; i < out.frames(); i++) {
+                dst[(out_pos + i) & ring_mask] += src[i];
+            }
+        }
+    }
+
+    segment.job_state.store(JOB_IDLE, std::memory_order_relaxed);
+}
+
+void NonUniformConvolver::process(const AudioBuffer& in, AudioBuffer& out) {
+    for (auto& segment_ptr : segments) {
+        auto& segment = *segment_ptr;
+        auto& fill = segment.blocks[segment.fill_index];
+        for (auto ch = 0; ch < num_channels; ch++) {
+            std::copy_n(in.channel(ch), block_size, fill.channel(ch) + segment.fill_pos);
+        }
+        segment.fill_pos += block_size;
+
+        if (segment.fill_pos == fill.frames()) {
+            // The previous job's output starts after this block, so it's due now
+            finish_job(segment, true);
+
+            auto partition = fill.frames();
+            segment.job_block = segment.fill_index;
+            segment.job_pos = stream_pos + block_size - partition;
+            segment.job_deadline.store(segment.job_pos + 2 * partition, std::memory_order_relaxed);
+            segment.fill_index ^= 1;
+            segment.fill_pos = 0;
+            segment.job_state.store(JOB_PENDING, std::memory_order_release);
+            jobs_posted.release();
+        }
+    }
+
+    head.process(in, out);
+
+    // Mix in finished segment output, and clear it for the next time around the ring
+    for (auto ch = 0; ch < num_channels; ch++) {
+        auto samples = out.channel(ch);
+        auto ring = tail_ring.channel(ch);
+        for (auto i = 0; i < block_size; i++) {
+            auto& tail = ring[(stream_pos + i) & ring_mask];
+            samples[i] += tail;
+            tail = 0.0f;
+        }
+    }
+
+    stream_pos += block_size;
+}
+
+void NonUniformConvolver::reset() {
+    for (auto& segment : segments) {
+        finish_job(*segment, false);
+        segment->engine.reset();
+        segment->fill_index = 0;
+        segment->fill_pos = 0;
+    }
+
+    head.reset();
+    tail_ring.clear();
+    stream_pos = 0;
+}
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <semaphore>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "../audio_buffer.h"
+#include "block_convolver.h"
+#include "uniform_convolver.h"
+
+namespace fxdsp {
+
+// Non-uniformly partitioned convolution (Gardner): a head of small partitions on the calling
+// thread, and tail segments with progressively larger partitions on worker threads
+// Segment i uses partitions of block_size * 4^i and starts 2 partitions into the filter, so each
+// block has a full partition of slack between its input being complete and its output being due.
+// Output is sample-exact: if a worker misses its deadline, the calling thread takes over the job
+// (or waits for it, if already running).
+class NonUniformConvolver : public BlockConvolver {
+private:
+    enum JobState {
+        JOB_IDLE,
+        JOB_PENDING,
+        JOB_RUNNING,
+        JOB_DONE,
+    };
+
+    struct Segment {
+        // Offset of this segment in the filter
+        int filter_offset;
+        UniformConvolver engine;
+        // Double-buffered: one filling from input, the other in the engine or waiting to be mixed
+        AudioBuffer blocks[2];
+        int fill_index;
+        int fill_pos;
+
+        // Current job: buffer, input stream position of its block, and when it's needed. Only the
+        // caller writes these, while no job is in flight.
+        std::atomic<int> job_state;
+        int job_block;
+        int64_t job_pos;
+        std::atomic<int64_t> job_deadline;
+
+        Segment(int channels, int partition_size, int filter_offset,
+                std::span<const std::span<const float>> filters, std::span<const ConvolutionPath> paths);
+    };
+
+    int num_channels;
+    int block_size;
+    UniformConvolver head;
+    std::vector<std::unique_ptr<Segment>> segments;
+
+    // Segment output, ring indexed by stream position
+    AudioBuffer tail_ring;
+    int ring_mask;
+    // Input frames processed
+    int64_t stream_pos;
+
+    std::vector<std::thread> workers;
+    std::counting_semaphore<> jobs_posted;
+    std::atomic<bool> stopping;
+
+    // Part of each filter in [start, end), clamped to its length
+    static std::vector<std::span<const float>> slice_filters(std::span<const std::span<const float>> filters,
+                                                             size_t start, size_t end);
+
+    void worker_loop();
+    void run_job(Segment& segment);
+    // Collects the current job's output into the ring, running it here if no worker started it
+    void finish_job(Segment& segment, bool keep_output);
+
+public:
+    // Max segment partition size; the last segment covers the rest of the filter
+    static constexpr int MAX_PARTITION_SIZE = 65536;
+
+    // Partition size ratio between consecutive segments
+    static constexpr int SEGMENT_GROWTH = 4;
+    // Head partitions of block_size, processed on the calling thread
+    static constexpr int HEAD_PARTITIONS = 2 * SEGMENT_GROWTH;
+
+    // head_fft_size: preferred FFT size for the head, see UniformConvolver
+    // workers = 0: one per segment, up to the number of spare cores
+    NonUniformConvolver(int channels, int block_size, std::span<const std::span<const float>> filters,
+                        std::span<const ConvolutionPath> paths, int head_fft_size = 0, int workers = 0);
+    ~NonUniformConvolver() override;
+
+    int get_block_size() const { return block_size; }
+    int get_segment_count() const { return static_cast<int>(segments.size()); }
+
+    void process(const AudioBuffer& in, AudioBuffer& out) override;
+    // Waits for running jobs
+    void reset() override;
+};
+
+}
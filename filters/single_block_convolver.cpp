@@ -0,0 +1,201 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "single_block_convolver.h"
+
+namespace fxdsp {
+
+SingleBlockConvolver::SingleBlockConvolver(int channels, int block_size,
+                                           std::span<const std::span<const float>> filters,
+                                           std::span<const ConvolutionPath> paths, int preferred_fft_size) :
+        SingleBlockConvolver(channels, block_size, prepare_filters(block_size, filters, preferred_fft_size), paths) {
+}
+
+SingleBlockConvolver::SingleBlockConvolver(int channels, int block_size, PreparedFilters filters,
+                                           std::span<const ConvolutionPath> paths) :
+        num_channels(channels),
+        block_size(block_size),
+        paths(paths.begin(), paths.end()) {
+    check_prepared(block_size, filters);
+    auto tail_size = filters.max_frames();
+    conv_size = block_size + tail_size;
+    fft_size = filters.fft_size;
+    fft_bins = fft_size / 2 + 1;
+    fft_time_bufs.allocate(channels, fft_size);
+    input_spectra.resize(channels * fft_bins);
+    output_spectra.resize(channels * fft_bins);
+    for (int ch = 0; ch < channels; ch++) {
+        time_ptrs.push_back(fft_time_bufs.channel(ch));
+        input_spectra_ptrs.push_back(input_spectra.data() + ch * fft_bins);
+        output_spectra_ptrs.push_back(output_spectra.data() + ch * fft_bins);
+    }
+
+    // Buffer for the tail that overlaps following blocks, zero-initialized
+    last_overlap.allocate(channels, tail_size);
+
+    // Init real-only FFT
+    fft = RealFft::create(fft_size);
+
+    // Already scaled, so taken as is
+    fir_filter_freq = filters.bins;
+    filter_owner = std::move(filters.owner);
+}
+
+int SingleBlockConvolver::fft_size_for(int block_size, int filter_frames, int preferred_fft_size) {
+    // Min size = N+M to accommodate ringing tail from linear convolution and avoid circular
+    // convolution (tail wrapping around)
+    // N+M-1 still results in circular convolution sometimes! e.g. Kronecker delta (filter = [1.0])
+    auto conv_size = block_size + filter_frames;
+
+    // Min size to run FFT quickly, unless the caller measured a faster one
+    return preferred_fft_size >= conv_size ? preferred_fft_size : next_fft_size(conv_size);
+}
+
+FilterSpectrum SingleBlockConvolver::transform_filter(std::span<const float> filter, int fft_size) {
+    if (fft_size < static_cast<int>(filter.size())) {
+        throw std::invalid_argument("FFT size (" + std::to_string(fft_size) + ") too small for filter (" +
+                                    std::to_string(filter.size()) + ")");
+    }
+
+    // Zero-padded. Single transforms give the same results on all backends, so use the cheapest to set up.
+    std::vector<float> time(fft_size);
+    std::copy(filter.begin(), filter.end(), time.begin());
+    auto fft = RealFft::create(fft_size, FFT_BACKEND_KISS);
+
+    FilterSpectrum spectrum { static_cast<int>(filter.size()), fft_size, std::vector<FftComplex>(fft->bins()) };
+    fft->forward(time.data(), spectrum.bins.data());
+    for (auto& bin : spectrum.bins) {
+        bin.r /= static_cast<float>(fft_size);
+        bin.i /= static_cast<float>(fft_size);
+    }
+
+    return spectrum;
+}
+
+PreparedFilters SingleBlockConvolver::prepare_filters(int block_size,
+                                                      std::span<const std::span<const float>> filters,
+                                                      int preferred_fft_size) {
+    size_t max_filter_size = 0;
+    for (auto& filter : filters) {
+        max_filter_size = std::max(max_filter_size, filter.size());
+    }
+
+    auto filter_fft_size = fft_size_for(block_size, static_cast<int>(max_filter_size), preferred_fft_size);
+    std::vector<FilterSpectrum> spectra;
+    for (auto& filter : filters) {
+        spectra.push_back(transform_filter(filter, filter_fft_size));
+    }
+
+    return from_spectra(std::move(spectra));
+}
+
+PreparedFilters SingleBlockConvolver::from_spectra(std::vector<FilterSpectrum> filters) {
+    if (filters.empty()) {
+        throw std::invalid_argument("No filter spectra");
+    }
+
+    PreparedFilters prepared { 0, 1, filters[0].fft_size, {}, {}, nullptr };
+    for (auto& filter : filters) {
+        if (filter.fft_size != prepared.fft_size || static_cast<int>(filter.bins.size()) != prepared.fft_bins()) {
+            throw std::invalid_argument("Filter spectra have different FFT sizes");
+        }
+        prepared.frames.push_back(filter.frames);
+    }
+    prepared.partition_size = std::max(prepared.max_frames(), 1);
+
+    // A single filter is moved as is
+    auto bins = std::make_shared<std::vector<FftComplex>>(std::move(filters[0].bins));
+    for (size_t f = 1; f < filters.size(); f++) {
+        bins->insert(bins->end(), filters[f].bins.begin(), filters[f].bins.end());
+    }
+    prepared.bins = *bins;
+    prepared.owner = std::move(bins);
+    return prepared;
+}
+
+void SingleBlockConvolver::check_prepared(int block_size, const PreparedFilters& filters) {
+    filters.validate();
+    if (filters.num_partitions != 1) {
+        throw std::invalid_argument("Single-block filters can't be partitioned");
+    }
+
+    auto conv_size = block_size + filters.max_frames();
+    if (filters.fft_size < conv_size) {
+        throw std::invalid_argument("FFT size (" + std::to_string(filters.fft_size) +
+                                    ") too small for block and filter (" + std::to_string(conv_size) + ")");
+    }
+}
+
+void SingleBlockConvolver::process(const AudioBuffer& in, AudioBuffer& out) {
+    // Transform each input once, for all the outputs it feeds
+    for (int ch = 0; ch < num_channels; ch++) {
+        // Copy and zero-pad to avoid circular convolution and improve performance
+        // (fft_time_bufs has static size of fft_size)
+        auto fft_time_buf = fft_time_bufs.channel(ch);
+        std::copy_n(in.channel(ch), block_size, fft_time_buf);
+        std::fill(fft_time_buf + block_size, fft_time_buf + fft_size, 0.0f);
+    }
+    fft->forward_batch(num_channels, time_ptrs.data(), input_spectra_ptrs.data());
+
+    for (int ch = 0; ch < num_channels; ch++) {
+        mix_paths(ch);
+    }
+
+    // Inverse FFT
+    fft->inverse_batch(num_channels, output_spectra_ptrs.data(), time_ptrs.data());
+
+    for (int ch = 0; ch < num_channels; ch++) {
+        overlap_add(ch, out[ch]);
+    }
+}
+
+void SingleBlockConvolver::mix_paths(int out) {
+    // Convolve by multiplying complex numbers, summing all paths to this output
+    auto acc = output_spectra_ptrs[out];
+    std::fill_n(acc, fft_bins, FftComplex{0.0f, 0.0f});
+    for (auto& path : paths) {
+        if (path.output != out) {
+            continue;
+        }
+
+        auto in = input_spectra_ptrs[path.input];
+        auto filter = fir_filter_freq.data() + path.filter * fft_bins;
+        for (auto i = 0; i < fft_bins; i++) {
+            // Multiply with filter FR
+            acc[i].r += in[i].r * filter[i].r - in[i].i * filter[i].i;
+            acc[i].i += in[i].r * filter[i].i + in[i].i * filter[i].r;
+        }
+    }
+}
+
+void SingleBlockConvolver::overlap_add(int out, std::span<float> block_buf) {
+    auto fft_time_buf = fft_time_bufs.channel(out);
+
+    // Add overlapping region from previous blocks
+    auto overlap = last_overlap[out];
+    auto overlap_size = static_cast<int>(overlap.size());
+    auto overlap_in_block = std::min(overlap_size, block_size);
+    for (auto i = 0; i < overlap_in_block; i++) {
+        fft_time_buf[i] += overlap[i];
+    }
+
+    // Shift out the part that was just used. The tail can be longer than a block, so older blocks
+    // may still contribute to the rest.
+    std::copy(overlap.begin() + overlap_in_block, overlap.end(), overlap.begin());
+    std::fill(overlap.end() - overlap_in_block, overlap.end(), 0.0f);
+
+    // Accumulate this block's tail
+    for (auto i = 0; i < overlap_size; i++) {
+        overlap[i] += fft_time_buf[block_size + i];
+    }
+
+    // Write non-ringing portion to the output block
+    std::copy_n(fft_time_buf, block_size, block_buf.begin());
+}
+
+void SingleBlockConvolver::reset() {
+    last_overlap.clear();
+}
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "../audio_buffer.h"
+#include "block_convolver.h"
+#include "../util/fft.h"
+
+namespace fxdsp {
+
+// Overlap-add with one FFT of the whole filter per block: FFT size grows with the filter
+// Each input is transformed once per block and shared by all paths it feeds.
+class SingleBlockConvolver : public BlockConvolver {
+private:
+    int num_channels;
+    // Sizes: fft > conv > block
+    // Input buffer block size, excl. conv and FFT padding
+    int block_size;
+    // Size of resulting linear convolution: L+M
+    int conv_size;
+    // FFT size, incl. conv and FFT padding
+    int fft_size;
+    // FFT bin count (fft_size/2+1 for real FFT)
+    int fft_bins;
+    std::vector<ConvolutionPath> paths;
+
+    // One per channel so all channels are transformed in one batch
+    // Allocated to FFT size, incl. all padding. Holds inputs, then outputs.
+    AudioBuffer fft_time_bufs;
+    // [channel: [bins]] input spectra, shared by all paths from each input
+    std::vector<FftComplex> input_spectra;
+    // [channel: [bins]] summed output spectra
+    std::vector<FftComplex> output_spectra;
+    // Per-channel pointers for the batch calls
+    std::vector<float*> time_ptrs;
+    std::vector<FftComplex*> input_spectra_ptrs;
+    std::vector<FftComplex*> output_spectra_ptrs;
+
+    // Overlapping region (M) from previous blocks, per output channel
+    AudioBuffer last_overlap;
+
+    // [filter: [bins]] frequency domain filters, incl. zero pad, kept alive by filter_owner
+    std::span<const FftComplex> fir_filter_freq;
+    std::shared_ptr<const void> filter_owner;
+
+    std::unique_ptr<RealFft> fft;
+
+    // Sum all paths to one output, from the transformed inputs
+    void mix_paths(int out);
+    // Overlap-add one inverse-transformed output
+    void overlap_add(int out, std::span<float> block_buf);
+
+public:
+    // preferred_fft_size is used if it fits block_size + the longest filter, otherwise the smallest
+    // size that does
+    SingleBlockConvolver(int channels, int block_size, std::span<const std::span<const float>> filters,
+                         std::span<const ConvolutionPath> paths, int preferred_fft_size = 0);
+    // Takes filters from prepare_filters() or from_spectra(), without copying them. Throws
+    // std::invalid_argument if they don't fit this block size (see check_prepared()).
+    SingleBlockConvolver(int channels, int block_size, PreparedFilters filters,
+                         std::span<const ConvolutionPath> paths);
+
+    // FFT size the engine uses for filters up to filter_frames long
+    static int fft_size_for(int block_size, int filter_frames, int preferred_fft_size = 0);
+    // Transforms and scales one filter as the engine does
+    static FilterSpectrum transform_filter(std::span<const float> filter, int fft_size);
+    static PreparedFilters prepare_filters(int block_size, std::span<const std::span<const float>> filters,
+                                           int preferred_fft_size = 0);
+    // Throws std::invalid_argument unless all spectra share one FFT size
+    static PreparedFilters from_spectra(std::vector<FilterSpectrum> filters);
+    // Throws std::invalid_argument unless the filters are unpartitioned and their FFT size fits the block
+    // and the longest filter
+    static void check_prepared(int block_size, const PreparedFilters& filters);
+
+    void process(const AudioBuffer& in, AudioBuffer& out) override;
+    void reset() override;
+};
+
+}
@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+#include "uniform_convolver.h"
+
+namespace fxdsp {
+
+UniformConvolver::UniformConvolver(int channels, int block_size, std::span<const std::span<const float>> filters,
+                                   std::span<const ConvolutionPath> paths, int preferred_fft_size) :
+        UniformConvolver(channels, block_size, prepare_filters(block_size, filters, preferred_fft_size), paths) {
+}
+
+UniformConvolver::UniformConvolver(int channels, int block_size, PreparedFilters filters,
+                                   std::span<const ConvolutionPath> paths) :
+        num_channels(channels),
+        block_size(block_size),
+        paths(paths.begin(), paths.end()),
+        fdl_pos(0) {
+    check_prepared(block_size, filters);
+    num_partitions = filters.num_partitions;
+    fft_size = filters.fft_size;
+    fft_bins = fft_size / 2 + 1;
+    fft_time_bufs.allocate(channels, fft_size);
+    fft_acc_bufs.resize(channels * fft_bins);
+    time_ptrs.resize(channels);
+    spectra_ptrs.resize(channels);
+    out_time_ptrs.resize(channels);
+    used_outputs.resize(channels);
+    for (auto ch = 0; ch < channels; ch++) {
+        time_ptrs[ch] = fft_time_bufs.channel(ch);
+    }
+
+    history.allocate(channels, fft_size - block_size);
+    fdl.resize(channels * num_partitions * fft_bins);
+
+    fft = RealFft::create(fft_size);
+
+    partition_filters = filters.bins;
+    filter_owner = std::move(filters.owner);
+}
+
+int UniformConvolver::fft_size_for(int block_size, int preferred_fft_size) {
+    // Each block sees block_size new samples against a filter partition of the same size, so the
+    // window must be at least twice the block to keep the output free of circular convolution
+    return preferred_fft_size >= block_size * 2 ? preferred_fft_size : next_fft_size(block_size * 2);
+}
+
+PreparedFilters UniformConvolver::prepare_filters(int block_size, std::span<const std::span<const float>> filters,
+                                                  int preferred_fft_size) {
+    size_t max_filter_size = 0;
+    for (auto& filter : filters) {
+        max_filter_size = std::max(max_filter_size, filter.size());
+    }
+
+    PreparedFilters prepared;
+    prepared.partition_size = block_size;
+    prepared.num_partitions = std::max((static_cast<int>(max_filter_size) + block_size - 1) / block_size, 1);
+    prepared.fft_size = fft_size_for(block_size, preferred_fft_size);
+    auto fft_bins = prepared.fft_bins();
+
+    // Zero-padded spectrum of each partition. Single transforms give the same results on all backends.
+    auto fft = RealFft::create(prepared.fft_size, FFT_BACKEND_KISS);
+    std::vector<float> fft_time_buf(prepared.fft_size);
+    auto bins = std::make_shared<std::vector<FftComplex>>(filters.size() * prepared.num_partitions * fft_bins);
+    for (size_t f = 0; f < filters.size(); f++) {
+        auto& filter = filters[f];
+        auto filter_size = static_cast<int>(filter.size());
+        prepared.frames.push_back(filter_size);
+
+        for (auto k = 0; k < prepared.num_partitions; k++) {
+            auto start = std::min(k * block_size, filter_size);
+            auto end = std::min(start + block_size, filter_size);
+            std::copy(filter.begin() + start, filter.begin() + end, fft_time_buf.begin());
+            std::fill(fft_time_buf.begin() + (end - start), fft_time_buf.end(), 0.0f);
+
+            auto partition = bins->data() + (f * prepared.num_partitions + k) * fft_bins;
+            fft->forward(fft_time_buf.data(), partition);
+            for (auto i = 0; i < fft_bins; i++) {
+                partition[i].r /= static_cast<float>(prepared.fft_size);
+                partition[i].i /= static_cast<float>(prepared.fft_size);
+            }
+        }
+    }
+
+    prepared.bins = *bins;
+    prepared.owner = std::move(bins);
+    return prepared;
+}
+
+void UniformConvolver::check_prepared(int block_size, const PreparedFilters& filters) {
+    filters.validate();
+    if (filters.partition_size != block_size) {
+        throw std::invalid_argument("Filters partitioned for block size " + std::to_string(filters.partition_size) +
+                                    ", not " + std::to_string(block_size));
+    }
+    if (filters.fft_size < block_size * 2) {
+        throw std::invalid_argument("FFT size (" + std::to_string(filters.fft_size) + ") too small for block size " +
+                                    std::to_string(block_size));
+    }
+}
+
+void UniformConvolver::process(const AudioBuffer& in, AudioBuffer& out) {
+    auto history_size = fft_size - block_size;
+
+    // Transform all inputs before any output overwrites them
+    for (auto ch = 0; ch < num_channels; ch++) {
+        // Overlap-save: previous input followed by the new block
+        auto fft_time_buf = fft_time_bufs.channel(ch);
+        auto ch_history = history.channel(ch);
+        std::copy_n(ch_history, history_size, fft_time_buf);
+        std::copy_n(in.channel(ch), block_size, fft_time_buf + history_size);
+        std::copy_n(fft_time_buf + block_size, history_size, ch_history);
+
+        // Forward FFT straight into the delay line
+        spectra_ptrs[ch] = fdl.data() + (ch * num_partitions + fdl_pos) * fft_bins;
+    }
+    fft->forward_batch(num_channels, time_ptrs.data(), spectra_ptrs.data());
+
+    auto num_used = 0;
+    for (auto out_ch = 0; out_ch < num_channels; out_ch++) {
+        // Spectral multiply-accumulate: partition k of the filter with the input from k blocks ago
+        auto acc = fft_acc_bufs.data() + out_ch * fft_bins;
+        std::fill_n(acc, fft_bins, FftComplex{0.0f, 0.0f});
+        auto used = false;
+        for (auto& path : paths) {
+            if (path.output != out_ch) {
+                continue;
+            }
+
+            used = true;
+            auto ch_fdl = fdl.data() + path.input * num_partitions * fft_bins;
+            auto filter_partitions = partition_filters.data() + path.filter * num_partitions * fft_bins;
+            for (auto k = 0; k < num_partitions; k++) {
+                auto slot = (fdl_pos - k + num_partitions) % num_partitions;
+                auto spectrum = ch_fdl + slot * fft_bins;
+                auto filter = filter_partitions + k * fft_bins;
+
+                for (auto i = 0; i < fft_bins; i++) {
+                    acc[i].r += spectrum[i].r * filter[i].r - spectrum[i].i * filter[i].i;
+                    acc[i].i += spectrum[i].r * filter[i].i + spectrum[i].i * filter[i].r;
+                }
+            }
+        }
+
+        if (used) {
+            spectra_ptrs[num_used] = acc;
+            out_time_ptrs[num_used] = fft_time_bufs.channel(out_ch);
+            used_outputs[num_used] = out_ch;
+            num_used++;
+        } else {
+            std::fill_n(out.channel(out_ch), block_size, 0.0f);
+        }
+    }
+
+    // Inverse FFT. The start is corrupted by circular convolution; the last block is valid.
+    fft->inverse_batch(num_used, spectra_ptrs.data(), out_time_ptrs.data());
+    for (auto i = 0; i < num_used; i++) {
+        auto out_ch = used_outputs[i];
+        std::copy_n(fft_time_bufs.channel(out_ch) + history_size, block_size, out.channel(out_ch));
+    }
+
+    // All channels share the delay line position
+    fdl_pos = (fdl_pos + 1) % num_partitions;
+}
+
+void UniformConvolver::reset() {
+    history.clear();
+    std::fill(fdl.begin(), fdl.end(), FftComplex{0.0f, 0.0f});
+    fdl_pos = 0;
+}
+
+}
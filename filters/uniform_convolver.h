@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "../audio_buffer.h"
+#include "block_convolver.h"
+#include "../util/fft.h"
+
+namespace fxdsp {
+
+// Uniformly partitioned overlap-save convolution with a frequency-domain delay line
+// The filter is split into partitions of block_size. Each block costs one forward and one inverse
+// FFT of about twice the block size, plus a spectral multiply-accumulate over all partitions.
+// Each input is transformed once per block and its spectra are shared by all paths it feeds, so a
+// 2x2 matrix costs 2 forward and 2 inverse FFTs rather than 4 of each.
+// Not thread-safe: each instance has its own scratch buffers.
+class UniformConvolver : public BlockConvolver {
+private:
+    int num_channels;
+    int block_size;
+    int fft_size;
+    int fft_bins;
+    int num_partitions;
+    std::vector<ConvolutionPath> paths;
+
+    // Previous input per channel
+    AudioBuffer history;
+    // [filter: [partition: [bins]]] filter spectra, with the IFFT scale factor, kept alive by filter_owner
+    std::span<const FftComplex> partition_filters;
+    std::shared_ptr<const void> filter_owner;
+    // [channel: [partition: [bins]]] input spectra, ring of partitions
+    std::vector<FftComplex> fdl;
+    int fdl_pos;
+
+    // Per channel, so inputs and outputs are each transformed in one batch
+    AudioBuffer fft_time_bufs;
+    // [channel: [bins]] summed output spectra
+    std::vector<FftComplex> fft_acc_bufs;
+    // Batch arguments, rebuilt each block without allocating
+    std::vector<float*> time_ptrs;
+    std::vector<FftComplex*> spectra_ptrs;
+    std::vector<float*> out_time_ptrs;
+    std::vector<int> used_outputs;
+    std::unique_ptr<RealFft> fft;
+
+public:
+    // Filters can have different lengths. Outputs without paths are silent.
+    // preferred_fft_size is used if it's at least twice the block size, otherwise the smallest size
+    // that is. Larger sizes keep more history, with the same output.
+    UniformConvolver(int channels, int block_size, std::span<const std::span<const float>> filters,
+                     std::span<const ConvolutionPath> paths, int preferred_fft_size = 0);
+    // Takes filters from prepare_filters() without copying them. Throws std::invalid_argument if they
+    // were partitioned for another block size.
+    UniformConvolver(int channels, int block_size, PreparedFilters filters, std::span<const ConvolutionPath> paths);
+
+    static int fft_size_for(int block_size, int preferred_fft_size = 0);
+    static PreparedFilters prepare_filters(int block_size, std::span<const std::span<const float>> filters,
+                                           int preferred_fft_size = 0);
+    // Throws std::invalid_argument unless the filters are partitioned by block_size, with an FFT size that
+    // fits two partitions
+    static void check_prepared(int block_size, const PreparedFilters& filters);
+
+    int get_block_size() const { return block_size; }
+
+    void process(const AudioBuffer& in, AudioBuffer& out) override;
+    void reset() override;
+};
+
+}
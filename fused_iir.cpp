@@ -0,0 +1,96 @@
+#include <algorithm>
+
+#include "fused_iir.h"
+
+namespace fxdsp {
+
+FusedIirStage::FusedIirStage(int channels, float gain, std::vector<BiquadCoeffs> sections, IirForm form,
+                             const FusedIirStage* previous) :
+        AudioSink(FORMAT_F32, channels),
+        plan(channels, fold_gain(gain, std::move(sections)), form, previous != nullptr ? &previous->plan : nullptr),
+        state(std::make_shared<State>()),
+        next_sink(nullptr),
+        first_effect(nullptr) {
+    state->values.resize(plan.state_size());
+}
+
+std::vector<BiquadCoeffs> FusedIirStage::fold_gain(float gain, std::vector<BiquadCoeffs> sections) {
+    if (sections.empty()) {
+        // Pure gain: b0 = gain, no feedback
+        sections.push_back({ 1.0f, 0.0f, 0.0f, 0.0f, 0.0f });
+    }
+
+    auto& first = sections[0];
+    first.b0 *= gain;
+    first.b1 *= gain;
+    first.b2 *= gain;
+
+    return sections;
+}
+
+void FusedIirStage::take_inherited(State& target) {
+    if (target.copied.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    // The old stage may have been replaced before it ever ran
+    auto& source = *target.inherited;
+    take_inherited(source);
+    for (auto& copy : target.copies) {
+        std::copy_n(source.values.begin() + copy.from, copy.size, target.values.begin() + copy.to);
+    }
+    target.copied.store(true, std::memory_order_release);
+}
+
+void FusedIirStage::write_audio(AudioBuffer& buf) {
+    take_inherited(*state);
+    plan.process(state->values.data(), buf);
+    next_sink->write_audio(buf);
+}
+
+void FusedIirStage::set_next_sink(AudioSink& new_next_sink) {
+    next_sink = &new_next_sink;
+}
+
+void FusedIirStage::inherit_state(const FusedIirStage& old_stage) {
+    // Once the audio thread has taken what the old state inherited, it's only kept alive here
+    if (old_stage.state->copied.load(std::memory_order_acquire)) {
+        old_stage.state->inherited.reset();
+    }
+
+    // Same sections: share state with the old stage, which stops running when this one starts
+    if (sources == old_stage.sources && plan.state_compatible(old_stage.plan)) {
+        state = old_stage.state;
+        return;
+    }
+
+    // Otherwise, sections that are in both keep their state, e.g. when a band passes through 0 dB
+    // and is dropped. Parallel form state isn't per section, so it starts over.
+    auto size = plan.section_state_size();
+    if (size == 0 || size != old_stage.plan.section_state_size() ||
+        sources.size() * size != state->values.size() ||
+        old_stage.sources.size() * size != old_stage.state->values.size()) {
+        return;
+    }
+
+    for (size_t i = 0; i < sources.size(); i++) {
+        auto old_section = std::find(old_stage.sources.begin(), old_stage.sources.end(), sources[i]);
+        if (old_section != old_stage.sources.end()) {
+            auto from = static_cast<int>(old_section - old_stage.sources.begin()) * size;
+            state->copies.push_back({ static_cast<int>(i) * size, from, size });
+        }
+    }
+
+    if (!state->copies.empty()) {
+        state->inherited = old_stage.state;
+        state->copied.store(false, std::memory_order_release);
+    }
+}
+
+void FusedIirStage::reset() {
+    // Nothing left to carry over
+    state->copied.store(true, std::memory_order_release);
+    std::fill(state->values.begin(), state->values.end(), 0.0f);
+}
+
+}
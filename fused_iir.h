@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "sink.h"
+#include "filters/biquad.h"
+#include "filters/iir_plan.h"
+
+namespace fxdsp {
+
+class Effect;
+
+// Where a fused section came from: the effect, and its index in that effect's sections
+struct IirSectionSource {
+    const Effect* effect;
+    int index;
+
+    bool operator==(const IirSectionSource&) const = default;
+};
+
+// A run of adjacent gain/biquad effects compiled into one cascade, processed in a single pass
+// Built by the control thread as part of a chain snapshot, immutable except for filter state.
+class FusedIirStage : public AudioSink {
+private:
+    struct StateCopy {
+        int to;
+        int from;
+        int size;
+    };
+
+    // Layout depends on the plan's form
+    struct State {
+        std::vector<float> values;
+        // Sections kept from the state this one replaces. Copied by the audio thread when the stage
+        // first runs, since the old stage runs until then.
+        std::shared_ptr<State> inherited;
+        std::vector<StateCopy> copies;
+        std::atomic<bool> copied;
+
+        State() : copied(true) {}
+    };
+
+    // Gain folded into the first section
+    IirPlan plan;
+    // Shared with the stage this replaced, if compatible
+    std::shared_ptr<State> state;
+    AudioSink* next_sink;
+
+    static std::vector<BiquadCoeffs> fold_gain(float gain, std::vector<BiquadCoeffs> sections);
+    static void take_inherited(State& target);
+
+public:
+    // previous: the stage this one replaces, if any, to keep its form where possible (see IirPlan)
+    FusedIirStage(int channels, float gain, std::vector<BiquadCoeffs> sections,
+                  IirForm form = IIR_FORM_AUTO, const FusedIirStage* previous = nullptr);
+
+    // First effect of the run, used to carry over state when the chain is recompiled
+    Effect* first_effect;
+    // One per section before gain folding, to carry over state by section
+    std::vector<IirSectionSource> sources;
+
+    IirForm get_form() const { return plan.get_form(); }
+
+    void write_audio(AudioBuffer& buf) override;
+
+    // Control thread, before publishing
+    void set_next_sink(AudioSink& next_sink);
+    void inherit_state(const FusedIirStage& old_stage);
+    // Audio thread
+    void reset();
+};
+
+}
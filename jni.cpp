@@ -1,4 +1,5 @@
 #include <jni.h>
+#include <stdexcept>
 #include <string>
 
 #include "dsp.h"
@@ -10,12 +11,18 @@
 #include "effects/convolver.h"
 #include "effects/graphic_eq_fir.h"
 #include "effects/graphic_eq_iir.h"
+#include "filters/kernel_cache.h"
 #include "sinks/oboe.h"
 #include "util/graph.h"
 #include "wave.h"
 
 namespace fxdsp {
 
+// Surfaces errors from loading user-supplied files as Java exceptions instead of aborting
+static void throw_java(JNIEnv* env, const std::exception& e) {
+    env->ThrowNew(env->FindClass("java/lang/IllegalArgumentException"), e.what());
+}
+
 extern "C" {
 
 JNIEXPORT jlong JNICALL
@@ -25,6 +32,13 @@ Java_dev_kdrag0n_audiofx_core_NativeLib_nDspCreate(JNIEnv *env, jclass clazz, ji
     return reinterpret_cast<long>(dsp);
 }
 
+// Call before starting the stream, with the frames per callback, so the audio thread never allocates
+JNIEXPORT void JNICALL
+Java_dev_kdrag0n_audiofx_core_NativeLib_nDspPrepare(JNIEnv *env, jclass clazz, jlong dsp_ptr, jint max_frames) {
+    auto dsp = reinterpret_cast<DSP*>(dsp_ptr);
+    dsp->prepare(max_frames);
+}
+
 JNIEXPORT void JNICALL
 Java_dev_kdrag0n_audiofx_core_NativeLib_nDspWriteAudio(
         JNIEnv* env,
@@ -34,14 +48,9 @@ Java_dev_kdrag0n_audiofx_core_NativeLib_nDspWriteAudio(
         jlong float_2d_buf,
         jint sample_count) {
     auto raw_buf = env->GetShortArrayElements(java_buf, nullptr);
-    auto& float_buf = *reinterpret_cast<std::vector<std::vector<float>>*>(float_2d_buf);
-
-    // We've already allocated max size. To avoid writing garbage samples, resize to the part we'll
-    // actually use.
-    for (auto& ch : float_buf) {
-        ch.resize(sample_count / float_buf.size());
-    }
+    auto& float_buf = *reinterpret_cast<AudioBuffer*>(float_2d_buf);
 
+    // We've already allocated max size, so this only updates the frame count
     auto dsp = reinterpret_cast<DSP*>(dsp_ptr);
     deinterleave_pcm_s16(raw_buf, sample_count, float_buf);
     dsp->write_audio(float_buf);
@@ -79,14 +88,14 @@ JNIEXPORT jboolean JNICALL
 Java_dev_kdrag0n_audiofx_core_NativeLib_nEffectGetEnabled(JNIEnv *env, jclass clazz,
                                                           jlong effect_ptr) {
     auto effect = reinterpret_cast<Effect*>(effect_ptr);
-    return effect->enabled;
+    return effect->is_enabled();
 }
 
 JNIEXPORT void JNICALL
 Java_dev_kdrag0n_audiofx_core_NativeLib_nEffectSetEnabled(JNIEnv *env, jclass clazz, jlong effect_ptr,
                                                           jboolean enabled) {
     auto effect = reinterpret_cast<Effect*>(effect_ptr);
-    effect->enabled = enabled;
+    effect->set_enabled(enabled);
 }
 
 JNIEXPORT jlong JNICALL
@@ -99,6 +108,50 @@ Java_dev_kdrag0n_audiofx_core_NativeLib_nConvolverEffectCreate(JNIEnv *env,
     return reinterpret_cast<long>(effect);
 }
 
+JNIEXPORT void JNICALL
+Java_dev_kdrag0n_audiofx_core_NativeLib_nConvolverEffectSetFilterFile(JNIEnv *env,
+                                                                      jclass clazz,
+                                                                      jlong effect_ptr,
+                                                                      jstring path_java) {
+    auto effect = reinterpret_cast<ConvolverEffect*>(effect_ptr);
+    auto path_data = env->GetStringUTFChars(path_java, nullptr);
+    std::string path(path_data, env->GetStringUTFLength(path_java));
+    env->ReleaseStringUTFChars(path_java, path_data);
+
+    try {
+        effect->set_filter_file(path);
+    } catch (const std::exception& e) {
+        throw_java(env, e);
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_dev_kdrag0n_audiofx_core_NativeLib_nConvolverEffectSetKernelFile(JNIEnv *env,
+                                                                      jclass clazz,
+                                                                      jlong effect_ptr,
+                                                                      jstring path_java) {
+    auto effect = reinterpret_cast<ConvolverEffect*>(effect_ptr);
+    auto path_data = env->GetStringUTFChars(path_java, nullptr);
+    std::string path(path_data, env->GetStringUTFLength(path_java));
+    env->ReleaseStringUTFChars(path_java, path_data);
+
+    try {
+        effect->set_kernel_file(path);
+    } catch (const std::exception& e) {
+        throw_java(env, e);
+    }
+}
+
+// Typically the app's cache directory, so designs and IRs survive restarts
+JNIEXPORT void JNICALL
+Java_dev_kdrag0n_audiofx_core_NativeLib_nKernelCacheSetDirectory(JNIEnv *env, jclass clazz, jstring path_java) {
+    auto path_data = env->GetStringUTFChars(path_java, nullptr);
+    std::string path(path_data, env->GetStringUTFLength(path_java));
+    env->ReleaseStringUTFChars(path_java, path_data);
+
+    kernel_cache::set_directory(path);
+}
+
 JNIEXPORT jlong JNICALL
 Java_dev_kdrag0n_audiofx_core_NativeLib_nGainEffectCreate(JNIEnv *env,
                                                           jclass clazz,
@@ -331,15 +384,11 @@ Java_dev_kdrag0n_audiofx_core_NativeLib_nOboeSinkGetBufferSize(JNIEnv *env, jcla
 JNIEXPORT jlong JNICALL
 Java_dev_kdrag0n_audiofx_core_NativeLib_nResizeFloat2d(JNIEnv *env, jclass clazz, jlong old_ptr,
                                                        jint channels, jint samples) {
-    auto buf = reinterpret_cast<std::vector<std::vector<float>>*>(old_ptr);
+    auto buf = reinterpret_cast<AudioBuffer*>(old_ptr);
     if (buf == nullptr) {
-        buf = new std::vector<std::vector<float>>(channels);
-    } else {
-        buf->resize(channels);
-    }
-
-    for (auto& ch : *buf) {
-        ch.resize(samples);
+        buf = new AudioBuffer(channels, samples);
+    } else if (buf->channels() != channels || buf->capacity() < samples) {
+        buf->allocate(channels, samples);
     }
 
     return reinterpret_cast<jlong>(buf);
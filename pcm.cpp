@@ -1,13 +1,35 @@
-#include <algorithm>
-#include <cmath>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 
 #include "pcm.h"
+#include "pcm_kernel.h"
+#include "util/cpu_features.h"
 
 namespace fxdsp {
 
+#if defined(__x86_64__)
+// pcm_avx2.cpp, instantiated for every sample type
+template <typename T>
+void deinterleave_avx2(const T* in, float* out, size_t stride, int channels, int frames);
+template <typename T>
+void interleave_avx2(const float* in, size_t stride, T* out, int channels, int frames);
+#endif
+
+int pcm_sample_size(AudioFormat format) {
+    switch (format) {
+        case FORMAT_U8: return 1;
+        case FORMAT_S16: return 2;
+        case FORMAT_S24: return 3;
+        case FORMAT_F32:
+        case FORMAT_S32:
+        case FORMAT_S24_32: return 4;
+        default: throw std::invalid_argument("Unknown PCM format " + std::to_string(format));
+    }
+}
+
 float pcm_s16_to_float32(short sample) {
-    // TODO: consider reciprocal multiplication for performance
-    return static_cast<float>(sample) / 32768.0f;
+    return ScalarPcm::load(&sample);
 }
 
 short pcm_float32_to_s16(float sample) {
@@ -18,39 +40,129 @@ short pcm_float32_to_s16(float sample) {
     //   - https://www.cs.cmu.edu/~rbd/papers/cmj-float-to-int.html
     // Might be worth reconsidering in the future.
 
-    // TODO: dither with blue noise?
-    float unnorm = std::roundf(sample * 32768.0f);
-    return static_cast<short>(std::clamp(unnorm, -32768.0f, 32767.0f));
+    // Undithered. Output stages use Dither first.
+    short out;
+    ScalarPcm::store(&out, sample);
+    return out;
 }
 
-void deinterleave_pcm(const float* raw_buf, int raw_samples, std::vector<std::vector<float>>& channel_bufs) {
-    auto samples_per_channel = raw_samples / channel_bufs.size();
-    for (auto &channel : channel_bufs) {
-        channel.clear();
-        channel.resize(samples_per_channel);
+template <typename T>
+static void deinterleave(const T* in, float* out, size_t stride, int channels, int frames) {
+#if defined(__x86_64__)
+    if (cpu_features::has_avx2()) {
+        deinterleave_avx2(in, out, stride, channels, frames);
+    } else {
+        deinterleave_channels<SsePcm>(in, out, stride, channels, frames);
     }
+#elif defined(__ARM_NEON)
+    deinterleave_channels<NeonPcm>(in, out, stride, channels, frames);
+#else
+    deinterleave_channels<ScalarPcm>(in, out, stride, channels, frames);
+#endif
+}
 
-    // PCM FORMAT_S16 int -> float32 and de-interleave
-    for (auto ch = 0; ch < channel_bufs.size(); ch++) {
-        for (auto i = 0; i < samples_per_channel; i++) {
-            channel_bufs[ch][i] = raw_buf[i * channel_bufs.size() + ch];
-        }
+template <typename T>
+static void interleave(const float* in, size_t stride, T* out, int channels, int frames) {
+#if defined(__x86_64__)
+    if (cpu_features::has_avx2()) {
+        interleave_avx2(in, stride, out, channels, frames);
+    } else {
+        interleave_channels<SsePcm>(in, stride, out, channels, frames);
     }
+#elif defined(__ARM_NEON)
+    interleave_channels<NeonPcm>(in, stride, out, channels, frames);
+#else
+    interleave_channels<ScalarPcm>(in, stride, out, channels, frames);
+#endif
 }
 
-void deinterleave_pcm_s16(const short* raw_buf, int raw_samples, std::vector<std::vector<float>>& channel_bufs) {
-    auto samples_per_channel = raw_samples / channel_bufs.size();
-    for (auto &channel : channel_bufs) {
-        channel.clear();
-        channel.resize(samples_per_channel);
+// Through a temporary planar buffer. Only used for loading files, so the copy doesn't matter.
+template <typename T>
+static void deinterleave_to_vectors(const T* raw_buf, int raw_samples, std::vector<std::vector<float>>& channel_bufs) {
+    auto channels = static_cast<int>(channel_bufs.size());
+    auto samples_per_channel = raw_samples / channels;
+    AudioBuffer planar(channels, samples_per_channel);
+    deinterleave(raw_buf, planar.channel(0), planar.stride(), channels, samples_per_channel);
+
+    for (auto ch = 0; ch < channels; ch++) {
+        channel_bufs[ch].assign(planar.channel(ch), planar.channel(ch) + samples_per_channel);
     }
+}
+
+void deinterleave_pcm(const float* raw_buf, int raw_samples, std::vector<std::vector<float>>& channel_bufs) {
+    deinterleave_to_vectors(raw_buf, raw_samples, channel_bufs);
+}
+
+void deinterleave_pcm_s16(const short* raw_buf, int raw_samples, std::vector<std::vector<float>>& channel_bufs) {
+    deinterleave_to_vectors(raw_buf, raw_samples, channel_bufs);
+}
+
+void deinterleave_pcm(const float* raw_buf, int raw_samples, AudioBuffer& channel_bufs) {
+    auto channels = channel_bufs.channels();
+    auto samples_per_channel = raw_samples / channels;
+    channel_bufs.set_frames(samples_per_channel);
 
-    // PCM FORMAT_S16 int -> float32 and de-interleave
-    for (auto ch = 0; ch < channel_bufs.size(); ch++) {
-        for (auto i = 0; i < samples_per_channel; i++) {
-            channel_bufs[ch][i] = pcm_s16_to_float32(raw_buf[i * channel_bufs.size() + ch]);
-        }
+    deinterleave(raw_buf, channel_bufs.channel(0), channel_bufs.stride(), channels, samples_per_channel);
+}
+
+void deinterleave_pcm_s16(const short* raw_buf, int raw_samples, AudioBuffer& channel_bufs) {
+    auto channels = channel_bufs.channels();
+    auto samples_per_channel = raw_samples / channels;
+    channel_bufs.set_frames(samples_per_channel);
+
+    // PCM S16 int -> float32 and de-interleave
+    deinterleave(raw_buf, channel_bufs.channel(0), channel_bufs.stride(), channels, samples_per_channel);
+}
+
+void interleave_pcm(const AudioBuffer& channel_bufs, int frames, float* raw_buf) {
+    interleave(channel_bufs.channel(0), channel_bufs.stride(), raw_buf, channel_bufs.channels(), frames);
+}
+
+void interleave_pcm_s16(const AudioBuffer& channel_bufs, int frames, short* raw_buf) {
+    // float32 -> PCM S16 int and re-interleave
+    interleave(channel_bufs.channel(0), channel_bufs.stride(), raw_buf, channel_bufs.channels(), frames);
+}
+
+// Calls fn with a null pointer of the sample type for format
+template <typename Fn>
+static void visit_sample_type(AudioFormat format, Fn&& fn) {
+    switch (format) {
+        case FORMAT_U8: fn(static_cast<uint8_t*>(nullptr)); break;
+        case FORMAT_S16: fn(static_cast<short*>(nullptr)); break;
+        case FORMAT_S24: fn(static_cast<PcmS24*>(nullptr)); break;
+        case FORMAT_F32: fn(static_cast<float*>(nullptr)); break;
+        case FORMAT_S32: fn(static_cast<int32_t*>(nullptr)); break;
+        case FORMAT_S24_32: fn(static_cast<PcmS24In32*>(nullptr)); break;
+        default: throw std::invalid_argument("Unknown PCM format " + std::to_string(format));
     }
 }
 
+void deinterleave_pcm(const void* raw_buf, AudioFormat format, int raw_samples,
+                      std::vector<std::vector<float>>& channel_bufs) {
+    visit_sample_type(format, [&](auto type) {
+        using T = std::remove_pointer_t<decltype(type)>;
+        deinterleave_to_vectors(static_cast<const T*>(raw_buf), raw_samples, channel_bufs);
+    });
+}
+
+void deinterleave_pcm(const void* raw_buf, AudioFormat format, int raw_samples, AudioBuffer& channel_bufs) {
+    auto channels = channel_bufs.channels();
+    auto samples_per_channel = raw_samples / channels;
+    channel_bufs.set_frames(samples_per_channel);
+
+    visit_sample_type(format, [&](auto type) {
+        using T = std::remove_pointer_t<decltype(type)>;
+        deinterleave(static_cast<const T*>(raw_buf), channel_bufs.channel(0), channel_bufs.stride(), channels,
+                     samples_per_channel);
+    });
+}
+
+void interleave_pcm(const AudioBuffer& channel_bufs, int frames, AudioFormat format, void* raw_buf) {
+    visit_sample_type(format, [&](auto type) {
+        using T = std::remove_pointer_t<decltype(type)>;
+        interleave(channel_bufs.channel(0), channel_bufs.stride(), static_cast<T*>(raw_buf), channel_bufs.channels(),
+                   frames);
+    });
+}
+
 }
@@ -1,21 +1,59 @@
 #pragma once
 
+#include <cstdint>
 #include <vector>
 
+#include "audio_buffer.h"
+
 namespace fxdsp {
 
 enum AudioFormat {
     FORMAT_UNKNOWN = 0,
     FORMAT_U8,
     FORMAT_S16,
+    // Packed, 3 bytes per sample
     FORMAT_S24,
     FORMAT_F32,
+    FORMAT_S32,
+    // 24-bit range in 32-bit words, e.g. Android's 8.24 format
+    FORMAT_S24_32,
+};
+
+// Little-endian, with no padding
+struct PcmS24 {
+    uint8_t bytes[3];
+};
+
+// Full scale is 1 << 23. Larger values are accepted as input, like floats above 1.0.
+struct PcmS24In32 {
+    int32_t value;
 };
 
+// Bytes per sample. Throws std::invalid_argument for FORMAT_UNKNOWN.
+int pcm_sample_size(AudioFormat format);
+
 float pcm_s16_to_float32(short sample);
 short pcm_float32_to_s16(float sample);
 
+// Conversions and (de)interleaving below are vectorized for the CPU, with specialized paths for 1, 2, 6
+// and 8 channels. Results are identical to the scalar conversions above.
 void deinterleave_pcm(const float* raw_buf, int raw_samples, std::vector<std::vector<float>>& channel_bufs);
 void deinterleave_pcm_s16(const short* raw_buf, int raw_samples, std::vector<std::vector<float>>& channel_bufs);
 
+// Sets frame count to raw_samples / channels
+void deinterleave_pcm(const float* raw_buf, int raw_samples, AudioBuffer& channel_bufs);
+void deinterleave_pcm_s16(const short* raw_buf, int raw_samples, AudioBuffer& channel_bufs);
+
+// Writes frames * channels() samples. Real-time safe.
+void interleave_pcm(const AudioBuffer& channel_bufs, int frames, float* raw_buf);
+void interleave_pcm_s16(const AudioBuffer& channel_bufs, int frames, short* raw_buf);
+
+// Any format, with raw_buf holding samples of pcm_sample_size(format) bytes
+// Integer formats are scaled so full scale is 1.0, and U8 is offset by 128. Output is rounded and
+// clamped to the format's range. Throws std::invalid_argument for FORMAT_UNKNOWN.
+void deinterleave_pcm(const void* raw_buf, AudioFormat format, int raw_samples,
+                      std::vector<std::vector<float>>& channel_bufs);
+void deinterleave_pcm(const void* raw_buf, AudioFormat format, int raw_samples, AudioBuffer& channel_bufs);
+void interleave_pcm(const AudioBuffer& channel_bufs, int frames, AudioFormat format, void* raw_buf);
+
 }
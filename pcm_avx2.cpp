@@ -0,0 +1,36 @@
+// Compiled with -mavx2 on x86-64. Only called after checking CPU support.
+
+#include "pcm_kernel.h"
+
+#if defined(__AVX2__)
+
+namespace fxdsp {
+
+template <typename T>
+void deinterleave_avx2(const T* in, float* out, size_t stride, int channels, int frames) {
+    deinterleave_channels<AvxPcm>(in, out, stride, channels, frames);
+}
+
+template <typename T>
+void interleave_avx2(const float* in, size_t stride, T* out, int channels, int frames) {
+    interleave_channels<AvxPcm>(in, stride, out, channels, frames);
+}
+
+// Every sample type in pcm.h
+template void deinterleave_avx2(const float*, float*, size_t, int, int);
+template void deinterleave_avx2(const uint8_t*, float*, size_t, int, int);
+template void deinterleave_avx2(const short*, float*, size_t, int, int);
+template void deinterleave_avx2(const PcmS24*, float*, size_t, int, int);
+template void deinterleave_avx2(const PcmS24In32*, float*, size_t, int, int);
+template void deinterleave_avx2(const int32_t*, float*, size_t, int, int);
+
+template void interleave_avx2(const float*, size_t, float*, int, int);
+template void interleave_avx2(const float*, size_t, uint8_t*, int, int);
+template void interleave_avx2(const float*, size_t, short*, int, int);
+template void interleave_avx2(const float*, size_t, PcmS24*, int, int);
+template void interleave_avx2(const float*, size_t, PcmS24In32*, int, int);
+template void interleave_avx2(const float*, size_t, int32_t*, int, int);
+
+}
+
+#endif
@@ -0,0 +1,517 @@
+#pragma once
+
+// Interleave/deinterleave kernels shared by the per-ISA translation units
+// Everything here has internal linkage: each TU compiles it with different target flags, so
+// instantiations must never be merged by the linker.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "pcm.h"
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace fxdsp {
+namespace {
+
+// Full scale of each integer format. Powers of 2, so multiplying by the inverse is exact.
+constexpr float U8_SCALE = 128.0f;
+constexpr float S16_SCALE = 32768.0f;
+constexpr float S24_SCALE = 8388608.0f;
+constexpr float S32_SCALE = 2147483648.0f;
+
+inline int32_t read_s24(const PcmS24* p) {
+    auto value = p->bytes[0] | (p->bytes[1] << 8) | (p->bytes[2] << 16);
+    // Sign-extend from bit 23
+    return static_cast<int32_t>(static_cast<uint32_t>(value) << 8) >> 8;
+}
+
+inline void write_s24(PcmS24* p, int32_t value) {
+    p->bytes[0] = static_cast<uint8_t>(value);
+    p->bytes[1] = static_cast<uint8_t>(value >> 8);
+    p->bytes[2] = static_cast<uint8_t>(value >> 16);
+}
+
+// Integer output rounds half away from zero, then clamps. Vector paths clamp first so the truncating
+// conversion can't overflow, and round up or down when the remainder reaches 0.5, which gives
+// identical results below 2^24. Larger values are already integers.
+struct ScalarPcm {
+    static constexpr int WIDTH = 1;
+    using V = float;
+
+    static float round_clamp(float v, float scale, float lo, float hi) {
+        return std::clamp(std::roundf(v * scale), lo, hi);
+    }
+
+    static V load(const float* p) { return *p; }
+    static void store(float* p, V v) { *p = v; }
+
+    static V load(const uint8_t* p) { return static_cast<float>(*p - 128) * (1.0f / U8_SCALE); }
+    static void store(uint8_t* p, V v) {
+        *p = static_cast<uint8_t>(static_cast<int>(round_clamp(v, U8_SCALE, -128.0f, 127.0f)) + 128);
+    }
+
+    static V load(const short* p) { return static_cast<float>(*p) * (1.0f / S16_SCALE); }
+    static void store(short* p, V v) { *p = static_cast<short>(round_clamp(v, S16_SCALE, -32768.0f, 32767.0f)); }
+
+    static V load(const PcmS24* p) { return static_cast<float>(read_s24(p)) * (1.0f / S24_SCALE); }
+    static void store(PcmS24* p, V v) {
+        write_s24(p, static_cast<int32_t>(round_clamp(v, S24_SCALE, -8388608.0f, 8388607.0f)));
+    }
+
+    static V load(const PcmS24In32* p) { return static_cast<float>(p->value) * (1.0f / S24_SCALE); }
+    static void store(PcmS24In32* p, V v) {
+        p->value = static_cast<int32_t>(round_clamp(v, S24_SCALE, -8388608.0f, 8388607.0f));
+    }
+
+    static V load(const int32_t* p) { return static_cast<float>(*p) * (1.0f / S32_SCALE); }
+    // 2^31 - 1 isn't a float
+    static void store(int32_t* p, V v) {
+        *p = static_cast<int32_t>(std::round(std::clamp(static_cast<double>(v) * S32_SCALE, -2147483648.0, 2147483647.0)));
+    }
+
+    static void unzip(V a, V b, V& even, V& odd) { even = a; odd = b; }
+    static void zip(V even, V odd, V& a, V& b) { a = even; b = odd; }
+    static void transpose(V*) {}
+};
+
+#if defined(__SSE2__)
+struct SsePcm {
+    static constexpr int WIDTH = 4;
+    using V = __m128;
+    using I = __m128i;
+
+    static V to_float(I v, float scale) { return _mm_mul_ps(_mm_cvtepi32_ps(v), _mm_set1_ps(1.0f / scale)); }
+
+    static I to_int(V v, float scale, float lo, float hi) {
+        v = _mm_mul_ps(v, _mm_set1_ps(scale));
+        v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(lo)), _mm_set1_ps(hi));
+        auto t = _mm_cvttps_epi32(v);
+        auto frac = _mm_sub_ps(v, _mm_cvtepi32_ps(t));
+        // Masks are -1
+        t = _mm_sub_epi32(t, _mm_castps_si128(_mm_cmpge_ps(frac, _mm_set1_ps(0.5f))));
+        return _mm_add_epi32(t, _mm_castps_si128(_mm_cmple_ps(frac, _mm_set1_ps(-0.5f))));
+    }
+
+    static V load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, V v) { _mm_storeu_ps(p, v); }
+
+    static V load(const uint8_t* p) {
+        int32_t word;
+        memcpy(&word, p, sizeof(word));
+        auto zero = _mm_setzero_si128();
+        auto u8 = _mm_cvtsi32_si128(word);
+        auto s32 = _mm_unpacklo_epi16(_mm_unpacklo_epi8(u8, zero), zero);
+        return to_float(_mm_sub_epi32(s32, _mm_set1_epi32(128)), U8_SCALE);
+    }
+
+    static void store(uint8_t* p, V v) {
+        auto t = _mm_add_epi32(to_int(v, U8_SCALE, -128.0f, 127.0f), _mm_set1_epi32(128));
+        auto u16 = _mm_packs_epi32(t, t);
+        auto word = _mm_cvtsi128_si32(_mm_packus_epi16(u16, u16));
+        memcpy(p, &word, sizeof(word));
+    }
+
+    static V load(const short* p) {
+        auto s16 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+        // Sign-extend by unpacking into the high halves and shifting back down
+        return to_float(_mm_srai_epi32(_mm_unpacklo_epi16(s16, s16), 16), S16_SCALE);
+    }
+
+    static void store(short* p, V v) {
+        auto t = to_int(v, S16_SCALE, -32768.0f, 32767.0f);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm_packs_epi32(t, t));
+    }
+
+    // SSE2 can't shuffle bytes, so 3-byte samples are moved one by one
+    static V load(const PcmS24* p) {
+        return to_float(_mm_setr_epi32(read_s24(p), read_s24(p + 1), read_s24(p + 2), read_s24(p + 3)), S24_SCALE);
+    }
+
+    static void store(PcmS24* p, V v) {
+        alignas(16) int32_t values[WIDTH];
+        _mm_store_si128(reinterpret_cast<__m128i*>(values), to_int(v, S24_SCALE, -8388608.0f, 8388607.0f));
+        for (auto i = 0; i < WIDTH; i++) {
+            write_s24(p + i, values[i]);
+        }
+    }
+
+    static V load(const PcmS24In32* p) {
+        return to_float(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), S24_SCALE);
+    }
+
+    static void store(PcmS24In32* p, V v) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), to_int(v, S24_SCALE, -8388608.0f, 8388607.0f));
+    }
+
+    static V load(const int32_t* p) {
+        return to_float(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), S32_SCALE);
+    }
+
+    // 2^31 converts to INT32_MIN, so saturate it separately
+    static void store(int32_t* p, V v) {
+        auto t = to_int(v, S32_SCALE, -S32_SCALE, S32_SCALE);
+        auto over = _mm_castps_si128(_mm_cmpge_ps(v, _mm_set1_ps(1.0f)));
+        t = _mm_or_si128(_mm_andnot_si128(over, t), _mm_and_si128(over, _mm_set1_epi32(INT32_MAX)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), t);
+    }
+
+    static void unzip(V a, V b, V& even, V& odd) {
+        even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+    }
+
+    static void zip(V even, V odd, V& a, V& b) {
+        a = _mm_unpacklo_ps(even, odd);
+        b = _mm_unpackhi_ps(even, odd);
+    }
+
+    static void transpose(V* rows) { _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]); }
+};
+#endif
+
+#if defined(__AVX2__)
+struct AvxPcm {
+    static constexpr int WIDTH = 8;
+    using V = __m256;
+    using I = __m256i;
+    // For channel counts below WIDTH
+    using Narrow = SsePcm;
+
+    static V to_float(I v, float scale) { return _mm256_mul_ps(_mm256_cvtepi32_ps(v), _mm256_set1_ps(1.0f / scale)); }
+
+    static I to_int(V v, float scale, float lo, float hi) {
+        v = _mm256_mul_ps(v, _mm256_set1_ps(scale));
+        v = _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(lo)), _mm256_set1_ps(hi));
+        auto t = _mm256_cvttps_epi32(v);
+        auto frac = _mm256_sub_ps(v, _mm256_cvtepi32_ps(t));
+        t = _mm256_sub_epi32(t, _mm256_castps_si256(_mm256_cmp_ps(frac, _mm256_set1_ps(0.5f), _CMP_GE_OQ)));
+        return _mm256_add_epi32(t, _mm256_castps_si256(_mm256_cmp_ps(frac, _mm256_set1_ps(-0.5f), _CMP_LE_OQ)));
+    }
+
+    static V load(const float* p) { return _mm256_loadu_ps(p); }
+    static void store(float* p, V v) { _mm256_storeu_ps(p, v); }
+
+    static V load(const uint8_t* p) {
+        auto s32 = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
+        return to_float(_mm256_sub_epi32(s32, _mm256_set1_epi32(128)), U8_SCALE);
+    }
+
+    // Packing works within 128-bit halves, so these gather the useful parts of each half
+    static void store(uint8_t* p, V v) {
+        auto t = _mm256_add_epi32(to_int(v, U8_SCALE, -128.0f, 127.0f), _mm256_set1_epi32(128));
+        auto u16 = _mm256_packs_epi32(t, t);
+        auto u8 = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(u16, u16), _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), _mm256_castsi256_si128(u8));
+    }
+
+    static V load(const short* p) {
+        auto s32 = _mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+        return to_float(s32, S16_SCALE);
+    }
+
+    static void store(short* p, V v) {
+        auto t = to_int(v, S16_SCALE, -32768.0f, 32767.0f);
+        auto packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(t, t), 0x08);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm256_castsi256_si128(packed));
+    }
+
+    // 8 samples are 24 bytes, so load bytes 0-15 and 8-23 to stay in bounds. Samples go to the top
+    // 3 bytes of each word, then shift down to sign-extend.
+    static V load(const PcmS24* p) {
+        auto bytes = reinterpret_cast<const uint8_t*>(p);
+        auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes));
+        auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 8));
+        auto shuffle = _mm256_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11,
+                                        -1, 4, 5, 6, -1, 7, 8, 9, -1, 10, 11, 12, -1, 13, 14, 15);
+        auto s32 = _mm256_srai_epi32(_mm256_shuffle_epi8(_mm256_set_m128i(hi, lo), shuffle), 8);
+        return to_float(s32, S24_SCALE);
+    }
+
+    static void store(PcmS24* p, V v) {
+        auto t = to_int(v, S24_SCALE, -8388608.0f, 8388607.0f);
+        // Low 3 bytes of each word, packed into the first 12 bytes of each half
+        auto shuffle = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+        auto packed = _mm256_shuffle_epi8(t, shuffle);
+        auto bytes = reinterpret_cast<uint8_t*>(p);
+        for (auto half : { _mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1) }) {
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(bytes), half);
+            auto word = _mm_cvtsi128_si32(_mm_srli_si128(half, 8));
+            memcpy(bytes + 8, &word, sizeof(word));
+            bytes += 12;
+        }
+    }
+
+    static V load(const PcmS24In32* p) {
+        return to_float(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), S24_SCALE);
+    }
+
+    static void store(PcmS24In32* p, V v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), to_int(v, S24_SCALE, -8388608.0f, 8388607.0f));
+    }
+
+    static V load(const int32_t* p) {
+        return to_float(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), S32_SCALE);
+    }
+
+    static void store(int32_t* p, V v) {
+        auto t = to_int(v, S32_SCALE, -S32_SCALE, S32_SCALE);
+        auto over = _mm256_castps_si256(_mm256_cmp_ps(v, _mm256_set1_ps(1.0f), _CMP_GE_OQ));
+        t = _mm256_blendv_epi8(t, _mm256_set1_epi32(INT32_MAX), over);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), t);
+    }
+
+    // Shuffles work within 128-bit halves, so these fix up the order of 64-bit quarters
+    static V swap_middle(V v) {
+        return _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(v), 0xD8));
+    }
+
+    static void unzip(V a, V b, V& even, V& odd) {
+        even = swap_middle(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        odd = swap_middle(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+
+    static void zip(V even, V odd, V& a, V& b) {
+        even = swap_middle(even);
+        odd = swap_middle(odd);
+        a = _mm256_unpacklo_ps(even, odd);
+        b = _mm256_unpackhi_ps(even, odd);
+    }
+
+    static void transpose(V* rows) {
+        V pairs[8];
+        for (auto r = 0; r < 8; r += 2) {
+            pairs[r] = _mm256_unpacklo_ps(rows[r], rows[r + 1]);
+            pairs[r + 1] = _mm256_unpackhi_ps(rows[r], rows[r + 1]);
+        }
+
+        // Columns 0-3 of rows 0-3 and 4-7, in both halves
+        V quads[8];
+        for (auto r = 0; r < 8; r += 4) {
+            quads[r] = _mm256_shuffle_ps(pairs[r], pairs[r + 2], _MM_SHUFFLE(1, 0, 1, 0));
+            quads[r + 1] = _mm256_shuffle_ps(pairs[r], pairs[r + 2], _MM_SHUFFLE(3, 2, 3, 2));
+            quads[r + 2] = _mm256_shuffle_ps(pairs[r + 1], pairs[r + 3], _MM_SHUFFLE(1, 0, 1, 0));
+            quads[r + 3] = _mm256_shuffle_ps(pairs[r + 1], pairs[r + 3], _MM_SHUFFLE(3, 2, 3, 2));
+        }
+
+        for (auto c = 0; c < 4; c++) {
+            rows[c] = _mm256_permute2f128_ps(quads[c], quads[c + 4], 0x20);
+            rows[c + 4] = _mm256_permute2f128_ps(quads[c], quads[c + 4], 0x31);
+        }
+    }
+};
+#endif
+
+#if defined(__ARM_NEON)
+struct NeonPcm {
+    static constexpr int WIDTH = 4;
+    using V = float32x4_t;
+    using I = int32x4_t;
+
+    static V to_float(I v, float scale) { return vmulq_n_f32(vcvtq_f32_s32(v), 1.0f / scale); }
+
+    // vcvtaq_s32_f32 would round the same way, but it's AArch64-only. Conversions saturate, so
+    // 2^31 gives INT32_MAX.
+    static I to_int(V v, float scale, float lo, float hi) {
+        v = vmulq_n_f32(v, scale);
+        v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(lo)), vdupq_n_f32(hi));
+        auto t = vcvtq_s32_f32(v);
+        auto frac = vsubq_f32(v, vcvtq_f32_s32(t));
+        // Masks are -1
+        t = vsubq_s32(t, vreinterpretq_s32_u32(vcgeq_f32(frac, vdupq_n_f32(0.5f))));
+        return vaddq_s32(t, vreinterpretq_s32_u32(vcleq_f32(frac, vdupq_n_f32(-0.5f))));
+    }
+
+    static V load(const float* p) { return vld1q_f32(p); }
+    static void store(float* p, V v) { vst1q_f32(p, v); }
+
+    static V load(const uint8_t* p) {
+        uint32_t word;
+        memcpy(&word, p, sizeof(word));
+        auto u16 = vget_low_u16(vmovl_u8(vreinterpret_u8_u32(vdup_n_u32(word))));
+        auto s32 = vreinterpretq_s32_u32(vmovl_u16(u16));
+        return to_float(vsubq_s32(s32, vdupq_n_s32(128)), U8_SCALE);
+    }
+
+    static void store(uint8_t* p, V v) {
+        auto t = vaddq_s32(to_int(v, U8_SCALE, -128.0f, 127.0f), vdupq_n_s32(128));
+        auto u16 = vqmovun_s32(t);
+        auto u8 = vqmovn_u16(vcombine_u16(u16, u16));
+        auto word = vget_lane_u32(vreinterpret_u32_u8(u8), 0);
+        memcpy(p, &word, sizeof(word));
+    }
+
+    static V load(const short* p) { return to_float(vmovl_s16(vld1_s16(p)), S16_SCALE); }
+    static void store(short* p, V v) { vst1_s16(p, vqmovn_s32(to_int(v, S16_SCALE, -32768.0f, 32767.0f))); }
+
+    static V load(const PcmS24* p) {
+        int32_t values[WIDTH] = { read_s24(p), read_s24(p + 1), read_s24(p + 2), read_s24(p + 3) };
+        return to_float(vld1q_s32(values), S24_SCALE);
+    }
+
+    static void store(PcmS24* p, V v) {
+        int32_t values[WIDTH];
+        vst1q_s32(values, to_int(v, S24_SCALE, -8388608.0f, 8388607.0f));
+        for (auto i = 0; i < WIDTH; i++) {
+            write_s24(p + i, values[i]);
+        }
+    }
+
+    static V load(const PcmS24In32* p) { return to_float(vld1q_s32(&p->value), S24_SCALE); }
+    static void store(PcmS24In32* p, V v) { vst1q_s32(&p->value, to_int(v, S24_SCALE, -8388608.0f, 8388607.0f)); }
+
+    static V load(const int32_t* p) { return to_float(vld1q_s32(p), S32_SCALE); }
+    static void store(int32_t* p, V v) { vst1q_s32(p, to_int(v, S32_SCALE, -S32_SCALE, S32_SCALE)); }
+
+    static void unzip(V a, V b, V& even, V& odd) {
+        auto halves = vuzpq_f32(a, b);
+        even = halves.val[0];
+        odd = halves.val[1];
+    }
+
+    static void zip(V even, V odd, V& a, V& b) {
+        auto pairs = vzipq_f32(even, odd);
+        a = pairs.val[0];
+        b = pairs.val[1];
+    }
+
+    static void transpose(V* rows) {
+        auto t01 = vtrnq_f32(rows[0], rows[1]);
+        auto t23 = vtrnq_f32(rows[2], rows[3]);
+        rows[0] = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+        rows[1] = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+        rows[2] = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+        rows[3] = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+    }
+};
+#endif
+
+// Interleaved [frame: [channel]] -> planar channels that start stride samples apart
+// C is the channel count when it's known at compile time, so the loops below fold away, or 0.
+// With W channels or more, blocks of W frames by W channels are transposed in registers. The last
+// group of channels overlaps the one before it when W doesn't divide the channel count, which writes
+// some samples twice with the same values.
+template <typename L, int C, typename T>
+void deinterleave_lanes(const T* in, float* out, size_t stride, int channels, int frames) {
+    constexpr auto W = L::WIDTH;
+    if (C != 0) {
+        channels = C;
+    }
+
+    auto i = 0;
+    if (channels == 1) {
+        for (; i + W <= frames; i += W) {
+            L::store(out + i, L::load(in + i));
+        }
+    } else if (channels == 2) {
+        for (; i + W <= frames; i += W) {
+            typename L::V left, right;
+            L::unzip(L::load(in + 2 * i), L::load(in + 2 * i + W), left, right);
+            L::store(out + i, left);
+            L::store(out + stride + i, right);
+        }
+    } else if (channels >= W) {
+        typename L::V rows[W];
+        for (; i + W <= frames; i += W) {
+            for (auto c0 = 0; c0 < channels; c0 += W) {
+                auto group = std::min(c0, channels - W);
+                for (auto f = 0; f < W; f++) {
+                    rows[f] = L::load(in + static_cast<size_t>(i + f) * channels + group);
+                }
+                L::transpose(rows);
+                for (auto c = 0; c < W; c++) {
+                    L::store(out + (group + c) * stride + i, rows[c]);
+                }
+            }
+        }
+    } else if constexpr (requires { typename L::Narrow; }) {
+        deinterleave_lanes<typename L::Narrow, C>(in, out, stride, channels, frames);
+        return;
+    }
+
+    for (; i < frames; i++) {
+        for (auto ch = 0; ch < channels; ch++) {
+            ScalarPcm::store(out + ch * stride + i, ScalarPcm::load(in + static_cast<size_t>(i) * channels + ch));
+        }
+    }
+}
+
+// Planar channels that start stride samples apart -> interleaved [frame: [channel]]
+template <typename L, int C, typename T>
+void interleave_lanes(const float* in, size_t stride, T* out, int channels, int frames) {
+    constexpr auto W = L::WIDTH;
+    if (C != 0) {
+        channels = C;
+    }
+
+    auto i = 0;
+    if (channels == 1) {
+        for (; i + W <= frames; i += W) {
+            L::store(out + i, L::load(in + i));
+        }
+    } else if (channels == 2) {
+        for (; i + W <= frames; i += W) {
+            typename L::V a, b;
+            L::zip(L::load(in + i), L::load(in + stride + i), a, b);
+            L::store(out + 2 * i, a);
+            L::store(out + 2 * i + W, b);
+        }
+    } else if (channels >= W) {
+        typename L::V rows[W];
+        for (; i + W <= frames; i += W) {
+            for (auto c0 = 0; c0 < channels; c0 += W) {
+                auto group = std::min(c0, channels - W);
+                for (auto c = 0; c < W; c++) {
+                    rows[c] = L::load(in + (group + c) * stride + i);
+                }
+                L::transpose(rows);
+                for (auto f = 0; f < W; f++) {
+                    L::store(out + static_cast<size_t>(i + f) * channels + group, rows[f]);
+                }
+            }
+        }
+    } else if constexpr (requires { typename L::Narrow; }) {
+        interleave_lanes<typename L::Narrow, C>(in, stride, out, channels, frames);
+        return;
+    }
+
+    for (; i < frames; i++) {
+        for (auto ch = 0; ch < channels; ch++) {
+            ScalarPcm::store(out + static_cast<size_t>(i) * channels + ch, ScalarPcm::load(in + ch * stride + i));
+        }
+    }
+}
+
+// Specialized for common layouts: mono, stereo, 5.1 and 7.1
+template <typename L, typename T>
+void deinterleave_channels(const T* in, float* out, size_t stride, int channels, int frames) {
+    switch (channels) {
+        case 1: deinterleave_lanes<L, 1>(in, out, stride, channels, frames); break;
+        case 2: deinterleave_lanes<L, 2>(in, out, stride, channels, frames); break;
+        case 6: deinterleave_lanes<L, 6>(in, out, stride, channels, frames); break;
+        case 8: deinterleave_lanes<L, 8>(in, out, stride, channels, frames); break;
+        default: deinterleave_lanes<L, 0>(in, out, stride, channels, frames); break;
+    }
+}
+
+template <typename L, typename T>
+void interleave_channels(const float* in, size_t stride, T* out, int channels, int frames) {
+    switch (channels) {
+        case 1: interleave_lanes<L, 1>(in, stride, out, channels, frames); break;
+        case 2: interleave_lanes<L, 2>(in, stride, out, channels, frames); break;
+        case 6: interleave_lanes<L, 6>(in, stride, out, channels, frames); break;
+        case 8: interleave_lanes<L, 8>(in, stride, out, channels, frames); break;
+        default: interleave_lanes<L, 0>(in, stride, out, channels, frames); break;
+    }
+}
+
+}
+}
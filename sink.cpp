@@ -1,11 +1,35 @@
+#include <algorithm>
+
 #include "sink.h"
 
 namespace fxdsp {
 
 AudioSink::AudioSink(AudioFormat audio_format, int channels) :
+        channel_bufs(channels, 0),
         audio_format(audio_format),
         channels(channels) {
-    channel_bufs.resize(channels);
+}
+
+void AudioSink::prepare(int max_frames) {
+    channel_bufs.reserve(max_frames);
+}
+
+void AudioSink::write_audio(std::vector<std::vector<float>>& buf) {
+    auto samples_per_channel = buf.empty() ? 0 : static_cast<int>(buf[0].size());
+    channel_bufs.set_frames(samples_per_channel);
+
+    // Channels missing from buf, or shorter than the first, are filled with silence
+    for (auto ch = 0; ch < channels; ch++) {
+        auto out = channel_bufs.channel(ch);
+        auto count = 0;
+        if (ch < static_cast<int>(buf.size())) {
+            count = std::min(static_cast<int>(buf[ch].size()), samples_per_channel);
+            std::copy_n(buf[ch].begin(), count, out);
+        }
+        std::fill(out + count, out + samples_per_channel, 0.0f);
+    }
+
+    write_audio(channel_bufs);
 }
 
 // Convert S16 LPCM to float and de-interleave channels
@@ -14,20 +38,8 @@ bool AudioSink::write_audio_1d(const std::vector<short>& raw_buf) {
         return false;
     }
 
-    auto samples_per_channel = raw_buf.size() / channels;
-    for (auto &channel : channel_bufs) {
-        channel.clear();
-        channel.resize(samples_per_channel);
-    }
-
     // PCM S16 int -> float32 and de-interleave
-    for (auto ch = 0; ch < channels; ch++) {
-        for (auto i = 0; i < samples_per_channel; i++) {
-            // Combined and duplicated loop for optimal vectorization
-            channel_bufs[ch][i] = pcm_s16_to_float32(raw_buf[i * channels + ch]);
-        }
-    }
-
+    deinterleave_pcm_s16(raw_buf.data(), static_cast<int>(raw_buf.size()), channel_bufs);
     write_audio(channel_bufs);
     return true;
 }
@@ -37,19 +49,18 @@ bool AudioSink::write_audio_1d(const std::vector<float>& raw_buf) {
         return false;
     }
 
-    auto samples_per_channel = raw_buf.size() / channels;
-    for (auto &channel : channel_bufs) {
-        channel.clear();
-        channel.resize(samples_per_channel);
-    }
+    deinterleave_pcm(raw_buf.data(), static_cast<int>(raw_buf.size()), channel_bufs);
+    write_audio(channel_bufs);
+    return true;
+}
 
-    // PCM FORMAT_S16 int -> float32 and de-interleave
-    for (auto ch = 0; ch < channels; ch++) {
-        for (auto i = 0; i < samples_per_channel; i++) {
-            channel_bufs[ch][i] = raw_buf[i * channels + ch];
-        }
+bool AudioSink::write_audio_1d(std::span<const std::byte> raw_buf) {
+    if (audio_format == FORMAT_UNKNOWN) {
+        return false;
     }
 
+    auto raw_samples = static_cast<int>(raw_buf.size() / pcm_sample_size(audio_format));
+    deinterleave_pcm(raw_buf.data(), audio_format, raw_samples, channel_bufs);
     write_audio(channel_bufs);
     return true;
 }
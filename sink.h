@@ -1,14 +1,17 @@
 #pragma once
 
+#include <cstddef>
+#include <span>
 #include <vector>
 
+#include "audio_buffer.h"
 #include "pcm.h"
 
 namespace fxdsp {
 
 class AudioSink {
 private:
-    std::vector<std::vector<float>> channel_bufs;
+    AudioBuffer channel_bufs;
 
 public:
     AudioSink(AudioFormat audio_format, int channels);
@@ -17,15 +20,26 @@ public:
     AudioFormat audio_format;
     int channels;
 
+    // Pre-size all buffers for blocks of up to max_frames, so write_audio never allocates
+    // Not real-time safe
+    virtual void prepare(int max_frames);
+
     // F32 [channel samples]
     // Implementations can mutate this for efficiency!
-    virtual void write_audio(std::vector<std::vector<float>>& buf) = 0;
+    virtual void write_audio(AudioBuffer& buf) = 0;
+
+    // Legacy adapter: copies into an AudioBuffer and calls write_audio(AudioBuffer&)
+    // Frames = buf[0].size(). Missing or shorter channels are padded with silence, extra ones ignored.
+    // Derived classes need "using AudioSink::write_audio" to expose this
+    void write_audio(std::vector<std::vector<float>>& buf);
 
     // Virtual dispatch doesn't play well with overloading here
     // S16 interleaved
     bool write_audio_1d(const std::vector<short>& raw_buf);
     // F32 interleaved
     bool write_audio_1d(const std::vector<float>& raw_buf);
+    // Any audio_format, interleaved
+    bool write_audio_1d(std::span<const std::byte> raw_buf);
 };
 
 }
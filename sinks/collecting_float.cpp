@@ -8,18 +8,13 @@ CollectingFloatBufferSink::CollectingFloatBufferSink(int channels, int samples_p
     out_buf.reserve(samples_per_channel * channels);
 }
 
-void CollectingFloatBufferSink::write_audio(std::vector<std::vector<float>>& buf) {
+void CollectingFloatBufferSink::write_audio(AudioBuffer& buf) {
     auto start_pos = out_buf.size();
-    auto new_spc = std::min(buf[0].size(), limit);
+    auto new_spc = std::min(static_cast<size_t>(buf.frames()), limit);
     out_buf.resize(start_pos + new_spc * channels);
     limit -= new_spc;
 
-    // Convert back to float32 and re-interleave
-    for (auto ch = 0; ch < channels; ch++) {
-        for (auto i = 0; i < new_spc; i++) {
-            out_buf[start_pos + i * channels + ch] = buf[ch][i];
-        }
-    }
+    interleave_pcm(buf, static_cast<int>(new_spc), out_buf.data() + start_pos);
 }
 
 std::vector<float>& CollectingFloatBufferSink::get_buffer() {
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+
 #include "../sink.h"
 
 namespace fxdsp {
@@ -12,7 +15,7 @@ private:
 public:
     CollectingFloatBufferSink(int channels, int samples_per_channel = 0);
 
-    void write_audio(std::vector<std::vector<float>>& buf) override;
+    void write_audio(AudioBuffer& buf) override;
     std::vector<float>& get_buffer();
 
     void set_limit(size_t limit);
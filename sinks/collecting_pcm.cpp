@@ -0,0 +1,32 @@
+#include "collecting_pcm.h"
+
+namespace fxdsp {
+
+CollectingPcmBufferSink::CollectingPcmBufferSink(AudioFormat format, int channels, int samples_per_channel) :
+        AudioSink(format, channels) {
+    out_buf.reserve(samples_per_channel * channels * pcm_sample_size(format));
+}
+
+void CollectingPcmBufferSink::write_audio(AudioBuffer& buf) {
+    auto start_pos = out_buf.size();
+    out_buf.resize(start_pos + buf.frames() * channels * pcm_sample_size(audio_format));
+
+    if (dither) {
+        dither->process(buf, buf.frames());
+    }
+    interleave_pcm(buf, buf.frames(), audio_format, out_buf.data() + start_pos);
+}
+
+std::vector<std::byte>& CollectingPcmBufferSink::get_buffer() {
+    return out_buf;
+}
+
+void CollectingPcmBufferSink::set_dither(DitherMode mode) {
+    if (dither) {
+        dither->set_mode(mode);
+    } else if (mode != DITHER_OFF) {
+        dither.emplace(channels, audio_format, mode);
+    }
+}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+#include "../dither.h"
+#include "../sink.h"
+
+namespace fxdsp {
+
+// Collects interleaved samples in any format, e.g. for writing WAV files
+class CollectingPcmBufferSink : public AudioSink {
+private:
+    std::vector<std::byte> out_buf;
+    // Only for formats that support it
+    std::optional<Dither> dither;
+
+public:
+    CollectingPcmBufferSink(AudioFormat format, int channels, int samples_per_channel = 0);
+
+    void write_audio(AudioBuffer& buf) override;
+    std::vector<std::byte>& get_buffer();
+
+    // Off by default. Throws std::invalid_argument if the format can't be dithered.
+    void set_dither(DitherMode mode);
+};
+
+}
@@ -3,24 +3,26 @@
 namespace fxdsp {
 
 CollectingS16BufferSink::CollectingS16BufferSink(int channels, int samples_per_channel) :
-        AudioSink(FORMAT_S16, channels) {
+        AudioSink(FORMAT_S16, channels),
+        dither(channels, FORMAT_S16, DITHER_OFF) {
     out_buf.reserve(samples_per_channel * channels);
 }
 
-void CollectingS16BufferSink::write_audio(std::vector<std::vector<float>>& buf) {
+void CollectingS16BufferSink::write_audio(AudioBuffer& buf) {
     auto start_pos = out_buf.size();
-    out_buf.resize(start_pos + buf[0].size() * channels);
+    out_buf.resize(start_pos + buf.frames() * channels);
 
     // Convert back to S16 int and re-interleave
-    for (auto ch = 0; ch < channels; ch++) {
-        for (auto i = 0; i < buf[ch].size(); i++) {
-            out_buf[start_pos + i * channels + ch] = pcm_float32_to_s16(buf[ch][i]);
-        }
-    }
+    dither.process(buf, buf.frames());
+    interleave_pcm_s16(buf, buf.frames(), reinterpret_cast<short*>(out_buf.data() + start_pos));
 }
 
 std::vector<uint16_t> &CollectingS16BufferSink::get_buffer() {
     return out_buf;
 }
 
+void CollectingS16BufferSink::set_dither(DitherMode mode) {
+    dither.set_mode(mode);
+}
+
 }
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 
+#include "../dither.h"
 #include "../sink.h"
 
 namespace fxdsp {
@@ -9,12 +10,16 @@ namespace fxdsp {
 class CollectingS16BufferSink : public AudioSink {
 private:
     std::vector<uint16_t> out_buf;
+    Dither dither;
 
 public:
     CollectingS16BufferSink(int channels, int samples_per_channel = 0);
 
-    void write_audio(std::vector<std::vector<float>>& buf) override;
+    void write_audio(AudioBuffer& buf) override;
     std::vector<uint16_t>& get_buffer();
+
+    // Off by default, so output matches the input exactly when nothing changes it
+    void set_dither(DitherMode mode);
 };
 
 }
@@ -36,17 +36,18 @@ void OboeSink::close() {
     }
 }
 
-void OboeSink::write_audio(std::vector<std::vector<float>> &buf) {
-    auto samples_per_ch = buf[0].size();
+void OboeSink::prepare(int max_frames) {
+    AudioSink::prepare(max_frames);
+    interleaved_buf.reserve(max_frames * channels);
+}
+
+void OboeSink::write_audio(AudioBuffer &buf) {
+    // Doesn't allocate if prepared
+    auto samples_per_ch = buf.frames();
     interleaved_buf.resize(samples_per_ch * channels);
-    for (int ch = 0; ch < channels; ch++) {
-        auto& ch_buf = buf[ch];
-        for (int i = 0; i < samples_per_ch; i++) {
-            interleaved_buf[i * channels + ch] = ch_buf[i];
-        }
-    }
+    interleave_pcm(buf, samples_per_ch, interleaved_buf.data());
 
-    auto sample_bytes = samples_per_ch * sizeof(buf[0][0]) * channels;
+    auto sample_bytes = samples_per_ch * sizeof(float) * channels;
     if (stream != nullptr) {
         stream->write(interleaved_buf.data(), static_cast<int32_t>(sample_bytes) / frame_size, 0);
     }
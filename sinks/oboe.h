@@ -11,7 +11,7 @@ private:
     std::shared_ptr<oboe::AudioStream> stream;
     oboe::AudioStreamBuilder builder;
 
-    // TODO: never allocate
+    // Reserved by prepare()
     std::vector<float> interleaved_buf;
     int32_t frame_size;
 
@@ -20,7 +20,8 @@ public:
 
     int32_t buffer_size;
 
-    void write_audio(std::vector<std::vector<float>>& buf) override;
+    void prepare(int max_frames) override;
+    void write_audio(AudioBuffer& buf) override;
     void open();
     void close();
 };
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "ring_buffer.h"
+
+namespace fxdsp {
+
+// Waiting sides poll, so the other side never has to signal them and stays wait-free
+// Yielding first catches up with a busy peer quickly, sleeping after that keeps idle waits cheap.
+static constexpr auto YIELD_POLLS = 100;
+static constexpr auto POLL_INTERVAL = std::chrono::microseconds(250);
+
+// Waits until ready() or the deadline, which is set on the first wait. Returns ready().
+template <typename Ready>
+static bool wait_until(Ready ready, int timeout_ms, std::chrono::steady_clock::time_point& deadline) {
+    if (timeout_ms <= 0) {
+        return false;
+    }
+    if (deadline == std::chrono::steady_clock::time_point()) {
+        deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    }
+
+    for (auto polls = 0; !ready(); polls++) {
+        if (std::chrono::steady_clock::now() >= deadline) {
+            return false;
+        }
+
+        if (polls < YIELD_POLLS) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(POLL_INTERVAL);
+        }
+    }
+
+    return true;
+}
+
+RingBufferSource::RingBufferSource(SpscRing& ring, AudioFormat format, int channels) :
+        ring(ring),
+        format(format),
+        frame_size(channels * pcm_sample_size(format)),
+        underruns(0) {
+}
+
+int RingBufferSource::read(void* out, int frames, int timeout_ms) {
+    auto out_bytes = static_cast<std::byte*>(out);
+    std::chrono::steady_clock::time_point deadline;
+    auto done = 0;
+    while (true) {
+        auto count = static_cast<int>(std::min(ring.read_available(), static_cast<size_t>(frames - done)));
+        auto regions = ring.read_regions(count);
+        for (auto part = 0; part < 2; part++) {
+            memcpy(out_bytes + static_cast<size_t>(done) * frame_size, regions.data[part],
+                   regions.frames[part] * frame_size);
+            done += static_cast<int>(regions.frames[part]);
+        }
+        ring.commit_read(count);
+
+        if (done == frames || !wait_until([&] { return ring.read_available() > 0; }, timeout_ms, deadline)) {
+            break;
+        }
+    }
+
+    if (done < frames) {
+        // U8 is unsigned, centered on 128
+        auto silence = format == FORMAT_U8 ? std::byte{0x80} : std::byte{0};
+        std::fill(out_bytes + static_cast<size_t>(done) * frame_size,
+                  out_bytes + static_cast<size_t>(frames) * frame_size, silence);
+        underruns.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return done;
+}
+
+RingBufferSink::RingBufferSink(AudioFormat format, int channels, int capacity_frames, int write_timeout_ms) :
+        AudioSink(format, channels),
+        ring(channels * pcm_sample_size(format), capacity_frames),
+        source(ring, format, channels),
+        write_timeout_ms(write_timeout_ms),
+        overruns(0) {
+}
+
+void RingBufferSink::write_audio(AudioBuffer& buf) {
+    auto frames = buf.frames();
+    std::chrono::steady_clock::time_point deadline;
+    auto done = 0;
+    while (true) {
+        // Converted straight into the ring, in up to two parts where it wraps
+        auto count = static_cast<int>(std::min(ring.write_space(), static_cast<size_t>(frames - done)));
+        auto regions = ring.write_regions(count);
+        for (auto part = 0; part < 2; part++) {
+            auto part_frames = static_cast<int>(regions.frames[part]);
+            if (part_frames > 0) {
+                interleave_pcm(buf.view(done, part_frames), part_frames, audio_format, regions.data[part]);
+                done += part_frames;
+            }
+        }
+        ring.commit_write(count);
+
+        if (done == frames || !wait_until([&] { return ring.write_space() > 0; }, write_timeout_ms, deadline)) {
+            break;
+        }
+    }
+
+    // The newest frames are dropped, so the reader never skips ahead
+    if (done < frames) {
+        overruns.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+}
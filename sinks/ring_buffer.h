@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "../sink.h"
+#include "../util/spsc_ring.h"
+
+namespace fxdsp {
+
+class RingBufferSink;
+
+// Pull side of a RingBufferSink, e.g. for an output device's callback
+// Only one thread may read at a time.
+class RingBufferSource {
+private:
+    SpscRing& ring;
+    AudioFormat format;
+    int frame_size;
+    std::atomic<uint64_t> underruns;
+
+    friend class RingBufferSink;
+    RingBufferSource(SpscRing& ring, AudioFormat format, int channels);
+
+public:
+    RingBufferSource(const RingBufferSource&) = delete;
+    RingBufferSource& operator=(const RingBufferSource&) = delete;
+
+    // Interleaved frames in the sink's format. With timeout_ms = 0 this never waits, so it's
+    // real-time safe. Otherwise it waits up to that long for frames that haven't been written yet,
+    // e.g. for offline use. Frames still missing after that are filled with silence and count as
+    // an underrun. Returns the number of frames read.
+    int read(void* out, int frames, int timeout_ms = 0);
+
+    // Frames waiting to be read
+    int get_fill_frames() const { return static_cast<int>(ring.fill()); }
+    // Reads that came up short
+    uint64_t get_underruns() const { return underruns.load(std::memory_order_relaxed); }
+};
+
+// Queues interleaved samples for another thread to pull with get_source(), so jitter in processing
+// doesn't reach the device and a slow device doesn't block processing
+// Wait-free on both sides unless given a timeout. Only one thread may write at a time.
+class RingBufferSink : public AudioSink {
+private:
+    SpscRing ring;
+    RingBufferSource source;
+    int write_timeout_ms;
+    std::atomic<uint64_t> overruns;
+
+public:
+    // Capacity is rounded up to a power of two. With write_timeout_ms = 0, frames that don't fit
+    // are dropped and count as an overrun, so write_audio() is real-time safe. Otherwise it waits
+    // up to that long for space first, e.g. to render offline at the reader's pace.
+    // Throws std::invalid_argument for invalid formats or sizes.
+    RingBufferSink(AudioFormat format, int channels, int capacity_frames, int write_timeout_ms = 0);
+
+    void write_audio(AudioBuffer& buf) override;
+    using AudioSink::write_audio;
+
+    RingBufferSource& get_source() { return source; }
+    int get_capacity_frames() const { return static_cast<int>(ring.capacity()); }
+    // Frames waiting to be read
+    int get_fill_frames() const { return static_cast<int>(ring.fill()); }
+    // Writes that came up short
+    uint64_t get_overruns() const { return overruns.load(std::memory_order_relaxed); }
+};
+
+}
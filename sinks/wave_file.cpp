@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "wave_file.h"
+
+namespace fxdsp {
+
+WaveFileSink::WaveFileSink(const std::string& path, AudioFormat format, int channels, uint32_t sample_rate,
+                           int block_frames, int num_blocks) :
+        AudioSink(format, channels),
+        path(path),
+        header(format, channels, sample_rate, 0),
+        frame_size(channels * pcm_sample_size(format)),
+        block_frames(block_frames),
+        free_blocks(num_blocks),
+        full_blocks(0),
+        submitted_blocks(0),
+        fill_block(0),
+        fill_frames(0),
+        data_size(0),
+        truncated(false),
+        write_failed(false) {
+    if (block_frames <= 0 || num_blocks <= 0) {
+        throw std::invalid_argument("WAVE: invalid block count or size");
+    }
+
+    // Sizes are filled in by close()
+    file.open(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    if (file.fail()) {
+        throw std::runtime_error("WAVE: can't create " + path);
+    }
+
+    blocks.resize(num_blocks, std::vector<std::byte>(static_cast<size_t>(block_frames) * frame_size));
+    block_sizes.resize(num_blocks);
+    writer = std::thread(&WaveFileSink::write_loop, this);
+}
+
+WaveFileSink::~WaveFileSink() {
+    try {
+        close();
+    } catch (const std::runtime_error&) {
+        // Callers that care about errors call close() themselves
+    }
+}
+
+void WaveFileSink::write_audio(AudioBuffer& buf) {
+    auto frames = buf.frames();
+    if (truncated || data_size + static_cast<uint64_t>(frames) * frame_size > MAX_DATA_SIZE) {
+        truncated = true;
+        return;
+    }
+
+    if (dither) {
+        dither->process(buf, frames);
+    }
+
+    for (auto offset = 0; offset < frames;) {
+        if (fill_frames == 0) {
+            // Backpressure: only waits if the writer is a whole pool behind
+            free_blocks.acquire();
+        }
+
+        auto count = std::min(frames - offset, block_frames - fill_frames);
+        auto& block = blocks[fill_block % blocks.size()];
+        interleave_pcm(buf.view(offset, count), count, audio_format, block.data() + fill_frames * frame_size);
+        fill_frames += count;
+        offset += count;
+
+        if (fill_frames == block_frames) {
+            submit_block();
+        }
+    }
+
+    data_size += static_cast<uint64_t>(frames) * frame_size;
+}
+
+void WaveFileSink::submit_block() {
+    block_sizes[fill_block % blocks.size()] = static_cast<size_t>(fill_frames) * frame_size;
+    fill_block++;
+    fill_frames = 0;
+
+    submitted_blocks.store(fill_block, std::memory_order_release);
+    full_blocks.release();
+}
+
+void WaveFileSink::write_loop() {
+    uint32_t written = 0;
+    while (true) {
+        full_blocks.acquire();
+        // The last release, from close(), comes without a block
+        if (written == submitted_blocks.load(std::memory_order_acquire)) {
+            break;
+        }
+
+        // After a failure, keep taking blocks so the processing thread never waits forever
+        auto index = written % blocks.size();
+        if (!write_failed) {
+            file.write(reinterpret_cast<const char*>(blocks[index].data()),
+                       static_cast<std::streamsize>(block_sizes[index]));
+            write_failed = file.fail();
+        }
+
+        written++;
+        free_blocks.release();
+    }
+}
+
+void WaveFileSink::close() {
+    if (!writer.joinable()) {
+        return;
+    }
+
+    if (fill_frames > 0) {
+        submit_block();
+    }
+    full_blocks.release();
+    writer.join();
+
+    // RIFF chunks are padded to an even size
+    auto padding = data_size % 2;
+    if (padding) {
+        file.put(0);
+    }
+
+    header.data.size = static_cast<uint32_t>(data_size);
+    header.riff.size = CHUNK_ID_SIZE + (CHUNK_HEADER_SIZE + header.fmt.size) +
+                       (CHUNK_HEADER_SIZE + header.data.size + padding);
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.close();
+
+    if (write_failed || file.fail()) {
+        throw std::runtime_error("WAVE: can't write " + path);
+    }
+    if (truncated) {
+        throw std::runtime_error("WAVE: " + path + " reached the size limit, later audio was dropped");
+    }
+}
+
+void WaveFileSink::set_dither(DitherMode mode) {
+    if (dither) {
+        dither->set_mode(mode);
+    } else if (mode != DITHER_OFF) {
+        dither.emplace(channels, audio_format, mode);
+    }
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <semaphore>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../dither.h"
+#include "../sink.h"
+#include "../wave.h"
+
+namespace fxdsp {
+
+// Streams interleaved samples in any WAV format to a file, e.g. for long offline renders
+// Samples are converted into a fixed pool of blocks, which a background thread writes to disk, so
+// memory doesn't grow with the length of the file. write_audio() doesn't lock or allocate, and
+// only waits when every block is still queued for the disk.
+class WaveFileSink : public AudioSink {
+private:
+    // Largest data chunk that leaves the RIFF size in range
+    static constexpr uint64_t MAX_DATA_SIZE = UINT32_MAX - sizeof(WaveHeader);
+
+    std::string path;
+    WaveHeader header;
+    std::ofstream file;
+    int frame_size;
+    int block_frames;
+
+    // Written in order, wrapping around. Sizes are in bytes.
+    std::vector<std::vector<std::byte>> blocks;
+    std::vector<size_t> block_sizes;
+    // Counts blocks free to fill, and blocks ready to write
+    std::counting_semaphore<> free_blocks;
+    std::counting_semaphore<> full_blocks;
+    std::atomic<uint32_t> submitted_blocks;
+    std::thread writer;
+
+    // Processing thread
+    uint32_t fill_block;
+    int fill_frames;
+    uint64_t data_size;
+    // Writes that would pass MAX_DATA_SIZE were dropped
+    bool truncated;
+    // Only for formats that support it
+    std::optional<Dither> dither;
+
+    // Writer thread, until joined
+    bool write_failed;
+
+    void submit_block();
+    void write_loop();
+
+public:
+    static constexpr int DEFAULT_BLOCK_FRAMES = 32768;
+    static constexpr int DEFAULT_NUM_BLOCKS = 4;
+
+    // Creates or replaces the file. Throws std::invalid_argument if the format can't be stored in WAV
+    // files, or std::runtime_error if the file can't be created.
+    WaveFileSink(const std::string& path, AudioFormat format, int channels, uint32_t sample_rate,
+                 int block_frames = DEFAULT_BLOCK_FRAMES, int num_blocks = DEFAULT_NUM_BLOCKS);
+    // Closes the file if needed, ignoring errors
+    ~WaveFileSink() override;
+    WaveFileSink(const WaveFileSink&) = delete;
+    WaveFileSink& operator=(const WaveFileSink&) = delete;
+
+    void write_audio(AudioBuffer& buf) override;
+    using AudioSink::write_audio;
+
+    // Writes what's left and fills in the header's sizes. Nothing can be written after this.
+    // Not real-time safe. Throws std::runtime_error on write errors, or if the file reached the
+    // WAV size limit (the file is still valid, but audio after that was dropped).
+    void close();
+
+    // Off by default. Throws std::invalid_argument if the format can't be dithered.
+    void set_dither(DitherMode mode);
+};
+
+}
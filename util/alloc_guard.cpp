@@ -0,0 +1,166 @@
+#include "alloc_guard.h"
+
+#ifdef FXDSP_ALLOC_GUARD
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include <dlfcn.h>
+#include <unwind.h>
+
+#include "../log.h"
+
+// Real allocator functions, bypassing our overrides
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+}
+
+#define RAW_MALLOC __libc_malloc
+#define RAW_FREE __libc_free
+#else
+#define RAW_MALLOC std::malloc
+#define RAW_FREE std::free
+#endif
+
+namespace fxdsp::alloc_guard {
+
+static constexpr auto MAX_BACKTRACE_FRAMES = 32;
+
+// initial-exec avoids lazy TLS allocation, which would recurse into malloc
+static thread_local int scope_depth __attribute__((tls_model("initial-exec"))) = 0;
+
+Scope::Scope() {
+    scope_depth++;
+}
+
+Scope::~Scope() {
+    scope_depth--;
+}
+
+static _Unwind_Reason_Code print_frame(struct _Unwind_Context* context, void* arg) {
+    auto& frame_idx = *static_cast<int*>(arg);
+    auto pc = reinterpret_cast<void*>(_Unwind_GetIP(context));
+    if (pc == nullptr) {
+        return _URC_END_OF_STACK;
+    }
+
+    Dl_info info{};
+    if (dladdr(pc, &info) && info.dli_sname != nullptr) {
+        auto offset = static_cast<char*>(pc) - static_cast<char*>(info.dli_saddr);
+        ALOGE("  #%02d pc %p  %s (%s+%td)\n", frame_idx, pc, info.dli_fname, info.dli_sname, offset);
+    } else {
+        ALOGE("  #%02d pc %p  %s\n", frame_idx, pc, info.dli_fname ? info.dli_fname : "??");
+    }
+
+    return (++frame_idx < MAX_BACKTRACE_FRAMES) ? _URC_NO_REASON : _URC_END_OF_STACK;
+}
+
+[[noreturn]] static void report_violation(const char* func, size_t size) {
+    // Reporting is allowed to allocate
+    scope_depth = 0;
+
+    ALOGE("Heap %s (%zu bytes) inside real-time audio path\n", func, size);
+    int frame_idx = 0;
+    _Unwind_Backtrace(print_frame, &frame_idx);
+
+    fflush(stdout);
+    abort();
+}
+
+static inline void check(const char* func, size_t size) {
+    if (scope_depth > 0) [[unlikely]] {
+        report_violation(func, size);
+    }
+}
+
+static void* checked_malloc(const char* func, size_t size) {
+    check(func, size);
+    auto ptr = RAW_MALLOC(size ? size : 1);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+static void* checked_aligned_alloc(const char* func, size_t size, std::align_val_t align) {
+    check(func, size);
+    void* ptr = nullptr;
+    auto alignment = std::max(static_cast<size_t>(align), sizeof(void*));
+    if (posix_memalign(&ptr, alignment, size ? size : 1) != 0) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+static void checked_free(const char* func, void* ptr) {
+    if (ptr != nullptr) {
+        check(func, 0);
+    }
+    RAW_FREE(ptr);
+}
+
+}
+
+using namespace fxdsp::alloc_guard;
+
+// C++ allocations: replace the global operators
+void* operator new(size_t size) { return checked_malloc("new", size); }
+void* operator new[](size_t size) { return checked_malloc("new[]", size); }
+void* operator new(size_t size, std::align_val_t align) { return checked_aligned_alloc("new", size, align); }
+void* operator new[](size_t size, std::align_val_t align) { return checked_aligned_alloc("new[]", size, align); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    check("new", size);
+    return RAW_MALLOC(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    check("new[]", size);
+    return RAW_MALLOC(size ? size : 1);
+}
+
+void operator delete(void* ptr) noexcept { checked_free("delete", ptr); }
+void operator delete[](void* ptr) noexcept { checked_free("delete[]", ptr); }
+void operator delete(void* ptr, size_t) noexcept { checked_free("delete", ptr); }
+void operator delete[](void* ptr, size_t) noexcept { checked_free("delete[]", ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { checked_free("delete", ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { checked_free("delete[]", ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { checked_free("delete", ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { checked_free("delete[]", ptr); }
+
+// C allocations (e.g. kissfft): interpose libc where we can reach the real implementation
+#ifdef __GLIBC__
+extern "C" {
+
+void* malloc(size_t size) noexcept {
+    check("malloc", size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) noexcept {
+    check("calloc", count * size);
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) noexcept {
+    check("realloc", size);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void* ptr) noexcept {
+    if (ptr != nullptr) {
+        check("free", 0);
+    }
+    __libc_free(ptr);
+}
+
+}
+#endif
+
+#endif
@@ -0,0 +1,32 @@
+#pragma once
+
+namespace fxdsp::alloc_guard {
+
+// Debug checker for the real-time audio path
+// When built with FXDSP_ALLOC_GUARD, any heap allocation or free on a thread that's inside a Scope
+// logs a backtrace and aborts. Otherwise, this compiles to nothing.
+#ifdef FXDSP_ALLOC_GUARD
+
+class Scope {
+public:
+    Scope();
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+};
+
+static constexpr bool ENABLED = true;
+
+#else
+
+class Scope {
+public:
+    Scope() {}
+};
+
+static constexpr bool ENABLED = false;
+
+#endif
+
+}
@@ -0,0 +1,20 @@
+#include "cpu_features.h"
+
+namespace fxdsp::cpu_features {
+
+#if defined(__x86_64__)
+static bool detect_avx2() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+static const bool HAS_AVX2 = detect_avx2();
+#else
+static const bool HAS_AVX2 = false;
+#endif
+
+bool has_avx2() {
+    return HAS_AVX2;
+}
+
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+namespace fxdsp::cpu_features {
+
+// Detected once at load time, so these are safe to call on the audio thread
+bool has_avx2();
+
+}
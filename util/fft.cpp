@@ -1,4 +1,18 @@
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+
 #include "fft.h"
+#include "fft_plan_cache.h"
+#include "kissfft_simd.h"
+
+#include "../external/kissfft/kiss_fft.h"
+
+#ifndef FXDSP_FFT_BACKEND_DEFAULT
+#define FXDSP_FFT_BACKEND_DEFAULT FFT_BACKEND_KISS
+#endif
+
+static_assert(sizeof(fxdsp::FftComplex) == sizeof(kiss_fft_cpx));
 
 namespace fxdsp {
 
@@ -26,4 +40,356 @@ int next_fft_size(int n) {
     }
 }
 
+static std::atomic<int> default_backend(FXDSP_FFT_BACKEND_DEFAULT);
+
+const char* fft_backend_name(FftBackend backend) {
+    switch (backend) {
+        case FFT_BACKEND_KISS:
+            return "kiss";
+        case FFT_BACKEND_KISS_SIMD:
+            return "kiss_simd";
+        default:
+            return "unknown";
+    }
+}
+
+bool fft_backend_available(FftBackend backend) {
+    switch (backend) {
+        case FFT_BACKEND_KISS:
+            return true;
+        case FFT_BACKEND_KISS_SIMD:
+#if defined(FXDSP_HAVE_KISS_SIMD)
+            return true;
+#else
+            return false;
+#endif
+        default:
+            return false;
+    }
+}
+
+FftBackend get_default_fft_backend() {
+    return static_cast<FftBackend>(default_backend.load(std::memory_order_relaxed));
+}
+
+void set_default_fft_backend(FftBackend backend) {
+    default_backend.store(backend, std::memory_order_relaxed);
+}
+
+void RealFft::forward_batch(int count, const float* const* in, FftComplex* const* out) {
+    for (int i = 0; i < count; i++) {
+        forward(in[i], out[i]);
+    }
+}
+
+void RealFft::inverse_batch(int count, const FftComplex* const* in, float* const* out) {
+    for (int i = 0; i < count; i++) {
+        inverse(in[i], out[i]);
+    }
+}
+
+template <typename T>
+static T broadcast(float value);
+
+template <>
+float broadcast<float>(float value) {
+    return value;
+}
+
+#if defined(FXDSP_HAVE_KISS_SIMD)
+template <>
+__m128 broadcast<__m128>(float value) {
+    return _mm_set1_ps(value);
+}
+#endif
+
+// kiss_fftr's post-processing: splits the half-size complex FFT of the packed real input into the
+// real spectrum. Same arithmetic in the same order, so results match kiss_fftr exactly.
+// Cpx is a kiss complex of float, or of __m128 for 4 signals at once.
+template <typename Cpx>
+static void split_real_spectrum(const Cpx* tmp, const FftComplex* super_twiddles, Cpx* out, int ncfft) {
+    using T = decltype(Cpx::r);
+    auto half = broadcast<T>(0.5f);
+
+    T dc_r = tmp[0].r;
+    T dc_i = tmp[0].i;
+    out[0].r = dc_r + dc_i;
+    out[ncfft].r = dc_r - dc_i;
+    out[0].i = out[ncfft].i = broadcast<T>(0.0f);
+
+    for (int k = 1; k <= ncfft / 2; k++) {
+        Cpx fpk = tmp[k];
+        Cpx fpnk = { tmp[ncfft - k].r, -tmp[ncfft - k].i };
+        Cpx f1k = { fpk.r + fpnk.r, fpk.i + fpnk.i };
+        Cpx f2k = { fpk.r - fpnk.r, fpk.i - fpnk.i };
+
+        auto tw_r = broadcast<T>(super_twiddles[k - 1].r);
+        auto tw_i = broadcast<T>(super_twiddles[k - 1].i);
+        Cpx tw = { f2k.r * tw_r - f2k.i * tw_i, f2k.r * tw_i + f2k.i * tw_r };
+
+        out[k].r = (f1k.r + tw.r) * half;
+        out[k].i = (f1k.i + tw.i) * half;
+        out[ncfft - k].r = (f1k.r - tw.r) * half;
+        out[ncfft - k].i = (tw.i - f1k.i) * half;
+    }
+}
+
+// kiss_fftri's pre-processing, the inverse of split_real_spectrum
+template <typename Cpx>
+static void merge_real_spectrum(const Cpx* in, const FftComplex* super_twiddles, Cpx* tmp, int ncfft) {
+    using T = decltype(Cpx::r);
+
+    tmp[0].r = in[0].r + in[ncfft].r;
+    tmp[0].i = in[0].r - in[ncfft].r;
+
+    for (int k = 1; k <= ncfft / 2; k++) {
+        Cpx fk = in[k];
+        Cpx fnkc = { in[ncfft - k].r, -in[ncfft - k].i };
+        Cpx fek = { fk.r + fnkc.r, fk.i + fnkc.i };
+        Cpx diff = { fk.r - fnkc.r, fk.i - fnkc.i };
+
+        auto tw_r = broadcast<T>(super_twiddles[k - 1].r);
+        auto tw_i = broadcast<T>(super_twiddles[k - 1].i);
+        Cpx fok = { diff.r * tw_r - diff.i * tw_i, diff.r * tw_i + diff.i * tw_r };
+
+        tmp[k] = { fek.r + fok.r, fek.i + fok.i };
+        tmp[ncfft - k] = { fek.r - fok.r, -(fek.i - fok.i) };
+    }
+}
+
+// Tables come from the plan cache, scratch is per instance
+class KissRealFft : public RealFft {
+private:
+    std::shared_ptr<const FftPlan> forward_plan;
+    std::shared_ptr<const FftPlan> inverse_plan;
+    // Half-size complex FFT output, so transforms can run in place
+    std::vector<FftComplex> tmp_buf;
+
+public:
+    KissRealFft(int size) :
+            RealFft(size),
+            forward_plan(fft_plan_cache::acquire({ size, false, true, FFT_BACKEND_KISS })),
+            inverse_plan(fft_plan_cache::acquire({ size, true, true, FFT_BACKEND_KISS })),
+            tmp_buf(size / 2) {
+    }
+
+    FftBackend get_backend() const override { return FFT_BACKEND_KISS; }
+
+    void forward(const float* in, FftComplex* out) override {
+        // Even and odd samples as real and imaginary parts
+        kiss_fft(static_cast<kiss_fft_cfg>(forward_plan->cfg), reinterpret_cast<const kiss_fft_cpx*>(in),
+                 reinterpret_cast<kiss_fft_cpx*>(tmp_buf.data()));
+        split_real_spectrum(tmp_buf.data(), forward_plan->super_twiddles.data(), out, fft_size / 2);
+    }
+
+    void inverse(const FftComplex* in, float* out) override {
+        merge_real_spectrum(in, inverse_plan->super_twiddles.data(), tmp_buf.data(), fft_size / 2);
+        kiss_fft(static_cast<kiss_fft_cfg>(inverse_plan->cfg), reinterpret_cast<const kiss_fft_cpx*>(tmp_buf.data()),
+                 reinterpret_cast<kiss_fft_cpx*>(out));
+    }
+};
+
+#if defined(FXDSP_HAVE_KISS_SIMD)
+// Batches are transposed into 4 lanes, transformed together, and transposed back
+// Single transforms and leftover singles use the scalar plans, which give the same results.
+class KissSimdRealFft : public KissRealFft {
+private:
+    static constexpr int LANES = 4;
+
+    std::shared_ptr<const FftPlan> simd_forward_plan;
+    std::shared_ptr<const FftPlan> simd_inverse_plan;
+    // Time samples of 4 signals, packed in pairs as the complex FFT sees them
+    std::vector<KissSimdComplex> lane_time;
+    std::vector<KissSimdComplex> lane_tmp;
+    std::vector<KissSimdComplex> lane_freq;
+    // Stand-ins for unused lanes
+    std::vector<float> pad_time;
+    std::vector<FftComplex> pad_freq;
+
+    // Sample i of all lanes: even samples are real parts, odd ones imaginary
+    __m128& time_lane(int i) { return i % 2 ? lane_time[i / 2].i : lane_time[i / 2].r; }
+
+    void pack_time(const float* const* in) {
+        auto n = fft_size & ~(LANES - 1);
+        for (int i = 0; i < n; i += LANES) {
+            auto r0 = _mm_loadu_ps(in[0] + i);
+            auto r1 = _mm_loadu_ps(in[1] + i);
+            auto r2 = _mm_loadu_ps(in[2] + i);
+            auto r3 = _mm_loadu_ps(in[3] + i);
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            time_lane(i) = r0;
+            time_lane(i + 1) = r1;
+            time_lane(i + 2) = r2;
+            time_lane(i + 3) = r3;
+        }
+        for (int i = n; i < fft_size; i++) {
+            time_lane(i) = _mm_setr_ps(in[0][i], in[1][i], in[2][i], in[3][i]);
+        }
+    }
+
+    void unpack_time(float* const* out) {
+        auto n = fft_size & ~(LANES - 1);
+        for (int i = 0; i < n; i += LANES) {
+            auto r0 = time_lane(i);
+            auto r1 = time_lane(i + 1);
+            auto r2 = time_lane(i + 2);
+            auto r3 = time_lane(i + 3);
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            _mm_storeu_ps(out[0] + i, r0);
+            _mm_storeu_ps(out[1] + i, r1);
+            _mm_storeu_ps(out[2] + i, r2);
+            _mm_storeu_ps(out[3] + i, r3);
+        }
+        for (int i = n; i < fft_size; i++) {
+            alignas(16) float lanes[LANES];
+            _mm_store_ps(lanes, time_lane(i));
+            for (int l = 0; l < LANES; l++) {
+                out[l][i] = lanes[l];
+            }
+        }
+    }
+
+    // Each complex is 8 bytes, so one 64-bit load or store moves a whole bin
+    void pack_freq(const FftComplex* const* in) {
+        auto n_bins = bins();
+        for (int k = 0; k < n_bins; k++) {
+            auto a = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(in[0] + k)),
+                                  reinterpret_cast<const __m64*>(in[1] + k));
+            auto b = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(in[2] + k)),
+                                  reinterpret_cast<const __m64*>(in[3] + k));
+            lane_freq[k].r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+            lane_freq[k].i = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        }
+    }
+
+    void unpack_freq(FftComplex* const* out) {
+        auto n_bins = bins();
+        for (int k = 0; k < n_bins; k++) {
+            auto a = _mm_unpacklo_ps(lane_freq[k].r, lane_freq[k].i);
+            auto b = _mm_unpackhi_ps(lane_freq[k].r, lane_freq[k].i);
+            _mm_storel_pi(reinterpret_cast<__m64*>(out[0] + k), a);
+            _mm_storeh_pi(reinterpret_cast<__m64*>(out[1] + k), a);
+            _mm_storel_pi(reinterpret_cast<__m64*>(out[2] + k), b);
+            _mm_storeh_pi(reinterpret_cast<__m64*>(out[3] + k), b);
+        }
+    }
+
+public:
+    KissSimdRealFft(int size) :
+            KissRealFft(size),
+            simd_forward_plan(fft_plan_cache::acquire({ size, false, true, FFT_BACKEND_KISS_SIMD })),
+            simd_inverse_plan(fft_plan_cache::acquire({ size, true, true, FFT_BACKEND_KISS_SIMD })),
+            lane_time(size / 2),
+            lane_tmp(size / 2),
+            lane_freq(bins()),
+            pad_time(size + 2),
+            pad_freq(bins()) {
+    }
+
+    FftBackend get_backend() const override { return FFT_BACKEND_KISS_SIMD; }
+
+    void forward_batch(int count, const float* const* in, FftComplex* const* out) override {
+        for (int start = 0; start < count; start += LANES) {
+            auto n = std::min(count - start, LANES);
+            if (n == 1) {
+                forward(in[start], out[start]);
+                continue;
+            }
+
+            // Unused lanes transform zeros into the pad
+            const float* lane_in[LANES];
+            FftComplex* lane_out[LANES];
+            if (n < LANES) {
+                std::fill(pad_time.begin(), pad_time.end(), 0.0f);
+            }
+            for (int l = 0; l < LANES; l++) {
+                lane_in[l] = l < n ? in[start + l] : pad_time.data();
+                lane_out[l] = l < n ? out[start + l] : pad_freq.data();
+            }
+
+            // Packing copies the input, so in-place batches are safe
+            pack_time(lane_in);
+            fxdsp_kiss_simd_fft(simd_forward_plan->cfg, lane_time.data(), lane_tmp.data());
+            split_real_spectrum(lane_tmp.data(), simd_forward_plan->super_twiddles.data(), lane_freq.data(),
+                                fft_size / 2);
+            unpack_freq(lane_out);
+        }
+    }
+
+    void inverse_batch(int count, const FftComplex* const* in, float* const* out) override {
+        for (int start = 0; start < count; start += LANES) {
+            auto n = std::min(count - start, LANES);
+            if (n == 1) {
+                inverse(in[start], out[start]);
+                continue;
+            }
+
+            const FftComplex* lane_in[LANES];
+            float* lane_out[LANES];
+            if (n < LANES) {
+                std::fill(pad_freq.begin(), pad_freq.end(), FftComplex{0.0f, 0.0f});
+            }
+            for (int l = 0; l < LANES; l++) {
+                lane_in[l] = l < n ? in[start + l] : pad_freq.data();
+                lane_out[l] = l < n ? out[start + l] : pad_time.data();
+            }
+
+            pack_freq(lane_in);
+            merge_real_spectrum(lane_freq.data(), simd_inverse_plan->super_twiddles.data(), lane_tmp.data(),
+                                fft_size / 2);
+            fxdsp_kiss_simd_fft(simd_inverse_plan->cfg, lane_tmp.data(), lane_time.data());
+            unpack_time(lane_out);
+        }
+    }
+};
+#endif
+
+std::unique_ptr<RealFft> RealFft::create(int size) {
+    return create(size, get_default_fft_backend());
+}
+
+std::unique_ptr<RealFft> RealFft::create(int size, FftBackend backend) {
+    if (size <= 0 || size % 2 != 0) {
+        throw std::invalid_argument("Real FFT size must be even");
+    }
+
+#if defined(FXDSP_HAVE_KISS_SIMD)
+    if (backend == FFT_BACKEND_KISS_SIMD) {
+        return std::make_unique<KissSimdRealFft>(size);
+    }
+#endif
+
+    return std::make_unique<KissRealFft>(size);
+}
+
+ComplexFft::ComplexFft(int size) :
+        fft_size(size),
+        scratch(size) {
+    if (size <= 0) {
+        throw std::invalid_argument("FFT size must be positive");
+    }
+
+    forward_plan = fft_plan_cache::acquire({ size, false, false, FFT_BACKEND_KISS });
+    inverse_plan = fft_plan_cache::acquire({ size, true, false, FFT_BACKEND_KISS });
+}
+
+void ComplexFft::transform(const FftPlan& plan, const FftComplex* in, FftComplex* out) {
+    // kiss_fft allocates a temporary buffer for in-place transforms
+    if (in == out) {
+        std::copy_n(in, fft_size, scratch.begin());
+        in = scratch.data();
+    }
+
+    kiss_fft(static_cast<kiss_fft_cfg>(plan.cfg), reinterpret_cast<const kiss_fft_cpx*>(in),
+             reinterpret_cast<kiss_fft_cpx*>(out));
+}
+
+void ComplexFft::forward(const FftComplex* in, FftComplex* out) {
+    transform(*forward_plan, in, out);
+}
+
+void ComplexFft::inverse(const FftComplex* in, FftComplex* out) {
+    transform(*inverse_plan, in, out);
+}
+
 }
@@ -1,7 +1,82 @@
 #pragma once
 
+#include <memory>
+#include <vector>
+
 namespace fxdsp {
 
 int next_fft_size(int n);
 
+// Interleaved complex, same layout as kiss_fft_cpx
+struct FftComplex {
+    float r;
+    float i;
+};
+
+class FftPlan;
+
+enum FftBackend {
+    // Scalar kissfft: one transform per call
+    FFT_BACKEND_KISS,
+    // kissfft built with SSE vectors as scalars (README.simd): batches transform 4 signals per call
+    // x86 only. Elsewhere, plans fall back to FFT_BACKEND_KISS.
+    FFT_BACKEND_KISS_SIMD,
+};
+
+const char* fft_backend_name(FftBackend backend);
+bool fft_backend_available(FftBackend backend);
+// Used by plans created without an explicit backend. Starts as the build's FXDSP_FFT_BACKEND.
+FftBackend get_default_fft_backend();
+void set_default_fft_backend(FftBackend backend);
+
+// Real FFT of one even size, planned on creation
+// Spectra have size/2+1 bins and are unscaled, so inverse(forward(x)) = x * size.
+// Transforms can run in place, in a buffer that holds size/2+1 bins.
+// Twiddle tables are shared through fft_plan_cache, but each instance has its own scratch buffers,
+// so it's only for one thread at a time.
+class RealFft {
+protected:
+    int fft_size;
+
+    RealFft(int size) : fft_size(size) {}
+
+public:
+    virtual ~RealFft() {}
+
+    // Throws std::invalid_argument for odd sizes
+    static std::unique_ptr<RealFft> create(int size);
+    static std::unique_ptr<RealFft> create(int size, FftBackend backend);
+
+    int size() const { return fft_size; }
+    int bins() const { return fft_size / 2 + 1; }
+    virtual FftBackend get_backend() const = 0;
+
+    virtual void forward(const float* in, FftComplex* out) = 0;
+    virtual void inverse(const FftComplex* in, float* out) = 0;
+
+    // Independent transforms, e.g. one per channel. Pointer arrays have count entries.
+    virtual void forward_batch(int count, const float* const* in, FftComplex* const* out);
+    virtual void inverse_batch(int count, const FftComplex* const* in, float* const* out);
+};
+
+// Complex FFT of one size, both directions planned on creation, with the same conventions
+class ComplexFft {
+private:
+    int fft_size;
+    std::shared_ptr<const FftPlan> forward_plan;
+    std::shared_ptr<const FftPlan> inverse_plan;
+    // For in-place transforms, which kissfft would otherwise allocate for
+    std::vector<FftComplex> scratch;
+
+    void transform(const FftPlan& plan, const FftComplex* in, FftComplex* out);
+
+public:
+    ComplexFft(int size);
+
+    int size() const { return fft_size; }
+
+    void forward(const FftComplex* in, FftComplex* out);
+    void inverse(const FftComplex* in, FftComplex* out);
+};
+
 }
@@ -0,0 +1,173 @@
+#include <cmath>
+#include <list>
+#include <map>
+#include <mutex>
+
+#include "fft_plan_cache.h"
+#include "kissfft_simd.h"
+
+#include "../external/kissfft/kiss_fft.h"
+
+namespace fxdsp {
+
+FftPlan::FftPlan(const FftPlanKey& key) :
+        key(key),
+        cfg(nullptr),
+        bytes(0) {
+    auto nfft = key.real ? key.size / 2 : key.size;
+
+#if defined(FXDSP_HAVE_KISS_SIMD)
+    if (key.backend == FFT_BACKEND_KISS_SIMD) {
+        fxdsp_kiss_simd_fft_alloc(nfft, key.inverse, nullptr, &bytes);
+        cfg = fxdsp_kiss_simd_fft_alloc(nfft, key.inverse, nullptr, nullptr);
+    }
+#endif
+    if (cfg == nullptr) {
+        this->key.backend = FFT_BACKEND_KISS;
+        kiss_fft_alloc(nfft, key.inverse, nullptr, &bytes);
+        cfg = kiss_fft_alloc(nfft, key.inverse, nullptr, nullptr);
+    }
+
+    if (cfg == nullptr) {
+        throw std::bad_alloc();
+    }
+
+    if (key.real) {
+        // Same values as kiss_fftr_alloc, so results match kiss_fftr exactly
+        super_twiddles.resize(nfft / 2);
+        for (int i = 0; i < nfft / 2; i++) {
+            auto phase = -3.14159265358979323846264338327 * (static_cast<double>(i + 1) / nfft + 0.5);
+            if (key.inverse) {
+                phase *= -1;
+            }
+
+            super_twiddles[i] = { static_cast<float>(cos(phase)), static_cast<float>(sin(phase)) };
+        }
+        bytes += super_twiddles.size() * sizeof(FftComplex);
+    }
+}
+
+FftPlan::~FftPlan() {
+#if defined(FXDSP_HAVE_KISS_SIMD)
+    if (key.backend == FFT_BACKEND_KISS_SIMD) {
+        fxdsp_kiss_simd_free(cfg);
+        return;
+    }
+#endif
+    kiss_fft_free(cfg);
+}
+
+}
+
+namespace fxdsp::fft_plan_cache {
+
+struct Entry {
+    std::shared_ptr<const FftPlan> plan;
+    // Position in lru_order
+    std::list<FftPlanKey>::iterator lru_pos;
+};
+
+struct Cache {
+    std::mutex lock;
+    std::map<FftPlanKey, Entry> entries;
+    // Most recently used first
+    std::list<FftPlanKey> lru_order;
+    size_t bytes = 0;
+    size_t budget = DEFAULT_BUDGET;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+static Cache& get_cache() {
+    static Cache cache;
+    return cache;
+}
+
+// The cache holds one reference, and new references are only handed out under the lock, so a
+// count of 1 can't go up concurrently
+static bool is_unused(const Entry& entry) {
+    return entry.plan.use_count() == 1;
+}
+
+static void evict(Cache& cache, size_t budget) {
+    auto it = cache.lru_order.end();
+    while (cache.bytes > budget && it != cache.lru_order.begin()) {
+        --it;
+        auto entry = cache.entries.find(*it);
+        if (!is_unused(entry->second)) {
+            continue;
+        }
+
+        cache.bytes -= entry->second.plan->bytes;
+        cache.evictions++;
+        cache.entries.erase(entry);
+        it = cache.lru_order.erase(it);
+    }
+}
+
+std::shared_ptr<const FftPlan> acquire(const FftPlanKey& key) {
+    auto& cache = get_cache();
+    {
+        std::lock_guard lock(cache.lock);
+        auto it = cache.entries.find(key);
+        if (it != cache.entries.end()) {
+            cache.hits++;
+            cache.lru_order.splice(cache.lru_order.begin(), cache.lru_order, it->second.lru_pos);
+            return it->second.plan;
+        }
+        cache.misses++;
+    }
+
+    // Build outside the lock: large plans take a while. Another thread may build the same plan
+    // meanwhile, in which case the first one inserted wins.
+    auto plan = std::make_shared<const FftPlan>(key);
+
+    std::lock_guard lock(cache.lock);
+    auto it = cache.entries.find(key);
+    if (it != cache.entries.end()) {
+        cache.lru_order.splice(cache.lru_order.begin(), cache.lru_order, it->second.lru_pos);
+        return it->second.plan;
+    }
+
+    cache.lru_order.push_front(key);
+    cache.entries[key] = { plan, cache.lru_order.begin() };
+    cache.bytes += plan->bytes;
+    evict(cache, cache.budget);
+    return plan;
+}
+
+void set_budget(size_t bytes) {
+    auto& cache = get_cache();
+    std::lock_guard lock(cache.lock);
+    cache.budget = bytes;
+    evict(cache, cache.budget);
+}
+
+Stats get_stats() {
+    auto& cache = get_cache();
+    std::lock_guard lock(cache.lock);
+
+    auto in_use = 0;
+    for (auto& [key, entry] : cache.entries) {
+        in_use += is_unused(entry) ? 0 : 1;
+    }
+
+    return {
+        .hits = cache.hits,
+        .misses = cache.misses,
+        .evictions = cache.evictions,
+        .plans = static_cast<int>(cache.entries.size()),
+        .plans_in_use = in_use,
+        .bytes = cache.bytes,
+        .budget = cache.budget,
+    };
+}
+
+void trim() {
+    auto& cache = get_cache();
+    std::lock_guard lock(cache.lock);
+    evict(cache, 0);
+}
+
+}
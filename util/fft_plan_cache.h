@@ -0,0 +1,71 @@
+#pragma once
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "fft.h"
+
+namespace fxdsp {
+
+struct FftPlanKey {
+    int size;
+    bool inverse;
+    // Real plans hold a complex transform of size/2 plus the twiddles to split its output
+    bool real;
+    FftBackend backend;
+
+    auto operator<=>(const FftPlanKey&) const = default;
+};
+
+// Factors and twiddles for one transform, immutable once built
+// Transforms only read the plan, so any number of threads can share one. Scratch buffers belong to
+// the RealFft or ComplexFft using it.
+class FftPlan {
+public:
+    FftPlanKey key;
+    // kiss_fft_cfg from the backend's kissfft build
+    void* cfg;
+    // Real plans only
+    std::vector<FftComplex> super_twiddles;
+    // Total memory, for the cache budget
+    size_t bytes;
+
+    explicit FftPlan(const FftPlanKey& key);
+    ~FftPlan();
+    FftPlan(const FftPlan&) = delete;
+    FftPlan& operator=(const FftPlan&) = delete;
+};
+
+}
+
+// Process-wide cache of FFT plans, used by all RealFft and ComplexFft instances
+// Plans are reference counted, so a plan stays alive while anything uses it. Unused plans are kept
+// for reuse until the cache exceeds its memory budget, then evicted in LRU order.
+// All functions are thread-safe. They lock, so none of them are real-time safe.
+namespace fxdsp::fft_plan_cache {
+
+static constexpr size_t DEFAULT_BUDGET = 16 << 20;
+
+struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    int plans;
+    // Plans that are referenced outside the cache
+    int plans_in_use;
+    size_t bytes;
+    size_t budget;
+};
+
+std::shared_ptr<const FftPlan> acquire(const FftPlanKey& key);
+
+// Plans in use are never evicted, so the cache can exceed the budget while they are alive
+void set_budget(size_t bytes);
+Stats get_stats();
+// Drops all unused plans
+void trim();
+
+}
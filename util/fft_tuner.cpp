@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <bit>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include "fft_tuner.h"
+#include "fft.h"
+
+namespace fxdsp::fft_tuner {
+
+static constexpr auto WISDOM_HEADER = "fxdsp-fft-wisdom";
+// Bump when measurements change, so older files are measured again
+static constexpr int WISDOM_VERSION = 3;
+static constexpr FftBackend BACKENDS[] = { FFT_BACKEND_KISS, FFT_BACKEND_KISS_SIMD };
+
+// Samples transformed per timing round, so small sizes aren't dominated by timer overhead
+static constexpr int BENCH_SAMPLES = 1 << 16;
+static constexpr int MAC_BINS = 1024;
+static constexpr int ADD_SAMPLES = 4096;
+
+struct Measurements {
+    std::mutex lock;
+    std::map<std::pair<FftBackend, int>, double> fft_costs;
+    // Negative until measured
+    double mac_cost = -1.0;
+    double add_cost = -1.0;
+};
+
+static Measurements& get_measurements() {
+    static Measurements measurements;
+    return measurements;
+}
+
+template <typename Fn>
+static double median_time_ns(int iterations, Fn&& run) {
+    return median_times_ns({ iterations }, [&](size_t) { run(); })[0];
+}
+
+// A stereo round trip at one size
+struct FftBench {
+    std::unique_ptr<RealFft> fft;
+    std::vector<float> time;
+    std::vector<FftComplex> freq;
+    float* time_ptrs[2];
+    FftComplex* freq_ptrs[2];
+
+    explicit FftBench(int fft_size) :
+            fft(RealFft::create(fft_size)),
+            time(2 * fft_size),
+            freq(2 * fft->bins()),
+            time_ptrs { time.data(), time.data() + fft_size },
+            freq_ptrs { freq.data(), freq.data() + fft->bins() } {}
+
+    void run() {
+        // Unscaled round trips grow by fft_size each, so start every run from the same input.
+        // Otherwise values reach inf/NaN, which can be much slower on some CPUs.
+        std::fill(time.begin(), time.end(), 0.5f);
+        fft->forward_batch(2, time_ptrs, freq_ptrs);
+        fft->inverse_batch(2, freq_ptrs, time_ptrs);
+    }
+};
+
+static std::vector<double> measure_ffts(const std::vector<int>& fft_sizes) {
+    std::vector<std::unique_ptr<FftBench>> benches;
+    std::vector<int> iterations;
+    for (auto fft_size : fft_sizes) {
+        benches.push_back(std::make_unique<FftBench>(fft_size));
+        iterations.push_back(std::max(BENCH_SAMPLES / fft_size, 1));
+    }
+
+    auto costs = median_times_ns(iterations, [&](size_t i) { benches[i]->run(); });
+    for (auto& cost : costs) {
+        cost /= 2.0;
+    }
+    return costs;
+}
+
+static double measure_mac() {
+    std::vector<FftComplex> acc(MAC_BINS), spectrum(MAC_BINS, { 0.5f, 0.25f }), filter(MAC_BINS, { 0.25f, 0.5f });
+
+    auto iterations = std::max(BENCH_SAMPLES / MAC_BINS, 1);
+    return median_time_ns(iterations, [&] {
+        // Same loop as the convolution engines
+        for (auto i = 0; i < MAC_BINS; i++) {
+            acc[i].r += spectrum[i].r * filter[i].r - spectrum[i].i * filter[i].i;
+            acc[i].i += spectrum[i].r * filter[i].i + spectrum[i].i * filter[i].r;
+        }
+        acc[0] = { 0.0f, 0.0f };
+    }) / MAC_BINS;
+}
+
+static double measure_add() {
+    std::vector<float> acc(ADD_SAMPLES), samples(ADD_SAMPLES, 0.5f);
+
+    auto iterations = std::max(BENCH_SAMPLES / ADD_SAMPLES, 1);
+    return median_time_ns(iterations, [&] {
+        for (auto i = 0; i < ADD_SAMPLES; i++) {
+            acc[i] += samples[i];
+        }
+        acc[0] = 0.0f;
+    }) / ADD_SAMPLES;
+}
+
+double fft_cost(int fft_size) {
+    return fft_costs({ fft_size })[0];
+}
+
+std::vector<double> fft_costs(const std::vector<int>& fft_sizes) {
+    auto& m = get_measurements();
+    std::lock_guard lock(m.lock);
+    auto backend = get_default_fft_backend();
+
+    std::vector<int> missing;
+    for (auto fft_size : fft_sizes) {
+        if (!m.fft_costs.contains({ backend, fft_size }) &&
+                std::find(missing.begin(), missing.end(), fft_size) == missing.end()) {
+            missing.push_back(fft_size);
+        }
+    }
+
+    if (!missing.empty()) {
+        auto costs = measure_ffts(missing);
+        for (size_t i = 0; i < missing.size(); i++) {
+            m.fft_costs[{ backend, missing[i] }] = costs[i];
+        }
+    }
+
+    std::vector<double> costs;
+    for (auto fft_size : fft_sizes) {
+        costs.push_back(m.fft_costs[{ backend, fft_size }]);
+    }
+    return costs;
+}
+
+double mac_cost() {
+    auto& m = get_measurements();
+    std::lock_guard lock(m.lock);
+
+    if (m.mac_cost < 0.0) {
+        m.mac_cost = measure_mac();
+    }
+    return m.mac_cost;
+}
+
+double add_cost() {
+    auto& m = get_measurements();
+    std::lock_guard lock(m.lock);
+
+    if (m.add_cost < 0.0) {
+        m.add_cost = measure_add();
+    }
+    return m.add_cost;
+}
+
+std::vector<int> fft_sizes_between(int min_size, int max_size) {
+    std::vector<int> sizes;
+    for (auto size = next_fft_size(std::max(min_size, 2)); size <= max_size; size = next_fft_size(size + 1)) {
+        sizes.push_back(size);
+    }
+
+    return sizes;
+}
+
+int fastest_fft_size(int min_size, int mac_passes) {
+    auto max_size = static_cast<int>(std::bit_ceil(static_cast<unsigned>(std::max(min_size, 2))));
+    auto mac = mac_passes > 0 ? mac_cost() * mac_passes : 0.0;
+
+    auto sizes = fft_sizes_between(min_size, max_size);
+    auto costs = fft_costs(sizes);
+
+    auto best_size = next_fft_size(min_size);
+    auto best_cost = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < sizes.size(); i++) {
+        auto size = sizes[i];
+        auto cost = costs[i] + mac * (size / 2 + 1);
+        if (cost < best_cost) {
+            best_size = size;
+            best_cost = cost;
+        }
+    }
+
+    return best_size;
+}
+
+bool load_wisdom(const std::string& path) {
+    std::ifstream file(path);
+    std::string header;
+    int version = 0;
+    if (!(file >> header >> version) || header != WISDOM_HEADER || version != WISDOM_VERSION) {
+        return false;
+    }
+
+    // Parse everything first, so a truncated file loads nothing
+    double mac = -1.0;
+    double add = -1.0;
+    std::map<std::pair<FftBackend, int>, double> costs;
+    std::string kind;
+    while (file >> kind) {
+        if (kind == "mac") {
+            if (!(file >> mac)) {
+                return false;
+            }
+        } else if (kind == "add") {
+            if (!(file >> add)) {
+                return false;
+            }
+        } else if (kind == "fft") {
+            std::string backend_name;
+            int size;
+            double cost;
+            if (!(file >> backend_name >> size >> cost)) {
+                return false;
+            }
+
+            // Skip backends this build doesn't have
+            for (auto backend : BACKENDS) {
+                if (backend_name == fft_backend_name(backend) && fft_backend_available(backend)) {
+                    costs[{ backend, size }] = cost;
+                }
+            }
+        } else {
+            return false;
+        }
+    }
+
+    auto& m = get_measurements();
+    std::lock_guard lock(m.lock);
+    if (mac >= 0.0) {
+        m.mac_cost = mac;
+    }
+    if (add >= 0.0) {
+        m.add_cost = add;
+    }
+    for (auto& [key, cost] : costs) {
+        m.fft_costs[key] = cost;
+    }
+    return true;
+}
+
+bool save_wisdom(const std::string& path) {
+    auto& m = get_measurements();
+    std::lock_guard lock(m.lock);
+
+    std::ofstream file(path);
+    file << WISDOM_HEADER << ' ' << WISDOM_VERSION << '\n';
+    if (m.mac_cost >= 0.0) {
+        file << "mac " << m.mac_cost << '\n';
+    }
+    if (m.add_cost >= 0.0) {
+        file << "add " << m.add_cost << '\n';
+    }
+    for (auto& [key, cost] : m.fft_costs) {
+        file << "fft " << fft_backend_name(key.first) << ' ' << key.second << ' ' << cost << '\n';
+    }
+
+    file.close();
+    return !file.fail();
+}
+
+void forget() {
+    auto& m = get_measurements();
+    std::lock_guard lock(m.lock);
+    m.fft_costs.clear();
+    m.mac_cost = -1.0;
+    m.add_cost = -1.0;
+}
+
+}
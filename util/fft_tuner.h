@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Measured FFT costs on the running device, for choosing FFT and block sizes
+// Costs are measured for the default FFT backend on first use and cached for the process. Wisdom
+// files save them, so later runs can skip measuring.
+// All functions are thread-safe. Measuring takes up to a few ms per size, so none of them are
+// real-time safe.
+namespace fxdsp::fft_tuner {
+
+// Timing rounds per measurement. Costs are the median round, which shrugs off preemption.
+static constexpr int BENCH_ROUNDS = 9;
+
+// ns per call of run(i) for each i < iterations.size(), timed over iterations[i] calls per round
+// Rounds go through all candidates in turn, so anything that slows the device down for a while, like
+// thermal throttling or other load, affects them all alike. finish(i) ends each round within its
+// timing, for candidates that leave work in flight.
+template <typename Fn, typename Finish>
+std::vector<double> median_times_ns(const std::vector<int>& iterations, Fn&& run, Finish&& finish) {
+    // Untimed first runs to fault in memory
+    for (size_t i = 0; i < iterations.size(); i++) {
+        run(i);
+        finish(i);
+    }
+
+    std::vector<std::vector<double>> times(iterations.size());
+    for (auto round = 0; round < BENCH_ROUNDS; round++) {
+        for (size_t i = 0; i < iterations.size(); i++) {
+            auto start = std::chrono::steady_clock::now();
+            for (auto n = 0; n < iterations[i]; n++) {
+                run(i);
+            }
+            finish(i);
+            auto end = std::chrono::steady_clock::now();
+            times[i].push_back(std::chrono::duration<double, std::nano>(end - start).count() / iterations[i]);
+        }
+    }
+
+    std::vector<double> medians;
+    for (auto& rounds : times) {
+        auto median = rounds.begin() + rounds.size() / 2;
+        std::nth_element(rounds.begin(), median, rounds.end());
+        medians.push_back(*median);
+    }
+    return medians;
+}
+
+template <typename Fn>
+std::vector<double> median_times_ns(const std::vector<int>& iterations, Fn&& run) {
+    return median_times_ns(iterations, run, [](size_t) {});
+}
+
+// ns per channel for one forward and one inverse real FFT, in stereo batches
+double fft_cost(int fft_size);
+// Same for each size, measuring the ones not yet measured together
+std::vector<double> fft_costs(const std::vector<int>& fft_sizes);
+// ns per bin for one complex multiply-accumulate, as in spectral convolution
+double mac_cost();
+// ns per sample for adding one buffer into another, as in overlap-add and history copies
+double add_cost();
+
+// Valid FFT sizes in [min_size, max_size], ascending
+std::vector<int> fft_sizes_between(int min_size, int max_size);
+// Size >= min_size with the lowest fft_cost + mac_passes multiply-accumulates over its bins
+// Candidates go up to the next power of 2, which is never slower than anything above it.
+int fastest_fft_size(int min_size, int mac_passes = 0);
+
+// Returns false, without loading anything, if the file is missing or has another format
+bool load_wisdom(const std::string& path);
+bool save_wisdom(const std::string& path);
+// Drops all measurements
+void forget();
+
+}
@@ -2,8 +2,8 @@
 #include "fft.h"
 #include "../log.h"
 
-#include "../external/kissfft/kiss_fftr.h"
 #include "amplitude.h"
+#include <cmath>
 #include <boost/math/interpolators/pchip.hpp>
 
 namespace fxdsp::graph {
@@ -15,7 +15,7 @@ void interpolate(std::vector<float>& in_x, std::vector<float>& in_y,
                  std::vector<float>& out_x, std::vector<float>& out_y,
                  float start_x) {
     auto count = out_x.size();
-    if (isnan(start_x)) {
+    if (std::isnan(start_x)) {
         start_x = in_x[0];
     }
     auto end_x = in_x[in_x.size() - 1];
@@ -48,7 +48,8 @@ void impulse_response_curves(std::vector<float>& ir,
     auto num_bins = ir.size() / 2;
     auto fft_size = next_fft_size(static_cast<int>(ir.size()));
     std::vector<float> fft_x(num_bins);
-    std::vector<kiss_fft_cpx> fft_y(fft_size / 2);
+    auto fft = RealFft::create(fft_size);
+    std::vector<FftComplex> fft_y(fft->bins());
     auto fft_x_max = static_cast<float>(num_bins - 1);
     auto log_min = log2(MIN_FREQ / max_freq);
     auto log_max = log2(1.0f);
@@ -61,9 +62,7 @@ void impulse_response_curves(std::vector<float>& ir,
     // FFT zero-padding
     std::vector<float> fft_in(fft_size);
     std::copy(ir.begin(),  ir.end(), fft_in.begin());
-    auto fft_cfg = kiss_fftr_alloc(fft_size, false, nullptr, nullptr);
-    kiss_fftr(fft_cfg, fft_in.data(), fft_y.data());
-    free(fft_cfg);
+    fft->forward(fft_in.data(), fft_y.data());
 
     // FR & PR
     std::vector<float> fr_y(num_bins);
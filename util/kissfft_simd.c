@@ -0,0 +1,19 @@
+// kissfft built again with SSE vectors as scalars, transforming 4 signals per call
+// Symbols are renamed so this links alongside the float build. See README.simd for the layout.
+#if defined(__SSE__)
+
+#define USE_SIMD 1
+
+#define kiss_fft_alloc fxdsp_kiss_simd_fft_alloc
+#define kiss_fft fxdsp_kiss_simd_fft
+#define kiss_fft_stride fxdsp_kiss_simd_fft_stride
+#define kiss_fft_cleanup fxdsp_kiss_simd_fft_cleanup
+#define kiss_fft_next_fast_size fxdsp_kiss_simd_fft_next_fast_size
+
+#include "../external/kissfft/kiss_fft.c"
+
+void fxdsp_kiss_simd_free(void* ptr) {
+    KISS_FFT_FREE(ptr);
+}
+
+#endif
@@ -0,0 +1,21 @@
+#pragma once
+
+// Declarations for kissfft_simd.c, which is only built with FXDSP_HAVE_KISS_SIMD
+#if defined(FXDSP_HAVE_KISS_SIMD)
+
+#include <cstddef>
+#include <xmmintrin.h>
+
+// kiss_fft_cpx with __m128 scalars: one bin of 4 signals
+struct KissSimdComplex {
+    __m128 r;
+    __m128 i;
+};
+
+extern "C" {
+void* fxdsp_kiss_simd_fft_alloc(int nfft, int inverse_fft, void* mem, size_t* lenmem);
+void fxdsp_kiss_simd_fft(void* cfg, const KissSimdComplex* fin, KissSimdComplex* fout);
+void fxdsp_kiss_simd_free(void* ptr);
+}
+
+#endif
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <bit>
+#include <stdexcept>
+#include <string>
+
+#include "spsc_ring.h"
+
+namespace fxdsp {
+
+// Keeps positions and byte offsets well inside size_t on 32-bit devices
+static constexpr int MAX_FRAMES = 1 << 24;
+
+SpscRing::SpscRing(int frame_size, int min_frames) :
+        frame_size(frame_size),
+        num_frames(0),
+        mask(0),
+        write_pos(0),
+        read_pos(0) {
+    if (frame_size <= 0 || min_frames <= 0 || min_frames > MAX_FRAMES) {
+        throw std::invalid_argument("Invalid ring size: " + std::to_string(min_frames) + " frames of " +
+                                    std::to_string(frame_size) + " bytes");
+    }
+
+    num_frames = std::bit_ceil(static_cast<size_t>(min_frames));
+    mask = num_frames - 1;
+    storage = std::make_unique<std::byte[]>(num_frames * frame_size);
+}
+
+SpscRing::Regions SpscRing::regions_at(size_t pos, size_t frames) const {
+    auto start = pos & mask;
+    auto first = std::min(frames, num_frames - start);
+    return {
+        { storage.get() + start * frame_size, storage.get() },
+        { first, frames - first },
+    };
+}
+
+size_t SpscRing::fill() const {
+    // Read position first: the write position can only have moved further since
+    auto read = read_pos.load(std::memory_order_acquire);
+    return write_pos.load(std::memory_order_acquire) - read;
+}
+
+size_t SpscRing::write_space() const {
+    // Acquire, so the consumer is done with frames before they're overwritten
+    auto read = read_pos.load(std::memory_order_acquire);
+    return num_frames - (write_pos.load(std::memory_order_relaxed) - read);
+}
+
+SpscRing::Regions SpscRing::write_regions(size_t frames) {
+    return regions_at(write_pos.load(std::memory_order_relaxed), frames);
+}
+
+void SpscRing::commit_write(size_t frames) {
+    write_pos.store(write_pos.load(std::memory_order_relaxed) + frames, std::memory_order_release);
+}
+
+SpscRing::Regions SpscRing::read_regions(size_t frames) const {
+    return regions_at(read_pos.load(std::memory_order_relaxed), frames);
+}
+
+void SpscRing::commit_read(size_t frames) {
+    read_pos.store(read_pos.load(std::memory_order_relaxed) + frames, std::memory_order_release);
+}
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace fxdsp {
+
+// Wait-free single-producer, single-consumer ring of fixed-size frames (e.g. interleaved PCM)
+// Positions only ever increase and are masked into the power-of-two capacity, so full and empty are
+// distinct without a spare slot. Frames never straddle the end, so either side gets at most two
+// contiguous regions to convert into or copy from in place.
+class SpscRing {
+public:
+    // Cache line size, on all supported CPUs
+    static constexpr size_t CACHE_LINE = 64;
+
+    // Where the next frames are in the ring, in order. The second region is empty unless they wrap.
+    struct Regions {
+        std::byte* data[2];
+        size_t frames[2];
+    };
+
+private:
+    std::unique_ptr<std::byte[]> storage;
+    size_t frame_size;
+    size_t num_frames;
+    size_t mask;
+
+    // Each written by one side only, on separate lines so the sides don't invalidate each other's
+    // caches on every commit
+    alignas(CACHE_LINE) std::atomic<size_t> write_pos;
+    alignas(CACHE_LINE) std::atomic<size_t> read_pos;
+
+    Regions regions_at(size_t pos, size_t frames) const;
+
+public:
+    // Capacity is rounded up to a power of two. Throws std::invalid_argument for invalid sizes.
+    SpscRing(int frame_size, int min_frames);
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    size_t capacity() const { return num_frames; }
+    // Frames waiting to be read. Exact on either side, a snapshot from other threads.
+    size_t fill() const;
+
+    // Producer only
+    size_t write_space() const;
+    // Up to write_space() frames
+    Regions write_regions(size_t frames);
+    // Publishes frames written to write_regions()
+    void commit_write(size_t frames);
+
+    // Consumer only
+    size_t read_available() const { return fill(); }
+    // Up to read_available() frames
+    Regions read_regions(size_t frames) const;
+    // Frees frames after reading them from read_regions()
+    void commit_read(size_t frames);
+};
+
+}
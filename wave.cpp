@@ -1,5 +1,6 @@
 #include "wave.h"
 
+#include <algorithm>
 #include <cstring>
 #include <exception>
 
@@ -30,10 +31,17 @@ WaveHeader::WaveHeader(AudioFormat dsp_format, uint16_t channels, uint32_t sampl
             fmt.audio_format = WAVE_LPCM;
             fmt.bits_per_sample = 24;
             break;
+        case FORMAT_S32:
+            fmt.audio_format = WAVE_LPCM;
+            fmt.bits_per_sample = 32;
+            break;
         case FORMAT_F32:
             fmt.audio_format = WAVE_IEEE_FLOAT;
             fmt.bits_per_sample = 32;
             break;
+        case FORMAT_S24_32:
+            // Would need WAVE_FORMAT_EXTENSIBLE
+            throw std::invalid_argument("WAVE: 24-in-32 samples can't be stored, use FORMAT_S24 or FORMAT_S32");
         case FORMAT_UNKNOWN:
             // Undefined
             throw std::invalid_argument("WAVE: creating header with unknown DSP audio format: " +
@@ -104,6 +112,7 @@ AudioFormat WaveHeader::getAudioFormat() const {
             case  8: return FORMAT_U8;
             case 16: return FORMAT_S16;
             case 24: return FORMAT_S24;
+            case 32: return FORMAT_S32;
             default: return FORMAT_UNKNOWN;
         }
     } else if (fmt.audio_format == WAVE_IEEE_FLOAT) {
@@ -126,22 +135,13 @@ std::vector<std::vector<float>> load_wave_data_float(std::span<std::byte> data)
     auto num_samples = wave.data.size / (wave.fmt.bits_per_sample / 8);
     auto format = wave.getAudioFormat();
 
-    std::vector<std::vector<float>> channel_bufs(wave.fmt.num_channels);
-    if (format == FORMAT_F32) {
-        auto float_data = reinterpret_cast<float*>(data_span.data());
-        deinterleave_pcm(float_data, num_samples, channel_bufs);
-    } else if (format == FORMAT_S16) {
-        auto int_data = reinterpret_cast<short*>(data_span.data());
-        std::vector<float> float_data(num_samples);
-        for (auto i = 0; i < num_samples; i++) {
-            float_data[i] = pcm_s16_to_float32(int_data[i]);
-        }
-
-        deinterleave_pcm(float_data.data(), num_samples, channel_bufs);
-    } else {
-        throw std::invalid_argument("WAVE: unsupported audio format " + std::to_string(format));
+    if (format == FORMAT_UNKNOWN) {
+        throw std::invalid_argument("WAVE: unsupported bits-per-sample for LPCM: " +
+                                    std::to_string(wave.fmt.bits_per_sample));
     }
 
+    std::vector<std::vector<float>> channel_bufs(wave.fmt.num_channels);
+    deinterleave_pcm(data_span.data(), format, num_samples, channel_bufs);
     return channel_bufs;
 }
 
@@ -155,6 +155,28 @@ std::vector<std::vector<float>> load_wave_file_float(const std::string& path) {
     return load_wave_data_float(data_span);
 }
 
+void save_wave_file_float(const std::string& path, const std::vector<std::vector<float>>& channel_bufs,
+                          uint32_t sample_rate, AudioFormat format) {
+    auto channels = static_cast<int>(channel_bufs.size());
+    auto samples_per_channel = channel_bufs.empty() ? 0 : static_cast<int>(channel_bufs[0].size());
+    WaveHeader wave(format, channels, sample_rate, samples_per_channel);
+
+    AudioBuffer planar(channels, samples_per_channel);
+    for (auto ch = 0; ch < channels; ch++) {
+        std::copy_n(channel_bufs[ch].begin(), samples_per_channel, planar.channel(ch));
+    }
+    std::vector<std::byte> pcm_data(wave.data.size);
+    interleave_pcm(planar, samples_per_channel, format, pcm_data.data());
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&wave), sizeof(wave));
+    file.write(reinterpret_cast<const char*>(pcm_data.data()), static_cast<std::streamsize>(pcm_data.size()));
+    file.close();
+    if (file.fail()) {
+        throw std::runtime_error("WAVE: can't write " + path);
+    }
+}
+
 void RiffHeaderChunk::validate() const {
     if (memcmp(id, CHUNK_ID_RIFF, CHUNK_ID_SIZE) != 0) {
         throw std::runtime_error("WAVE: invalid RIFF chunk ID");
@@ -68,5 +68,9 @@ struct WaveHeader {
 
 std::vector<std::vector<float>> load_wave_data_float(std::span<std::byte> data);
 std::vector<std::vector<float>> load_wave_file_float(const std::string& in_path);
+// Channels must all have the same length. Throws std::invalid_argument if format can't be stored in WAV
+// files, or std::runtime_error on write errors.
+void save_wave_file_float(const std::string& out_path, const std::vector<std::vector<float>>& channel_bufs,
+                          uint32_t sample_rate, AudioFormat format);
 
 }